@@ -0,0 +1,63 @@
+//
+// AnimationFixtures.h
+//
+// Synthetic skeletons and clips for animation tests and benchmarks, so they
+// run without loading a GEM file or creating a device.
+//
+
+#pragma once
+
+#include "../inc/Animation.h"
+
+// Builds a skeleton of boneCount bones where each bone's parent is an earlier
+// bone (a mix of chains and branches), plus a clip with frameCount frames of
+// pseudo-random translation, rotation and scale keys.
+inline void buildTestAnimation(Animation& animation, const std::string& clipName, int boneCount, int frameCount, unsigned int seed = 1) {
+    srand(seed);
+    auto r = []() { return (static_cast<float>(rand()) / RAND_MAX) * 2.0f - 1.0f; };
+    if (animation.skeleton.bones.empty()) {
+        for (int i = 0; i < boneCount; i++) {
+            Bone bone;
+            bone.name = "bone" + std::to_string(i);
+            bone.parentIndex = i == 0 ? -1 : (i % 5 == 0 ? i / 2 : i - 1);
+            bone.offset = Matrix::translation(vec3(r(), r(), r()));
+            animation.skeleton.bones.push_back(bone);
+        }
+    }
+    AnimationSequence sequence;
+    sequence.ticksPerSecond = 30.0f;
+    sequence.allocate(frameCount, boneCount);
+    for (int f = 0; f < frameCount; f++) {
+        for (int i = 0; i < boneCount; i++) {
+            int key = sequence.keyIndex(f, i);
+            sequence.positions[key] = vec3(r(), r(), r());
+            sequence.rotations[key] = Quaternion(r(), r(), r(), 1.0f + r() * 0.5f).normalize();
+            sequence.scales[key] = vec3(1.0f + r() * 0.1f, 1.0f + r() * 0.1f, 1.0f + r() * 0.1f);
+        }
+    }
+    animation.addSequence(clipName, std::move(sequence));
+}
+
+// Builds a clip shaped like real skeletal data: constant bone translations and
+// unit scales, every third bone static and the others rotating smoothly about a
+// fixed axis. Useful where compression behaviour matters; the random clip
+// above has nothing to compress.
+inline void buildSmoothTestAnimation(Animation& animation, const std::string& clipName, int boneCount, int frameCount, unsigned int seed = 1) {
+    buildTestAnimation(animation, clipName, boneCount, frameCount, seed);
+    AnimationSequence& sequence = animation.getSequence(animation.findSequence(clipName));
+    srand(seed);
+    auto r = []() { return (static_cast<float>(rand()) / RAND_MAX) * 2.0f - 1.0f; };
+    for (int i = 0; i < boneCount; i++) {
+        vec3 translation(r(), r(), r());
+        vec3 axis = vec3(r(), r(), r() + 2.0f).normalize();
+        float amplitude = i % 3 == 0 ? 0.0f : 0.5f + r() * 0.3f;
+        float phase = r() * 3.0f;
+        for (int f = 0; f < frameCount; f++) {
+            int key = sequence.keyIndex(f, i);
+            float angle = amplitude * sinf(phase + 6.2831853f * f / frameCount);
+            sequence.positions[key] = translation;
+            sequence.rotations[key] = Quaternion::fromAxisAngle(axis, angle);
+            sequence.scales[key] = vec3(1.0f, 1.0f, 1.0f);
+        }
+    }
+}
@@ -0,0 +1,29 @@
+//
+// TestResources.h
+//
+// Locates the game's resources and textures from the test working directory,
+// so tests and benchmarks can read the shipped assets.
+//
+
+#pragma once
+
+#include <fstream>
+#include <string>
+
+// Returns the path of a file relative to the repository root, or an empty
+// string if it cannot be found from the working directory.
+inline std::string findRepoFile(const std::string& relativePath) {
+    for (const char* prefix : { "../", "", "../../" }) {
+        std::string path = prefix + relativePath;
+        if (std::ifstream(path, std::ios::binary).good()) {
+            return path;
+        }
+    }
+    return std::string();
+}
+
+// Returns the path of a file under resources/, or an empty string if it
+// cannot be found from the working directory.
+inline std::string findResource(const std::string& relativePath) {
+    return findRepoFile("resources/" + relativePath);
+}
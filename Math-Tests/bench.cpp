@@ -0,0 +1,915 @@
+#include "pch.h"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <functional>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <cstddef>
+#include "../inc/core.h"
+#include "../inc/TransformBatch.h"
+#include "AnimationFixtures.h"
+#include "../inc/AnimationJobs.h"
+#include "../inc/GEMLoader.h"
+#include "../inc/ModelCache.h"
+#include "../inc/AssetPipeline.h"
+#include "../inc/MeshOptimizer.h"
+#include "../inc/MeshSimplifier.h"
+#include "../inc/MeshClusters.h"
+#include "../inc/VertexCompression.h"
+#include "../inc/MipChain.h"
+#include "../inc/BlockCompression.h"
+#include "../inc/TextureCache.h"
+#include "../inc/TextureStreamer.h"
+#include "../inc/stb_image.h"
+#include "../inc/ImageDecoder.h"
+#include "TestResources.h"
+
+// Micro-benchmarks. They always pass; the numbers are printed to stdout so they
+// can be compared between machines and builds.
+
+// Global allocation counter so benchmarks can prove a path is allocation free.
+static std::atomic<size_t> allocationCount(0);
+// Live and peak heap bytes, so benchmarks can compare memory high-water marks.
+// Each block carries its size in a header that keeps malloc's alignment.
+static std::atomic<size_t> liveBytes(0);
+static std::atomic<size_t> peakBytes(0);
+static const size_t allocationHeader = alignof(std::max_align_t);
+
+static void* trackedAlloc(size_t size) {
+    allocationCount++;
+    unsigned char* p = static_cast<unsigned char*>(malloc(size + allocationHeader));
+    if (!p) throw std::bad_alloc();
+    *reinterpret_cast<size_t*>(p) = size;
+    size_t live = liveBytes += size;
+    size_t peak = peakBytes;
+    while (live > peak && !peakBytes.compare_exchange_weak(peak, live)) {}
+    return p + allocationHeader;
+}
+static void trackedFree(void* p) noexcept {
+    if (!p) return;
+    unsigned char* block = static_cast<unsigned char*>(p) - allocationHeader;
+    liveBytes -= *reinterpret_cast<size_t*>(block);
+    free(block);
+}
+
+// Restarts the high-water mark from the current live bytes.
+static void resetPeakBytes() {
+    peakBytes = liveBytes.load();
+}
+
+void* operator new(size_t size) { return trackedAlloc(size); }
+void* operator new[](size_t size) { return trackedAlloc(size); }
+void operator delete(void* p) noexcept { trackedFree(p); }
+void operator delete[](void* p) noexcept { trackedFree(p); }
+void operator delete(void* p, size_t) noexcept { trackedFree(p); }
+void operator delete[](void* p, size_t) noexcept { trackedFree(p); }
+
+// Runs fn repeatedly for at least minSeconds and returns the average seconds per call.
+template<typename Fn>
+static double timeIt(Fn fn, double minSeconds = 0.2) {
+    auto start = std::chrono::high_resolution_clock::now();
+    int iterations = 0;
+    double elapsed = 0.0;
+    do {
+        fn();
+        iterations++;
+        elapsed = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    } while (elapsed < minSeconds);
+    return elapsed / iterations;
+}
+
+struct BenchVertex {
+    vec3 pos;
+    vec3 normal;
+    vec3 tangent;
+    float tu, tv;
+};
+
+TEST(TransformBatchBenchmark, PointsPerSecond) {
+    const size_t count = 1 << 18;
+    std::vector<BenchVertex> vertices(count);
+    std::vector<float> xs(count), ys(count), zs(count);
+    for (size_t i = 0; i < count; i++) {
+        vertices[i].pos = vec3(static_cast<float>(i % 97), static_cast<float>(i % 89), static_cast<float>(i % 83));
+        xs[i] = vertices[i].pos.x; ys[i] = vertices[i].pos.y; zs[i] = vertices[i].pos.z;
+    }
+    std::vector<float> ox(count), oy(count), oz(count);
+    SoAStream out = { ox.data(), oy.data(), oz.data() };
+    Matrix m = Matrix::translation(vec3(1, 2, 3)) * Matrix::RotateY(0.5f) * Matrix::scaling(vec3(2, 2, 2));
+
+    double loop = timeIt([&]() {
+        for (size_t i = 0; i < count; i++) {
+            vec3 r = m.mulPoint(vertices[i].pos);
+            ox[i] = r.x; oy[i] = r.y; oz[i] = r.z;
+        }
+    });
+    double aos = timeIt([&]() { TransformBatch::transformVertexPositions(m, vertices.data(), out, count); });
+    double soa = timeIt([&]() { TransformBatch::transformPoints(m, ConstSoAStream{ xs.data(), ys.data(), zs.data() }, out, count); });
+    TransformBatch::Options threaded;
+    threaded.threads = max(1u, std::thread::hardware_concurrency());
+    double soaThreaded = timeIt([&]() { TransformBatch::transformPoints(m, ConstSoAStream{ xs.data(), ys.data(), zs.data() }, out, count, threaded); });
+
+    std::cout << "[ BENCH    ] mulPoint loop:        " << count / loop / 1e6 << " Mpoints/s" << std::endl;
+    std::cout << "[ BENCH    ] batch AoS vertices:   " << count / aos / 1e6 << " Mpoints/s" << std::endl;
+    std::cout << "[ BENCH    ] batch SoA:            " << count / soa / 1e6 << " Mpoints/s" << std::endl;
+    std::cout << "[ BENCH    ] batch SoA " << threaded.threads << " threads: " << count / soaThreaded / 1e6 << " Mpoints/s" << std::endl;
+}
+
+TEST(AffineMatrixBenchmark, PaletteBuild) {
+    const int bones = 120;
+    Animation animation;
+    buildTestAnimation(animation, "clip", bones, 60);
+    Matrix full[256];
+    AffineMatrix affine[256];
+    int frame = 0;
+    float fact = 0.0f;
+    animation.calcFrame("clip", 0.5f, frame, fact);
+
+    double fullTime = timeIt([&]() {
+        for (int i = 0; i < bones; i++) {
+            full[i] = animation.interpolateBoneToGlobal("clip", full, frame, fact, i);
+        }
+        animation.calcFinalTransforms(full);
+    });
+    double affineTime = timeIt([&]() {
+        for (int i = 0; i < bones; i++) {
+            affine[i] = animation.interpolateBoneToGlobal("clip", affine, frame, fact, i);
+        }
+        animation.calcFinalTransforms(affine);
+    });
+
+    std::cout << "[ BENCH    ] 4x4 palette build: " << fullTime * 1e6 << " us, " << sizeof(full) << " bytes" << std::endl;
+    std::cout << "[ BENCH    ] 3x4 palette build: " << affineTime * 1e6 << " us, " << sizeof(affine) << " bytes" << std::endl;
+}
+
+TEST(AnimationBenchmark, HandleVersusNameUpdate) {
+    const int bones = 120;
+    Animation animation;
+    buildTestAnimation(animation, "Idle", bones, 60, 1);
+    buildTestAnimation(animation, "Run", bones, 60, 2);
+    buildTestAnimation(animation, "attack", bones, 60, 3);
+    AnimationInstance instance;
+    instance.animation = &animation;
+    AnimationHandle run = animation.findSequence("Run");
+    ASSERT_NE(run, INVALID_ANIMATION_HANDLE);
+
+    std::string name = "Run";
+    double byName = timeIt([&]() { instance.update(name, 1.0f / 60.0f); });
+    double byHandle = timeIt([&]() { instance.update(run, 1.0f / 60.0f); });
+
+    // Steady state: the handle path must not touch the heap.
+    instance.update(run, 0.0f);
+    size_t before = allocationCount.load();
+    for (int i = 0; i < 1000; i++) {
+        instance.update(run, 1.0f / 60.0f);
+    }
+    size_t allocations = allocationCount.load() - before;
+    EXPECT_EQ(allocations, 0u);
+
+    std::cout << "[ BENCH    ] update by name:   " << byName * 1e6 << " us" << std::endl;
+    std::cout << "[ BENCH    ] update by handle: " << byHandle * 1e6 << " us, " << allocations << " allocations in 1000 updates" << std::endl;
+}
+
+TEST(AnimationBenchmark, ParallelInstanceUpdate) {
+    const int bones = 120;
+    Animation animation;
+    buildTestAnimation(animation, "Idle", bones, 60, 1);
+    buildTestAnimation(animation, "Run", bones, 60, 2);
+    unsigned int hardware = std::thread::hardware_concurrency();
+    if (hardware == 0) hardware = 1;
+    std::vector<unsigned int> threadCounts = { 1, 2, 4 };
+    if (hardware > 4) threadCounts.push_back(hardware);
+
+    for (size_t instanceCount : { 1, 16, 64, 256 }) {
+        std::vector<AnimationInstance> instances(instanceCount);
+        std::vector<AnimationUpdateRequest> requests;
+        for (size_t i = 0; i < instanceCount; i++) {
+            instances[i].animation = &animation;
+            requests.push_back({ &instances[i], static_cast<AnimationHandle>(i % 2), 1.0f / 60.0f });
+        }
+        for (unsigned int threads : threadCounts) {
+            // The calling thread runs jobs too, so the pool needs threads - 1 workers.
+            JobSystem jobs(threads - 1);
+            double seconds = timeIt([&]() { updateAnimationInstances(jobs, requests); });
+            std::cout << "[ BENCH    ] " << instanceCount << " instances, " << threads << " threads: " << seconds * 1e6 << " us" << std::endl;
+        }
+    }
+}
+
+TEST(AnimationBenchmark, BakedVersusLivePalette) {
+    const int bones = 120;
+    Animation animation;
+    buildTestAnimation(animation, "Idle", bones, 60, 1);
+    buildTestAnimation(animation, "Run", bones, 60, 2);
+    AnimationHandle run = animation.findSequence("Run");
+    AnimationInstance instance;
+    instance.animation = &animation;
+
+    double live = timeIt([&]() { instance.update(run, 1.0f / 60.0f); });
+    AnimationBakeReport report = animation.bakePalettes(30.0f, 16u << 20);
+    double baked = timeIt([&]() { instance.update(run, 1.0f / 60.0f); });
+
+    for (const AnimationBakeReport::Clip& clip : report.clips) {
+        std::cout << "[ BENCH    ] bake " << clip.name << ": " << clip.samples << " samples, " << clip.bytes / 1024.0 << " KB" << (clip.baked ? "" : " (over budget)") << std::endl;
+    }
+    std::cout << "[ BENCH    ] live palette update:  " << live * 1e6 << " us" << std::endl;
+    std::cout << "[ BENCH    ] baked palette update: " << baked * 1e6 << " us" << std::endl;
+}
+
+TEST(AnimationBenchmark, CompressedClipSizeAndSampling) {
+    const int bones = 120;
+    Animation animation;
+    buildSmoothTestAnimation(animation, "Run", bones, 60);
+    AnimationInstance instance;
+    instance.animation = &animation;
+    double raw = timeIt([&]() { instance.update(0, 1.0f / 60.0f); });
+    AnimationCompressionReport report = animation.getSequence(0).compress();
+    double compressed = timeIt([&]() { instance.update(0, 1.0f / 60.0f); });
+
+    std::cout << "[ BENCH    ] clip keys: " << report.originalBytes / 1024.0 << " KB -> " << report.compressedBytes / 1024.0 << " KB (" << report.ratio() << "x), "
+        << report.constantTracks << "/" << report.tracks << " constant tracks, " << report.originalKeys << " -> " << report.compressedKeys << " keys" << std::endl;
+    std::cout << "[ BENCH    ] max error: position " << report.maxPositionError << ", rotation " << report.maxRotationError << " rad, scale " << report.maxScaleError << std::endl;
+    std::cout << "[ BENCH    ] update raw keys:        " << raw * 1e6 << " us" << std::endl;
+    std::cout << "[ BENCH    ] update compressed keys: " << compressed * 1e6 << " us" << std::endl;
+}
+
+TEST(AnimationBenchmark, CrossFadeVersusSingleClip) {
+    const int bones = 120;
+    Animation animation;
+    buildSmoothTestAnimation(animation, "Idle", bones, 60, 1);
+    buildSmoothTestAnimation(animation, "Run", bones, 60, 2);
+    AnimationInstance instance;
+    instance.animation = &animation;
+    instance.update(0, 0.1f);
+    double single = timeIt([&]() { instance.update(0, 1.0f / 60.0f); });
+
+    // Keep the fade from ever completing so every update takes the blend path.
+    instance.crossFade(1, 1e9f);
+    size_t before = allocationCount.load();
+    double blended = timeIt([&]() { instance.update(1, 1.0f / 60.0f); });
+    size_t allocations = allocationCount.load() - before;
+    EXPECT_TRUE(instance.isFading());
+    EXPECT_EQ(allocations, 0u);
+
+    std::cout << "[ BENCH    ] single clip update: " << single * 1e6 << " us" << std::endl;
+    std::cout << "[ BENCH    ] cross-fade update:  " << blended * 1e6 << " us (" << blended / single << "x)" << std::endl;
+}
+
+TEST(GEMLoaderBenchmark, StreamVersusMapped) {
+    for (const char* name : { "TRex.gem", "acacia_003.gem", "Pine/pine.gem" }) {
+        std::string path = findResource(name);
+        if (path.empty()) {
+            std::cout << "[ BENCH    ] " << name << " not found, skipping" << std::endl;
+            continue;
+        }
+        double megabytes = std::ifstream(path, std::ios::binary | std::ios::ate).tellg() / (1024.0 * 1024.0);
+        GEMLoader::GEMModelLoader loader;
+        double stream = timeIt([&]() {
+            std::vector<GEMLoader::GEMMesh> meshes;
+            GEMLoader::GEMAnimation animation;
+            loader.load(path, meshes, animation);
+        });
+        double mapped = timeIt([&]() {
+            std::vector<GEMLoader::GEMMesh> meshes;
+            GEMLoader::GEMAnimation animation;
+            loader.loadMapped(path, meshes, animation);
+        });
+        std::cout << "[ BENCH    ] " << name << " stream: " << stream * 1e3 << " ms (" << megabytes / stream << " MB/s), mapped: "
+            << mapped * 1e3 << " ms (" << megabytes / mapped << " MB/s), " << stream / mapped << "x" << std::endl;
+    }
+}
+
+// Stand-in for buffer creation: reads the data once, as the upload would.
+static size_t uploadChecksum(const void* data, size_t bytes) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    size_t sum = 0;
+    for (size_t i = 0; i < bytes; i += 64) sum += p[i];
+    return sum;
+}
+
+// The previous Mesh::init path: vertices copied one by one into a new vector,
+// which is then passed by value along with the indices.
+static size_t uploadByValue(std::vector<BenchVertex> vertices, std::vector<unsigned int> indices) {
+    return uploadChecksum(&vertices[0], vertices.size() * sizeof(BenchVertex)) + uploadChecksum(&indices[0], indices.size() * sizeof(unsigned int));
+}
+
+static size_t uploadSpan(Span<BenchVertex> vertices, Span<unsigned int> indices) {
+    return uploadChecksum(vertices.data, vertices.size * sizeof(BenchVertex)) + uploadChecksum(indices.data, indices.size * sizeof(unsigned int));
+}
+
+TEST(GEMLoaderBenchmark, PeakMemoryCopyVersusSpan) {
+    static_assert(sizeof(BenchVertex) == sizeof(GEMLoader::GEMStaticVertex), "BenchVertex must match GEMStaticVertex");
+    for (const char* name : { "acacia_003.gem", "Pine/pine.gem" }) {
+        std::string path = findResource(name);
+        if (path.empty()) {
+            std::cout << "[ BENCH    ] " << name << " not found, skipping" << std::endl;
+            continue;
+        }
+        GEMLoader::GEMModelLoader loader;
+        size_t checksum = 0;
+
+        size_t base = liveBytes;
+        resetPeakBytes();
+        {
+            std::vector<GEMLoader::GEMMesh> meshes;
+            loader.loadMapped(path, meshes);
+            for (auto& mesh : meshes) {
+                std::vector<BenchVertex> vertices;
+                for (size_t j = 0; j < mesh.verticesStatic.size(); j++) {
+                    BenchVertex v;
+                    memcpy(&v, &mesh.verticesStatic[j], sizeof(BenchVertex));
+                    vertices.push_back(v);
+                }
+                checksum += uploadByValue(vertices, mesh.indices);
+            }
+        }
+        size_t copyPeak = peakBytes - base;
+
+        base = liveBytes;
+        resetPeakBytes();
+        {
+            std::vector<GEMLoader::GEMMesh> meshes;
+            loader.loadMapped(path, meshes);
+            for (auto& mesh : meshes) {
+                checksum += uploadSpan(Span<BenchVertex>(reinterpret_cast<const BenchVertex*>(mesh.verticesStatic.data()), mesh.verticesStatic.size()),
+                    Span<unsigned int>(mesh.indices));
+                std::vector<GEMLoader::GEMStaticVertex>().swap(mesh.verticesStatic);
+                std::vector<unsigned int>().swap(mesh.indices);
+            }
+        }
+        size_t spanPeak = peakBytes - base;
+
+        std::cout << "[ BENCH    ] " << name << " peak load memory, copy: " << copyPeak / 1024 << " KB, span: " << spanPeak / 1024
+            << " KB, " << static_cast<double>(copyPeak) / spanPeak << "x (checksum " << checksum % 10 << ")" << std::endl;
+    }
+}
+
+TEST(ModelCacheBenchmark, GEMVersusCache) {
+    const char* cachePath = "modelcache_bench.gemc";
+    for (const char* name : { "TRex.gem", "Pine/pine.gem" }) {
+        std::string path = findResource(name);
+        if (path.empty()) {
+            std::cout << "[ BENCH    ] " << name << " not found, skipping" << std::endl;
+            continue;
+        }
+        GEMLoader::GEMModelLoader loader;
+        size_t checksum = 0;
+        // What Model::init does on each path, minus the GPU upload.
+        double gem = timeIt([&]() {
+            std::vector<GEMLoader::GEMMesh> meshes;
+            GEMLoader::GEMAnimation gemanimation;
+            loader.loadMapped(path, meshes, gemanimation);
+            Animation animation;
+            buildSkeleton(gemanimation, animation.skeleton);
+            for (const auto& gemsequence : gemanimation.animations) {
+                AnimationSequence aseq;
+                buildAnimationSequence(gemsequence, aseq);
+                animation.addSequence(gemsequence.name, std::move(aseq));
+            }
+            for (auto& mesh : meshes) {
+                checksum += mesh.material.find("diffuse").getValue().size();
+            }
+        });
+        {
+            std::vector<GEMLoader::GEMMesh> meshes;
+            GEMLoader::GEMAnimation gemanimation;
+            loader.loadMapped(path, meshes, gemanimation);
+            Animation animation;
+            buildSkeleton(gemanimation, animation.skeleton);
+            for (const auto& gemsequence : gemanimation.animations) {
+                AnimationSequence aseq;
+                buildAnimationSequence(gemsequence, aseq);
+                animation.addSequence(gemsequence.name, std::move(aseq));
+            }
+            ModelCache::write(path, cachePath, meshes, animation.sequences.empty() ? nullptr : &animation);
+        }
+        double cached = timeIt([&]() {
+            ModelCache cache;
+            cache.open(path, cachePath);
+            Animation animation;
+            if (cache.hasAnimation()) {
+                cache.loadAnimation(animation);
+            }
+            for (int i = 0; i < cache.getMeshCount(); i++) {
+                checksum += cache.getMesh(i).texture.size();
+            }
+        });
+        std::cout << "[ BENCH    ] " << name << " GEM: " << gem * 1e3 << " ms, cache: " << cached * 1e3 << " ms, "
+            << gem / cached << "x (checksum " << checksum % 10 << ")" << std::endl;
+    }
+    std::remove(cachePath);
+}
+
+TEST(LazyAnimationBenchmark, EagerVersusLazyClips) {
+    std::string path = findResource("TRex.gem");
+    if (path.empty()) {
+        std::cout << "[ BENCH    ] TRex.gem not found, skipping" << std::endl;
+        return;
+    }
+    GEMLoader::GEMModelLoader loader;
+    size_t eagerBytes = 0;
+    size_t lazyBytes = 0;
+    size_t oneClipBytes = 0;
+    double eager = timeIt([&]() {
+        std::vector<GEMLoader::GEMMesh> meshes;
+        GEMLoader::GEMAnimation gemanimation;
+        loader.loadMapped(path, meshes, gemanimation);
+        Animation animation;
+        buildSkeleton(gemanimation, animation.skeleton);
+        for (const auto& gemsequence : gemanimation.animations) {
+            AnimationSequence aseq;
+            buildAnimationSequence(gemsequence, aseq);
+            animation.addSequence(gemsequence.name, std::move(aseq));
+        }
+        eagerBytes = animation.residentKeyBytes();
+    });
+    double lazy = timeIt([&]() {
+        std::vector<GEMLoader::GEMMesh> meshes;
+        GEMLoader::GEMAnimation gemanimation;
+        loader.loadMappedLazy(path, meshes, gemanimation);
+        std::shared_ptr<GEMClipSource> clips = std::make_shared<GEMClipSource>();
+        clips->open(path, gemanimation);
+        Animation animation;
+        buildSkeleton(gemanimation, animation.skeleton);
+        animation.setClipSource(clips);
+        lazyBytes = animation.residentKeyBytes();
+        animation.getSequence(0);
+        oneClipBytes = animation.residentKeyBytes();
+    });
+    std::cout << "[ BENCH    ] TRex load, all clips: " << eager * 1e3 << " ms, lazy: " << lazy * 1e3 << " ms (first clip included), "
+        << eager / lazy << "x" << std::endl;
+    std::cout << "[ BENCH    ] TRex clip keys resident, eager: " << eagerBytes / 1024 << " KB, lazy: " << lazyBytes / 1024
+        << " KB, after one clip: " << oneClipBytes / 1024 << " KB" << std::endl;
+}
+
+TEST(AssetPipelineBenchmark, SerialVersusPipelined) {
+    std::vector<std::string> paths;
+    for (const char* name : { "TRex.gem", "acacia_003.gem", "Pine/pine.gem" }) {
+        std::string path = findResource(name);
+        if (!path.empty()) {
+            paths.push_back(path);
+        }
+    }
+    if (paths.empty()) {
+        std::cout << "[ BENCH    ] No models found, skipping" << std::endl;
+        return;
+    }
+    // Decode is what Model::load does on a cache miss; the upload is a null sink.
+    auto decode = [](const std::string& path) {
+        GEMLoader::GEMModelLoader loader;
+        std::vector<GEMLoader::GEMMesh> meshes;
+        GEMLoader::GEMAnimation gemanimation;
+        loader.loadMapped(path, meshes, gemanimation);
+        Animation animation;
+        buildSkeleton(gemanimation, animation.skeleton);
+        for (const auto& gemsequence : gemanimation.animations) {
+            AnimationSequence aseq;
+            buildAnimationSequence(gemsequence, aseq);
+            animation.addSequence(gemsequence.name, std::move(aseq));
+        }
+        return meshes.size();
+    };
+    size_t checksum = 0;
+    double serial = timeIt([&]() {
+        for (const std::string& path : paths) {
+            checksum += decode(path);
+        }
+    });
+    JobSystem jobs;
+    double pipelined = timeIt([&]() {
+        AssetPipeline assets(jobs);
+        for (const std::string& path : paths) {
+            assets.load(path, [&decode, path]() { return decode(path); }, [&checksum](size_t& meshes) { checksum += meshes; });
+        }
+        assets.finish();
+    });
+    std::cout << "[ BENCH    ] " << paths.size() << " models, " << jobs.getWorkerCount() << " workers: serial " << serial * 1e3
+        << " ms, pipelined " << pipelined * 1e3 << " ms, " << serial / pipelined << "x (checksum " << checksum % 10 << ")" << std::endl;
+}
+
+// Simulated post-transform cache (16 entry FIFO) before and after the mesh
+// optimization Model::load runs on GEM files.
+template<typename Vertex>
+static void optimizeAndMeasure(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices,
+    MeshOptimizer::VertexCacheStats& before, MeshOptimizer::VertexCacheStats& after) {
+    MeshOptimizer::VertexCacheStats b = MeshOptimizer::analyzeVertexCache(indices.data(), indices.size(), vertices.size());
+    MeshOptimizer::optimizeMesh(vertices, indices);
+    MeshOptimizer::VertexCacheStats a = MeshOptimizer::analyzeVertexCache(indices.data(), indices.size(), vertices.size());
+    before.triangles += b.triangles; before.vertices += b.vertices; before.misses += b.misses;
+    after.triangles += a.triangles; after.vertices += a.vertices; after.misses += a.misses;
+}
+
+TEST(MeshOptimizerBenchmark, ACMRAndATVR) {
+    for (const char* name : { "TRex.gem", "Pine/pine.gem", "acacia_003.gem" }) {
+        std::string path = findResource(name);
+        if (path.empty()) {
+            std::cout << "[ BENCH    ] " << name << " not found, skipping" << std::endl;
+            continue;
+        }
+        GEMLoader::GEMModelLoader loader;
+        std::vector<GEMLoader::GEMMesh> meshes;
+        GEMLoader::GEMAnimation animation;
+        loader.loadMapped(path, meshes, animation);
+        MeshOptimizer::VertexCacheStats before, after;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (auto& mesh : meshes) {
+            if (mesh.isAnimated()) {
+                optimizeAndMeasure(mesh.verticesAnimated, mesh.indices, before, after);
+            }
+            else {
+                optimizeAndMeasure(mesh.verticesStatic, mesh.indices, before, after);
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        std::cout << "[ BENCH    ] " << name << " " << before.triangles << " triangles, transforms " << before.misses << " -> " << after.misses << ", ACMR " << static_cast<float>(before.misses) / before.triangles
+            << " -> " << static_cast<float>(after.misses) / after.triangles << ", ATVR " << static_cast<float>(before.misses) / before.vertices
+            << " -> " << static_cast<float>(after.misses) / after.vertices << " (" << seconds * 1e3 << " ms including analysis)" << std::endl;
+    }
+}
+
+// Triangles, ratio reached and error of each LOD after the load-time
+// optimization, and the time to build the chain. Animated meshes use the
+// skin-aware collapse.
+TEST(MeshSimplifierBenchmark, LODChains) {
+    const std::vector<float> ratios = { 0.5f, 0.25f, 0.1f };
+    for (const char* name : { "TRex.gem", "Pine/pine.gem", "acacia_003.gem" }) {
+        std::string path = findResource(name);
+        if (path.empty()) {
+            std::cout << "[ BENCH    ] " << name << " not found, skipping" << std::endl;
+            continue;
+        }
+        GEMLoader::GEMModelLoader loader;
+        std::vector<GEMLoader::GEMMesh> meshes;
+        GEMLoader::GEMAnimation animation;
+        loader.loadMapped(path, meshes, animation);
+        size_t triangles = 0;
+        for (auto& mesh : meshes) {
+            if (mesh.isAnimated()) {
+                MeshOptimizer::optimizeMesh(mesh.verticesAnimated, mesh.indices);
+            }
+            else {
+                MeshOptimizer::optimizeMesh(mesh.verticesStatic, mesh.indices);
+            }
+            triangles += mesh.indices.size() / 3;
+        }
+        std::vector<size_t> levelTriangles(ratios.size(), 0);
+        std::vector<float> levelErrors(ratios.size(), 0.0f);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (auto& mesh : meshes) {
+            std::vector<MeshSimplifier::LOD> chain = mesh.isAnimated() ? MeshSimplifier::buildSkinnedLODChain(mesh.verticesAnimated, mesh.indices, ratios)
+                : MeshSimplifier::buildLODChain(mesh.verticesStatic, mesh.indices, ratios);
+            for (size_t l = 0; l < ratios.size(); l++) {
+                // A chain that stopped early draws its last level.
+                const std::vector<unsigned int>& indices = chain.empty() ? mesh.indices : chain[l < chain.size() ? l : chain.size() - 1].indices;
+                float error = chain.empty() ? 0.0f : chain[l < chain.size() ? l : chain.size() - 1].error;
+                levelTriangles[l] += indices.size() / 3;
+                levelErrors[l] = error > levelErrors[l] ? error : levelErrors[l];
+            }
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+        std::cout << "[ BENCH    ] " << name << " " << triangles << " triangles";
+        for (size_t l = 0; l < ratios.size(); l++) {
+            std::cout << ", LOD" << l + 1 << " " << levelTriangles[l] << " (" << static_cast<float>(levelTriangles[l]) / triangles << " of " << ratios[l]
+                << " asked, error " << levelErrors[l] << ")";
+        }
+        std::cout << ", built in " << seconds * 1e3 << " ms" << std::endl;
+    }
+}
+
+// Vertex memory of the full-float and compact formats, the largest round-trip
+// errors and the encode time.
+// Clusters of the static models after the load-time optimization, and how
+// much of each one cluster culling removes for cameras circling it at a few
+// distances: the frustum alone, and frustum plus normal cones.
+TEST(MeshClustersBenchmark, ClusterCulling) {
+    for (const char* name : { "Pine/pine.gem", "acacia_003.gem" }) {
+        std::string path = findResource(name);
+        if (path.empty()) {
+            std::cout << "[ BENCH    ] " << name << " not found, skipping" << std::endl;
+            continue;
+        }
+        GEMLoader::GEMModelLoader loader;
+        std::vector<GEMLoader::GEMMesh> meshes;
+        loader.loadMapped(path, meshes);
+        vec3 lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        MeshOptimizer::VertexCacheStats before, after;
+        std::vector<std::vector<MeshClusters::Cluster>> clusters;
+        double seconds = 0.0;
+        for (auto& mesh : meshes) {
+            MeshOptimizer::optimizeMesh(mesh.verticesStatic, mesh.indices);
+            before = MeshOptimizer::analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.verticesStatic.size());
+            auto start = std::chrono::high_resolution_clock::now();
+            clusters.push_back(MeshClusters::buildClusters(mesh.verticesStatic, mesh.indices));
+            seconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+            after = MeshOptimizer::analyzeVertexCache(mesh.indices.data(), mesh.indices.size(), mesh.verticesStatic.size());
+            for (const auto& v : mesh.verticesStatic) {
+                lo = vec3::Min(lo, vec3(v.position.x, v.position.y, v.position.z));
+                hi = vec3::Max(hi, vec3(v.position.x, v.position.y, v.position.z));
+            }
+        }
+        size_t clusterCount = 0, triangles = 0;
+        for (const auto& list : clusters) {
+            clusterCount += list.size();
+            for (const auto& cluster : list) {
+                triangles += cluster.indexCount / 3;
+            }
+        }
+        std::cout << "[ BENCH    ] " << name << " " << clusterCount << " clusters, " << static_cast<float>(triangles) / clusterCount << " triangles each, built in "
+            << seconds * 1e3 << " ms, ACMR " << before.acmr << " -> " << after.acmr << " (last mesh)" << std::endl;
+
+        vec3 center = (lo + hi) * 0.5f;
+        float extent = (hi - lo).getLength();
+        Matrix projection = Matrix::Projection(1.0f, 1.0f, extent * 0.01f, extent * 100.0f);
+        for (float distance : { 0.35f, 0.75f, 2.0f }) {
+            MeshClusters::CullStats frustumOnly, withCones;
+            std::vector<MeshClusters::DrawRange> ranges;
+            for (int step = 0; step < 16; step++) {
+                float angle = step * 6.2831853f / 16;
+                vec3 eye = center + vec3(cosf(angle), 0.2f, sinf(angle)) * (extent * distance);
+                MeshClusters::Frustum frustum = MeshClusters::Frustum::fromMatrix(projection.mul(Matrix::LookAt(eye, center, vec3(0.0f, 1.0f, 0.0f))));
+                for (const auto& list : clusters) {
+                    ranges.clear();
+                    MeshClusters::cullClusters(list, frustum, eye, ranges, &frustumOnly, false);
+                    ranges.clear();
+                    MeshClusters::cullClusters(list, frustum, eye, ranges, &withCones);
+                }
+            }
+            std::cout << "[ BENCH    ] " << name << " camera at " << distance << "x extent: culled " << frustumOnly.cullRatio() * 100.0f << "% of triangles by frustum, "
+                << withCones.cullRatio() * 100.0f << "% with cones (" << withCones.backfaceCulled << " of " << withCones.clusters << " cluster tests back-facing)" << std::endl;
+        }
+    }
+}
+
+TEST(VertexCompressionBenchmark, CompactVertexMemory) {
+    for (const char* name : { "TRex.gem", "Pine/pine.gem", "acacia_003.gem" }) {
+        std::string path = findResource(name);
+        if (path.empty()) {
+            std::cout << "[ BENCH    ] " << name << " not found, skipping" << std::endl;
+            continue;
+        }
+        GEMLoader::GEMModelLoader loader;
+        std::vector<GEMLoader::GEMMesh> meshes;
+        GEMLoader::GEMAnimation animation;
+        loader.loadMapped(path, meshes, animation);
+        size_t originalBytes = 0, compactBytes = 0;
+        VertexCompression::ErrorReport worst;
+        double seconds = 0.0;
+        for (auto& mesh : meshes) {
+            VertexCompression::Quantization q;
+            VertexCompression::ErrorReport error;
+            auto start = std::chrono::high_resolution_clock::now();
+            if (mesh.isAnimated()) {
+                std::vector<VertexCompression::CompactAnimatedVertex> compact;
+                VertexCompression::compressAnimated(mesh.verticesAnimated, compact, q);
+                seconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+                error = VertexCompression::measureError(mesh.verticesAnimated, VertexCompression::decompressAnimated<GEMLoader::GEMAnimatedVertex>(compact, q));
+                originalBytes += mesh.verticesAnimated.size() * sizeof(GEMLoader::GEMAnimatedVertex);
+                compactBytes += compact.size() * sizeof(VertexCompression::CompactAnimatedVertex);
+            }
+            else {
+                std::vector<VertexCompression::CompactStaticVertex> compact = VertexCompression::compressStatic(mesh.verticesStatic, q);
+                seconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+                error = VertexCompression::measureError(mesh.verticesStatic, VertexCompression::decompressStatic<GEMLoader::GEMStaticVertex>(compact, q));
+                originalBytes += mesh.verticesStatic.size() * sizeof(GEMLoader::GEMStaticVertex);
+                compactBytes += compact.size() * sizeof(VertexCompression::CompactStaticVertex);
+            }
+            worst.position = max(worst.position, error.position);
+            worst.normal = max(worst.normal, error.normal);
+            worst.tangent = max(worst.tangent, error.tangent);
+            worst.uv = max(worst.uv, error.uv);
+            worst.weight = max(worst.weight, error.weight);
+        }
+        std::cout << "[ BENCH    ] " << name << " vertices " << originalBytes / 1024 << " KB -> " << compactBytes / 1024 << " KB ("
+            << 100.0 * (1.0 - static_cast<double>(compactBytes) / originalBytes) << "% smaller), max error position " << worst.position
+            << ", normal " << worst.normal << " rad, tangent " << worst.tangent << " rad, uv " << worst.uv << ", weight " << worst.weight
+            << ", encoded in " << seconds * 1e3 << " ms" << std::endl;
+    }
+}
+
+TEST(MipChainBenchmark, ChainGeneration) {
+    for (const char* name : { "Textures/bark09.png", "Textures/pine branch.png", "Textures/stump01_normal.png" }) {
+        std::string path = findRepoFile(name);
+        int width = 0, height = 0, channels = 0;
+        unsigned char* texels = path.empty() ? nullptr : stbi_load(path.c_str(), &width, &height, &channels, 4);
+        if (texels == nullptr) {
+            std::cout << "[ BENCH    ] " << name << " not found, skipping" << std::endl;
+            continue;
+        }
+        size_t texelCount = static_cast<size_t>(width) * height;
+        MipChain::Settings settings = MipChain::settingsFor(path, texels, texelCount);
+        std::vector<unsigned char> chain;
+        const int runs = 5;
+        int levels = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < runs; i++) {
+            levels = MipChain::generate(texels, width, height, settings, chain);
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / runs;
+        // The box filter alone, SSE against scalar, for the first level
+        std::vector<unsigned char> level1(MipChain::levelOffset(width, height, 2) - MipChain::levelOffset(width, height, 1));
+        double filterMs[2];
+        for (int simd = 0; simd < 2; simd++) {
+            auto filterStart = std::chrono::high_resolution_clock::now();
+            for (int i = 0; i < runs; i++) {
+                MipChain::Detail::downsample(texels, width, height, level1.data(), settings.srgb, simd == 1);
+            }
+            filterMs[simd] = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - filterStart).count() / runs;
+        }
+        stbi_image_free(texels);
+        std::cout << "[ BENCH    ] " << name << " " << width << "x" << height << " " << levels << " levels ("
+            << (settings.srgb ? "sRGB" : "linear") << (settings.preserveAlphaCoverage ? ", alpha coverage" : "") << ") in " << ms << " ms, "
+            << texelCount / (ms * 1e3) << " Mtexels/s, +" << 100.0 * (chain.size() - texelCount * 4) / (texelCount * 4)
+            << "% memory; level 1 filter scalar " << filterMs[0] << " ms, SSE " << filterMs[1] << " ms" << std::endl;
+    }
+}
+
+TEST(BlockCompressionBenchmark, CookedTextures) {
+    JobSystem jobs;
+    for (const char* name : { "Textures/bark09.png", "Textures/pine branch.png", "Textures/stump01.png" }) {
+        std::string path = findRepoFile(name);
+        if (path.empty()) {
+            std::cout << "[ BENCH    ] " << name << " not found, skipping" << std::endl;
+            continue;
+        }
+        // What a load without the cache does: decode the image and build its mips
+        auto start = std::chrono::high_resolution_clock::now();
+        int width = 0, height = 0, channels = 0;
+        unsigned char* texels = stbi_load(path.c_str(), &width, &height, &channels, 4);
+        size_t texelCount = static_cast<size_t>(width) * height;
+        std::vector<unsigned char> chain;
+        int levels = MipChain::generate(texels, width, height, MipChain::settingsFor(path, texels, texelCount), chain);
+        double sourceMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+        BlockCompression::Format format = BlockCompression::chooseFormat(texels, texelCount);
+        std::vector<unsigned char> blocks;
+        double encodeMs[2];
+        for (int threaded = 0; threaded < 2; threaded++) {
+            auto encodeStart = std::chrono::high_resolution_clock::now();
+            BlockCompression::encodeChain(chain.data(), width, height, levels, format, blocks, threaded ? &jobs : nullptr);
+            encodeMs[threaded] = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - encodeStart).count();
+        }
+        std::vector<unsigned char> decoded(texelCount * 4);
+        BlockCompression::decodeLevel(blocks.data(), width, height, format, decoded.data());
+        double psnr = BlockCompression::psnr(texels, decoded.data(), texelCount, format == BlockCompression::Format::BC3);
+        stbi_image_free(texels);
+
+        // What a load with the cache does: map it and copy the blocks out
+        const char* cachePath = "bench_texture.pngc";
+        TextureCache::write(path, cachePath, width, height, levels, format, blocks.data());
+        auto cacheStart = std::chrono::high_resolution_clock::now();
+        TextureCache cache;
+        cache.open(path, cachePath);
+        std::vector<unsigned char> cached(cache.data(), cache.data() + cache.dataBytes());
+        cache.close();
+        double cacheMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - cacheStart).count();
+        std::remove(cachePath);
+
+        std::cout << "[ BENCH    ] " << name << " " << (format == BlockCompression::Format::BC1 ? "BC1" : "BC3") << " "
+            << chain.size() / 1024 << " KB -> " << blocks.size() / 1024 << " KB, PSNR " << psnr << " dB, encode "
+            << encodeMs[0] << " ms on one thread, " << encodeMs[1] << " ms on " << jobs.getWorkerCount() + 1 << "; load "
+            << sourceMs << " ms from the image, " << cacheMs << " ms from the cache" << std::endl;
+    }
+}
+
+// The decode before ImageDecoder: stb_image with the file's own channel count,
+// then a per-texel loop expanding RGB to RGBA into a second buffer.
+static bool decodeExpanding(const std::string& path, int& width, int& height, std::vector<unsigned char>& texels) {
+    int channels = 0;
+    unsigned char* decoded = stbi_load(path.c_str(), &width, &height, &channels, 0);
+    if (decoded == nullptr) {
+        return false;
+    }
+    if (channels == 3) {
+        texels.resize(static_cast<size_t>(width) * height * 4);
+        for (int i = 0; i < width * height; i++) {
+            texels[i * 4] = decoded[i * 3];
+            texels[i * 4 + 1] = decoded[i * 3 + 1];
+            texels[i * 4 + 2] = decoded[i * 3 + 2];
+            texels[i * 4 + 3] = 255;
+        }
+    }
+    else {
+        texels.assign(decoded, decoded + static_cast<size_t>(width) * height * channels);
+    }
+    stbi_image_free(decoded);
+    return true;
+}
+
+TEST(ImageDecoderBenchmark, DecodeThroughput) {
+    // The images initializeTextures loads
+    std::vector<std::string> paths;
+    for (const char* name : { "Textures/bark09.png", "Textures/pine branch.png", "Textures/stump01.png",
+        "resources/NightSkyHDRI001_4K-TONEMAPPED.jpg", "Textures/T-rex_Base_Color.png" }) {
+        std::string path = findRepoFile(name);
+        if (path.empty()) {
+            std::cout << "[ BENCH    ] " << name << " not found, skipping" << std::endl;
+            continue;
+        }
+        paths.push_back(path);
+    }
+    // Best of three runs of each step
+    auto bestMs = [](const std::function<void()>& step) {
+        double best = 1e30;
+        for (int run = 0; run < 3; run++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            step();
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            best = min(best, ms);
+        }
+        return best;
+    };
+    double serialMs = 0.0;
+    size_t totalBytes = 0;
+    for (const std::string& path : paths) {
+        int width = 0, height = 0;
+        std::vector<unsigned char> texels, chain;
+        // The RGBA chain as decode builds it: after the expanding decode, a copy into a new chain
+        double expandingMs = bestMs([&]() { decodeExpanding(path, width, height, texels); });
+        double expandingChainMs = bestMs([&]() {
+            decodeExpanding(path, width, height, texels);
+            MipChain::generate(texels.data(), width, height, MipChain::Settings(), chain);
+        });
+        double directMs = bestMs([&]() { ImageDecoder::decodeRGBA8(path, width, height, texels); });
+        double directChainMs = bestMs([&]() {
+            ImageDecoder::decodeRGBA8(path, width, height, texels);
+            MipChain::generateInPlace(texels, width, height, MipChain::Settings());
+        });
+
+        double mb = static_cast<double>(width) * height * 4 / (1024.0 * 1024.0);
+        serialMs += directMs;
+        totalBytes += static_cast<size_t>(width) * height * 4;
+        std::cout << "[ BENCH    ] " << path << " " << width << "x" << height << ": expanding decode " << expandingMs << " ms ("
+            << mb / (expandingMs * 1e-3) << " MB/s), RGBA decode " << directMs << " ms (" << mb / (directMs * 1e-3)
+            << " MB/s); with mips " << expandingChainMs << " -> " << directChainMs << " ms" << std::endl;
+    }
+    // All of them at once on the job system, as the asset pipeline decodes them
+    JobSystem jobs;
+    std::vector<std::vector<unsigned char>> decoded(paths.size());
+    auto start = std::chrono::high_resolution_clock::now();
+    jobs.parallelFor(paths.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            int width = 0, height = 0;
+            ImageDecoder::decodeRGBA8(paths[i], width, height, decoded[i]);
+        }
+    });
+    double parallelMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    double mb = totalBytes / (1024.0 * 1024.0);
+    std::cout << "[ BENCH    ] " << paths.size() << " textures, " << mb << " MB: serial " << serialMs << " ms (" << mb / (serialMs * 1e-3)
+        << " MB/s), on " << jobs.getWorkerCount() + 1 << " threads " << parallelMs << " ms (" << mb / (parallelMs * 1e-3) << " MB/s)" << std::endl;
+}
+
+TEST(TextureStreamerBenchmark, TimeToFirstUsableLevel) {
+    // The images initializeTextures loads, cooked as TextureManager loads them
+    JobSystem jobs;
+    double sourceTotalMs = 0.0, wholeTotalMs = 0.0, streamedTotalMs = 0.0;
+    for (const char* name : { "Textures/bark09.png", "Textures/pine branch.png", "Textures/stump01.png",
+        "resources/NightSkyHDRI001_4K-TONEMAPPED.jpg", "Textures/T-rex_Base_Color.png" }) {
+        std::string path = findRepoFile(name);
+        if (path.empty()) {
+            std::cout << "[ BENCH    ] " << name << " not found, skipping" << std::endl;
+            continue;
+        }
+        // Without a cache: decode, build the mips and compress
+        auto start = std::chrono::high_resolution_clock::now();
+        int width = 0, height = 0;
+        std::vector<unsigned char> chain;
+        ImageDecoder::decodeRGBA8(path, width, height, chain);
+        size_t texelCount = static_cast<size_t>(width) * height;
+        int levels = MipChain::generateInPlace(chain, width, height, MipChain::settingsFor(path, chain.data(), texelCount));
+        BlockCompression::Format format = BlockCompression::chooseFormat(chain.data(), texelCount);
+        std::vector<unsigned char> blocks;
+        BlockCompression::encodeChain(chain.data(), width, height, levels, format, blocks, &jobs);
+        double sourceMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+        const char* cachePath = "bench_streamed.pngc";
+        TextureCache::write(path, cachePath, width, height, levels, format, blocks.data());
+
+        // The whole chain out of the cache, as a load without streaming takes
+        start = std::chrono::high_resolution_clock::now();
+        TextureCache cache;
+        cache.open(path, cachePath);
+        std::vector<unsigned char> whole(cache.data(), cache.data() + cache.dataBytes());
+        cache.close();
+        double wholeMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+        // Only the levels a streamed texture starts with
+        start = std::chrono::high_resolution_clock::now();
+        cache.open(path, cachePath);
+        int first = TextureStreamer::initialLevel(width, height, levels);
+        size_t offset = BlockCompression::chainBytes(width, height, first, format);
+        std::vector<unsigned char> tail(cache.data() + offset, cache.data() + cache.dataBytes());
+        cache.close();
+        double streamedMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        std::remove(cachePath);
+
+        sourceTotalMs += sourceMs;
+        wholeTotalMs += wholeMs;
+        streamedTotalMs += streamedMs;
+        std::cout << "[ BENCH    ] " << name << " " << width << "x" << height << ": first usable from the image " << sourceMs
+            << " ms, whole cached chain " << wholeMs << " ms (" << whole.size() / 1024 << " KB), streamed from level " << first
+            << " " << streamedMs << " ms (" << tail.size() / 1024 << " KB)" << std::endl;
+    }
+    std::cout << "[ BENCH    ] All textures: " << sourceTotalMs << " ms from the images, " << wholeTotalMs << " ms whole from the cache, "
+        << streamedTotalMs << " ms streamed" << std::endl;
+}
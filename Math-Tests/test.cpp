@@ -1,6 +1,31 @@
 #include "pch.h"
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <array>
+#include <map>
+#include <random>
+#include <set>
+#include <stdexcept>
 #include "../inc/core.h"
+#include "../inc/TransformBatch.h"
+#include "AnimationFixtures.h"
+#include "../inc/AnimationController.h"
+#include "../inc/AnimationLOD.h"
+#include "../inc/GEMLoader.h"
+#include "../inc/ModelCache.h"
+#include "../inc/AssetPipeline.h"
+#include "../inc/MeshOptimizer.h"
+#include "../inc/MeshSimplifier.h"
+#include "../inc/MeshClusters.h"
+#include "../inc/VertexCompression.h"
+#include "../inc/MipChain.h"
+#include "../inc/BlockCompression.h"
+#include "../inc/TextureCache.h"
+#include "../inc/TextureResidency.h"
+#include "../inc/TextureStreamer.h"
+#define STB_IMAGE_IMPLEMENTATION
+#include "../inc/ImageDecoder.h"
+#include "TestResources.h"
 
 // vec2 Tests
 TEST(Vec2Test, Addition) {
@@ -96,6 +121,2190 @@ TEST(MatrixTest, Inversion) {
     EXPECT_FLOAT_EQ(inv.m[15], 1.0f);
 }
 
+// Fills a matrix with a well-conditioned pseudo-random affine transform.
+static Matrix randomMatrix(unsigned int seed) {
+    srand(seed);
+    auto r = []() { return (static_cast<float>(rand()) / RAND_MAX) * 2.0f - 1.0f; };
+    Matrix mat = Matrix::translation(vec3(r() * 10.0f, r() * 10.0f, r() * 10.0f)) *
+        Quaternion(r(), r(), r(), r()).normalize().toMatrix() *
+        Matrix::scaling(vec3(1.5f + r(), 1.5f + r(), 1.5f + r()));
+    mat.m[12] = r() * 0.1f;
+    return mat;
+}
+
+TEST(MatrixTest, SIMDBackendsMatchScalar) {
+    const MatrixKernels::Backend backends[] = {
+        MatrixKernels::Backend::SSE, MatrixKernels::Backend::AVX2, MatrixKernels::Backend::NEON };
+    for (int n = 0; n < 100; n++) {
+        Matrix a = randomMatrix(n * 2 + 1);
+        Matrix b = randomMatrix(n * 2 + 2);
+        MatrixKernels::setBackend(MatrixKernels::Backend::Scalar);
+        Matrix mulRef = a.mul(b);
+        Matrix invRef = a.invert();
+        Matrix trRef = a.transpose();
+        for (MatrixKernels::Backend backend : backends) {
+            MatrixKernels::setBackend(backend);
+            Matrix mul = a.mul(b);
+            Matrix inv = a.invert();
+            Matrix tr = a.transpose();
+            for (int i = 0; i < 16; i++) {
+                EXPECT_EQ(mul.m[i], mulRef.m[i]);
+                EXPECT_NEAR(inv.m[i], invRef.m[i], 1e-4f);
+                EXPECT_EQ(tr.m[i], trRef.m[i]);
+            }
+        }
+    }
+    MatrixKernels::setBackend(MatrixKernels::detectBackend());
+}
+
+TEST(MatrixTest, InverseTimesMatrixIsIdentity) {
+    Matrix a = randomMatrix(42);
+    Matrix result = a.mul(a.invert());
+    Matrix identity;
+    for (int i = 0; i < 16; i++) {
+        EXPECT_NEAR(result.m[i], identity.m[i], 1e-5f);
+    }
+}
+
+// AffineMatrix tests
+TEST(AffineMatrixTest, ComposeMatchesMatrix) {
+    Matrix a = randomMatrix(11);
+    Matrix b = randomMatrix(12);
+    a.m[12] = 0.0f; b.m[12] = 0.0f; // Make both strictly affine
+    AffineMatrix result = AffineMatrix(a) * AffineMatrix(b);
+    Matrix ref = a.mul(b);
+    for (int i = 0; i < 12; i++) {
+        EXPECT_FLOAT_EQ(result.m[i], ref.m[i]);
+    }
+    Matrix back = result.toMatrix();
+    EXPECT_EQ(back.m[12], 0.0f);
+    EXPECT_EQ(back.m[15], 1.0f);
+}
+
+TEST(AffineMatrixTest, InverseAffine) {
+    Matrix a = randomMatrix(13);
+    a.m[12] = 0.0f;
+    AffineMatrix affine(a);
+    AffineMatrix identity = affine * affine.invertAffine();
+    AffineMatrix expected;
+    for (int i = 0; i < 12; i++) {
+        EXPECT_NEAR(identity.m[i], expected.m[i], 1e-5f);
+    }
+    vec3 p(1.0f, -2.0f, 3.0f);
+    vec3 roundTrip = affine.invertAffine().mulPoint(affine.mulPoint(p));
+    EXPECT_NEAR(roundTrip.x, p.x, 1e-4f);
+    EXPECT_NEAR(roundTrip.y, p.y, 1e-4f);
+    EXPECT_NEAR(roundTrip.z, p.z, 1e-4f);
+}
+
+TEST(AffineMatrixTest, FromTRSMatchesMatrixProduct) {
+    vec3 t(1.0f, 2.0f, 3.0f);
+    Quaternion q = Quaternion(0.3f, 0.2f, -0.5f, 0.7f).normalize();
+    vec3 s(1.5f, 0.5f, 2.0f);
+    AffineMatrix affine = AffineMatrix::fromTRS(t, q, s);
+    Matrix ref = Matrix::translation(t) * q.toMatrix() * Matrix::scaling(s);
+    for (int i = 0; i < 12; i++) {
+        EXPECT_FLOAT_EQ(affine.m[i], ref.m[i]);
+    }
+    vec3 p(0.25f, -1.0f, 4.0f);
+    vec3 a = affine.mulPoint(p);
+    vec3 b = ref.mulPoint(p);
+    EXPECT_FLOAT_EQ(a.x, b.x);
+    EXPECT_FLOAT_EQ(a.y, b.y);
+    EXPECT_FLOAT_EQ(a.z, b.z);
+}
+
+TEST(AffineMatrixTest, PaletteMatchesMatrixPalette) {
+    Animation animation;
+    buildTestAnimation(animation, "clip", 40, 10);
+    Matrix full[256];
+    AffineMatrix affine[256];
+    int frame = 0;
+    float fact = 0.0f;
+    animation.calcFrame("clip", 0.1f, frame, fact);
+    for (int i = 0; i < 40; i++) {
+        full[i] = animation.interpolateBoneToGlobal("clip", full, frame, fact, i);
+        affine[i] = animation.interpolateBoneToGlobal("clip", affine, frame, fact, i);
+    }
+    animation.calcFinalTransforms(full);
+    animation.calcFinalTransforms(affine);
+    for (int b = 0; b < 40; b++) {
+        for (int i = 0; i < 12; i++) {
+            EXPECT_NEAR(affine[b].m[i], full[b].m[i], 1e-4f);
+        }
+    }
+}
+
+// Animation handle tests
+TEST(AnimationTest, HandlesResolveNames) {
+    Animation animation;
+    buildTestAnimation(animation, "Idle", 8, 4, 1);
+    buildTestAnimation(animation, "Run", 8, 4, 2);
+    AnimationHandle idle = animation.findSequence("Idle");
+    AnimationHandle run = animation.findSequence("Run");
+    EXPECT_NE(idle, run);
+    EXPECT_EQ(animation.findSequence("Missing"), INVALID_ANIMATION_HANDLE);
+
+    AnimationInstance byName, byHandle;
+    byName.animation = &animation;
+    byHandle.animation = &animation;
+    byName.update("Run", 0.05f);
+    byHandle.update(run, 0.05f);
+    for (int b = 0; b < 8; b++) {
+        for (int i = 0; i < 12; i++) {
+            EXPECT_EQ(byName.matrices[b].m[i], byHandle.matrices[b].m[i]);
+        }
+    }
+}
+
+TEST(AnimationTest, ControllerMapsStatesToHandles) {
+    Animation animation;
+    buildTestAnimation(animation, "Idle", 4, 4, 1);
+    buildTestAnimation(animation, "Run", 4, 4, 2);
+    AnimationController controller;
+    int entered = 0;
+    controller.addState("Idle", animation.findSequence("Idle"), [&]() { entered++; });
+    controller.addState("Run", animation.findSequence("Run"), [&]() { entered++; });
+    controller.transitionTo("Run");
+    controller.transitionTo("Run");
+    EXPECT_EQ(entered, 1);
+    EXPECT_EQ(controller.getCurrentClip(), animation.findSequence("Run"));
+}
+
+TEST(AnimationTest, SoAKeyframesAreAlignedAndCopyable) {
+    Animation animation;
+    buildTestAnimation(animation, "clip", 7, 5);
+    AnimationSequence& sequence = animation.getSequence(animation.findSequence("clip"));
+    EXPECT_EQ(sequence.getFrameCount(), 5);
+    EXPECT_EQ(sequence.getBoneCount(), 7);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(sequence.positions) % 16, 0u);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(sequence.rotations) % 16, 0u);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(sequence.scales) % 16, 0u);
+
+    AnimationSequence copy = sequence;
+    int key = sequence.keyIndex(3, 6);
+    EXPECT_EQ(copy.positions[key].x, sequence.positions[key].x);
+    EXPECT_EQ(copy.rotations[key].w, sequence.rotations[key].w);
+    EXPECT_EQ(copy.scales[key].z, sequence.scales[key].z);
+    EXPECT_NE(copy.positions, sequence.positions);
+
+    vec3 t, s;
+    Quaternion q;
+    sequence.sampleBone(3, 0.0f, 6, t, q, s);
+    EXPECT_FLOAT_EQ(t.y, sequence.positions[key].y);
+    EXPECT_FLOAT_EQ(s.x, sequence.scales[key].x);
+}
+
+// TransformBatch tests
+struct TestVertex {
+    vec3 pos;
+    vec3 normal;
+    float tu, tv;
+};
+
+TEST(TransformBatchTest, MatchesMulPointAndMulVec) {
+    const size_t count = 37; // Not a multiple of 4, so the scalar tail runs too
+    Matrix m = randomMatrix(7);
+    std::vector<TestVertex> vertices(count);
+    std::vector<float> xs(count), ys(count), zs(count);
+    for (size_t i = 0; i < count; i++) {
+        vertices[i].pos = vec3(i * 0.5f, i * -0.25f, 1.0f + i);
+        vertices[i].normal = vec3(0.0f, 1.0f, i * 0.1f).normalize();
+        xs[i] = vertices[i].pos.x; ys[i] = vertices[i].pos.y; zs[i] = vertices[i].pos.z;
+    }
+    std::vector<float> ox(count), oy(count), oz(count);
+    SoAStream out = { ox.data(), oy.data(), oz.data() };
+
+    TransformBatch::transformPoints(m, ConstSoAStream{ xs.data(), ys.data(), zs.data() }, out, count);
+    for (size_t i = 0; i < count; i++) {
+        vec3 ref = m.mulPoint(vertices[i].pos);
+        EXPECT_EQ(ox[i], ref.x); EXPECT_EQ(oy[i], ref.y); EXPECT_EQ(oz[i], ref.z);
+    }
+
+    TransformBatch::transformVertexNormals(m, vertices.data(), out, count);
+    for (size_t i = 0; i < count; i++) {
+        vec3 ref = m.mulVec(vertices[i].normal);
+        EXPECT_EQ(ox[i], ref.x); EXPECT_EQ(oy[i], ref.y); EXPECT_EQ(oz[i], ref.z);
+    }
+
+    std::vector<Matrix> perElement(count);
+    for (size_t i = 0; i < count; i++) {
+        perElement[i] = randomMatrix(100 + static_cast<unsigned int>(i));
+    }
+    TransformBatch::transformPointsStrided(perElement.data(), vertices[0].pos.v, sizeof(TestVertex), out, count);
+    for (size_t i = 0; i < count; i++) {
+        vec3 ref = perElement[i].mulPoint(vertices[i].pos);
+        EXPECT_EQ(ox[i], ref.x); EXPECT_EQ(oy[i], ref.y); EXPECT_EQ(oz[i], ref.z);
+    }
+}
+
+TEST(TransformBatchTest, ThreadedMatchesSingleThreaded) {
+    const size_t count = 10001;
+    Matrix m = randomMatrix(3);
+    std::vector<TestVertex> vertices(count);
+    for (size_t i = 0; i < count; i++) {
+        vertices[i].pos = vec3(static_cast<float>(i), 1.0f, -static_cast<float>(i));
+    }
+    std::vector<float> ax(count), ay(count), az(count), bx(count), by(count), bz(count);
+    TransformBatch::transformVertexPositions(m, vertices.data(), SoAStream{ ax.data(), ay.data(), az.data() }, count);
+    TransformBatch::Options options;
+    options.threads = 4;
+    options.minElementsPerThread = 1000;
+    TransformBatch::transformVertexPositions(m, vertices.data(), SoAStream{ bx.data(), by.data(), bz.data() }, count, options);
+    EXPECT_EQ(ax, bx);
+    EXPECT_EQ(ay, by);
+    EXPECT_EQ(az, bz);
+}
+
+// JobSystem tests
+TEST(JobSystemTest, ParallelForCoversEveryIndexOnce) {
+    JobSystem jobs(3);
+    std::vector<int> hits(1000, 0);
+    jobs.parallelFor(hits.size(), 7, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            hits[i]++;
+        }
+    });
+    for (int h : hits) {
+        EXPECT_EQ(h, 1);
+    }
+}
+
+TEST(JobSystemTest, SubmittedTasksRunWithoutWorkers) {
+    JobSystem jobs(0);
+    int runs = 0;
+    jobs.submit([&]() { runs++; });
+    jobs.submit([&]() { runs++; });
+    EXPECT_EQ(runs, 0);
+    while (jobs.runOne()) {}
+    EXPECT_EQ(runs, 2);
+}
+
+TEST(JobSystemTest, ParallelForRethrowsAfterEveryChunkFinishes) {
+    JobSystem jobs(3);
+    std::atomic<int> chunks(0);
+    EXPECT_THROW(jobs.parallelFor(100, 1, [&](size_t begin, size_t) {
+        chunks++;
+        if (begin % 10 == 3) {
+            throw std::runtime_error("chunk failed");
+        }
+    }), std::runtime_error);
+    EXPECT_EQ(chunks.load(), 100);
+    // The pool is still usable
+    int sum = 0;
+    jobs.parallelFor(10, 10, [&](size_t begin, size_t end) { sum += static_cast<int>(end - begin); });
+    EXPECT_EQ(sum, 10);
+}
+
+TEST(AssetPipelineTest, DecodesInParallelAndUploadsOnCaller) {
+    JobSystem jobs(4);
+    AssetPipeline assets(jobs);
+    std::thread::id caller = std::this_thread::get_id();
+    std::vector<std::thread::id> uploadThreads;
+    const int count = 4;
+    for (int i = 0; i < count; i++) {
+        // Null upload sink: the upload only records where it ran.
+        assets.load("asset" + std::to_string(i), [i]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            return i;
+        }, [&uploadThreads](int&) {
+            uploadThreads.push_back(std::this_thread::get_id());
+        });
+    }
+    assets.finish();
+    double wall = assets.elapsed();
+    ASSERT_EQ(uploadThreads.size(), static_cast<size_t>(count));
+    for (auto& id : uploadThreads) {
+        EXPECT_EQ(id, caller);
+    }
+    double decodeSum = 0.0;
+    for (const AssetTiming& timing : assets.getTimings()) {
+        EXPECT_GE(timing.decodeSeconds, 0.045);
+        EXPECT_GE(timing.uploadedTime, timing.readyTime);
+        decodeSum += timing.decodeSeconds;
+    }
+    // Bounded by the slowest decode rather than the sum.
+    EXPECT_LT(wall, decodeSum * 0.75);
+    for (int i = 0; i < count; i++) {
+        EXPECT_TRUE(assets.isUploaded(i));
+    }
+}
+
+TEST(AssetPipelineTest, PassesDecodedDataAndRethrowsDecodeErrors) {
+    JobSystem jobs(0);
+    AssetPipeline assets(jobs);
+    std::vector<int> received;
+    assets.load("data", []() { return std::vector<int>{ 1, 2, 3 }; }, [&](std::vector<int>& data) { received = data; });
+    assets.add("broken", []() { throw std::runtime_error("bad file"); }, []() { FAIL() << "upload of a failed decode"; });
+    EXPECT_THROW(assets.finish(), std::runtime_error);
+    assets.finish();
+    EXPECT_EQ(received, std::vector<int>({ 1, 2, 3 }));
+}
+
+TEST(AnimationTest, ParallelUpdateMatchesSerial) {
+    const int bones = 40;
+    const size_t instanceCount = 37;
+    Animation animation;
+    buildTestAnimation(animation, "Idle", bones, 30, 1);
+    buildTestAnimation(animation, "Run", bones, 30, 2);
+    std::vector<AnimationInstance> serial(instanceCount), parallel(instanceCount);
+    std::vector<AnimationUpdateRequest> requests;
+    for (size_t i = 0; i < instanceCount; i++) {
+        serial[i].animation = &animation;
+        parallel[i].animation = &animation;
+        requests.push_back({ &parallel[i], static_cast<AnimationHandle>(i % 2), 0.0f });
+    }
+    JobSystem jobs(4);
+    for (int frame = 0; frame < 10; frame++) {
+        float dt = 0.01f * (frame + 1);
+        for (size_t i = 0; i < instanceCount; i++) {
+            serial[i].update(requests[i].clip, dt);
+            requests[i].dt = dt;
+        }
+        updateAnimationInstances(jobs, requests, 3);
+    }
+    for (size_t i = 0; i < instanceCount; i++) {
+        EXPECT_EQ(serial[i].t, parallel[i].t);
+        EXPECT_EQ(memcmp(serial[i].matrices, parallel[i].matrices, sizeof(AffineMatrix) * bones), 0);
+    }
+}
+
+TEST(AnimationLODTest, DistanceBandsPickUpdateRate) {
+    Animation animation;
+    buildTestAnimation(animation, "Idle", 20, 30);
+    AnimationLOD lod(animation.skeleton);
+    EXPECT_EQ(lod.updateInterval(10.0f), 1);
+    EXPECT_EQ(lod.updateInterval(45.0f), 2);
+    EXPECT_EQ(lod.updateInterval(100.0f), 4);
+    EXPECT_FALSE(lod.collapseLeaves(10.0f));
+    EXPECT_TRUE(lod.collapseLeaves(200.0f));
+}
+
+TEST(AnimationLODTest, SkippedFramesBankTime) {
+    const int bones = 20;
+    Animation animation;
+    AnimationHandle idle = AnimationHandle(0);
+    buildTestAnimation(animation, "Idle", bones, 30);
+    AnimationInstance full, reduced;
+    full.animation = &animation;
+    reduced.animation = &animation;
+    AnimationLOD lod(animation.skeleton);
+    lod.settings.leafScreenSize = 0.0f;
+    AnimationLODState state;
+    const float dt = 0.01f;
+    int evaluated = 0;
+    AnimationLODStats total;
+    for (int frame = 0; frame < 8; frame++) {
+        lod.beginFrame();
+        full.update(idle, dt);
+        if (lod.update(reduced, state, idle, dt, 100.0f)) {
+            evaluated++;
+            EXPECT_NEAR(reduced.t, full.t, 1e-6f);
+        }
+        else {
+            EXPECT_EQ(lod.stats.instancesSkipped, 1);
+            EXPECT_EQ(lod.stats.bonesSaved, bones);
+        }
+        total.add(lod.stats);
+    }
+    // First frame is a clip change, then one frame in four.
+    EXPECT_EQ(evaluated, 3);
+    EXPECT_EQ(total.instances, 8);
+    EXPECT_EQ(total.evaluatedPerTier[2], 3);
+    EXPECT_EQ(total.skippedPerTier[2], 5);
+    EXPECT_EQ(total.evaluatedPerTier[0] + total.skippedPerTier[0] + total.evaluatedPerTier[1] + total.skippedPerTier[1], 0);
+}
+
+TEST(AnimationLODTest, CollapsedLeavesFollowParent) {
+    const int bones = 30;
+    Animation animation;
+    buildTestAnimation(animation, "Idle", bones, 30);
+    AnimationLOD lod(animation.skeleton);
+    ASSERT_GT(lod.getLeafCount(), 0);
+    AnimationInstance full, collapsed;
+    full.animation = &animation;
+    collapsed.animation = &animation;
+    AnimationLODState state;
+    lod.beginFrame();
+    full.update(0, 0.1f);
+    ASSERT_TRUE(lod.update(collapsed, state, 0, 0.1f, 500.0f));
+    EXPECT_EQ(lod.stats.bonesSaved, lod.getLeafCount());
+    EXPECT_EQ(lod.stats.bonesEvaluated, bones - lod.getLeafCount());
+    std::vector<int> children(bones, 0);
+    for (const Bone& bone : animation.skeleton.bones) {
+        if (bone.parentIndex >= 0) children[bone.parentIndex]++;
+    }
+    for (int i = 0; i < bones; i++) {
+        const AffineMatrix& expected = (children[i] == 0 && i > 0) ? collapsed.matrices[animation.skeleton.bones[i].parentIndex] : full.matrices[i];
+        EXPECT_EQ(memcmp(&collapsed.matrices[i], &expected, sizeof(AffineMatrix)), 0) << "bone " << i;
+    }
+}
+
+TEST(AnimationBakeTest, SamplesMatchLiveEvaluation) {
+    const int bones = 25;
+    Animation animation;
+    buildTestAnimation(animation, "Idle", bones, 30);
+    AnimationBakeReport report = animation.bakePalettes(20.0f, 1u << 20);
+    ASSERT_EQ(report.clips.size(), 1u);
+    ASSERT_TRUE(report.clips[0].baked);
+    const BakedPalettes* baked = animation.findBakedPalettes(0);
+    ASSERT_NE(baked, nullptr);
+    EXPECT_EQ(report.totalBytes, baked->bytes());
+    EXPECT_EQ(baked->bytes(), sizeof(AffineMatrix) * bones * baked->sampleCount);
+
+    AffineMatrix live[bones], fetched[bones];
+    for (int k = 0; k < baked->sampleCount; k++) {
+        float t = k == baked->sampleCount - 1 ? animation.sequences[0].duration() : k / baked->sampleRate;
+        animation.evaluatePalette(0, t, live);
+        EXPECT_EQ(memcmp(live, baked->palette(k), sizeof(live)), 0) << "sample " << k;
+    }
+
+    // Halfway between two samples is the average of both palettes.
+    baked->fetch(2.5f / baked->sampleRate, fetched);
+    for (int b = 0; b < bones; b++) {
+        for (int i = 0; i < 12; i++) {
+            float expected = (baked->palette(2)[b].m[i] + baked->palette(3)[b].m[i]) * 0.5f;
+            EXPECT_NEAR(fetched[b].m[i], expected, 1e-4f);
+        }
+    }
+}
+
+TEST(AnimationBakeTest, BudgetLimitsBakedClips) {
+    const int bones = 10;
+    Animation animation;
+    buildTestAnimation(animation, "Idle", bones, 30, 1);
+    buildTestAnimation(animation, "Run", bones, 30, 2);
+    size_t oneClip = sizeof(AffineMatrix) * bones * 31;
+    AnimationBakeReport report = animation.bakePalettes(30.0f, oneClip);
+    ASSERT_EQ(report.clips.size(), 2u);
+    EXPECT_EQ(report.clips[0].name, "Idle");
+    EXPECT_TRUE(report.clips[0].baked);
+    EXPECT_EQ(report.clips[0].bytes, oneClip);
+    EXPECT_FALSE(report.clips[1].baked);
+    EXPECT_EQ(report.totalBytes, oneClip);
+    EXPECT_EQ(animation.findBakedPalettes(1), nullptr);
+
+    // Replacing a clip drops its stale bake.
+    buildTestAnimation(animation, "Idle", bones, 30, 3);
+    EXPECT_EQ(animation.findBakedPalettes(0), nullptr);
+}
+
+TEST(AnimationCompressionTest, SmallestThreeRoundTrip) {
+    srand(7);
+    auto r = []() { return (static_cast<float>(rand()) / RAND_MAX) * 2.0f - 1.0f; };
+    for (int i = 0; i < 1000; i++) {
+        Quaternion q = Quaternion(r(), r(), r(), r()).normalize();
+        uint16_t packed[3];
+        CompressedAnimationClip::encodeRotation(q, packed);
+        Quaternion decoded = CompressedAnimationClip::decodeRotation(packed);
+        EXPECT_LT(CompressedAnimationClip::rotationError(q, decoded), 2e-4f);
+    }
+}
+
+TEST(AnimationCompressionTest, MatchesUncompressedSamplerWithinTolerance) {
+    const int bones = 30, frames = 60;
+    Animation animation;
+    buildSmoothTestAnimation(animation, "Idle", bones, frames);
+    AnimationSequence original = animation.getSequence(0);
+    AnimationSequence& sequence = animation.getSequence(0);
+    AnimationCompressionSettings settings;
+    AnimationCompressionReport report = sequence.compress(settings);
+
+    ASSERT_TRUE(sequence.isCompressed());
+    EXPECT_EQ(sequence.positions, nullptr);
+    EXPECT_EQ(report.originalBytes, original.keyframeBytes());
+    EXPECT_EQ(report.compressedBytes, sequence.keyframeBytes());
+    EXPECT_LT(report.compressedBytes * 4, report.originalBytes);
+    // Positions, scales and the static bones' rotations are all constant.
+    EXPECT_GE(report.constantTracks, bones * 2 + bones / 3);
+    EXPECT_LT(report.compressedKeys, report.originalKeys);
+    EXPECT_LE(report.maxPositionError, settings.positionTolerance);
+    EXPECT_LE(report.maxScaleError, settings.scaleTolerance);
+    EXPECT_LE(report.maxRotationError, settings.rotationTolerance * 2.0f);
+
+    for (int frame = 0; frame < frames; frame++) {
+        for (int bone = 0; bone < bones; bone++) {
+            vec3 t0, s0, t1, s1;
+            Quaternion q0, q1;
+            original.sampleBone(frame, 0.25f, bone, t0, q0, s0);
+            sequence.sampleBone(frame, 0.25f, bone, t1, q1, s1);
+            EXPECT_LE((t1 - t0).getLength(), settings.positionTolerance);
+            EXPECT_LE(CompressedAnimationClip::rotationError(q0, q1), settings.rotationTolerance * 2.0f);
+        }
+    }
+
+    // Compressed clips still copy and evaluate.
+    AnimationSequence copy = sequence;
+    EXPECT_TRUE(copy.isCompressed());
+    EXPECT_EQ(copy.keyframeBytes(), sequence.keyframeBytes());
+}
+
+TEST(AnimationBlendTest, PosePathMatchesPalettePath) {
+    const int bones = 40;
+    Animation animation;
+    buildTestAnimation(animation, "Idle", bones, 30);
+    AnimationPose pose;
+    AffineMatrix direct[bones], viaPose[bones];
+    animation.evaluatePalette(0, 0.37f, direct);
+    animation.evaluatePose(0, 0.37f, pose);
+    animation.poseToPalette(pose, viaPose);
+    EXPECT_EQ(memcmp(direct, viaPose, sizeof(direct)), 0);
+}
+
+TEST(AnimationBlendTest, BlendEndpointsAndShortestArc) {
+    const int bones = 7;
+    Animation animation;
+    buildTestAnimation(animation, "Idle", bones, 30, 1);
+    buildTestAnimation(animation, "Run", bones, 30, 2);
+    AnimationPose a, b, out;
+    animation.evaluatePose(0, 0.2f, a);
+    animation.evaluatePose(1, 0.6f, b);
+    // A negated quaternion is the same rotation and must blend the same way.
+    b.rotations[3] = Quaternion(-b.rotations[3].q[0], -b.rotations[3].q[1], -b.rotations[3].q[2], -b.rotations[3].q[3]);
+    for (float weight : { 0.0f, 1.0f }) {
+        blendPoses(out, a, b, weight, bones);
+        const AnimationPose& expected = weight == 0.0f ? a : b;
+        for (int i = 0; i < bones; i++) {
+            EXPECT_LT(CompressedAnimationClip::rotationError(out.rotations[i], expected.rotations[i]), 1e-3f);
+            EXPECT_NEAR((out.translations[i] - expected.translations[i]).getLength(), 0.0f, 1e-6f);
+            EXPECT_NEAR((out.scales[i] - expected.scales[i]).getLength(), 0.0f, 1e-6f);
+        }
+    }
+    blendPoses(out, a, b, 0.5f, bones);
+    for (int i = 0; i < bones; i++) {
+        float half = CompressedAnimationClip::rotationError(a.rotations[i], b.rotations[i]) * 0.5f;
+        EXPECT_NEAR(CompressedAnimationClip::rotationError(out.rotations[i], a.rotations[i]), half, 1e-3f);
+    }
+}
+
+TEST(AnimationBlendTest, InstancesCarryNoScratchPoses) {
+    // The palette plus a few scalars; fade poses live per thread
+    EXPECT_LT(sizeof(AnimationInstance), sizeof(AffineMatrix) * MAX_ANIMATION_BONES + 256);
+}
+
+TEST(AnimationBlendTest, CrossFadeStartsFromOldClipAndEndsOnNewClip) {
+    const int bones = 20;
+    Animation animation;
+    buildSmoothTestAnimation(animation, "Idle", bones, 30, 1);
+    buildSmoothTestAnimation(animation, "Run", bones, 30, 2);
+    AnimationInstance fading, idle, run;
+    fading.animation = idle.animation = run.animation = &animation;
+    fading.update(0, 0.3f);
+    idle.update(0, 0.3f);
+
+    fading.crossFade(1, 0.5f);
+    ASSERT_TRUE(fading.isFading());
+    fading.update(1, 0.0001f);
+    idle.update(0, 0.0001f);
+    for (int b = 0; b < bones; b++) {
+        for (int k = 0; k < 12; k++) {
+            EXPECT_NEAR(fading.matrices[b].m[k], idle.matrices[b].m[k], 1e-2f);
+        }
+    }
+
+    run.update(1, 0.0f);
+    run.update(1, 0.0001f);
+    for (int frame = 0; frame < 10; frame++) {
+        fading.update(1, 0.06f);
+        run.update(1, 0.06f);
+    }
+    EXPECT_FALSE(fading.isFading());
+    EXPECT_EQ(fading.t, run.t);
+    EXPECT_EQ(memcmp(fading.matrices, run.matrices, sizeof(AffineMatrix) * bones), 0);
+}
+
+TEST(AnimationTest, ControllerFadeTimes) {
+    AnimationController controller;
+    controller.setDefaultFadeTime(0.2f);
+    controller.setFadeTime("Run", "attack", 0.05f);
+    controller.addState("Idle", 0, []() {});
+    controller.addState("Run", 1, []() {});
+    controller.addState("attack", 2, []() {});
+    controller.transitionTo("Run");
+    EXPECT_FLOAT_EQ(controller.getFadeTime(), 0.2f);
+    controller.transitionTo("attack");
+    EXPECT_FLOAT_EQ(controller.getFadeTime(), 0.05f);
+    controller.transitionTo("Idle");
+    EXPECT_FLOAT_EQ(controller.getFadeTime(), 0.2f);
+}
+
+static void expectSameGEM(const std::vector<GEMLoader::GEMMesh>& a, const std::vector<GEMLoader::GEMMesh>& b,
+    const GEMLoader::GEMAnimation& animA, const GEMLoader::GEMAnimation& animB) {
+    ASSERT_EQ(a.size(), b.size());
+    for (size_t i = 0; i < a.size(); i++) {
+        ASSERT_EQ(a[i].material.properties.size(), b[i].material.properties.size());
+        for (size_t p = 0; p < a[i].material.properties.size(); p++) {
+            EXPECT_EQ(a[i].material.properties[p].name, b[i].material.properties[p].name);
+            EXPECT_EQ(a[i].material.properties[p].value, b[i].material.properties[p].value);
+        }
+        ASSERT_EQ(a[i].verticesStatic.size(), b[i].verticesStatic.size());
+        ASSERT_EQ(a[i].verticesAnimated.size(), b[i].verticesAnimated.size());
+        EXPECT_EQ(memcmp(a[i].verticesStatic.data(), b[i].verticesStatic.data(), a[i].verticesStatic.size() * sizeof(GEMLoader::GEMStaticVertex)), 0);
+        EXPECT_EQ(memcmp(a[i].verticesAnimated.data(), b[i].verticesAnimated.data(), a[i].verticesAnimated.size() * sizeof(GEMLoader::GEMAnimatedVertex)), 0);
+        EXPECT_EQ(a[i].indices, b[i].indices);
+    }
+    ASSERT_EQ(animA.bones.size(), animB.bones.size());
+    for (size_t i = 0; i < animA.bones.size(); i++) {
+        EXPECT_EQ(animA.bones[i].name, animB.bones[i].name);
+        EXPECT_EQ(animA.bones[i].parentIndex, animB.bones[i].parentIndex);
+        EXPECT_EQ(memcmp(animA.bones[i].offset.m, animB.bones[i].offset.m, sizeof(animA.bones[i].offset.m)), 0);
+    }
+    ASSERT_EQ(animA.animations.size(), animB.animations.size());
+    for (size_t i = 0; i < animA.animations.size(); i++) {
+        const GEMLoader::GEMAnimationSequence& sa = animA.animations[i];
+        const GEMLoader::GEMAnimationSequence& sb = animB.animations[i];
+        EXPECT_EQ(sa.name, sb.name);
+        EXPECT_EQ(sa.ticksPerSecond, sb.ticksPerSecond);
+        ASSERT_EQ(sa.frames.size(), sb.frames.size());
+        for (size_t f = 0; f < sa.frames.size(); f++) {
+            ASSERT_EQ(sa.frames[f].rotations.size(), sb.frames[f].rotations.size());
+            EXPECT_EQ(memcmp(sa.frames[f].positions.data(), sb.frames[f].positions.data(), sa.frames[f].positions.size() * sizeof(GEMLoader::GEMVec3)), 0);
+            EXPECT_EQ(memcmp(sa.frames[f].rotations.data(), sb.frames[f].rotations.data(), sa.frames[f].rotations.size() * sizeof(GEMLoader::GEMQuaternion)), 0);
+            EXPECT_EQ(memcmp(sa.frames[f].scales.data(), sb.frames[f].scales.data(), sa.frames[f].scales.size() * sizeof(GEMLoader::GEMVec3)), 0);
+        }
+    }
+}
+
+TEST(GEMLoaderTest, MappedLoaderMatchesStreamLoader) {
+    for (const char* name : { "TRex.gem", "acacia_003.gem", "Pine/pine.gem" }) {
+        std::string path = findResource(name);
+        if (path.empty()) {
+            std::cout << name << " not found, skipping" << std::endl;
+            continue;
+        }
+        GEMLoader::GEMModelLoader loader;
+        std::vector<GEMLoader::GEMMesh> streamMeshes, mappedMeshes;
+        GEMLoader::GEMAnimation streamAnimation, mappedAnimation;
+        ASSERT_TRUE(loader.loadMapped(path, mappedMeshes, mappedAnimation)) << path;
+        if (mappedMeshes.empty() || mappedMeshes[0].isAnimated()) {
+            loader.load(path, streamMeshes, streamAnimation);
+        }
+        else {
+            // The stream loader reads a skeleton past the end of static files.
+            loader.load(path, streamMeshes);
+            EXPECT_TRUE(mappedAnimation.bones.empty());
+            EXPECT_TRUE(mappedAnimation.animations.empty());
+        }
+        expectSameGEM(streamMeshes, mappedMeshes, streamAnimation, mappedAnimation);
+    }
+}
+
+TEST(GEMLoaderTest, MappedLoaderRejectsTruncatedFiles) {
+    std::string path = findResource("TRex.gem");
+    if (path.empty()) {
+        std::cout << "TRex.gem not found, skipping" << std::endl;
+        return;
+    }
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const char* truncatedPath = "truncated_test.gem";
+    for (size_t length : { bytes.size() / 2, static_cast<size_t>(10), bytes.size() - 1 }) {
+        {
+            std::ofstream out(truncatedPath, std::ios::binary);
+            out.write(bytes.data(), length);
+        }
+        GEMLoader::GEMModelLoader loader;
+        std::vector<GEMLoader::GEMMesh> meshes;
+        GEMLoader::GEMAnimation animation;
+        EXPECT_FALSE(loader.loadMapped(truncatedPath, meshes, animation)) << length;
+    }
+    std::remove(truncatedPath);
+
+    // A vertex count far beyond the data fails without allocating for it.
+    const unsigned int header[] = { 4058972161u, 0u, 1u, 0u, 0xFFFFFFFFu };
+    GEMLoader::GEMSpanReader reader(reinterpret_cast<const unsigned char*>(header), sizeof(header));
+    std::vector<GEMLoader::GEMStaticVertex> vertices;
+    reader.read<unsigned int>();
+    reader.read<unsigned int>();
+    reader.read<unsigned int>();
+    reader.read<unsigned int>();
+    EXPECT_FALSE(reader.readVector(vertices, reader.read<unsigned int>()));
+    EXPECT_TRUE(vertices.empty());
+}
+
+TEST(GEMLoaderTest, MappedLoaderRejectsIndicesPastVertices) {
+    // One static mesh, no properties, three vertices, one triangle.
+    const char* corruptPath = "corrupt_index_test.gem";
+    for (unsigned int lastIndex : { 2u, 3u, 0xFFFFFFFFu }) {
+        {
+            std::ofstream out(corruptPath, std::ios::binary);
+            const unsigned int header[] = { 4058972161u, 0u, 1u, 0u, 3u };
+            out.write(reinterpret_cast<const char*>(header), sizeof(header));
+            GEMLoader::GEMStaticVertex vertices[3] = {};
+            out.write(reinterpret_cast<const char*>(vertices), sizeof(vertices));
+            const unsigned int indices[] = { 3u, 0u, 1u, lastIndex };
+            out.write(reinterpret_cast<const char*>(indices), sizeof(indices));
+        }
+        GEMLoader::GEMModelLoader loader;
+        std::vector<GEMLoader::GEMMesh> meshes;
+        EXPECT_EQ(loader.loadMapped(corruptPath, meshes), lastIndex < 3u) << lastIndex;
+    }
+    std::remove(corruptPath);
+}
+
+static void buildAnimation(const GEMLoader::GEMAnimation& gemanimation, Animation& animation) {
+    buildSkeleton(gemanimation, animation.skeleton);
+    for (const auto& gemsequence : gemanimation.animations) {
+        AnimationSequence aseq;
+        buildAnimationSequence(gemsequence, aseq);
+        animation.addSequence(gemsequence.name, std::move(aseq));
+    }
+}
+
+static void writeFile(const char* path, const std::vector<char>& bytes) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), bytes.size());
+}
+
+TEST(IndexDataTest, NarrowsWhenVerticesFit) {
+    std::vector<unsigned int> indices = { 0, 1, 2, 65535, 2, 1 };
+    IndexData compact(indices, 65536);
+    EXPECT_EQ(compact.stride(), 2u);
+    EXPECT_EQ(compact.bytes(), indices.size() * 2);
+    IndexData wide(indices, 65537);
+    EXPECT_EQ(wide.stride(), 4u);
+    EXPECT_EQ(wide.bytes(), indices.size() * 4);
+    for (size_t i = 0; i < indices.size(); i++) {
+        EXPECT_EQ(compact[i], indices[i]);
+        EXPECT_EQ(wide[i], indices[i]);
+    }
+
+    IndexMemoryReport report;
+    report.add(compact.count(), compact.stride());
+    report.add(wide.count(), wide.stride());
+    EXPECT_EQ(report.compactBuffers, 1u);
+    EXPECT_EQ(report.bytes, 36u);
+    EXPECT_EQ(report.savedBytes(), 12u);
+}
+
+TEST(ModelCacheTest, MatchesGEMModel) {
+    const char* cachePath = "modelcache_test.gemc";
+    for (const char* name : { "TRex.gem", "acacia_003.gem" }) {
+        std::string path = findResource(name);
+        if (path.empty()) {
+            std::cout << name << " not found, skipping" << std::endl;
+            continue;
+        }
+        GEMLoader::GEMModelLoader loader;
+        std::vector<GEMLoader::GEMMesh> meshes;
+        GEMLoader::GEMAnimation gemanimation;
+        ASSERT_TRUE(loader.loadMapped(path, meshes, gemanimation));
+        Animation animation;
+        buildAnimation(gemanimation, animation);
+        bool animated = !animation.sequences.empty();
+        ASSERT_TRUE(ModelCache::write(path, cachePath, meshes, animated ? &animation : nullptr));
+
+        ModelCache cache;
+        ASSERT_TRUE(cache.open(path, cachePath));
+        EXPECT_EQ(cache.hasAnimation(), animated);
+        ASSERT_EQ(cache.getMeshCount(), static_cast<int>(meshes.size()));
+        for (size_t i = 0; i < meshes.size(); i++) {
+            ModelCache::MeshView view = cache.getMesh(static_cast<int>(i));
+            const void* vertices = animated ? static_cast<const void*>(meshes[i].verticesAnimated.data()) : meshes[i].verticesStatic.data();
+            size_t vertexCount = animated ? meshes[i].verticesAnimated.size() : meshes[i].verticesStatic.size();
+            ASSERT_EQ(view.vertexCount, vertexCount);
+            EXPECT_EQ(memcmp(view.vertices, vertices, vertexCount * view.vertexStride), 0);
+            ASSERT_EQ(view.indexCount, meshes[i].indices.size());
+            // Meshes under 65536 vertices are stored with 16-bit indices.
+            EXPECT_EQ(view.indexStride, IndexData::strideFor(vertexCount));
+            IndexData expected(meshes[i].indices, vertexCount);
+            EXPECT_EQ(memcmp(view.indices, expected.data(), expected.bytes()), 0);
+            EXPECT_EQ(reinterpret_cast<uintptr_t>(view.vertices) % 16, 0u);
+            EXPECT_EQ(view.texture, meshes[i].material.find("diffuse").getValue());
+            const float* first = reinterpret_cast<const float*>(vertices);
+            EXPECT_LE(view.boundsMin.x, first[0]);
+            EXPECT_GE(view.boundsMax.y, first[1]);
+        }
+
+        Animation loaded;
+        if (animated) {
+            cache.loadAnimation(loaded);
+        }
+        ASSERT_EQ(loaded.skeleton.bones.size(), animation.skeleton.bones.size());
+        for (size_t i = 0; i < animation.skeleton.bones.size(); i++) {
+            EXPECT_EQ(loaded.skeleton.bones[i].name, animation.skeleton.bones[i].name);
+            EXPECT_EQ(loaded.skeleton.bones[i].parentIndex, animation.skeleton.bones[i].parentIndex);
+            EXPECT_EQ(memcmp(&loaded.skeleton.bones[i].offset, &animation.skeleton.bones[i].offset, sizeof(Matrix)), 0);
+        }
+        ASSERT_EQ(loaded.sequences.size(), animation.sequences.size());
+        for (auto& named : animation.sequenceNames) {
+            ASSERT_EQ(loaded.findSequence(named.first), named.second);
+            const AnimationSequence& a = animation.sequences[named.second];
+            const AnimationSequence& b = loaded.sequences[named.second];
+            EXPECT_EQ(a.ticksPerSecond, b.ticksPerSecond);
+            ASSERT_EQ(a.getFrameCount(), b.getFrameCount());
+            ASSERT_EQ(a.getBoneCount(), b.getBoneCount());
+            EXPECT_EQ(memcmp(a.keyBlock(), b.keyBlock(), AnimationSequence::keyBlockBytes(a.getFrameCount(), a.getBoneCount())), 0);
+        }
+    }
+    std::remove(cachePath);
+}
+
+TEST(ModelCacheTest, RejectsStaleAndCorruptCaches) {
+    std::string path = findResource("acacia_003.gem");
+    if (path.empty()) {
+        std::cout << "acacia_003.gem not found, skipping" << std::endl;
+        return;
+    }
+    std::ifstream in(path, std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    const char* sourcePath = "modelcache_source.gem";
+    const char* cachePath = "modelcache_source.gemc";
+    writeFile(sourcePath, bytes);
+
+    GEMLoader::GEMModelLoader loader;
+    std::vector<GEMLoader::GEMMesh> meshes;
+    ASSERT_TRUE(loader.loadMapped(sourcePath, meshes));
+    ASSERT_TRUE(ModelCache::write(sourcePath, meshes, nullptr));
+    ModelCache cache;
+    EXPECT_TRUE(cache.open(sourcePath));
+    EXPECT_FALSE(cache.open("missing_source.gem", cachePath));
+
+    // Edited source.
+    std::vector<char> edited = bytes;
+    edited.push_back(0);
+    writeFile(sourcePath, edited);
+    EXPECT_FALSE(cache.open(sourcePath));
+
+    // Same contents rewritten: accepted by time or, if that moved, by hash.
+    writeFile(sourcePath, bytes);
+    EXPECT_TRUE(cache.open(sourcePath));
+    cache.close();
+
+    std::ifstream cacheIn(cachePath, std::ios::binary);
+    std::vector<char> cacheBytes((std::istreambuf_iterator<char>(cacheIn)), std::istreambuf_iterator<char>());
+    cacheIn.close();
+    writeFile(cachePath, std::vector<char>(cacheBytes.begin(), cacheBytes.end() - 1));
+    EXPECT_FALSE(cache.open(sourcePath));
+    std::vector<char> badMagic = cacheBytes;
+    badMagic[0] = 'X';
+    writeFile(cachePath, badMagic);
+    EXPECT_FALSE(cache.open(sourcePath));
+
+    std::remove(sourcePath);
+    std::remove(cachePath);
+}
+
+TEST(ModelCacheTest, StoresLODChains) {
+    std::string path = findResource("acacia_003.gem");
+    if (path.empty()) {
+        std::cout << "acacia_003.gem not found, skipping" << std::endl;
+        return;
+    }
+    const char* cachePath = "modelcache_lod.gemc";
+    GEMLoader::GEMModelLoader loader;
+    std::vector<GEMLoader::GEMMesh> meshes;
+    ASSERT_TRUE(loader.loadMapped(path, meshes));
+    std::vector<float> ratios = { 0.5f, 0.25f };
+    std::vector<std::vector<MeshSimplifier::LOD>> lods;
+    for (auto& mesh : meshes) {
+        MeshOptimizer::weldVertices(mesh.verticesStatic, mesh.indices);
+        lods.push_back(MeshSimplifier::buildLODChain(mesh.verticesStatic, mesh.indices, ratios));
+    }
+    ASSERT_TRUE(ModelCache::write(path, cachePath, meshes, nullptr, ratios, lods));
+
+    ModelCache cache;
+    ASSERT_TRUE(cache.open(path, cachePath));
+    EXPECT_EQ(cache.getLODRatios(), ratios);
+    for (size_t i = 0; i < meshes.size(); i++) {
+        ModelCache::MeshView view = cache.getMesh(static_cast<int>(i));
+        ASSERT_EQ(view.lods.size(), lods[i].size());
+        for (size_t l = 0; l < lods[i].size(); l++) {
+            ASSERT_EQ(view.lods[l].indexCount, lods[i][l].indices.size());
+            EXPECT_EQ(view.lods[l].error, lods[i][l].error);
+            IndexData expected(lods[i][l].indices, view.vertexCount);
+            EXPECT_EQ(memcmp(view.lods[l].indices, expected.data(), expected.bytes()), 0);
+        }
+    }
+    cache.close();
+    std::remove(cachePath);
+}
+
+static void expectSameKeys(AnimationSequence& a, AnimationSequence& b) {
+    EXPECT_EQ(a.ticksPerSecond, b.ticksPerSecond);
+    ASSERT_EQ(a.getFrameCount(), b.getFrameCount());
+    ASSERT_EQ(a.getBoneCount(), b.getBoneCount());
+    EXPECT_EQ(memcmp(a.keyBlock(), b.keyBlock(), AnimationSequence::keyBlockBytes(a.getFrameCount(), a.getBoneCount())), 0);
+}
+
+TEST(LazyAnimationTest, ClipsLoadOnFirstUseAndMatchEager) {
+    std::string path = findResource("TRex.gem");
+    if (path.empty()) {
+        std::cout << "TRex.gem not found, skipping" << std::endl;
+        return;
+    }
+    GEMLoader::GEMModelLoader loader;
+    std::vector<GEMLoader::GEMMesh> meshes;
+    GEMLoader::GEMAnimation gemanimation;
+    ASSERT_TRUE(loader.loadMapped(path, meshes, gemanimation));
+    Animation eager;
+    buildAnimation(gemanimation, eager);
+    const char* cachePath = "lazyclips_test.gemc";
+    ASSERT_TRUE(ModelCache::write(path, cachePath, meshes, &eager));
+
+    std::vector<GEMLoader::GEMMesh> lazyMeshes;
+    GEMLoader::GEMAnimation lazyGEM;
+    ASSERT_TRUE(loader.loadMappedLazy(path, lazyMeshes, lazyGEM));
+    EXPECT_TRUE(lazyGEM.animations.empty());
+    ASSERT_EQ(lazyGEM.clips.size(), gemanimation.animations.size());
+    expectSameGEM(meshes, lazyMeshes, GEMLoader::GEMAnimation(), GEMLoader::GEMAnimation());
+
+    std::shared_ptr<GEMClipSource> gemClips = std::make_shared<GEMClipSource>();
+    ASSERT_TRUE(gemClips->open(path, lazyGEM));
+    std::shared_ptr<CachedClipSource> cachedClips = std::make_shared<CachedClipSource>();
+    ASSERT_TRUE(cachedClips->open(path, cachePath));
+    for (std::shared_ptr<AnimationClipSource> source : { std::shared_ptr<AnimationClipSource>(gemClips), std::shared_ptr<AnimationClipSource>(cachedClips) }) {
+        Animation lazy;
+        lazy.skeleton = eager.skeleton;
+        lazy.setClipSource(source);
+        ASSERT_EQ(lazy.sequences.size(), eager.sequences.size());
+        EXPECT_EQ(lazy.residentKeyBytes(), 0u);
+        for (auto& named : eager.sequenceNames) {
+            AnimationHandle handle = lazy.findSequence(named.first);
+            ASSERT_EQ(handle, named.second);
+            EXPECT_FALSE(lazy.isSequenceLoaded(handle));
+            expectSameKeys(eager.getSequence(handle), lazy.getSequence(handle));
+            EXPECT_TRUE(lazy.isSequenceLoaded(handle));
+        }
+        EXPECT_EQ(lazy.residentKeyBytes(), eager.residentKeyBytes());
+    }
+    std::remove(cachePath);
+}
+
+TEST(LazyAnimationTest, EvictsIdleClipsAndReloadsThem) {
+    std::string path = findResource("TRex.gem");
+    if (path.empty()) {
+        std::cout << "TRex.gem not found, skipping" << std::endl;
+        return;
+    }
+    GEMLoader::GEMModelLoader loader;
+    std::vector<GEMLoader::GEMMesh> meshes;
+    GEMLoader::GEMAnimation gemanimation;
+    ASSERT_TRUE(loader.loadMappedLazy(path, meshes, gemanimation));
+    std::shared_ptr<GEMClipSource> clips = std::make_shared<GEMClipSource>();
+    ASSERT_TRUE(clips->open(path, gemanimation));
+    Animation animation;
+    buildSkeleton(gemanimation, animation.skeleton);
+    animation.setClipSource(clips);
+    ASSERT_GE(animation.sequences.size(), 2u);
+
+    // Jobs ask for the same clips at once; each clip is decoded under the load
+    // lock and every job sees the same keys.
+    JobSystem jobs(3);
+    std::vector<std::vector<AffineMatrix>> palettes(16, std::vector<AffineMatrix>(animation.skeleton.bones.size()));
+    jobs.parallelFor(palettes.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            animation.evaluatePalette(static_cast<AnimationHandle>(i % animation.sequences.size()), 0.1f, palettes[i].data());
+        }
+    });
+    size_t resident = animation.residentKeyBytes();
+    for (size_t i = animation.sequences.size(); i < palettes.size(); i++) {
+        EXPECT_EQ(memcmp(palettes[i].data(), palettes[i % animation.sequences.size()].data(), palettes[i].size() * sizeof(AffineMatrix)), 0);
+    }
+
+    // Keep clip 0 in use; the rest go idle and are evicted.
+    for (int frame = 0; frame < 10; frame++) {
+        animation.beginFrame();
+        animation.getSequence(0);
+    }
+    EXPECT_EQ(animation.evictUnusedSequences(20), 0);
+    EXPECT_EQ(animation.evictUnusedSequences(5), static_cast<int>(animation.sequences.size()) - 1);
+    EXPECT_TRUE(animation.isSequenceLoaded(0));
+    EXPECT_FALSE(animation.isSequenceLoaded(1));
+    EXPECT_LT(animation.residentKeyBytes(), resident);
+
+    std::vector<AffineMatrix> reloaded(animation.skeleton.bones.size());
+    animation.evaluatePalette(1, 0.1f, reloaded.data());
+    EXPECT_TRUE(animation.isSequenceLoaded(1));
+    EXPECT_EQ(memcmp(reloaded.data(), palettes[1].data(), reloaded.size() * sizeof(AffineMatrix)), 0);
+}
+
+// Serves the clips of an in-memory animation as a clip source.
+class TestClipSource : public AnimationClipSource {
+public:
+    Animation clips;
+    int loads = 0;
+    std::set<int> failing;      // Clips whose load fails after writing part of the sequence
+
+    int getClipCount() const override { return static_cast<int>(clips.sequences.size()); }
+    std::string getClipName(int clip) const override {
+        for (auto& entry : clips.sequenceNames) {
+            if (entry.second == clip) return entry.first;
+        }
+        return "";
+    }
+    bool loadClip(int clip, AnimationSequence& sequence) override {
+        loads++;
+        sequence = clips.sequences[clip];
+        return failing.count(clip) == 0;
+    }
+};
+
+TEST(LazyAnimationTest, FailedClipLoadsLeaveThePaletteUnchanged) {
+    const int bones = 8;
+    std::shared_ptr<TestClipSource> source = std::make_shared<TestClipSource>();
+    buildTestAnimation(source->clips, "Idle", bones, 10, 1);
+    buildTestAnimation(source->clips, "Run", bones, 10, 2);
+    source->failing.insert(1);
+    Animation animation;
+    animation.skeleton = source->clips.skeleton;
+    animation.setClipSource(source);
+    AnimationHandle run = animation.findSequence("Run");
+
+    std::vector<AffineMatrix> palette(bones);
+    for (int i = 0; i < bones; i++) {
+        palette[i].a[0][3] = static_cast<float>(i);
+    }
+    std::vector<AffineMatrix> before = palette;
+    animation.evaluatePalette(run, 0.1f, palette.data());
+    EXPECT_EQ(memcmp(palette.data(), before.data(), palette.size() * sizeof(AffineMatrix)), 0);
+    EXPECT_FALSE(animation.isSequenceLoaded(run));
+    EXPECT_TRUE(animation.hasSequenceFailed(run));
+    EXPECT_EQ(animation.getSequence(run).getFrameCount(), 0);
+    EXPECT_EQ(source->loads, 1);
+
+    // Not retried on later use, and the pose path is left alone too
+    AnimationPose pose;
+    pose.translations[0] = vec3(1.0f, 2.0f, 3.0f);
+    animation.evaluatePose(run, 0.2f, pose);
+    EXPECT_EQ(pose.translations[0].x, 1.0f);
+    EXPECT_EQ(source->loads, 1);
+
+    // Playing it through an instance does not crash and keeps the last palette
+    AnimationInstance instance;
+    instance.animation = &animation;
+    AnimationHandle idle = animation.findSequence("Idle");
+    instance.update(idle, 0.1f);
+    std::vector<AffineMatrix> idlePalette(instance.matrices, instance.matrices + bones);
+    instance.update(run, 0.1f);
+    EXPECT_EQ(memcmp(instance.matrices, idlePalette.data(), bones * sizeof(AffineMatrix)), 0);
+    EXPECT_TRUE(animation.isSequenceLoaded(idle));
+    EXPECT_FALSE(animation.hasSequenceFailed(idle));
+}
+
+TEST(LazyAnimationTest, ClipsAddedAfterTheSourceStayResident) {
+    const int bones = 8;
+    std::shared_ptr<TestClipSource> source = std::make_shared<TestClipSource>();
+    buildTestAnimation(source->clips, "Idle", bones, 10, 1);
+    buildTestAnimation(source->clips, "Run", bones, 10, 2);
+    Animation animation;
+    animation.skeleton = source->clips.skeleton;
+    animation.setClipSource(source);
+
+    // Added after the source: past the end of the lazy bookkeeping
+    buildTestAnimation(animation, "Attack", bones, 12, 3);
+    AnimationHandle attack = animation.findSequence("Attack");
+    ASSERT_EQ(attack, 2);
+    EXPECT_TRUE(animation.isSequenceLoaded(attack));
+    EXPECT_EQ(animation.getSequence(attack).getFrameCount(), 12);
+
+    // Replacing a source clip keeps the replacement rather than reloading
+    buildTestAnimation(animation, "Run", bones, 14, 4);
+    AnimationHandle run = animation.findSequence("Run");
+    EXPECT_TRUE(animation.isSequenceLoaded(run));
+    EXPECT_EQ(animation.getSequence(run).getFrameCount(), 14);
+
+    EXPECT_EQ(animation.getSequence(animation.findSequence("Idle")).getFrameCount(), 10);
+    EXPECT_EQ(source->loads, 1);
+    for (int frame = 0; frame < 10; frame++) {
+        animation.beginFrame();
+    }
+    EXPECT_EQ(animation.evictUnusedSequences(5), 1);
+    EXPECT_TRUE(animation.isSequenceLoaded(attack));
+    EXPECT_TRUE(animation.isSequenceLoaded(run));
+}
+
+// Grid of quads with its triangles in a shuffled order, as some exporters write them.
+static void buildShuffledGrid(int size, std::vector<TestVertex>& vertices, std::vector<unsigned int>& indices) {
+    vertices.clear();
+    indices.clear();
+    for (int y = 0; y <= size; y++) {
+        for (int x = 0; x <= size; x++) {
+            TestVertex v = {};
+            v.pos = vec3(static_cast<float>(x), static_cast<float>(y), 0.05f * ((x * 7 + y * 3) % 5));
+            vertices.push_back(v);
+        }
+    }
+    std::vector<std::array<unsigned int, 3>> triangles;
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            unsigned int a = y * (size + 1) + x, b = a + 1, c = a + size + 1, d = c + 1;
+            triangles.push_back({ { a, b, c } });
+            triangles.push_back({ { b, d, c } });
+        }
+    }
+    std::mt19937 rng(5);
+    std::shuffle(triangles.begin(), triangles.end(), rng);
+    for (auto& t : triangles) {
+        indices.insert(indices.end(), t.begin(), t.end());
+    }
+}
+
+// Triangles as sorted position triples, starting at the smallest corner so
+// winding is kept; equal for meshes that draw the same triangles.
+static std::vector<std::array<float, 9>> canonicalTriangles(const std::vector<TestVertex>& vertices, const std::vector<unsigned int>& indices) {
+    std::vector<std::array<float, 9>> result;
+    for (size_t t = 0; t < indices.size(); t += 3) {
+        std::array<std::array<float, 3>, 3> corners;
+        for (int k = 0; k < 3; k++) {
+            const vec3& p = vertices[indices[t + k]].pos;
+            corners[k] = { { p.x, p.y, p.z } };
+        }
+        int first = static_cast<int>(std::min_element(corners.begin(), corners.end()) - corners.begin());
+        std::array<float, 9> tri;
+        for (int k = 0; k < 3; k++) {
+            for (int c = 0; c < 3; c++) {
+                tri[k * 3 + c] = corners[(first + k) % 3][c];
+            }
+        }
+        result.push_back(tri);
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+TEST(MeshOptimizerTest, VertexCacheOrderLowersACMR) {
+    std::vector<TestVertex> vertices;
+    std::vector<unsigned int> indices;
+    buildShuffledGrid(32, vertices, indices);
+    std::vector<unsigned int> original = indices;
+    MeshOptimizer::VertexCacheStats before = MeshOptimizer::analyzeVertexCache(indices.data(), indices.size(), vertices.size());
+    MeshOptimizer::optimizeVertexCache(indices, vertices.size());
+    MeshOptimizer::VertexCacheStats after = MeshOptimizer::analyzeVertexCache(indices.data(), indices.size(), vertices.size());
+    EXPECT_GT(before.acmr, 2.0f);
+    EXPECT_LT(after.acmr, 0.8f);
+    EXPECT_LT(after.atvr, 1.5f);
+    EXPECT_EQ(canonicalTriangles(vertices, original), canonicalTriangles(vertices, indices));
+}
+
+TEST(MeshOptimizerTest, WeldMergesIdenticalVertices) {
+    std::vector<TestVertex> vertices;
+    std::vector<unsigned int> indices;
+    buildShuffledGrid(8, vertices, indices);
+    size_t indexedCount = vertices.size();
+    // Unindexed copy: every triangle has its own three vertices.
+    std::vector<TestVertex> flat;
+    std::vector<unsigned int> flatIndices;
+    for (unsigned int index : indices) {
+        flatIndices.push_back(static_cast<unsigned int>(flat.size()));
+        flat.push_back(vertices[index]);
+    }
+    std::vector<TestVertex> originalFlat = flat;
+    std::vector<unsigned int> originalIndices = flatIndices;
+    EXPECT_EQ(MeshOptimizer::weldVertices(flat, flatIndices), indexedCount);
+    EXPECT_EQ(canonicalTriangles(originalFlat, originalIndices), canonicalTriangles(flat, flatIndices));
+}
+
+TEST(MeshOptimizerTest, OverdrawAndFetchKeepTriangles) {
+    std::vector<TestVertex> vertices;
+    std::vector<unsigned int> indices;
+    buildShuffledGrid(24, vertices, indices);
+    // An unreferenced vertex, which the fetch pass drops.
+    vertices.push_back(vertices[0]);
+    std::vector<TestVertex> originalVertices = vertices;
+    std::vector<unsigned int> originalIndices = indices;
+
+    MeshOptimizer::optimizeVertexCache(indices, vertices.size());
+    float cacheACMR = MeshOptimizer::analyzeVertexCache(indices.data(), indices.size(), vertices.size()).acmr;
+    MeshOptimizer::optimizeOverdraw(indices, &vertices[0].pos.x, vertices.size(), sizeof(TestVertex), 1.05f);
+    float overdrawACMR = MeshOptimizer::analyzeVertexCache(indices.data(), indices.size(), vertices.size()).acmr;
+    EXPECT_LE(overdrawACMR, cacheACMR * 1.15f);
+
+    size_t count = MeshOptimizer::optimizeVertexFetch(vertices, indices);
+    EXPECT_EQ(count, originalVertices.size() - 1);
+    // First use order: indices never jump past the next new vertex.
+    unsigned int next = 0;
+    for (unsigned int index : indices) {
+        ASSERT_LE(index, next);
+        if (index == next) next++;
+    }
+    EXPECT_EQ(canonicalTriangles(originalVertices, originalIndices), canonicalTriangles(vertices, indices));
+}
+
+// Flat size x size grid in the XY plane, one vertex per grid point.
+static void buildFlatGrid(int size, std::vector<TestVertex>& vertices, std::vector<unsigned int>& indices) {
+    vertices.clear();
+    indices.clear();
+    for (int y = 0; y <= size; y++) {
+        for (int x = 0; x <= size; x++) {
+            TestVertex v = {};
+            v.pos = vec3(static_cast<float>(x), static_cast<float>(y), 0.0f);
+            v.tu = static_cast<float>(x) / size;
+            v.tv = static_cast<float>(y) / size;
+            vertices.push_back(v);
+        }
+    }
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            unsigned int a = y * (size + 1) + x, b = a + 1, c = a + size + 1, d = c + 1;
+            indices.insert(indices.end(), { a, b, c, b, d, c });
+        }
+    }
+}
+
+static float meshArea(const std::vector<TestVertex>& vertices, const std::vector<unsigned int>& indices) {
+    float area = 0.0f;
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        vec3 e1 = vertices[indices[i + 1]].pos - vertices[indices[i]].pos;
+        vec3 e2 = vertices[indices[i + 2]].pos - vertices[indices[i]].pos;
+        area += e1.cross(e2).getLength() * 0.5f;
+    }
+    return area;
+}
+
+TEST(MeshSimplifierTest, FlatGridKeepsOutline) {
+    std::vector<TestVertex> vertices;
+    std::vector<unsigned int> indices;
+    buildFlatGrid(16, vertices, indices);
+    MeshSimplifier::Settings settings;
+    settings.targetRatio = 0.1f;
+    std::vector<unsigned int> simplified = indices;
+    float error = MeshSimplifier::simplify(simplified, &vertices[0].pos.x, sizeof(TestVertex), vertices.size(), settings);
+    EXPECT_LE(simplified.size(), indices.size() / 10 + 6);
+    EXPECT_LT(error, 1e-3f);
+    // Borders only slide along themselves, so the covered area is unchanged.
+    EXPECT_NEAR(meshArea(vertices, simplified), 256.0f, 1e-2f);
+}
+
+TEST(MeshSimplifierTest, SeamsCollapseWithoutTearing) {
+    std::vector<TestVertex> vertices;
+    std::vector<unsigned int> indices;
+    buildFlatGrid(16, vertices, indices);
+    // Split the grid along x = 8 into two UV islands sharing positions.
+    const unsigned int firstDuplicate = static_cast<unsigned int>(vertices.size());
+    for (int y = 0; y <= 16; y++) {
+        unsigned int original = y * 17 + 8;
+        TestVertex copy = vertices[original];
+        copy.tu += 1.0f;
+        unsigned int duplicate = static_cast<unsigned int>(vertices.size());
+        vertices.push_back(copy);
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            float cx = (vertices[indices[i]].pos.x + vertices[indices[i + 1]].pos.x + vertices[indices[i + 2]].pos.x) / 3.0f;
+            for (int k = 0; k < 3; k++) {
+                if (indices[i + k] == original && cx > 8.0f) indices[i + k] = duplicate;
+            }
+        }
+    }
+    std::vector<MeshSimplifier::VertexAttributes> attributes = MeshSimplifier::Detail::gatherAttributes(vertices);
+    MeshSimplifier::Settings settings;
+    settings.targetRatio = 0.1f;
+    MeshSimplifier::simplify(indices, &vertices[0].pos.x, sizeof(TestVertex), vertices.size(), settings, nullptr, attributes.data());
+    // The seam shortens along itself instead of holding the mesh back.
+    EXPECT_LE(indices.size(), static_cast<size_t>(16 * 16 * 6 / 5));
+    // No triangle spans both islands, and both end on the same seam positions.
+    std::set<float> leftSeam, rightSeam;
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        bool left = false, right = false;
+        for (int k = 0; k < 3; k++) {
+            const TestVertex& v = vertices[indices[i + k]];
+            bool onRight = v.pos.x > 8.0f || indices[i + k] >= firstDuplicate;
+            left = left || !onRight;
+            right = right || onRight;
+        }
+        EXPECT_FALSE(left && right);
+        for (int k = 0; k < 3; k++) {
+            const TestVertex& v = vertices[indices[i + k]];
+            if (v.pos.x == 8.0f) (right ? rightSeam : leftSeam).insert(v.pos.y);
+        }
+    }
+    EXPECT_EQ(leftSeam, rightSeam);
+    EXPECT_NEAR(meshArea(vertices, indices), 256.0f, 1e-2f);
+}
+
+TEST(MeshSimplifierTest, SkinnedCollapsesKeepBoneRegions) {
+    std::vector<TestVertex> vertices;
+    std::vector<unsigned int> indices;
+    buildFlatGrid(16, vertices, indices);
+    // Left half on bone 0, right half on bone 1, the middle column shared.
+    std::vector<MeshSimplifier::SkinInfluence> skin(vertices.size());
+    for (size_t v = 0; v < vertices.size(); v++) {
+        float x = vertices[v].pos.x;
+        float w1 = x < 8.0f ? 0.0f : (x > 8.0f ? 1.0f : 0.5f);
+        skin[v] = { { 0, 1, 2, 3 }, { 1.0f - w1, w1, 0.0f, 0.0f } };
+    }
+    MeshSimplifier::Settings settings;
+    settings.targetRatio = 0.1f;
+    MeshSimplifier::simplify(indices, &vertices[0].pos.x, sizeof(TestVertex), vertices.size(), settings, skin.data());
+    EXPECT_LT(indices.size(), static_cast<size_t>(16 * 16 * 6 / 2));
+    std::vector<unsigned char> referenced(vertices.size(), 0);
+    for (size_t i = 0; i < indices.size(); i += 3) {
+        bool left = false, right = false;
+        for (int k = 0; k < 3; k++) {
+            referenced[indices[i + k]] = 1;
+            left = left || skin[indices[i + k]].weights[0] == 1.0f;
+            right = right || skin[indices[i + k]].weights[1] == 1.0f;
+        }
+        EXPECT_FALSE(left && right);
+    }
+    // The shared column may shorten along itself, but both ends stay.
+    EXPECT_TRUE(referenced[8]);
+    EXPECT_TRUE(referenced[16 * 17 + 8]);
+}
+
+// Largest distance from a vertex of original to any triangle of simplified.
+static float measuredDeviation(const std::vector<TestVertex>& vertices, const std::vector<unsigned int>& original, const std::vector<unsigned int>& simplified) {
+    float worst = 0.0f;
+    for (unsigned int v : original) {
+        float best = FLT_MAX;
+        for (size_t i = 0; i < simplified.size(); i += 3) {
+            float d = MeshSimplifier::Detail::pointTriangleDistanceSquared(&vertices[v].pos.x, &vertices[simplified[i]].pos.x,
+                &vertices[simplified[i + 1]].pos.x, &vertices[simplified[i + 2]].pos.x);
+            best = d < best ? d : best;
+        }
+        worst = best > worst ? best : worst;
+    }
+    return sqrtf(worst);
+}
+
+TEST(MeshSimplifierTest, ReportedErrorMatchesMeasuredDeviation) {
+    std::vector<TestVertex> vertices;
+    std::vector<unsigned int> indices;
+    buildFlatGrid(24, vertices, indices);
+    for (TestVertex& v : vertices) {
+        v.pos.z = 2.0f * sinf(v.pos.x * 0.4f) * cosf(v.pos.y * 0.3f);
+    }
+    for (float ratio : { 0.5f, 0.25f, 0.1f }) {
+        MeshSimplifier::Settings settings;
+        settings.targetRatio = ratio;
+        std::vector<unsigned int> simplified = indices;
+        float error = MeshSimplifier::simplify(simplified, &vertices[0].pos.x, sizeof(TestVertex), vertices.size(), settings);
+        float measured = measuredDeviation(vertices, indices, simplified);
+        EXPECT_GT(measured, 0.0f) << ratio;
+        EXPECT_NEAR(error, measured, measured * 1e-3f) << ratio;
+    }
+    // Chain levels are measured against the original, never below the true deviation.
+    std::vector<MeshSimplifier::LOD> chain = MeshSimplifier::buildLODChain(vertices, indices, { 0.5f, 0.25f, 0.1f });
+    ASSERT_EQ(chain.size(), 3u);
+    for (const MeshSimplifier::LOD& lod : chain) {
+        EXPECT_GE(lod.error, measuredDeviation(vertices, indices, lod.indices) * 0.999f);
+    }
+}
+
+TEST(MeshSimplifierTest, LODChainAndSelection) {
+    std::vector<TestVertex> vertices;
+    std::vector<unsigned int> indices;
+    buildShuffledGrid(24, vertices, indices);
+    std::vector<MeshSimplifier::LOD> chain = MeshSimplifier::buildLODChain(vertices, indices, { 0.5f, 0.25f, 0.125f });
+    ASSERT_EQ(chain.size(), 3u);
+    size_t previous = indices.size();
+    float previousError = 0.0f;
+    for (const MeshSimplifier::LOD& lod : chain) {
+        EXPECT_LT(lod.indices.size(), previous);
+        EXPECT_GE(lod.error, previousError);
+        previous = lod.indices.size();
+        previousError = lod.error;
+    }
+
+    std::vector<float> errors = { 0.0f, 0.01f, 0.1f };
+    const float fov = static_cast<float>(M_PI) / 4.0f;
+    EXPECT_EQ(MeshSimplifier::selectLOD(errors, 1.0f, 1.0f, fov, 1024.0f), 0);
+    EXPECT_EQ(MeshSimplifier::selectLOD(errors, 50.0f, 1.0f, fov, 1024.0f), 1);
+    EXPECT_EQ(MeshSimplifier::selectLOD(errors, 1000.0f, 1.0f, fov, 1024.0f), 2);
+    // A larger instance keeps detail further away.
+    EXPECT_EQ(MeshSimplifier::selectLOD(errors, 50.0f, 10.0f, fov, 1024.0f), 0);
+}
+
+TEST(MeshClustersTest, ClustersRespectLimitsAndKeepTriangles) {
+    std::vector<TestVertex> vertices;
+    std::vector<unsigned int> indices;
+    buildShuffledGrid(40, vertices, indices);
+    std::vector<std::array<float, 9>> before = canonicalTriangles(vertices, indices);
+    std::vector<MeshClusters::Cluster> clusters = MeshClusters::buildClusters(vertices, indices);
+    EXPECT_EQ(canonicalTriangles(vertices, indices), before);
+
+    uint32_t next = 0;
+    for (const MeshClusters::Cluster& cluster : clusters) {
+        EXPECT_EQ(cluster.indexOffset, next);
+        next += cluster.indexCount;
+        EXPECT_LE(cluster.indexCount / 3, MeshClusters::MAX_TRIANGLES);
+        std::vector<unsigned int> used(indices.begin() + cluster.indexOffset, indices.begin() + cluster.indexOffset + cluster.indexCount);
+        std::sort(used.begin(), used.end());
+        EXPECT_LE(std::unique(used.begin(), used.end()) - used.begin(), static_cast<long>(MeshClusters::MAX_VERTICES));
+        vec3 center(cluster.center[0], cluster.center[1], cluster.center[2]);
+        for (unsigned int v : used) {
+            EXPECT_LE((vertices[v].pos - center).getLength(), cluster.radius + 1e-4f);
+        }
+        // The grid is nearly flat and faces +z, so every cone is narrow.
+        EXPECT_GT(cluster.coneAxis[2], 0.95f);
+        EXPECT_LT(cluster.coneCutoff, 0.3f);
+    }
+    EXPECT_EQ(next, indices.size());
+    // 3200 triangles need at least 26 clusters; compact ones stay near that.
+    EXPECT_LE(clusters.size(), 40u);
+}
+
+TEST(MeshClustersTest, DisconnectedCardsFormCompactClusters) {
+    // Foliage-like cards with no shared vertices, scattered through a 100 unit cube.
+    std::vector<TestVertex> vertices;
+    std::vector<unsigned int> indices;
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> range(0.0f, 100.0f);
+    for (unsigned int card = 0; card < 6000; card++) {
+        vec3 corner(range(rng), range(rng), range(rng));
+        for (const vec3& offset : { vec3(0.0f, 0.0f, 0.0f), vec3(0.5f, 0.0f, 0.0f), vec3(0.0f, 0.5f, 0.0f) }) {
+            TestVertex v = {};
+            v.pos = corner + offset;
+            vertices.push_back(v);
+        }
+        indices.insert(indices.end(), { card * 3, card * 3 + 1, card * 3 + 2 });
+    }
+    std::vector<std::array<float, 9>> before = canonicalTriangles(vertices, indices);
+    std::vector<MeshClusters::Cluster> clusters = MeshClusters::buildClusters(vertices, indices);
+    EXPECT_EQ(canonicalTriangles(vertices, indices), before);
+
+    // 21 cards fill a cluster's 64 vertices.
+    EXPECT_EQ(clusters.size(), (6000u + 20u) / 21u);
+    float radiusSum = 0.0f;
+    for (const MeshClusters::Cluster& cluster : clusters) {
+        EXPECT_LE(cluster.indexCount / 3, 21u);
+        radiusSum += cluster.radius;
+    }
+    // Each cluster covers about 1/286 of the cube, a ball of radius 9.5;
+    // clusters of unrelated cards would span most of it.
+    EXPECT_LT(radiusSum / clusters.size(), 20.0f);
+}
+
+TEST(MeshClustersTest, CullsByFrustumAndCone) {
+    std::vector<TestVertex> vertices;
+    std::vector<unsigned int> indices;
+    buildFlatGrid(40, vertices, indices);
+    std::vector<MeshClusters::Cluster> clusters = MeshClusters::buildClusters(vertices, indices);
+    Matrix projection = Matrix::Projection(1.0f, 1.0f, 0.1f, 100.0f);
+
+    // Above the grid looking down at it: everything is visible, in one range.
+    vec3 above(20.0f, 20.0f, 60.0f);
+    MeshClusters::Frustum frustum = MeshClusters::Frustum::fromMatrix(projection.mul(Matrix::LookAt(above, vec3(20.0f, 20.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f))));
+    std::vector<MeshClusters::DrawRange> ranges;
+    MeshClusters::CullStats stats;
+    EXPECT_EQ(MeshClusters::cullClusters(clusters, frustum, above, ranges, &stats), indices.size() / 3);
+    ASSERT_EQ(ranges.size(), 1u);
+    EXPECT_EQ(ranges[0].indexCount, indices.size());
+    EXPECT_EQ(stats.cullRatio(), 0.0f);
+
+    // Below it, every cluster faces away, unless back faces are kept.
+    vec3 below(20.0f, 20.0f, -60.0f);
+    frustum = MeshClusters::Frustum::fromMatrix(projection.mul(Matrix::LookAt(below, vec3(20.0f, 20.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f))));
+    ranges.clear();
+    stats = MeshClusters::CullStats();
+    EXPECT_EQ(MeshClusters::cullClusters(clusters, frustum, below, ranges, &stats), 0u);
+    EXPECT_EQ(stats.backfaceCulled, clusters.size());
+    EXPECT_EQ(MeshClusters::cullClusters(clusters, frustum, below, ranges, nullptr, false), indices.size() / 3);
+
+    // Looking at one corner from close by leaves the far clusters out.
+    vec3 corner(2.0f, 2.0f, 4.0f);
+    frustum = MeshClusters::Frustum::fromMatrix(projection.mul(Matrix::LookAt(corner, vec3(2.0f, 2.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f))));
+    ranges.clear();
+    stats = MeshClusters::CullStats();
+    size_t visible = MeshClusters::cullClusters(clusters, frustum, corner, ranges, &stats);
+    EXPECT_GT(visible, 0u);
+    EXPECT_GT(stats.frustumCulled, clusters.size() / 2);
+    EXPECT_EQ(stats.backfaceCulled, 0u);
+    size_t ranged = 0;
+    for (const MeshClusters::DrawRange& range : ranges) {
+        ranged += range.indexCount / 3;
+    }
+    EXPECT_EQ(ranged, visible);
+}
+
+TEST(ModelCacheTest, StoresClusters) {
+    std::string path = findResource("Pine/pine.gem");
+    if (path.empty()) {
+        std::cout << "Pine/pine.gem not found, skipping" << std::endl;
+        return;
+    }
+    const char* cachePath = "modelcache_clusters.gemc";
+    GEMLoader::GEMModelLoader loader;
+    std::vector<GEMLoader::GEMMesh> meshes;
+    ASSERT_TRUE(loader.loadMapped(path, meshes));
+    std::vector<std::vector<MeshClusters::Cluster>> clusters;
+    for (auto& mesh : meshes) {
+        MeshOptimizer::optimizeMesh(mesh.verticesStatic, mesh.indices);
+        clusters.push_back(MeshClusters::buildClusters(mesh.verticesStatic, mesh.indices));
+    }
+    ASSERT_TRUE(ModelCache::write(path, cachePath, meshes, nullptr, std::vector<float>(), std::vector<std::vector<MeshSimplifier::LOD>>(), clusters));
+
+    ModelCache cache;
+    ASSERT_TRUE(cache.open(path, cachePath));
+    EXPECT_TRUE(cache.hasClusters());
+    for (size_t i = 0; i < meshes.size(); i++) {
+        ModelCache::MeshView view = cache.getMesh(static_cast<int>(i));
+        ASSERT_EQ(view.clusterCount, clusters[i].size());
+        EXPECT_EQ(memcmp(view.clusters, clusters[i].data(), clusters[i].size() * sizeof(MeshClusters::Cluster)), 0);
+    }
+    cache.close();
+    ASSERT_TRUE(ModelCache::write(path, cachePath, meshes, nullptr));
+    ASSERT_TRUE(cache.open(path, cachePath));
+    EXPECT_FALSE(cache.hasClusters());
+    EXPECT_EQ(cache.getMesh(0).clusterCount, 0u);
+    cache.close();
+    std::remove(cachePath);
+}
+
+TEST(ModelCacheTest, StoresCompactVertices) {
+    std::string path = findResource("Pine/pine.gem");
+    if (path.empty()) {
+        std::cout << "Pine/pine.gem not found, skipping" << std::endl;
+        return;
+    }
+    const char* cachePath = "modelcache_compact.gemc";
+    GEMLoader::GEMModelLoader loader;
+    std::vector<GEMLoader::GEMMesh> meshes;
+    ASSERT_TRUE(loader.loadMapped(path, meshes));
+    std::vector<VertexCompression::CompactMesh> compactMeshes;
+    for (auto& mesh : meshes) {
+        compactMeshes.push_back(VertexCompression::compressStaticMesh(mesh.verticesStatic));
+    }
+    ASSERT_TRUE(ModelCache::write(path, cachePath, meshes, nullptr, std::vector<float>(), std::vector<std::vector<MeshSimplifier::LOD>>(),
+        std::vector<std::vector<MeshClusters::Cluster>>(), compactMeshes));
+
+    ModelCache cache;
+    ASSERT_TRUE(cache.open(path, cachePath));
+    EXPECT_TRUE(cache.hasCompactVertices());
+    for (size_t i = 0; i < meshes.size(); i++) {
+        ModelCache::MeshView view = cache.getMesh(static_cast<int>(i));
+        ASSERT_EQ(view.vertexStride, sizeof(VertexCompression::CompactStaticVertex));
+        ASSERT_EQ(view.vertexCount * view.vertexStride, compactMeshes[i].vertices.size());
+        EXPECT_EQ(memcmp(view.vertices, compactMeshes[i].vertices.data(), compactMeshes[i].vertices.size()), 0);
+        for (int k = 0; k < 3; k++) {
+            EXPECT_EQ(view.quantization.offset[k], compactMeshes[i].quantization.offset[k]);
+            EXPECT_EQ(view.quantization.scale[k], compactMeshes[i].quantization.scale[k]);
+        }
+    }
+    cache.close();
+
+    // One packed stream per mesh, or none.
+    compactMeshes.pop_back();
+    EXPECT_FALSE(ModelCache::write(path, cachePath, meshes, nullptr, std::vector<float>(), std::vector<std::vector<MeshSimplifier::LOD>>(),
+        std::vector<std::vector<MeshClusters::Cluster>>(), compactMeshes));
+    ASSERT_TRUE(ModelCache::write(path, cachePath, meshes, nullptr));
+    ASSERT_TRUE(cache.open(path, cachePath));
+    EXPECT_FALSE(cache.hasCompactVertices());
+    EXPECT_EQ(cache.getMesh(0).vertexStride, sizeof(GEMLoader::GEMStaticVertex));
+    cache.close();
+    std::remove(cachePath);
+}
+
+TEST(VertexCompressionTest, HalfFloatRoundTrip) {
+    for (float exact : { 0.0f, 1.0f, -2.0f, 0.5f, 65504.0f, 5.9604645e-8f, -0.25f }) {
+        EXPECT_EQ(VertexCompression::halfToFloat(VertexCompression::floatToHalf(exact)), exact);
+    }
+    EXPECT_TRUE(std::isinf(VertexCompression::halfToFloat(VertexCompression::floatToHalf(1e6f))));
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> range(-8.0f, 8.0f);
+    for (int i = 0; i < 10000; i++) {
+        float value = range(rng);
+        float decoded = VertexCompression::halfToFloat(VertexCompression::floatToHalf(value));
+        // Half precision keeps 11 significant bits; rounding halves the step.
+        EXPECT_LE(fabsf(decoded - value), fabsf(value) * (1.0f / 2048.0f) + 1e-7f) << value;
+    }
+}
+
+TEST(VertexCompressionTest, OctahedralDirectionsWithinTolerance) {
+    std::vector<vec3> directions = { vec3(1, 0, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1), vec3(-1, -1, -1) };
+    std::mt19937 rng(11);
+    std::normal_distribution<float> normal(0.0f, 1.0f);
+    for (int i = 0; i < 10000; i++) {
+        directions.push_back(vec3(normal(rng), normal(rng), normal(rng)));
+    }
+    for (vec3 d : directions) {
+        d = d.normalize();
+        int16_t encoded[2];
+        VertexCompression::encodeOctahedral(&d.x, encoded);
+        vec3 decoded;
+        VertexCompression::decodeOctahedral(encoded, &decoded.x);
+        EXPECT_NEAR(decoded.getLength(), 1.0f, 1e-5f);
+        EXPECT_LT(VertexCompression::Detail::angleBetween(&d.x, &decoded.x), 1e-4f);
+    }
+}
+
+TEST(VertexCompressionTest, WeightsSumTo255) {
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (int i = 0; i < 10000; i++) {
+        float weights[4] = { unit(rng), unit(rng), unit(rng) * (i % 2), 0.0f };
+        float sum = weights[0] + weights[1] + weights[2];
+        for (float& w : weights) w /= sum;
+        uint8_t encoded[4];
+        VertexCompression::encodeWeights(weights, encoded);
+        EXPECT_EQ(encoded[0] + encoded[1] + encoded[2] + encoded[3], 255);
+        float decoded[4];
+        VertexCompression::decodeWeights(encoded, decoded);
+        for (int k = 0; k < 4; k++) {
+            EXPECT_LE(fabsf(decoded[k] - weights[k]), 2.0f / 255.0f);
+        }
+    }
+}
+
+TEST(VertexCompressionTest, ModelsRoundTripAtLessThanHalfTheSize) {
+    for (const char* name : { "TRex.gem", "Pine/pine.gem" }) {
+        std::string path = findResource(name);
+        if (path.empty()) {
+            std::cout << name << " not found, skipping" << std::endl;
+            continue;
+        }
+        GEMLoader::GEMModelLoader loader;
+        std::vector<GEMLoader::GEMMesh> meshes;
+        GEMLoader::GEMAnimation animation;
+        ASSERT_TRUE(loader.loadMapped(path, meshes, animation));
+        size_t originalBytes = 0, compactBytes = 0;
+        for (auto& mesh : meshes) {
+            VertexCompression::Quantization q;
+            VertexCompression::ErrorReport error;
+            if (mesh.isAnimated()) {
+                std::vector<VertexCompression::CompactAnimatedVertex> compact;
+                ASSERT_TRUE(VertexCompression::compressAnimated(mesh.verticesAnimated, compact, q));
+                error = VertexCompression::measureError(mesh.verticesAnimated, VertexCompression::decompressAnimated<GEMLoader::GEMAnimatedVertex>(compact, q));
+                originalBytes += mesh.verticesAnimated.size() * sizeof(GEMLoader::GEMAnimatedVertex);
+                compactBytes += compact.size() * sizeof(VertexCompression::CompactAnimatedVertex);
+                EXPECT_LE(error.weight, 2.0f / 255.0f);
+            }
+            else {
+                std::vector<VertexCompression::CompactStaticVertex> compact = VertexCompression::compressStatic(mesh.verticesStatic, q);
+                error = VertexCompression::measureError(mesh.verticesStatic, VertexCompression::decompressStatic<GEMLoader::GEMStaticVertex>(compact, q));
+                originalBytes += mesh.verticesStatic.size() * sizeof(GEMLoader::GEMStaticVertex);
+                compactBytes += compact.size() * sizeof(VertexCompression::CompactStaticVertex);
+            }
+            float extent = max(q.scale[0], max(q.scale[1], q.scale[2]));
+            EXPECT_LE(error.position, extent / 65535.0f);
+            EXPECT_LT(error.normal, 1e-3f);
+            EXPECT_LT(error.tangent, 1e-3f);
+            EXPECT_LT(error.uv, 1e-2f);
+        }
+        EXPECT_LT(compactBytes * 2, originalBytes) << name;
+    }
+}
+
+static uint32_t fnv1a(const unsigned char* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Decodes a texture as RGBA8, the layout Texture::decode hands to MipChain.
+static bool loadRGBA(const std::string& path, int& width, int& height, std::vector<unsigned char>& rgba) {
+    int channels = 0;
+    unsigned char* texels = stbi_load(path.c_str(), &width, &height, &channels, 4);
+    if (texels == nullptr) {
+        return false;
+    }
+    rgba.assign(texels, texels + static_cast<size_t>(width) * height * 4);
+    stbi_image_free(texels);
+    return true;
+}
+
+TEST(MipChainTest, LevelSizes) {
+    EXPECT_EQ(MipChain::levelCount(1, 1), 1);
+    EXPECT_EQ(MipChain::levelCount(1024, 1024), 11);
+    EXPECT_EQ(MipChain::levelCount(512, 1024), 11);
+    EXPECT_EQ(MipChain::levelCount(5, 3), 3);
+    EXPECT_EQ(MipChain::levelSize(512, 10), 1);
+    EXPECT_EQ(MipChain::levelSize(5, 1), 2);
+    // 4x2, 2x1 and 1x1 texels
+    EXPECT_EQ(MipChain::levelOffset(4, 2, 3), (8 + 2 + 1) * 4u);
+}
+
+TEST(MipChainTest, AveragesInLinearLight) {
+    // Black and white average to middle grey in linear light, which is 188 in
+    // sRGB rather than the 128 of averaging the stored values.
+    std::vector<unsigned char> image = { 0, 0, 0, 255, 255, 255, 255, 255, 0, 0, 0, 255, 255, 255, 255, 255 };
+    std::vector<unsigned char> chain;
+    MipChain::Settings settings;
+    ASSERT_EQ(MipChain::generate(image.data(), 2, 2, settings, chain), 2);
+    ASSERT_EQ(chain.size(), 20u);
+    EXPECT_NEAR(chain[16], 188, 1);
+    EXPECT_EQ(chain[19], 255);
+    settings.srgb = false;
+    MipChain::generate(image.data(), 2, 2, settings, chain);
+    EXPECT_NEAR(chain[16], 128, 1);
+}
+
+TEST(MipChainTest, SimdMatchesScalar) {
+    const int width = 37, height = 19; // Odd sizes, so the clamped edges run too
+    std::mt19937 rng(5);
+    std::vector<unsigned char> image(width * height * 4);
+    for (auto& texel : image) {
+        texel = static_cast<unsigned char>(rng() & 255);
+    }
+    for (bool srgb : { true, false }) {
+        std::vector<unsigned char> simd((width / 2) * (height / 2) * 4), scalar(simd.size());
+        MipChain::Detail::downsample(image.data(), width, height, simd.data(), srgb, true);
+        MipChain::Detail::downsample(image.data(), width, height, scalar.data(), srgb, false);
+        EXPECT_EQ(simd, scalar);
+    }
+}
+
+TEST(MipChainTest, ShippedTexturesMatchReference) {
+    // Checksums of the whole chain, recorded when the filter was written. A
+    // change means every mip of the shipped textures changed.
+    struct Reference { const char* name; int levels; uint32_t checksum; };
+    const Reference references[] = {
+        { "Textures/bark09.png", 11, 4262333121u },
+        { "Textures/pine branch.png", 11, 1021982652u },
+        { "Textures/stump01_normal.png", 10, 3076354908u },
+    };
+    for (const Reference& reference : references) {
+        std::string path = findRepoFile(reference.name);
+        int width = 0, height = 0;
+        std::vector<unsigned char> rgba;
+        if (path.empty() || !loadRGBA(path, width, height, rgba)) {
+            std::cout << reference.name << " not found, skipping" << std::endl;
+            continue;
+        }
+        std::vector<unsigned char> chain;
+        MipChain::Settings settings = MipChain::settingsFor(path, rgba.data(), rgba.size() / 4);
+        int levels = MipChain::generate(rgba.data(), width, height, settings, chain);
+        EXPECT_EQ(levels, reference.levels) << reference.name;
+        EXPECT_EQ(chain.size(), MipChain::levelOffset(width, height, levels)) << reference.name;
+        EXPECT_EQ(memcmp(chain.data(), rgba.data(), rgba.size()), 0) << reference.name;
+        EXPECT_EQ(fnv1a(chain.data(), chain.size()), reference.checksum) << reference.name;
+    }
+}
+
+TEST(MipChainTest, PreservesAlphaCoverageOfFoliage) {
+    std::string path = findRepoFile("Textures/pine branch.png");
+    int width = 0, height = 0;
+    std::vector<unsigned char> rgba;
+    if (path.empty() || !loadRGBA(path, width, height, rgba)) {
+        std::cout << "pine branch.png not found, skipping" << std::endl;
+        return;
+    }
+    MipChain::Settings settings = MipChain::settingsFor(path, rgba.data(), rgba.size() / 4);
+    ASSERT_TRUE(settings.srgb);
+    ASSERT_TRUE(settings.preserveAlphaCoverage);
+    auto coverageAt = [&](const std::vector<unsigned char>& chain, int level) {
+        size_t texels = static_cast<size_t>(MipChain::levelSize(width, level)) * MipChain::levelSize(height, level);
+        return static_cast<float>(MipChain::Detail::coverage(chain.data() + MipChain::levelOffset(width, height, level), texels, 1.0f, settings.alphaReference)) / texels;
+    };
+    std::vector<unsigned char> preserved, plain;
+    MipChain::generate(rgba.data(), width, height, settings, preserved);
+    settings.preserveAlphaCoverage = false;
+    MipChain::generate(rgba.data(), width, height, settings, plain);
+    // Plain box filtering drifts further from level 0 the smaller the level
+    float target = coverageAt(preserved, 0);
+    float preservedError = 0.0f, plainError = 0.0f;
+    for (int level = 1; level <= 6; level++) {
+        preservedError = max(preservedError, fabsf(coverageAt(preserved, level) - target));
+        plainError = max(plainError, fabsf(coverageAt(plain, level) - target));
+    }
+    EXPECT_LT(preservedError, 0.01f);
+    EXPECT_LT(preservedError, plainError);
+}
+
+// Encodes and decodes one level, returning the decoded RGBA8 texels.
+static std::vector<unsigned char> roundTrip(const std::vector<unsigned char>& rgba, int width, int height, BlockCompression::Format format) {
+    std::vector<unsigned char> blocks(BlockCompression::levelBytes(width, height, format));
+    BlockCompression::encodeLevel(rgba.data(), width, height, format, blocks.data());
+    std::vector<unsigned char> decoded(rgba.size());
+    BlockCompression::decodeLevel(blocks.data(), width, height, format, decoded.data());
+    return decoded;
+}
+
+TEST(ImageDecoderTest, AnyChannelCountDecodesToRGBA) {
+    // One-channel metallic map and an RGB image, which used to be uploaded
+    // with their own channel count as if they were RGBA
+    for (const char* name : { "Textures/T-rex_Metallic.png", "Textures/Textures1.png", "Textures/pine branch.png" }) {
+        std::string path = findRepoFile(name);
+        if (path.empty()) {
+            std::cout << name << " not found, skipping" << std::endl;
+            continue;
+        }
+        int width = 0, height = 0;
+        std::vector<unsigned char> texels;
+        ASSERT_TRUE(ImageDecoder::decodeRGBA8(path, width, height, texels)) << name;
+        int referenceWidth = 0, referenceHeight = 0, channels = 0;
+        unsigned char* reference = stbi_load(path.c_str(), &referenceWidth, &referenceHeight, &channels, 4);
+        ASSERT_NE(reference, nullptr);
+        EXPECT_EQ(width, referenceWidth);
+        EXPECT_EQ(height, referenceHeight);
+        ASSERT_EQ(texels.size(), static_cast<size_t>(width) * height * 4) << name;
+        EXPECT_EQ(memcmp(texels.data(), reference, texels.size()), 0) << name;
+        stbi_image_free(reference);
+        // Room for the mip chain, so generating it does not reallocate
+        EXPECT_GE(texels.capacity(), MipChain::levelOffset(width, height, MipChain::levelCount(width, height))) << name;
+        const unsigned char* before = texels.data();
+        MipChain::generateInPlace(texels, width, height, MipChain::Settings());
+        EXPECT_EQ(texels.data(), before) << name;
+        if (channels == 1) {
+            EXPECT_TRUE(texels[0] == texels[1] && texels[1] == texels[2] && texels[3] == 255) << name;
+        }
+    }
+    int width = 0, height = 0;
+    std::vector<unsigned char> texels;
+    EXPECT_FALSE(ImageDecoder::decodeRGBA8("missing_texture.png", width, height, texels));
+}
+
+TEST(BlockCompressionTest, Sizes) {
+    EXPECT_EQ(BlockCompression::levelBytes(1024, 512, BlockCompression::Format::BC1), 1024u * 512u / 2u);
+    EXPECT_EQ(BlockCompression::levelBytes(1024, 512, BlockCompression::Format::BC3), 1024u * 512u);
+    // Levels smaller than a block still take a whole one
+    EXPECT_EQ(BlockCompression::levelBytes(2, 1, BlockCompression::Format::BC1), 8u);
+    EXPECT_EQ(BlockCompression::rowPitch(6, BlockCompression::Format::BC3), 32u);
+    EXPECT_EQ(BlockCompression::chainBytes(8, 8, 4, BlockCompression::Format::BC1), (4 + 1 + 1 + 1) * 8u);
+    EXPECT_TRUE(BlockCompression::canCompress(512, 1024));
+    EXPECT_FALSE(BlockCompression::canCompress(510, 1024));
+}
+
+TEST(BlockCompressionTest, SolidAndTwoColourBlocks) {
+    std::mt19937 rng(9);
+    for (int run = 0; run < 32; run++) {
+        // 565 quantization moves a channel by at most 4
+        unsigned char colour[4] = { static_cast<unsigned char>(rng()), static_cast<unsigned char>(rng()), static_cast<unsigned char>(rng()), 255 };
+        std::vector<unsigned char> solid(16 * 4);
+        for (int i = 0; i < 16; i++) {
+            memcpy(&solid[i * 4], colour, 4);
+        }
+        std::vector<unsigned char> decoded = roundTrip(solid, 4, 4, BlockCompression::Format::BC1);
+        for (size_t i = 0; i < solid.size(); i++) {
+            EXPECT_NEAR(decoded[i], solid[i], 4) << i;
+        }
+    }
+    // Colours exactly representable in 565 come back exactly
+    std::vector<unsigned char> twoColour(16 * 4);
+    for (int i = 0; i < 16; i++) {
+        unsigned char value = i < 8 ? 0 : 255;
+        twoColour[i * 4] = value;
+        twoColour[i * 4 + 1] = 255 - value;
+        twoColour[i * 4 + 2] = value;
+        twoColour[i * 4 + 3] = 255;
+    }
+    EXPECT_EQ(roundTrip(twoColour, 4, 4, BlockCompression::Format::BC1), twoColour);
+}
+
+TEST(BlockCompressionTest, GradientsAndAlpha) {
+    const int width = 64, height = 36; // 36 is not a power of two
+    std::vector<unsigned char> rgba(width * height * 4);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            unsigned char* t = &rgba[(y * width + x) * 4];
+            t[0] = static_cast<unsigned char>(x * 4);
+            t[1] = static_cast<unsigned char>(y * 7);
+            t[2] = static_cast<unsigned char>(128 + x - y);
+            t[3] = static_cast<unsigned char>((x / 8) % 2 ? 255 : x * 4);
+        }
+    }
+    std::vector<unsigned char> bc1 = roundTrip(rgba, width, height, BlockCompression::Format::BC1);
+    std::vector<unsigned char> bc3 = roundTrip(rgba, width, height, BlockCompression::Format::BC3);
+    EXPECT_GT(BlockCompression::psnr(rgba.data(), bc1.data(), width * height), 36.0);
+    EXPECT_GT(BlockCompression::psnr(rgba.data(), bc3.data(), width * height, true), 36.0);
+    for (int i = 0; i < width * height; i++) {
+        // BC1 blocks stay in four-colour mode, so opaque texels never become transparent
+        EXPECT_EQ(bc1[i * 4 + 3], 255);
+        // Eight alpha levels per block: within half a step of the block's range
+        EXPECT_NEAR(bc3[i * 4 + 3], rgba[i * 4 + 3], 255 / 14 + 1) << i;
+    }
+    EXPECT_EQ(BlockCompression::chooseFormat(rgba.data(), width * height), BlockCompression::Format::BC3);
+}
+
+TEST(BlockCompressionTest, ThreadedMatchesSingleThreaded) {
+    const int width = 256, height = 128;
+    std::mt19937 rng(3);
+    std::vector<unsigned char> rgba(width * height * 4);
+    for (auto& texel : rgba) {
+        texel = static_cast<unsigned char>(rng());
+    }
+    JobSystem jobs(3);
+    for (BlockCompression::Format format : { BlockCompression::Format::BC1, BlockCompression::Format::BC3 }) {
+        std::vector<unsigned char> single(BlockCompression::levelBytes(width, height, format)), threaded(single.size());
+        BlockCompression::encodeLevel(rgba.data(), width, height, format, single.data());
+        BlockCompression::encodeLevel(rgba.data(), width, height, format, threaded.data(), &jobs);
+        EXPECT_EQ(single, threaded);
+    }
+}
+
+TEST(BlockCompressionTest, ShippedTexturesKeepQuality) {
+    for (const char* name : { "Textures/bark09.png", "Textures/pine branch.png", "Textures/stump01.png" }) {
+        std::string path = findRepoFile(name);
+        int width = 0, height = 0;
+        std::vector<unsigned char> rgba;
+        if (path.empty() || !loadRGBA(path, width, height, rgba)) {
+            std::cout << name << " not found, skipping" << std::endl;
+            continue;
+        }
+        BlockCompression::Format format = BlockCompression::chooseFormat(rgba.data(), rgba.size() / 4);
+        std::vector<unsigned char> decoded = roundTrip(rgba, width, height, format);
+        double psnr = BlockCompression::psnr(rgba.data(), decoded.data(), rgba.size() / 4, format == BlockCompression::Format::BC3);
+        EXPECT_GT(psnr, 30.0) << name;
+    }
+}
+
+TEST(TextureCacheTest, RoundTripsAndRejectsStaleCaches) {
+    const char* sourcePath = "texturecache_source.png";
+    const char* cachePath = "texturecache_source.pngc";
+    std::vector<char> source(100, 7);
+    writeFile(sourcePath, source);
+
+    const int width = 16, height = 8;
+    int levels = MipChain::levelCount(width, height);
+    std::vector<unsigned char> rgba(width * height * 4, 200), chain, blocks;
+    MipChain::generate(rgba.data(), width, height, MipChain::Settings(), chain);
+    BlockCompression::encodeChain(chain.data(), width, height, levels, BlockCompression::Format::BC1, blocks);
+    ASSERT_TRUE(TextureCache::write(sourcePath, width, height, levels, BlockCompression::Format::BC1, blocks.data()));
+
+    TextureCache cache;
+    ASSERT_TRUE(cache.open(sourcePath));
+    EXPECT_EQ(cache.getWidth(), width);
+    EXPECT_EQ(cache.getHeight(), height);
+    EXPECT_EQ(cache.getMipLevels(), levels);
+    EXPECT_EQ(cache.getFormat(), BlockCompression::Format::BC1);
+    ASSERT_EQ(cache.dataBytes(), blocks.size());
+    EXPECT_EQ(memcmp(cache.data(), blocks.data(), blocks.size()), 0);
+    cache.close();
+
+    // Edited source.
+    source.push_back(0);
+    writeFile(sourcePath, source);
+    EXPECT_FALSE(cache.open(sourcePath));
+    source.pop_back();
+    writeFile(sourcePath, source);
+    EXPECT_TRUE(cache.open(sourcePath));
+    cache.close();
+
+    std::ifstream cacheIn(cachePath, std::ios::binary);
+    std::vector<char> cacheBytes((std::istreambuf_iterator<char>(cacheIn)), std::istreambuf_iterator<char>());
+    cacheIn.close();
+    writeFile(cachePath, std::vector<char>(cacheBytes.begin(), cacheBytes.end() - 1));
+    EXPECT_FALSE(cache.open(sourcePath));
+
+    std::remove(sourcePath);
+    std::remove(cachePath);
+}
+
+// Texture backend without a device: sizes come from a table, and names not
+// in it fail to load.
+struct FakeTexture {
+    std::string name;
+};
+
+class FakeTextureBackend : public TextureBackend<FakeTexture> {
+public:
+    std::map<std::string, size_t> sizes;
+    std::vector<std::string> created;
+    std::vector<std::string> destroyed;
+
+    FakeTexture* create(const std::string& name, size_t& bytes) override {
+        auto it = sizes.find(name);
+        if (it == sizes.end()) {
+            return nullptr;
+        }
+        created.push_back(name);
+        bytes = it->second;
+        return new FakeTexture{ name };
+    }
+    void destroy(FakeTexture* texture) override {
+        destroyed.push_back(texture->name);
+        delete texture;
+    }
+};
+
+TEST(TextureResidencyTest, LoadsOnceAndCountsHits) {
+    FakeTextureBackend backend;
+    backend.sizes = { { "bark", 100 }, { "pine", 200 } };
+    TextureResidency<FakeTexture> residency(backend);
+    FakeTexture* bark = residency.acquire("bark");
+    ASSERT_NE(bark, nullptr);
+    EXPECT_EQ(residency.acquire("bark"), bark);
+    EXPECT_NE(residency.acquire("pine"), nullptr);
+    // Misses return nullptr without adding entries, and are not retried
+    EXPECT_EQ(residency.acquire("missing"), nullptr);
+    EXPECT_EQ(residency.acquire("missing"), nullptr);
+    EXPECT_EQ(residency.find("other"), nullptr);
+    EXPECT_FALSE(residency.isResident("missing"));
+
+    const TextureResidencyStats& stats = residency.getStats();
+    EXPECT_EQ(backend.created.size(), 2u);
+    EXPECT_EQ(stats.residentTextures, 2u);
+    EXPECT_EQ(stats.residentBytes, 300u);
+    EXPECT_EQ(stats.requests, 5u);
+    EXPECT_EQ(stats.hits, 1u);
+    EXPECT_EQ(stats.failedLoads, 1u);
+    EXPECT_FLOAT_EQ(stats.hitRate(), 0.2f);
+
+    residency.clear();
+    EXPECT_EQ(backend.destroyed.size(), 2u);
+    EXPECT_EQ(residency.getStats().residentBytes, 0u);
+}
+
+TEST(TextureResidencyTest, EvictsIdleTexturesAndReloadsThem) {
+    FakeTextureBackend backend;
+    backend.sizes = { { "bark", 100 }, { "pine", 200 } };
+    TextureResidency<FakeTexture> residency(backend, TextureResidency<FakeTexture>::UNLIMITED, 2);
+    residency.acquire("bark");
+    residency.acquire("pine");
+    for (int frame = 0; frame < 3; frame++) {
+        residency.beginFrame();
+        residency.acquire("pine");
+    }
+    // bark was last used three frames ago
+    EXPECT_FALSE(residency.isResident("bark"));
+    EXPECT_TRUE(residency.isResident("pine"));
+    EXPECT_EQ(residency.getStats().evictions, 1u);
+    EXPECT_EQ(residency.getStats().residentBytes, 200u);
+    ASSERT_EQ(backend.destroyed.size(), 1u);
+    EXPECT_EQ(backend.destroyed[0], "bark");
+
+    EXPECT_NE(residency.acquire("bark"), nullptr);
+    EXPECT_EQ(std::count(backend.created.begin(), backend.created.end(), "bark"), 2);
+}
+
+TEST(TextureResidencyTest, EvictsLeastRecentlyUsedOverBudget) {
+    FakeTextureBackend backend;
+    backend.sizes = { { "a", 100 }, { "b", 100 }, { "c", 100 }, { "d", 100 } };
+    TextureResidency<FakeTexture> residency(backend, 300);
+    residency.acquire("a");
+    residency.acquire("b");
+    residency.acquire("c");
+    residency.beginFrame();
+    residency.acquire("b");
+    residency.acquire("a");
+    // c is the least recently used and not drawn this frame
+    residency.acquire("d");
+    EXPECT_FALSE(residency.isResident("c"));
+    EXPECT_EQ(residency.getStats().residentBytes, 300u);
+
+    // Textures used this frame are never evicted, so the budget can be exceeded
+    residency.acquire("c");
+    EXPECT_TRUE(residency.isResident("a"));
+    EXPECT_TRUE(residency.isResident("b"));
+    EXPECT_TRUE(residency.isResident("d"));
+    EXPECT_EQ(residency.getStats().residentBytes, 400u);
+    EXPECT_EQ(residency.getStats().peakResidentBytes, 400u);
+    // ... until the next frame's loads make room
+    residency.beginFrame();
+    residency.setBudget(200);
+    EXPECT_EQ(residency.getStats().residentBytes, 200u);
+    EXPECT_EQ(residency.getStats().evictions, 3u);
+
+    std::vector<std::string> order;
+    residency.forEach([&order](const std::string& name, const FakeTexture*, size_t) { order.push_back(name); });
+    EXPECT_EQ(order, (std::vector<std::string>{ "c", "d" }));
+}
+
+TEST(TextureResidencyTest, InsertTakesPipelineLoads) {
+    FakeTextureBackend backend;
+    TextureResidency<FakeTexture> residency(backend);
+    residency.markFailed("sky");
+    EXPECT_EQ(residency.acquire("sky"), nullptr);
+    FakeTexture* sky = new FakeTexture{ "sky" };
+    EXPECT_TRUE(residency.insert("sky", sky, 64));
+    FakeTexture duplicate{ "sky" };
+    EXPECT_FALSE(residency.insert("sky", &duplicate, 64));
+    EXPECT_EQ(residency.acquire("sky"), sky);
+    EXPECT_EQ(residency.getStats().loads, 1u);
+    EXPECT_TRUE(residency.evict("sky"));
+    EXPECT_FALSE(residency.evict("sky"));
+    EXPECT_TRUE(backend.created.empty());
+}
+
+// Level data for the streamer tests: a level's bytes are its number, its size
+// one byte per texel row so uploads can be checked. Uploads are recorded.
+struct FakeLevelSource {
+    std::set<std::pair<std::string, int>> failing;
+    std::vector<TextureStreamRequest> uploads;
+
+    TextureStreamer::ReadLevel reader() {
+        return [this](const std::string& name, int level, std::vector<unsigned char>& data) {
+            if (failing.count({ name, level }) > 0) {
+                return false;
+            }
+            data.assign(static_cast<size_t>(MipChain::levelSize(256, level)), static_cast<unsigned char>(level));
+            return true;
+        };
+    }
+    TextureStreamer::UploadLevel uploader() {
+        return [this](const std::string& name, int level, std::vector<unsigned char>& data) {
+            EXPECT_EQ(data.size(), static_cast<size_t>(MipChain::levelSize(256, level)));
+            EXPECT_EQ(data[0], level);
+            uploads.push_back({ name, level });
+            return true;
+        };
+    }
+};
+
+static std::vector<std::string> requestStrings(const std::vector<TextureStreamRequest>& requests) {
+    std::vector<std::string> out;
+    for (const TextureStreamRequest& request : requests) {
+        out.push_back(request.name + ":" + std::to_string(request.level));
+    }
+    return out;
+}
+
+TEST(TextureStreamerTest, LevelSelection) {
+    // 4096 starts at its 64 texel level; a 32 texel texture is resident whole
+    EXPECT_EQ(TextureStreamer::initialLevel(4096, 2048, 13), 6);
+    EXPECT_EQ(TextureStreamer::initialLevel(32, 32, 6), 0);
+    EXPECT_EQ(TextureStreamer::initialLevel(4096, 4096, 3), 2);
+    // Levels up to twice the pixels covered are worth loading
+    EXPECT_EQ(TextureStreamer::levelForCoverage(1024, 11, 512.0f), 0);
+    EXPECT_EQ(TextureStreamer::levelForCoverage(1024, 11, 100.0f), 3);
+    EXPECT_EQ(TextureStreamer::levelForCoverage(1024, 11, 0.0f), 10);
+    // Halving the distance doubles the coverage
+    float farPixels = TextureStreamer::screenCoverage(5.0f, 40.0f, 3.14159265f / 4.0f, 1024.0f);
+    EXPECT_NEAR(TextureStreamer::screenCoverage(5.0f, 20.0f, 3.14159265f / 4.0f, 1024.0f), farPixels * 2.0f, 1e-3f);
+}
+
+TEST(TextureStreamerTest, StreamsCoarseToFineOneLevelAtATime) {
+    FakeLevelSource source;
+    TextureStreamer streamer(source.reader(), source.uploader());
+    streamer.add("bark", 256, 256, 9, TextureStreamer::initialLevel(256, 256, 9));
+    EXPECT_EQ(streamer.getResidentLevel("bark"), 2);
+    EXPECT_EQ(streamer.getResidentLevel("missing"), -1);
+    EXPECT_EQ(streamer.update(), 1);
+    EXPECT_EQ(streamer.getResidentLevel("bark"), 1);
+    EXPECT_EQ(streamer.update(), 1);
+    EXPECT_EQ(streamer.getResidentLevel("bark"), 0);
+    EXPECT_TRUE(streamer.isIdle());
+    EXPECT_EQ(streamer.update(), 0);
+    std::vector<std::string> expected = { "bark:1", "bark:0" };
+    EXPECT_EQ(requestStrings(streamer.getRequestLog()), expected);
+    EXPECT_EQ(requestStrings(source.uploads), expected);
+}
+
+TEST(TextureStreamerTest, LargestOnScreenStreamsFirst) {
+    FakeLevelSource source;
+    TextureStreamer streamer(source.reader(), source.uploader(), nullptr, 1);
+    for (const char* name : { "far", "mid", "near" }) {
+        streamer.add(name, 256, 256, 9, 3);
+    }
+    streamer.setScreenCoverage("near", 1000.0f);	// Wants level 0
+    streamer.setScreenCoverage("mid", 100.0f);		// Wants level 1
+    streamer.setScreenCoverage("far", 40.0f);		// Wants level 2
+    streamer.finish();
+    std::vector<std::string> expected = { "near:2", "near:1", "near:0", "mid:2", "mid:1", "far:2" };
+    EXPECT_EQ(requestStrings(streamer.getRequestLog()), expected);
+    EXPECT_EQ(streamer.getResidentLevel("far"), 2);
+
+    // Coming closer asks for the finer levels
+    streamer.clearRequestLog();
+    streamer.setScreenCoverage("far", 1000.0f);
+    streamer.finish();
+    expected = { "far:1", "far:0" };
+    EXPECT_EQ(requestStrings(streamer.getRequestLog()), expected);
+}
+
+TEST(TextureStreamerTest, RemovedAndFailedTexturesStopStreaming) {
+    FakeLevelSource source;
+    source.failing.insert({ "broken", 1 });
+    JobSystem jobs(2);
+    TextureStreamer streamer(source.reader(), source.uploader(), &jobs, 4);
+    streamer.add("broken", 256, 256, 9, 3);
+    streamer.add("evicted", 256, 256, 9, 3);
+    streamer.add("kept", 256, 256, 9, 3);
+    streamer.update();
+    EXPECT_EQ(streamer.getRequestLog().size(), 3u);
+    // Its read may still be in flight; the level it brings back is dropped
+    streamer.remove("evicted");
+    streamer.finish();
+    EXPECT_EQ(streamer.getResidentLevel("broken"), 2);
+    EXPECT_EQ(streamer.getResidentLevel("evicted"), -1);
+    EXPECT_EQ(streamer.getResidentLevel("kept"), 0);
+    for (const TextureStreamRequest& upload : source.uploads) {
+        EXPECT_NE(upload.name, "evicted");
+        EXPECT_FALSE(upload.name == "broken" && upload.level < 2);
+    }
+}
+
 // Quaternion tests
 TEST(QuaternionTest, Multiplication) {
     Quaternion q1(1, 0, 0, 0); // Identity quaternion
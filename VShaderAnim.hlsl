@@ -2,14 +2,23 @@ cbuffer animatedMeshBuffer
 {
     float4x4 W;
     float4x4 VP;
-    float4x4 bones[256];
+    float4 bones[768]; // 256 affine bone transforms, three rows each
+#ifdef COMPACT_VERTICES
+    float4 positionOffset; // Mesh bounds minimum
+    float4 positionScale; // Mesh bounds extent
+#endif
 };
 
 struct VS_INPUT
 {
     float4 Pos : POS;
+#ifdef COMPACT_VERTICES
+    float2 Normal : NORMAL; // Octahedral
+    float2 Tangent : TANGENT; // Octahedral
+#else
     float3 Normal : NORMAL;
     float3 Tangent : TANGENT;
+#endif
     float2 TexCoords : TEXCOORD;
     uint4 BoneIDs : BONEIDS;
     float4 BoneWeights : BONEWEIGHTS;
@@ -23,20 +32,49 @@ struct PS_INPUT
     float2 TexCoords : TEXCOORD; // Texture coordinates
 };
 
+#ifdef COMPACT_VERTICES
+// Unfolds an octahedral-encoded unit vector, see VertexCompression.
+float3 decodeOctahedral(float2 e)
+{
+    float3 n = float3(e, 1.0f - abs(e.x) - abs(e.y));
+    if (n.z < 0.0f)
+    {
+        n.xy = (1.0f - abs(n.yx)) * (n.xy >= 0.0f ? 1.0f : -1.0f);
+    }
+    return normalize(n);
+}
+#endif
+
 PS_INPUT VS(VS_INPUT input)
 {
     PS_INPUT output;
-    float4x4 transform = bones[input.BoneIDs[0]] * input.BoneWeights[0];
-    transform += bones[input.BoneIDs[1]] * input.BoneWeights[1];
-    transform += bones[input.BoneIDs[2]] * input.BoneWeights[2];
-    transform += bones[input.BoneIDs[3]] * input.BoneWeights[3];
-    output.Pos = mul(input.Pos, transform);
+    // Blend the 3x4 rows of the influencing bones; the bottom row is always (0, 0, 0, 1).
+    float4 row0 = bones[input.BoneIDs[0] * 3] * input.BoneWeights[0];
+    float4 row1 = bones[input.BoneIDs[0] * 3 + 1] * input.BoneWeights[0];
+    float4 row2 = bones[input.BoneIDs[0] * 3 + 2] * input.BoneWeights[0];
+    [unroll]
+    for (int i = 1; i < 4; i++)
+    {
+        row0 += bones[input.BoneIDs[i] * 3] * input.BoneWeights[i];
+        row1 += bones[input.BoneIDs[i] * 3 + 1] * input.BoneWeights[i];
+        row2 += bones[input.BoneIDs[i] * 3 + 2] * input.BoneWeights[i];
+    }
+#ifdef COMPACT_VERTICES
+    float4 pos = float4(positionOffset.xyz + input.Pos.xyz * positionScale.xyz, 1.0f);
+    float3 normal = decodeOctahedral(input.Normal);
+    float3 tangent = decodeOctahedral(input.Tangent);
+#else
+    float4 pos = float4(input.Pos.xyz, 1.0f);
+    float3 normal = input.Normal;
+    float3 tangent = input.Tangent;
+#endif
+    output.Pos = float4(dot(row0, pos), dot(row1, pos), dot(row2, pos), 1.0f);
     output.Pos = mul(output.Pos, W);
     output.Pos = mul(output.Pos, VP);
-    output.Normal = mul(input.Normal, (float3x3) transform);
+    output.Normal = float3(dot(row0.xyz, normal), dot(row1.xyz, normal), dot(row2.xyz, normal));
     output.Normal = mul(output.Normal, (float3x3) W);
     output.Normal = normalize(output.Normal);
-    output.Tangent = mul(input.Tangent, (float3x3) transform);
+    output.Tangent = float3(dot(row0.xyz, tangent), dot(row1.xyz, tangent), dot(row2.xyz, tangent));
     output.Tangent = mul(output.Tangent, (float3x3) W);
     output.Tangent = normalize(output.Tangent);
     output.TexCoords = input.TexCoords;
@@ -2,13 +2,22 @@ cbuffer staticMeshBuffer
 {
     float4x4 W; // World matrix
     float4x4 VP; // View-Projection matrix
+#ifdef COMPACT_VERTICES
+    float4 positionOffset; // Mesh bounds minimum
+    float4 positionScale; // Mesh bounds extent
+#endif
 };
 
 struct VS_INPUT
 {
     float4 Pos : POS; // Vertex position
+#ifdef COMPACT_VERTICES
+    float2 Normal : NORMAL; // Octahedral vertex normal
+    float2 Tangent : TANGENT; // Octahedral vertex tangent
+#else
     float3 Normal : NORMAL; // Vertex normal
     float3 Tangent : TANGENT; // Vertex tangent
+#endif
     float2 TexCoords : TEXCOORD; // Texture coordinates
 };
 
@@ -20,14 +29,36 @@ struct PS_INPUT
     float2 TexCoords : TEXCOORD; // Texture coordinates
 };
 
+#ifdef COMPACT_VERTICES
+// Unfolds an octahedral-encoded unit vector, see VertexCompression.
+float3 decodeOctahedral(float2 e)
+{
+    float3 n = float3(e, 1.0f - abs(e.x) - abs(e.y));
+    if (n.z < 0.0f)
+    {
+        n.xy = (1.0f - abs(n.yx)) * (n.xy >= 0.0f ? 1.0f : -1.0f);
+    }
+    return normalize(n);
+}
+#endif
+
 PS_INPUT VS(VS_INPUT input)
 {
     PS_INPUT output;
-    output.Pos = mul(input.Pos, W);
+#ifdef COMPACT_VERTICES
+    float4 pos = float4(positionOffset.xyz + input.Pos.xyz * positionScale.xyz, 1.0f);
+    float3 normal = decodeOctahedral(input.Normal);
+    float3 tangent = decodeOctahedral(input.Tangent);
+#else
+    float4 pos = input.Pos;
+    float3 normal = input.Normal;
+    float3 tangent = input.Tangent;
+#endif
+    output.Pos = mul(pos, W);
     output.Pos = mul(output.Pos, VP);
-    output.Normal = mul(input.Normal, (float3x3) W);
+    output.Normal = mul(normal, (float3x3) W);
     output.Normal = normalize(output.Normal);
-    output.Tangent = mul(input.Tangent, (float3x3) W);
+    output.Tangent = mul(tangent, (float3x3) W);
     output.TexCoords = input.TexCoords;
     return output;
 
@@ -1,7 +1,13 @@
 #pragma once
 #include <vector>
 #include <map>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
 #include "core.h"
+#include "AnimationCompression.h"
+#include "AnimationPose.h"
 
 struct Bone
 {
@@ -16,18 +22,130 @@ struct Skeleton
 	Matrix globalInverse;
 };
 
-struct AnimationFrame
-{
-	std::vector<vec3> positions;
-	std::vector<Quaternion> rotations;
-	std::vector<vec3> scales;
-};
-
+// A clip's keyframes, stored structure-of-arrays in a single 16-byte aligned
+// block: all positions, then all rotations, then all scales. Each array is
+// indexed frame * boneCount + bone, so sampling one frame walks contiguous memory.
+// After compress() the keys live in a CompressedAnimationClip instead and the
+// SoA arrays are released.
 class AnimationSequence
 {
 public:
-	std::vector<AnimationFrame> frames;
 	float ticksPerSecond;
+	vec3* positions = nullptr;
+	Quaternion* rotations = nullptr;
+	vec3* scales = nullptr;
+
+	AnimationSequence() : ticksPerSecond(0), frameCount(0), boneCount(0), data(nullptr), dataSize(0) {}
+
+	AnimationSequence(const AnimationSequence& other) : AnimationSequence() {
+		*this = other;
+	}
+
+	AnimationSequence(AnimationSequence&& other) noexcept : AnimationSequence() {
+		swap(other);
+	}
+
+	AnimationSequence& operator=(const AnimationSequence& other) {
+		if (this != &other) {
+			if (other.data) {
+				allocate(other.frameCount, other.boneCount);
+				memcpy(data, other.data, dataSize);
+			}
+			else {
+				releaseKeys();
+				frameCount = other.frameCount;
+				boneCount = other.boneCount;
+			}
+			compressed = other.compressed;
+			ticksPerSecond = other.ticksPerSecond;
+		}
+		return *this;
+	}
+
+	AnimationSequence& operator=(AnimationSequence&& other) noexcept {
+		if (this != &other) {
+			swap(other);
+		}
+		return *this;
+	}
+
+	~AnimationSequence() {
+		alignedFree(data);
+	}
+
+	// Allocates storage for frames * bones keys in one block. Existing keys are discarded.
+	void allocate(int frames, int bones) {
+		alignedFree(data);
+		compressed.clear();
+		frameCount = frames;
+		boneCount = bones;
+		size_t keys = static_cast<size_t>(frames) * bones;
+		size_t positionBytes = alignUp(keys * sizeof(vec3));
+		size_t rotationBytes = alignUp(keys * sizeof(Quaternion));
+		dataSize = keyBlockBytes(frames, bones);
+		data = static_cast<unsigned char*>(alignedAlloc(dataSize, 16));
+		memset(data, 0, dataSize);
+		positions = reinterpret_cast<vec3*>(data);
+		rotations = reinterpret_cast<Quaternion*>(data + positionBytes);
+		scales = reinterpret_cast<vec3*>(data + positionBytes + rotationBytes);
+	}
+
+	// Size of the block allocate() creates for frames * bones keys. The block can
+	// be filled with one copy from data saved in the same layout (see ModelCache).
+	static size_t keyBlockBytes(int frames, int bones) {
+		size_t keys = static_cast<size_t>(frames) * bones;
+		return alignUp(keys * sizeof(vec3)) + alignUp(keys * sizeof(Quaternion)) + alignUp(keys * sizeof(vec3));
+	}
+	// The keys as one block, or nullptr once compressed.
+	unsigned char* keyBlock() { return data; }
+	const unsigned char* keyBlock() const { return data; }
+
+	int getFrameCount() const { return frameCount; }
+	int getBoneCount() const { return boneCount; }
+	size_t keyframeBytes() const { return dataSize + compressed.bytes(); }
+	bool isCompressed() const { return !compressed.empty(); }
+	const CompressedAnimationClip& getCompressed() const { return compressed; }
+
+	// Replaces the SoA keys with a compressed clip (constant tracks dropped to one
+	// key, smallest-three rotations, error-bounded key reduction) and reports the
+	// size change and the largest error against the uncompressed sampler.
+	AnimationCompressionReport compress(const AnimationCompressionSettings& settings = AnimationCompressionSettings()) {
+		AnimationCompressionReport report;
+		if (data == nullptr || frameCount == 0) {
+			return report;
+		}
+		report.originalBytes = dataSize;
+		report.tracks = boneCount * 3;
+		report.originalKeys = frameCount * boneCount * 3;
+		CompressedAnimationClip clip;
+		clip.build(positions, rotations, scales, frameCount, boneCount, settings);
+		for (int bone = 0; bone < boneCount; bone++) {
+			report.constantTracks += (clip.positionTrack(bone).keyCount == 1) + (clip.rotationTrack(bone).keyCount == 1) + (clip.scaleTrack(bone).keyCount == 1);
+		}
+		report.compressedKeys = clip.keyCount();
+		report.compressedBytes = clip.bytes();
+		// Compare at every frame and halfway to the next one.
+		for (int frame = 0; frame < frameCount; frame++) {
+			for (float fact : { 0.0f, 0.5f }) {
+				for (int bone = 0; bone < boneCount; bone++) {
+					vec3 t0, s0, t1, s1;
+					Quaternion q0, q1;
+					sampleBone(frame, fact, bone, t0, q0, s0);
+					clip.sample(frame + (nextFrame(frame) - frame) * fact, bone, t1, q1, s1);
+					report.maxPositionError = max(report.maxPositionError, (t1 - t0).getLength());
+					report.maxRotationError = max(report.maxRotationError, CompressedAnimationClip::rotationError(q0, q1));
+					report.maxScaleError = max(report.maxScaleError, (s1 - s0).getLength());
+				}
+			}
+		}
+		releaseKeys();
+		compressed = std::move(clip);
+		return report;
+	}
+
+	int keyIndex(int frame, int bone) const {
+		return frame * boneCount + bone;
+	}
 
 	vec3 interpolate(vec3 p1, vec3 p2, float t) {
 		return ((p1 * (1.0f - t)) + (p2 * t));
@@ -38,7 +156,10 @@ public:
 	}
 
 	float duration() {
-		return ((float)frames.size() / ticksPerSecond);
+		if (frameCount == 0) {
+			return 0.0f;	// Empty, e.g. a clip that failed to load; avoids 0 / 0
+		}
+		return ((float)frameCount / ticksPerSecond);
 	}
 
 	void calcFrame(float t, int& frame, float& interpolationFact)
@@ -46,20 +167,32 @@ public:
 		interpolationFact = t * ticksPerSecond;
 		frame = (int)floorf(interpolationFact);
 		interpolationFact = interpolationFact - (float)frame;
-		frame = min(frame, frames.size() - 1);
+		frame = min(frame, frameCount - 1);
 	}
 
 	int nextFrame(int frame)
 	{
-		return min(frame + 1, frames.size() - 1);
+		return min(frame + 1, frameCount - 1);
+	}
+
+	// Samples one bone's local translation, rotation and scale between baseFrame and the next frame.
+	void sampleBone(int baseFrame, float interpolationFact, int boneIndex, vec3& translation, Quaternion& rotation, vec3& scale) {
+		if (!compressed.empty()) {
+			compressed.sample(baseFrame + (nextFrame(baseFrame) - baseFrame) * interpolationFact, boneIndex, translation, rotation, scale);
+			return;
+		}
+		int a = keyIndex(baseFrame, boneIndex);
+		int b = keyIndex(nextFrame(baseFrame), boneIndex);
+		translation = interpolate(positions[a], positions[b], interpolationFact);
+		rotation = interpolate(rotations[a], rotations[b], interpolationFact);
+		scale = interpolate(scales[a], scales[b], interpolationFact);
 	}
 
 	Matrix interpolateBoneToGlobal(Matrix* matrices, int baseFrame, float interpolationFact, Skeleton* skeleton, int boneIndex) {
-		int nextFrameIndex = nextFrame(baseFrame);
-		Matrix scale = Matrix::scaling(interpolate(frames[baseFrame].scales[boneIndex], frames[nextFrameIndex].scales[boneIndex], interpolationFact));
-		Matrix rotation = interpolate(frames[baseFrame].rotations[boneIndex], frames[nextFrameIndex].rotations[boneIndex], interpolationFact).toMatrix();
-		Matrix translation = Matrix::translation(interpolate(frames[baseFrame].positions[boneIndex], frames[nextFrameIndex].positions[boneIndex], interpolationFact));
-		Matrix local = translation * rotation * scale;
+		vec3 t, s;
+		Quaternion q;
+		sampleBone(baseFrame, interpolationFact, boneIndex, t, q, s);
+		Matrix local = Matrix::translation(t) * q.toMatrix() * Matrix::scaling(s);
 		if (skeleton->bones[boneIndex].parentIndex > -1)
 		{
 			Matrix global = matrices[skeleton->bones[boneIndex].parentIndex] * local;
@@ -68,35 +201,487 @@ public:
 		return local;
 	}
 
+	// Affine version of interpolateBoneToGlobal used to build 3x4 bone palettes.
+	AffineMatrix interpolateBoneToGlobal(AffineMatrix* matrices, int baseFrame, float interpolationFact, Skeleton* skeleton, int boneIndex) {
+		vec3 t, s;
+		Quaternion q;
+		sampleBone(baseFrame, interpolationFact, boneIndex, t, q, s);
+		AffineMatrix local = AffineMatrix::fromTRS(t, q, s);
+		if (skeleton->bones[boneIndex].parentIndex > -1)
+		{
+			return matrices[skeleton->bones[boneIndex].parentIndex] * local;
+		}
+		return local;
+	}
+
+	// Samples every bone's local transform into pose. Bones flagged in
+	// collapsedBones (may be null) are left untouched.
+	void samplePose(int baseFrame, float interpolationFact, AnimationPose& pose, const unsigned char* collapsedBones = nullptr) {
+		for (int i = 0; i < boneCount; i++)
+		{
+			if (collapsedBones == nullptr || !collapsedBones[i])
+			{
+				sampleBone(baseFrame, interpolationFact, i, pose.translations[i], pose.rotations[i], pose.scales[i]);
+			}
+		}
+	}
+
+private:
+	int frameCount;
+	int boneCount;
+	unsigned char* data;	// Single allocation backing positions, rotations and scales
+	size_t dataSize;
+	CompressedAnimationClip compressed;	// Used instead of data once compressed
+
+	void releaseKeys() {
+		alignedFree(data);
+		data = nullptr;
+		dataSize = 0;
+		positions = nullptr;
+		rotations = nullptr;
+		scales = nullptr;
+	}
+
+	static size_t alignUp(size_t bytes) {
+		return (bytes + 15) & ~static_cast<size_t>(15);
+	}
+
+	void swap(AnimationSequence& other) {
+		std::swap(ticksPerSecond, other.ticksPerSecond);
+		std::swap(positions, other.positions);
+		std::swap(rotations, other.rotations);
+		std::swap(scales, other.scales);
+		std::swap(frameCount, other.frameCount);
+		std::swap(boneCount, other.boneCount);
+		std::swap(data, other.data);
+		std::swap(dataSize, other.dataSize);
+		std::swap(compressed, other.compressed);
+	}
+};
+
+// Integer handle to a clip in Animation::sequences. Resolve names to handles
+// once (findSequence) and pass handles on the per-frame path.
+typedef int AnimationHandle;
+constexpr AnimationHandle INVALID_ANIMATION_HANDLE = -1;
+
+// Final skinning palettes for one clip, sampled at a fixed rate by
+// Animation::bakePalettes. Fetching a palette is a copy or a lerp of two
+// palettes, with no sampling or hierarchy walk.
+struct BakedPalettes
+{
+	float sampleRate = 0.0f;			// Samples per second, adjusted so the last sample lands on the clip end
+	int sampleCount = 0;
+	int boneCount = 0;
+	std::vector<AffineMatrix> palettes;	// sampleCount palettes of boneCount matrices, back to back
+
+	bool empty() const {
+		return palettes.empty();
+	}
+	size_t bytes() const {
+		return palettes.size() * sizeof(AffineMatrix);
+	}
+	const AffineMatrix* palette(int sample) const {
+		return &palettes[static_cast<size_t>(sample) * boneCount];
+	}
+
+	// Writes the palette at time t, lerping the two nearest samples when
+	// interpolate is set and copying the nearest one otherwise.
+	void fetch(float t, AffineMatrix* out, bool interpolate = true) const {
+		float position = max(t, 0.0f) * sampleRate;
+		int sample = min(static_cast<int>(position), sampleCount - 1);
+		float fact = position - static_cast<float>(sample);
+		if (!interpolate && fact >= 0.5f && sample + 1 < sampleCount) {
+			sample++;
+		}
+		if (!interpolate || fact <= 0.0f || sample + 1 >= sampleCount) {
+			memcpy(out, palette(sample), sizeof(AffineMatrix) * boneCount);
+			return;
+		}
+		const float* a = reinterpret_cast<const float*>(palette(sample));
+		const float* b = reinterpret_cast<const float*>(palette(sample + 1));
+		float* o = reinterpret_cast<float*>(out);
+		float inv = 1.0f - fact;
+		for (int i = 0; i < boneCount * 12; i++) {
+			o[i] = a[i] * inv + b[i] * fact;
+		}
+	}
+};
+
+// Result of Animation::bakePalettes, one entry per clip.
+struct AnimationBakeReport
+{
+	struct Clip
+	{
+		std::string name;
+		AnimationHandle handle;
+		int samples;
+		size_t bytes;	// Size of the bake, or what it would have needed if it did not fit
+		bool baked;
+	};
+	std::vector<Clip> clips;
+	size_t totalBytes = 0;	// Bytes actually baked
+};
+
+// Decodes clips on request for Animation::setClipSource. Clips are numbered in
+// the source's own order.
+class AnimationClipSource
+{
+public:
+	virtual ~AnimationClipSource() {}
+	virtual int getClipCount() const = 0;
+	virtual std::string getClipName(int clip) const = 0;
+	// Fills sequence with the clip's keys. Called with the animation's load lock
+	// held, so one call runs at a time per animation.
+	virtual bool loadClip(int clip, AnimationSequence& sequence) = 0;
 };
 
 class Animation
 {
 public:
-	std::map<std::string, AnimationSequence> animations;
+	std::vector<AnimationSequence> sequences;			// Clips, indexed by AnimationHandle; use getSequence with a clip source
+	std::map<std::string, AnimationHandle> sequenceNames;	// Clip name to handle, used only when resolving
 	Skeleton skeleton;
-	void calcFrame(std::string name, float t, int& frame, float& interpolationFact) {
-		animations[name].calcFrame(t, frame, interpolationFact);
+	std::vector<BakedPalettes> bakedPalettes;		// Optional, indexed by AnimationHandle; see bakePalettes
+
+	// Adds (or replaces) a named clip and returns its handle. A clip added
+	// after setClipSource, or replacing one of its clips, is resident for good.
+	AnimationHandle addSequence(const std::string& name, AnimationSequence sequence) {
+		auto it = sequenceNames.find(name);
+		if (it != sequenceNames.end()) {
+			sequences[it->second] = std::move(sequence);
+			if (it->second < static_cast<AnimationHandle>(bakedPalettes.size())) {
+				bakedPalettes[it->second] = BakedPalettes();
+			}
+			if (isLazy(it->second)) {
+				lazyClips->clips[it->second] = -1;
+				lazyClips->loaded[it->second].store(true, std::memory_order_release);
+			}
+			return it->second;
+		}
+		sequences.push_back(std::move(sequence));
+		AnimationHandle handle = static_cast<AnimationHandle>(sequences.size() - 1);
+		sequenceNames.insert({ name, handle });
+		return handle;
+	}
+	// Returns INVALID_ANIMATION_HANDLE if no clip has this name.
+	AnimationHandle findSequence(const std::string& name) const {
+		auto it = sequenceNames.find(name);
+		return it != sequenceNames.end() ? it->second : INVALID_ANIMATION_HANDLE;
+	}
+	bool hasSequence(const std::string& name) const {
+		return findSequence(name) != INVALID_ANIMATION_HANDLE;
+	}
+	// Clips from a clip source are decoded here on first use, so this is safe
+	// to call from animation jobs. Marks the clip as used this frame. A clip
+	// whose load failed stays empty (no frames) and is not tried again.
+	AnimationSequence& getSequence(AnimationHandle handle) {
+		if (isLazy(handle)) {
+			lazyClips->lastUsed[handle].store(lazyClips->frame.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			if (!lazyClips->loaded[handle].load(std::memory_order_acquire) && !lazyClips->failed[handle].load(std::memory_order_acquire)) {
+				loadSequence(handle);
+			}
+		}
+		return sequences[handle];
+	}
+
+	// Registers every clip of source without decoding it; each one is loaded by
+	// the first getSequence for it, then compressed if compress is set. The
+	// skeleton must be filled separately. Call once; clips added earlier stay as
+	// they are.
+	void setClipSource(std::shared_ptr<AnimationClipSource> source, bool compress = false, const AnimationCompressionSettings& settings = AnimationCompressionSettings()) {
+		std::vector<int> clips(sequences.size(), -1);
+		for (int i = 0; i < source->getClipCount(); i++) {
+			AnimationHandle handle = addSequence(source->getClipName(i), AnimationSequence());
+			clips.resize(sequences.size(), -1);
+			clips[handle] = i;
+		}
+		lazyClips.reset(new LazyClips(sequences.size()));
+		lazyClips->source = std::move(source);
+		lazyClips->compress = compress;
+		lazyClips->compressionSettings = settings;
+		lazyClips->clips = std::move(clips);
+		for (size_t i = 0; i < sequences.size(); i++) {
+			lazyClips->loaded[i].store(lazyClips->clips[i] < 0);
+			lazyClips->failed[i].store(false);
+		}
+	}
+	bool isSequenceLoaded(AnimationHandle handle) const {
+		return !isLazy(handle) || lazyClips->loaded[handle].load(std::memory_order_acquire);
+	}
+	// Whether the clip source failed to load the clip.
+	bool hasSequenceFailed(AnimationHandle handle) const {
+		return isLazy(handle) && lazyClips->failed[handle].load(std::memory_order_acquire);
+	}
+	// Advances the frame counter that evictUnusedSequences measures against.
+	void beginFrame() {
+		if (lazyClips) {
+			lazyClips->frame.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	// Frees source clips not requested in the last unusedFrames frames; they are
+	// decoded again if needed. Returns the number evicted. Must not run while
+	// any job may be evaluating this animation.
+	int evictUnusedSequences(unsigned int unusedFrames) {
+		if (!lazyClips) {
+			return 0;
+		}
+		int evicted = 0;
+		uint32_t frame = lazyClips->frame.load(std::memory_order_relaxed);
+		for (size_t i = 0; i < lazyClips->clips.size(); i++) {
+			if (lazyClips->clips[i] < 0 || !lazyClips->loaded[i].load(std::memory_order_relaxed)) {
+				continue;
+			}
+			if (frame - lazyClips->lastUsed[i].load(std::memory_order_relaxed) >= unusedFrames) {
+				sequences[i] = AnimationSequence();
+				lazyClips->loaded[i].store(false, std::memory_order_relaxed);
+				evicted++;
+			}
+		}
+		return evicted;
+	}
+	// Keyframe memory of the clips currently resident.
+	size_t residentKeyBytes() const {
+		size_t bytes = 0;
+		for (const AnimationSequence& sequence : sequences) {
+			bytes += sequence.keyframeBytes();
+		}
+		return bytes;
+	}
+
+	void calcFrame(AnimationHandle handle, float t, int& frame, float& interpolationFact) {
+		getSequence(handle).calcFrame(t, frame, interpolationFact);
+	}
+	Matrix interpolateBoneToGlobal(AnimationHandle handle, Matrix* matrices, int baseFrame, float interpolationFact, int boneIndex) {
+		return getSequence(handle).interpolateBoneToGlobal(matrices, baseFrame, interpolationFact, &skeleton, boneIndex);
 	}
-	Matrix interpolateBoneToGlobal(std::string name, Matrix* matrices, int baseFrame, float interpolationFact, int boneIndex) {
-		return animations[name].interpolateBoneToGlobal(matrices, baseFrame, interpolationFact, &skeleton, boneIndex);
+	AffineMatrix interpolateBoneToGlobal(AnimationHandle handle, AffineMatrix* matrices, int baseFrame, float interpolationFact, int boneIndex) {
+		return getSequence(handle).interpolateBoneToGlobal(matrices, baseFrame, interpolationFact, &skeleton, boneIndex);
 	}
+
+	// Name-based convenience versions. These resolve the name on every call, so
+	// keep them off per-bone and per-frame paths.
+	void calcFrame(const std::string& name, float t, int& frame, float& interpolationFact) {
+		calcFrame(findSequence(name), t, frame, interpolationFact);
+	}
+	Matrix interpolateBoneToGlobal(const std::string& name, Matrix* matrices, int baseFrame, float interpolationFact, int boneIndex) {
+		return interpolateBoneToGlobal(findSequence(name), matrices, baseFrame, interpolationFact, boneIndex);
+	}
+	AffineMatrix interpolateBoneToGlobal(const std::string& name, AffineMatrix* matrices, int baseFrame, float interpolationFact, int boneIndex) {
+		return interpolateBoneToGlobal(findSequence(name), matrices, baseFrame, interpolationFact, boneIndex);
+	}
+
 	void calcFinalTransforms(Matrix* matrices)
 	{
-		for (int i = 0; i < skeleton.bones.size(); i++)
+		for (size_t i = 0; i < skeleton.bones.size(); i++)
 		{
 			matrices[i] = matrices[i] * skeleton.bones[i].offset * skeleton.globalInverse;
 		}
 	}
+	// Bone offsets and the global inverse are affine, so the 3x4 palette is the
+	// top three rows of the 4x4 one.
+	void calcFinalTransforms(AffineMatrix* matrices)
+	{
+		AffineMatrix globalInverse(skeleton.globalInverse);
+		for (size_t i = 0; i < skeleton.bones.size(); i++)
+		{
+			matrices[i] = matrices[i] * AffineMatrix(skeleton.bones[i].offset) * globalInverse;
+		}
+	}
+	// As above, but bones flagged in collapsedBones take their parent's final
+	// transform, so their vertices follow the parent rigidly in bind pose. Only
+	// valid for non-root bones that are not parents of evaluated bones (leaves).
+	void calcFinalTransforms(AffineMatrix* matrices, const unsigned char* collapsedBones)
+	{
+		AffineMatrix globalInverse(skeleton.globalInverse);
+		for (size_t i = 0; i < skeleton.bones.size(); i++)
+		{
+			if (collapsedBones[i])
+			{
+				matrices[i] = matrices[skeleton.bones[i].parentIndex];
+				continue;
+			}
+			matrices[i] = matrices[i] * AffineMatrix(skeleton.bones[i].offset) * globalInverse;
+		}
+	}
+
+	// Evaluates the final palette of a clip at time t (seconds). Bones flagged in
+	// collapsedBones (may be null) are not sampled. A clip without frames, such
+	// as one that failed to load, leaves matrices unchanged.
+	void evaluatePalette(AnimationHandle handle, float t, AffineMatrix* matrices, const unsigned char* collapsedBones = nullptr)
+	{
+		int frame = 0;
+		float interpolationFact = 0;
+		AnimationSequence& sequence = getSequence(handle);
+		if (sequence.getFrameCount() == 0)
+		{
+			return;
+		}
+		sequence.calcFrame(t, frame, interpolationFact);
+		if (collapsedBones == nullptr)
+		{
+			for (size_t i = 0; i < skeleton.bones.size(); i++)
+			{
+				matrices[i] = sequence.interpolateBoneToGlobal(matrices, frame, interpolationFact, &skeleton, i);
+			}
+			calcFinalTransforms(matrices);
+			return;
+		}
+		for (size_t i = 0; i < skeleton.bones.size(); i++)
+		{
+			if (!collapsedBones[i])
+			{
+				matrices[i] = sequence.interpolateBoneToGlobal(matrices, frame, interpolationFact, &skeleton, i);
+			}
+		}
+		calcFinalTransforms(matrices, collapsedBones);
+	}
+
+	// Samples a clip's local pose at time t (seconds), without the hierarchy. A
+	// clip without frames leaves pose unchanged.
+	void evaluatePose(AnimationHandle handle, float t, AnimationPose& pose, const unsigned char* collapsedBones = nullptr)
+	{
+		int frame = 0;
+		float interpolationFact = 0;
+		AnimationSequence& sequence = getSequence(handle);
+		if (sequence.getFrameCount() == 0)
+		{
+			return;
+		}
+		sequence.calcFrame(t, frame, interpolationFact);
+		sequence.samplePose(frame, interpolationFact, pose, collapsedBones);
+	}
+
+	// Walks the hierarchy once over a local pose and writes the final palette.
+	void poseToPalette(const AnimationPose& pose, AffineMatrix* matrices, const unsigned char* collapsedBones = nullptr)
+	{
+		for (size_t i = 0; i < skeleton.bones.size(); i++)
+		{
+			if (collapsedBones != nullptr && collapsedBones[i])
+			{
+				continue;
+			}
+			AffineMatrix local = AffineMatrix::fromTRS(pose.translations[i], pose.rotations[i], pose.scales[i]);
+			int parent = skeleton.bones[i].parentIndex;
+			matrices[i] = parent > -1 ? matrices[parent] * local : local;
+		}
+		if (collapsedBones == nullptr)
+		{
+			calcFinalTransforms(matrices);
+		}
+		else
+		{
+			calcFinalTransforms(matrices, collapsedBones);
+		}
+	}
+
+	// Precomputes final palettes for every clip at sampleRate samples per second.
+	// Clips are baked in handle order until budgetBytes is used up; clips that do
+	// not fit stay on live evaluation. Replaces any previous bake.
+	AnimationBakeReport bakePalettes(float sampleRate, size_t budgetBytes)
+	{
+		AnimationBakeReport report;
+		bakedPalettes.clear();
+		bakedPalettes.resize(sequences.size());
+		std::vector<std::string> names(sequences.size());
+		for (const auto& entry : sequenceNames) {
+			names[entry.second] = entry.first;
+		}
+		int bones = static_cast<int>(skeleton.bones.size());
+		for (AnimationHandle handle = 0; handle < static_cast<AnimationHandle>(sequences.size()); handle++)
+		{
+			float clipDuration = getSequence(handle).duration();
+			int intervals = max(static_cast<int>(ceilf(clipDuration * sampleRate)), 1);
+			int samples = intervals + 1;
+			size_t bytes = static_cast<size_t>(samples) * bones * sizeof(AffineMatrix);
+			bool fits = report.totalBytes + bytes <= budgetBytes;
+			report.clips.push_back({ names[handle], handle, samples, bytes, fits });
+			if (!fits) {
+				continue;
+			}
+			BakedPalettes& bake = bakedPalettes[handle];
+			bake.sampleRate = clipDuration > 0.0f ? intervals / clipDuration : 0.0f;
+			bake.sampleCount = samples;
+			bake.boneCount = bones;
+			bake.palettes.resize(static_cast<size_t>(samples) * bones);
+			for (int k = 0; k < samples; k++)
+			{
+				float t = k == intervals ? clipDuration : k / bake.sampleRate;
+				evaluatePalette(handle, bake.sampleRate > 0.0f ? t : 0.0f, &bake.palettes[static_cast<size_t>(k) * bones]);
+			}
+			report.totalBytes += bytes;
+		}
+		return report;
+	}
+
+	// Returns the bake for a clip, or null if it is evaluated live.
+	const BakedPalettes* findBakedPalettes(AnimationHandle handle) const
+	{
+		if (handle < 0 || handle >= static_cast<AnimationHandle>(bakedPalettes.size()) || bakedPalettes[handle].empty()) {
+			return nullptr;
+		}
+		return &bakedPalettes[handle];
+	}
+
+private:
+	// State of clips registered by setClipSource, indexed by handle.
+	struct LazyClips
+	{
+		std::shared_ptr<AnimationClipSource> source;
+		bool compress = false;
+		AnimationCompressionSettings compressionSettings;
+		std::vector<int> clips;		// Source clip, or -1 for clips added directly
+		std::unique_ptr<std::atomic<bool>[]> loaded;
+		std::unique_ptr<std::atomic<bool>[]> failed;	// The source could not load the clip
+		std::unique_ptr<std::atomic<uint32_t>[]> lastUsed;
+		std::atomic<uint32_t> frame;
+		std::mutex loadLock;
+
+		explicit LazyClips(size_t count) : loaded(new std::atomic<bool>[count]), failed(new std::atomic<bool>[count]), lastUsed(new std::atomic<uint32_t>[count]), frame(0) {
+			for (size_t i = 0; i < count; i++) {
+				lastUsed[i].store(0);
+			}
+		}
+	};
+	std::unique_ptr<LazyClips> lazyClips;
+
+	// Whether handle is a clip source clip. Handles added after setClipSource
+	// lie past the end of lazyClips' arrays and are always resident.
+	bool isLazy(AnimationHandle handle) const {
+		return lazyClips && handle >= 0 && static_cast<size_t>(handle) < lazyClips->clips.size() && lazyClips->clips[handle] >= 0;
+	}
+
+	void loadSequence(AnimationHandle handle) {
+		std::lock_guard<std::mutex> lock(lazyClips->loadLock);
+		if (lazyClips->loaded[handle].load(std::memory_order_relaxed) || lazyClips->failed[handle].load(std::memory_order_relaxed)) {
+			return;
+		}
+		AnimationSequence sequence;
+		if (!lazyClips->source->loadClip(lazyClips->clips[handle], sequence)) {
+			// Keeps the empty clip, which evaluates to no change
+			lazyClips->failed[handle].store(true, std::memory_order_release);
+			return;
+		}
+		if (lazyClips->compress) {
+			sequence.compress(lazyClips->compressionSettings);
+		}
+		sequences[handle] = std::move(sequence);
+		lazyClips->loaded[handle].store(true, std::memory_order_release);
+	}
 };
 
 class AnimationInstance
 {
 public:
 	Animation* animation;
-	std::string currentAnimation;
-	float t;
-	Matrix matrices[256];
+	AnimationHandle currentSequence = INVALID_ANIMATION_HANDLE;
+	float t = 0;
+	AffineMatrix matrices[MAX_ANIMATION_BONES];	// Bone palette as 3x4 rows, uploaded to VShaderAnim.hlsl
+
+	// Cross-fade state, see crossFade. fadeSequence is the clip being faded out.
+	AnimationHandle fadeSequence = INVALID_ANIMATION_HANDLE;
+	float fadeT = 0;
+	float fadeElapsed = 0;
+	float fadeDuration = 0;
 
 	void resetAnimationTime()
 	{
@@ -104,31 +689,91 @@ public:
 	}
 	bool animationFinished()
 	{
-		if (t > animation->animations[currentAnimation].duration())
+		if (t > animation->getSequence(currentSequence).duration())
 		{
 			return true;
 		}
 		return false;
 	}
 
-	void update(std::string name, float dt) {
-		if (name == currentAnimation) {
+	// Advances and evaluates the clip behind handle. Does no string work and no
+	// heap allocation. Baked clips are fetched from their palette cache; otherwise
+	// bones flagged in collapsedBones (may be null) are not sampled, see
+	// Animation::calcFinalTransforms.
+	void update(AnimationHandle handle, float dt, const unsigned char* collapsedBones = nullptr) {
+		if (handle == INVALID_ANIMATION_HANDLE) {
+			return;
+		}
+		if (handle == currentSequence) {
 			t += dt;
 		}
 		else {
-			currentAnimation = name;  t = 0;
+			currentSequence = handle;  t = 0;
+			fadeSequence = INVALID_ANIMATION_HANDLE;
 		}
 		if (animationFinished() == true) { 
 			resetAnimationTime(); 
 		}
-		int frame = 0;
-		float interpolationFact = 0;
-		animation->calcFrame(name, t, frame, interpolationFact);
-		for (int i = 0; i < animation->skeleton.bones.size(); i++)
-		{
-			matrices[i] = animation->interpolateBoneToGlobal(name, matrices, frame, interpolationFact, i);
+		if (fadeSequence != INVALID_ANIMATION_HANDLE) {
+			fadeElapsed += dt;
+			if (fadeElapsed < fadeDuration) {
+				fadeT += dt;
+				if (fadeT > animation->getSequence(fadeSequence).duration()) {
+					fadeT = 0;
+				}
+				// Blend local poses, then walk the hierarchy once for both clips.
+				AnimationPose* scratch = scratchPoses();
+				AnimationPose& pose = scratch[0];
+				AnimationPose& fadePose = scratch[1];
+				animation->evaluatePose(fadeSequence, fadeT, fadePose, collapsedBones);
+				animation->evaluatePose(handle, t, pose, collapsedBones);
+				blendPoses(pose, fadePose, pose, fadeElapsed / fadeDuration, static_cast<int>(animation->skeleton.bones.size()));
+				animation->poseToPalette(pose, matrices, collapsedBones);
+				return;
+			}
+			fadeSequence = INVALID_ANIMATION_HANDLE;
+		}
+		if (const BakedPalettes* baked = animation->findBakedPalettes(handle)) {
+			baked->fetch(t, matrices);
+			return;
 		}
-		animation->calcFinalTransforms(matrices);
+		animation->evaluatePalette(handle, t, matrices, collapsedBones);
 	}
 
+	// Switches to handle, fading out the current clip over duration seconds. The
+	// outgoing clip keeps playing while it fades. Starting a new fade mid-fade
+	// drops the older clip; a duration of 0 or no current clip switches at once.
+	void crossFade(AnimationHandle handle, float duration) {
+		if (handle == currentSequence) {
+			return;
+		}
+		if (duration > 0.0f && currentSequence != INVALID_ANIMATION_HANDLE && handle != INVALID_ANIMATION_HANDLE) {
+			fadeSequence = currentSequence;
+			fadeT = t;
+			fadeElapsed = 0;
+			fadeDuration = duration;
+		}
+		else {
+			fadeSequence = INVALID_ANIMATION_HANDLE;
+		}
+		currentSequence = handle;
+		t = 0;
+	}
+
+	bool isFading() const {
+		return fadeSequence != INVALID_ANIMATION_HANDLE;
+	}
+
+	// Resolves name and forwards to the handle version.
+	void update(const std::string& name, float dt) {
+		update(animation->findSequence(name), dt);
+	}
+
+private:
+	// Poses a fade blends, one pair per thread and so per job system worker,
+	// rather than two in every instance. Only used within update.
+	static AnimationPose* scratchPoses() {
+		thread_local AnimationPose poses[2];
+		return poses;
+	}
 };
\ No newline at end of file
@@ -0,0 +1,268 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include "core.h"
+
+// Error tolerances for AnimationSequence::compress. Keys are dropped while
+// interpolating the remaining ones stays within tolerance of every original key.
+struct AnimationCompressionSettings
+{
+	float positionTolerance = 0.001f;	// Model units
+	float rotationTolerance = 0.001f;	// Radians
+	float scaleTolerance = 0.001f;
+	std::vector<float> boneToleranceScale;	// Optional per-bone multiplier, e.g. < 1 near the root
+};
+
+// Measured result of compressing one clip.
+struct AnimationCompressionReport
+{
+	size_t originalBytes = 0;
+	size_t compressedBytes = 0;
+	int tracks = 0;				// Position, rotation and scale track per bone
+	int constantTracks = 0;		// Reduced to a single key
+	int originalKeys = 0;
+	int compressedKeys = 0;
+	float maxPositionError = 0.0f;	// Against the uncompressed sampler, at every frame and midpoint
+	float maxRotationError = 0.0f;	// Radians
+	float maxScaleError = 0.0f;
+
+	float ratio() const {
+		return compressedBytes > 0 ? static_cast<float>(originalBytes) / compressedBytes : 0.0f;
+	}
+};
+
+// Compressed keyframes for one clip. Every bone has a position, rotation and
+// scale track holding only the keys that survived reduction, with frame numbers
+// stored as 16 bits. Constant tracks keep one key. Rotations are quantized to
+// 48 bits with the smallest-three encoding: the index of the largest component
+// plus the other three at 15 bits each.
+class CompressedAnimationClip
+{
+public:
+	struct Track
+	{
+		uint32_t firstKey;	// Into the key pool of the track's kind
+		uint32_t keyCount;
+	};
+
+	bool empty() const {
+		return tracks.empty();
+	}
+
+	size_t bytes() const {
+		return tracks.size() * sizeof(Track) +
+			vectorKeyFrames.size() * sizeof(uint16_t) + vectorKeys.size() * sizeof(vec3) +
+			rotationKeyFrames.size() * sizeof(uint16_t) + rotationKeys.size() * sizeof(uint16_t);
+	}
+
+	int keyCount() const {
+		return static_cast<int>(vectorKeyFrames.size() + rotationKeyFrames.size());
+	}
+
+	const Track& positionTrack(int bone) const { return tracks[bone * 3]; }
+	const Track& rotationTrack(int bone) const { return tracks[bone * 3 + 1]; }
+	const Track& scaleTrack(int bone) const { return tracks[bone * 3 + 2]; }
+
+	// Builds the clip from SoA keys indexed frame * boneCount + bone.
+	void build(const vec3* positions, const Quaternion* rotations, const vec3* scales, int frameCount, int boneCount,
+		const AnimationCompressionSettings& settings) {
+		clear();
+		if (frameCount == 0) {
+			return;
+		}
+		if (frameCount > 65536) {
+			throw std::runtime_error("Animation clip has too many frames to compress");
+		}
+		std::vector<vec3> vectorTrack(frameCount);
+		std::vector<Quaternion> rotationTrack(frameCount), quantized(frameCount);
+		for (int bone = 0; bone < boneCount; bone++) {
+			float boneScale = bone < static_cast<int>(settings.boneToleranceScale.size()) ? settings.boneToleranceScale[bone] : 1.0f;
+
+			for (int f = 0; f < frameCount; f++) vectorTrack[f] = positions[f * boneCount + bone];
+			tracks.push_back(reduceVectorTrack(vectorTrack, settings.positionTolerance * boneScale));
+
+			for (int f = 0; f < frameCount; f++) {
+				rotationTrack[f] = rotations[f * boneCount + bone];
+				uint16_t packed[3];
+				encodeRotation(rotationTrack[f], packed);
+				quantized[f] = decodeRotation(packed);
+			}
+			tracks.push_back(reduceRotationTrack(rotationTrack, quantized, settings.rotationTolerance * boneScale));
+
+			for (int f = 0; f < frameCount; f++) vectorTrack[f] = scales[f * boneCount + bone];
+			tracks.push_back(reduceVectorTrack(vectorTrack, settings.scaleTolerance * boneScale));
+		}
+	}
+
+	void clear() {
+		tracks.clear();
+		vectorKeyFrames.clear();
+		vectorKeys.clear();
+		rotationKeyFrames.clear();
+		rotationKeys.clear();
+	}
+
+	// Samples a bone at a fractional frame position.
+	void sample(float frame, int bone, vec3& translation, Quaternion& rotation, vec3& scale) const {
+		translation = sampleVector(positionTrack(bone), frame);
+		rotation = sampleRotation(rotationTrack(bone), frame);
+		scale = sampleVector(scaleTrack(bone), frame);
+	}
+
+	static void encodeRotation(const Quaternion& q, uint16_t out[3]) {
+		int largest = 0;
+		for (int i = 1; i < 4; i++) {
+			if (fabsf(q.q[i]) > fabsf(q.q[largest])) largest = i;
+		}
+		// q and -q are the same rotation; flip so the dropped component is positive.
+		float sign = q.q[largest] < 0.0f ? -1.0f : 1.0f;
+		uint64_t bits = static_cast<uint64_t>(largest) << 45;
+		int shift = 30;
+		for (int i = 0; i < 4; i++) {
+			if (i == largest) continue;
+			float v = q.q[i] * sign * ROTATION_RANGE + 0.5f;
+			v = min(max(v, 0.0f), 1.0f);
+			bits |= static_cast<uint64_t>(v * 32767.0f + 0.5f) << shift;
+			shift -= 15;
+		}
+		out[0] = static_cast<uint16_t>(bits >> 32);
+		out[1] = static_cast<uint16_t>(bits >> 16);
+		out[2] = static_cast<uint16_t>(bits);
+	}
+
+	static Quaternion decodeRotation(const uint16_t in[3]) {
+		uint64_t bits = (static_cast<uint64_t>(in[0]) << 32) | (static_cast<uint64_t>(in[1]) << 16) | in[2];
+		int largest = static_cast<int>((bits >> 45) & 3);
+		Quaternion q;
+		float sum = 0.0f;
+		int shift = 30;
+		for (int i = 0; i < 4; i++) {
+			if (i == largest) continue;
+			float v = (static_cast<float>((bits >> shift) & 0x7FFF) / 32767.0f - 0.5f) / ROTATION_RANGE;
+			q.q[i] = v;
+			sum += v * v;
+			shift -= 15;
+		}
+		q.q[largest] = sqrtf(max(1.0f - sum, 0.0f));
+		return q;
+	}
+
+	// Angle between two rotations, ignoring the sign of the quaternions. Uses the
+	// chord length |a - b| = 2 sin(angle / 4), which unlike acos of the dot
+	// product stays accurate for the tiny angles tolerances are measured in.
+	static float rotationError(const Quaternion& a, const Quaternion& b) {
+		float dot = a.q[0] * b.q[0] + a.q[1] * b.q[1] + a.q[2] * b.q[2] + a.q[3] * b.q[3];
+		float sign = dot < 0.0f ? -1.0f : 1.0f;
+		float chord = 0.0f;
+		for (int i = 0; i < 4; i++) {
+			float d = a.q[i] - b.q[i] * sign;
+			chord += d * d;
+		}
+		return 4.0f * asinf(min(sqrtf(chord) * 0.5f, 1.0f));
+	}
+
+private:
+	// The three stored components lie in [-1/sqrt(2), 1/sqrt(2)]; scaling by
+	// sqrt(2)/2 maps them to [-0.5, 0.5] before quantizing.
+	static constexpr float ROTATION_RANGE = 0.70710678f;
+
+	std::vector<Track> tracks;				// Three per bone: position, rotation, scale
+	std::vector<uint16_t> vectorKeyFrames;	// Key frames of position and scale tracks
+	std::vector<vec3> vectorKeys;
+	std::vector<uint16_t> rotationKeyFrames;
+	std::vector<uint16_t> rotationKeys;		// Three words per key
+
+	static vec3 lerp(const vec3& a, const vec3& b, float t) {
+		return a * (1.0f - t) + b * t;
+	}
+
+	// Finds the key pair around frame: key k and k + 1, with t between them.
+	static uint32_t findSegment(const uint16_t* frames, uint32_t count, float frame, float& t) {
+		const uint16_t* upper = std::upper_bound(frames, frames + count, frame,
+			[](float value, uint16_t key) { return value < static_cast<float>(key); });
+		uint32_t k = upper == frames ? 0 : static_cast<uint32_t>(upper - frames) - 1;
+		if (k + 1 >= count) {
+			t = 0.0f;
+			return count - 1;
+		}
+		t = (frame - frames[k]) / static_cast<float>(frames[k + 1] - frames[k]);
+		return k;
+	}
+
+	vec3 sampleVector(const Track& track, float frame) const {
+		if (track.keyCount == 1) {
+			return vectorKeys[track.firstKey];
+		}
+		float t;
+		uint32_t k = track.firstKey + findSegment(&vectorKeyFrames[track.firstKey], track.keyCount, frame, t);
+		return t > 0.0f ? lerp(vectorKeys[k], vectorKeys[k + 1], t) : vectorKeys[k];
+	}
+
+	Quaternion sampleRotation(const Track& track, float frame) const {
+		if (track.keyCount == 1) {
+			return decodeRotation(&rotationKeys[track.firstKey * 3]);
+		}
+		float t;
+		uint32_t k = track.firstKey + findSegment(&rotationKeyFrames[track.firstKey], track.keyCount, frame, t);
+		Quaternion a = decodeRotation(&rotationKeys[k * 3]);
+		return t > 0.0f ? Quaternion::slerp(a, decodeRotation(&rotationKeys[(k + 1) * 3]), t) : a;
+	}
+
+	// Greedy reduction: from each kept key, extend to the furthest key such that
+	// interpolating between the two reproduces every skipped key within tolerance.
+	template<typename Value, typename Interpolate, typename Error>
+	static void reduceKeys(const std::vector<Value>& original, const std::vector<Value>& stored, float tolerance,
+		Interpolate interpolate, Error error, std::vector<int>& kept) {
+		int frameCount = static_cast<int>(original.size());
+		kept.clear();
+		bool constant = true;
+		for (int f = 1; f < frameCount && constant; f++) {
+			constant = error(stored[0], original[f]) <= tolerance;
+		}
+		kept.push_back(0);
+		if (constant) {
+			return;
+		}
+		int start = 0;
+		while (start < frameCount - 1) {
+			int end = start + 1;
+			for (int candidate = start + 2; candidate < frameCount; candidate++) {
+				bool fits = true;
+				for (int f = start + 1; f < candidate && fits; f++) {
+					float t = static_cast<float>(f - start) / (candidate - start);
+					fits = error(interpolate(stored[start], stored[candidate], t), original[f]) <= tolerance;
+				}
+				if (!fits) break;
+				end = candidate;
+			}
+			kept.push_back(end);
+			start = end;
+		}
+	}
+
+	Track reduceVectorTrack(const std::vector<vec3>& values, float tolerance) {
+		std::vector<int> kept;
+		reduceKeys(values, values, tolerance, lerp,
+			[](const vec3& a, const vec3& b) { return (a - b).getLength(); }, kept);
+		Track track = { static_cast<uint32_t>(vectorKeyFrames.size()), static_cast<uint32_t>(kept.size()) };
+		for (int f : kept) {
+			vectorKeyFrames.push_back(static_cast<uint16_t>(f));
+			vectorKeys.push_back(values[f]);
+		}
+		return track;
+	}
+
+	Track reduceRotationTrack(const std::vector<Quaternion>& values, const std::vector<Quaternion>& quantized, float tolerance) {
+		std::vector<int> kept;
+		reduceKeys(values, quantized, tolerance, Quaternion::slerp, rotationError, kept);
+		Track track = { static_cast<uint32_t>(rotationKeyFrames.size()), static_cast<uint32_t>(kept.size()) };
+		for (int f : kept) {
+			uint16_t packed[3];
+			encodeRotation(values[f], packed);
+			rotationKeyFrames.push_back(static_cast<uint16_t>(f));
+			rotationKeys.insert(rotationKeys.end(), packed, packed + 3);
+		}
+		return track;
+	}
+};
@@ -1,28 +1,68 @@
+#pragma once
 #include <string>
 #include <unordered_map>
 #include <functional>
+#include "Animation.h"
 
 // The AnimationController defines a simple state machine for controlling animations.
 // This class manages animation states and transitions, allowing for dynamic changes based on game logic.
 class AnimationController {
 private:
     std::unordered_map<std::string, std::function<void()>> states;  // Map of animation states to their actions.
+    std::unordered_map<std::string, AnimationHandle> clips;         // Map of animation states to their clip handles.
+    std::unordered_map<std::string, float> fadeTimes;               // Cross-fade times keyed by "from->to".
     std::string currentState;   // Tracks the currently active state.
+    AnimationHandle currentClip = INVALID_ANIMATION_HANDLE;  // Clip handle of the current state.
+    float defaultFadeTime = 0.0f;   // Cross-fade time for transitions without their own.
+    float fadeTime = 0.0f;          // Cross-fade time of the latest transition.
 public:
     // Adds a new animation state with a corresponding on-enter action.
     void addState(const std::string& state, std::function<void()> onEnter) {
         states[state] = onEnter;    // Map the state name to its callback function.
     }
 
+    // Adds a new animation state that plays a pre-resolved clip handle.
+    void addState(const std::string& state, AnimationHandle clip, std::function<void()> onEnter) {
+        states[state] = onEnter;
+        clips[state] = clip;
+    }
+
+    // Sets the cross-fade time used by transitions without a specific one.
+    void setDefaultFadeTime(float seconds) {
+        defaultFadeTime = seconds;
+    }
+
+    // Sets the cross-fade time for transitions from one state to another.
+    void setFadeTime(const std::string& from, const std::string& to, float seconds) {
+        fadeTimes[from + "->" + to] = seconds;
+    }
+
     // Transitions to a new animation state if it's different from the current state.
-    // Executes the on-enter action for the new state.
+    // Executes the on-enter action for the new state. Staying in the current
+    // state is a plain string compare, so calling this every frame is cheap.
     void transitionTo(const std::string& newState) {
         if (currentState != newState && states.find(newState) != states.end()) {
+            auto fade = fadeTimes.empty() ? fadeTimes.end() : fadeTimes.find(currentState + "->" + newState);
+            fadeTime = fade != fadeTimes.end() ? fade->second : defaultFadeTime;
             currentState = newState;
+            auto clip = clips.find(newState);
+            currentClip = clip != clips.end() ? clip->second : INVALID_ANIMATION_HANDLE;
             states[newState]();
         }
     }
 
+    // Retrieves the clip handle of the current state, or INVALID_ANIMATION_HANDLE
+    // if the state was added without one.
+    AnimationHandle getCurrentClip() const {
+        return currentClip;
+    }
+
+    // Cross-fade time of the latest transition, for AnimationInstance::crossFade
+    // in the on-enter action.
+    float getFadeTime() const {
+        return fadeTime;
+    }
+
     // Retrieves the name of the current animation state.
     const std::string& getCurrentState() const {
         return currentState;
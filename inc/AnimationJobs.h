@@ -0,0 +1,26 @@
+#pragma once
+#include "JobSystem.h"
+#include "Animation.h"
+
+// One instance to advance this frame, the clip it should play and by how much.
+struct AnimationUpdateRequest
+{
+	AnimationInstance* instance;
+	AnimationHandle clip;
+	float dt;
+	const unsigned char* collapsedBones = nullptr;	// Optional, see AnimationInstance::update
+};
+
+// Updates a batch of animation instances on the job system and returns once
+// every palette is written, so constant buffers can be filled straight after.
+// Instances are independent and each writes only its own palette, so the
+// results are identical for any worker count.
+inline void updateAnimationInstances(JobSystem& jobs, const std::vector<AnimationUpdateRequest>& requests, size_t instancesPerJob = 4)
+{
+	const AnimationUpdateRequest* batch = requests.data();
+	jobs.parallelFor(requests.size(), instancesPerJob, [batch](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			batch[i].instance->update(batch[i].clip, batch[i].dt, batch[i].collapsedBones);
+		}
+	});
+}
@@ -0,0 +1,170 @@
+#pragma once
+#include "AnimationJobs.h"
+
+// Distance bands and thresholds used by AnimationLOD.
+struct AnimationLODSettings
+{
+	float fullRateDistance = 30.0f;			// Closer than this: evaluated every frame
+	float halfRateDistance = 60.0f;			// Closer than this: every 2nd frame, beyond: every 4th
+	float boundingRadius = 5.0f;			// Instance radius used to estimate its size on screen
+	float fieldOfView = (float)M_PI / 4.0f;	// Vertical field of view of the camera
+	float leafScreenSize = 0.1f;			// Leaf bones collapse below this fraction of screen height, 0 disables
+};
+
+// Per-frame counters, reset by AnimationLOD::beginFrame.
+struct AnimationLODStats
+{
+	static const int TIERS = 3;	// Evaluated every frame, every 2nd, every 4th
+
+	int instances = 0;
+	int instancesEvaluated = 0;
+	int instancesSkipped = 0;	// Kept last frame's palette
+	int bonesEvaluated = 0;
+	int bonesSaved = 0;			// Not sampled because of a skipped frame or a collapsed leaf
+	int evaluatedPerTier[TIERS] = {};
+	int skippedPerTier[TIERS] = {};
+
+	// Accumulates another frame's counters, for reports over several frames.
+	void add(const AnimationLODStats& other)
+	{
+		instances += other.instances;
+		instancesEvaluated += other.instancesEvaluated;
+		instancesSkipped += other.instancesSkipped;
+		bonesEvaluated += other.bonesEvaluated;
+		bonesSaved += other.bonesSaved;
+		for (int tier = 0; tier < TIERS; tier++)
+		{
+			evaluatedPerTier[tier] += other.evaluatedPerTier[tier];
+			skippedPerTier[tier] += other.skippedPerTier[tier];
+		}
+	}
+};
+
+// LOD bookkeeping kept next to each AnimationInstance.
+struct AnimationLODState
+{
+	float pendingTime = 0.0f;	// Time not yet applied to the instance
+	AnimationHandle lastClip = INVALID_ANIMATION_HANDLE;
+	unsigned int phase = 0;		// Staggers reduced-rate instances across frames
+
+	AnimationLODState(unsigned int _phase = 0) : phase(_phase) {}
+};
+
+// Animation level of detail on top of AnimationInstance::update. Distance to
+// the camera picks how often an instance is evaluated (every frame, every 2nd
+// or every 4th); skipped frames keep the previous palette and bank the elapsed
+// time for the next evaluation. Instances that are small on screen also
+// collapse their leaf bones onto their parents instead of sampling them.
+class AnimationLOD
+{
+public:
+	AnimationLODSettings settings;
+	AnimationLODStats stats;
+
+	explicit AnimationLOD(const Skeleton& skeleton) : boneCount(static_cast<int>(skeleton.bones.size())), leafCount(0) {
+		std::vector<unsigned char> hasChildren(skeleton.bones.size(), 0);
+		for (const Bone& bone : skeleton.bones) {
+			if (bone.parentIndex >= 0) {
+				hasChildren[bone.parentIndex] = 1;
+			}
+		}
+		leafBones.resize(skeleton.bones.size(), 0);
+		for (size_t i = 0; i < skeleton.bones.size(); i++) {
+			if (skeleton.bones[i].parentIndex >= 0 && !hasChildren[i]) {
+				leafBones[i] = 1;
+				leafCount++;
+			}
+		}
+	}
+
+	// Call once per frame before scheduling instances.
+	void beginFrame() {
+		stats = AnimationLODStats();
+		frameIndex++;
+	}
+
+	// Rate tier at this distance: 0, 1 or 2 for every frame, every 2nd or every 4th.
+	int updateTier(float distance) const {
+		if (distance < settings.fullRateDistance) return 0;
+		if (distance < settings.halfRateDistance) return 1;
+		return 2;
+	}
+
+	// Frames between evaluations at this distance: 1, 2 or 4.
+	int updateInterval(float distance) const {
+		return 1 << updateTier(distance);
+	}
+
+	// Approximate fraction of the screen height covered by the instance.
+	float screenSize(float distance) const {
+		return settings.boundingRadius / (max(distance, 0.0001f) * tanf(settings.fieldOfView * 0.5f));
+	}
+
+	bool collapseLeaves(float distance) const {
+		return screenSize(distance) < settings.leafScreenSize;
+	}
+
+	int getLeafCount() const {
+		return leafCount;
+	}
+
+	// Decides whether instance is evaluated this frame. If so, appends a request
+	// covering all time banked since its last evaluation, to be run with
+	// updateAnimationInstances, and returns true. A clip change is always
+	// evaluated straight away.
+	bool schedule(AnimationInstance& instance, AnimationLODState& state, AnimationHandle clip, float dt, float distance,
+		std::vector<AnimationUpdateRequest>& requests) {
+		const unsigned char* collapsedBones;
+		float elapsed;
+		if (!decide(state, clip, dt, distance, elapsed, collapsedBones)) {
+			return false;
+		}
+		requests.push_back({ &instance, clip, elapsed, collapsedBones });
+		return true;
+	}
+
+	// Single-instance version of schedule that updates the instance immediately.
+	bool update(AnimationInstance& instance, AnimationLODState& state, AnimationHandle clip, float dt, float distance) {
+		const unsigned char* collapsedBones;
+		float elapsed;
+		if (!decide(state, clip, dt, distance, elapsed, collapsedBones)) {
+			return false;
+		}
+		instance.update(clip, elapsed, collapsedBones);
+		return true;
+	}
+
+private:
+	std::vector<unsigned char> leafBones;	// Non-root bones without children
+	int boneCount;
+	int leafCount;
+	unsigned int frameIndex = 0;
+
+	bool decide(AnimationLODState& state, AnimationHandle clip, float dt, float distance, float& elapsed, const unsigned char*& collapsedBones) {
+		stats.instances++;
+		state.pendingTime += dt;
+		int tier = updateTier(distance);
+		int interval = 1 << tier;
+		bool due = clip != state.lastClip || (frameIndex + state.phase) % interval == 0;
+		if (!due) {
+			stats.instancesSkipped++;
+			stats.skippedPerTier[tier]++;
+			stats.bonesSaved += boneCount;
+			return false;
+		}
+		elapsed = state.pendingTime;
+		state.pendingTime = 0.0f;
+		state.lastClip = clip;
+		collapsedBones = nullptr;
+		int collapsed = 0;
+		if (leafCount > 0 && collapseLeaves(distance)) {
+			collapsedBones = leafBones.data();
+			collapsed = leafCount;
+		}
+		stats.instancesEvaluated++;
+		stats.evaluatedPerTier[tier]++;
+		stats.bonesEvaluated += boneCount - collapsed;
+		stats.bonesSaved += collapsed;
+		return true;
+	}
+};
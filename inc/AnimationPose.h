@@ -0,0 +1,76 @@
+#pragma once
+#include "core.h"
+
+// Most bones a pose or palette holds; matches the bones array in VShaderAnim.hlsl.
+constexpr int MAX_ANIMATION_BONES = 256;
+
+// Local-space pose of a skeleton: one translation, rotation and scale per bone,
+// before the hierarchy is applied. Fixed size so scratch poses can be kept per
+// thread and reused every frame without allocating.
+struct alignas(16) AnimationPose
+{
+	Quaternion rotations[MAX_ANIMATION_BONES];
+	vec3 translations[MAX_ANIMATION_BONES];
+	vec3 scales[MAX_ANIMATION_BONES];
+};
+
+// Blends two poses into out (which may be either input): translation and scale
+// are lerped, rotations nlerped along the shorter arc. weight 0 gives from,
+// 1 gives to.
+inline void blendPoses(AnimationPose& out, const AnimationPose& from, const AnimationPose& to, float weight, int boneCount)
+{
+	float inverse = 1.0f - weight;
+	int i = 0;
+#if defined(CORE_SIMD_SSE)
+	const __m128 w = _mm_set1_ps(weight);
+	const __m128 iw = _mm_set1_ps(inverse);
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+	for (; i < boneCount; i++)
+	{
+		__m128 a = _mm_loadu_ps(from.rotations[i].q);
+		__m128 b = _mm_loadu_ps(to.rotations[i].q);
+		__m128 dot = _mm_mul_ps(a, b);
+		dot = _mm_add_ps(dot, _mm_shuffle_ps(dot, dot, _MM_SHUFFLE(2, 3, 0, 1)));
+		dot = _mm_add_ps(dot, _mm_shuffle_ps(dot, dot, _MM_SHUFFLE(1, 0, 3, 2)));
+		b = _mm_xor_ps(b, _mm_and_ps(dot, signMask));
+		__m128 r = _mm_add_ps(_mm_mul_ps(a, iw), _mm_mul_ps(b, w));
+		__m128 length = _mm_mul_ps(r, r);
+		length = _mm_add_ps(length, _mm_shuffle_ps(length, length, _MM_SHUFFLE(2, 3, 0, 1)));
+		length = _mm_add_ps(length, _mm_shuffle_ps(length, length, _MM_SHUFFLE(1, 0, 3, 2)));
+		_mm_storeu_ps(out.rotations[i].q, _mm_div_ps(r, _mm_sqrt_ps(length)));
+	}
+	// Translations and scales are flat float arrays, lerped four floats at a time.
+	static_assert(sizeof(vec3) == 3 * sizeof(float), "vec3 arrays must be tightly packed");
+	const int floats = boneCount * 3;
+	const int simdFloats = floats & ~3;
+	const float* fromT = reinterpret_cast<const float*>(from.translations);
+	const float* toT = reinterpret_cast<const float*>(to.translations);
+	float* outT = reinterpret_cast<float*>(out.translations);
+	const float* fromS = reinterpret_cast<const float*>(from.scales);
+	const float* toS = reinterpret_cast<const float*>(to.scales);
+	float* outS = reinterpret_cast<float*>(out.scales);
+	int f = 0;
+	for (; f < simdFloats; f += 4)
+	{
+		_mm_storeu_ps(outT + f, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(fromT + f), iw), _mm_mul_ps(_mm_loadu_ps(toT + f), w)));
+		_mm_storeu_ps(outS + f, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(fromS + f), iw), _mm_mul_ps(_mm_loadu_ps(toS + f), w)));
+	}
+	for (; f < floats; f++)
+	{
+		outT[f] = fromT[f] * inverse + toT[f] * weight;
+		outS[f] = fromS[f] * inverse + toS[f] * weight;
+	}
+#else
+	for (; i < boneCount; i++)
+	{
+		const Quaternion& a = from.rotations[i];
+		const Quaternion& b = to.rotations[i];
+		float dot = a.q[0] * b.q[0] + a.q[1] * b.q[1] + a.q[2] * b.q[2] + a.q[3] * b.q[3];
+		float wb = dot < 0.0f ? -weight : weight;
+		Quaternion r(a.q[0] * inverse + b.q[0] * wb, a.q[1] * inverse + b.q[1] * wb, a.q[2] * inverse + b.q[2] * wb, a.q[3] * inverse + b.q[3] * wb);
+		out.rotations[i] = r.normalize();
+		out.translations[i] = from.translations[i] * inverse + to.translations[i] * weight;
+		out.scales[i] = from.scales[i] * inverse + to.scales[i] * weight;
+	}
+#endif
+}
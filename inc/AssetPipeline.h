@@ -0,0 +1,247 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "JobSystem.h"
+
+// Index of an asset in an AssetPipeline.
+typedef int AssetHandle;
+
+// Per-asset timings, in seconds. readyTime and uploadedTime are measured from
+// the pipeline's creation.
+struct AssetTiming
+{
+	std::string name;
+	double decodeSeconds = 0.0;
+	double uploadSeconds = 0.0;
+	double readyTime = 0.0;		// Decode finished
+	double uploadedTime = 0.0;	// Upload finished
+};
+
+// Loads assets in two steps: reading and decoding run as tasks on a JobSystem,
+// and the upload to the device runs on the thread that calls finish(), one
+// asset at a time, in the order decodes complete. Startup then takes about as
+// long as the slowest decode plus the uploads, instead of the sum of all loads.
+//
+// The upload step is whatever function is passed with each asset; passing one
+// that discards the data (a null upload sink) runs the pipeline headlessly.
+class AssetPipeline
+{
+public:
+	explicit AssetPipeline(JobSystem& _jobs) : jobs(_jobs), start(Clock::now()) {}
+
+	~AssetPipeline()
+	{
+		// Decode tasks reference the assets, so they must finish first.
+		waitForDecodes();
+	}
+
+	AssetPipeline(const AssetPipeline&) = delete;
+	AssetPipeline& operator=(const AssetPipeline&) = delete;
+
+	// Starts decoding an asset. decode runs on a pool thread and returns the CPU
+	// data; upload later receives it by reference on the thread calling finish().
+	template<typename Decode, typename Upload>
+	AssetHandle load(const std::string& name, Decode decode, Upload upload)
+	{
+		typedef typename std::decay<decltype(decode())>::type T;
+		std::shared_ptr<T> data = std::make_shared<T>();
+		return add(name, [data, decode]() { *data = decode(); }, [data, upload]() { upload(*data); });
+	}
+
+	// Untyped form: decode and upload share state through their captures.
+	AssetHandle add(const std::string& name, std::function<void()> decode, std::function<void()> upload)
+	{
+		std::unique_lock<std::mutex> lock(assetsMutex);
+		AssetHandle handle = static_cast<AssetHandle>(assets.size());
+		assets.push_back(std::unique_ptr<Asset>(new Asset()));
+		Asset* asset = assets.back().get();
+		asset->timing.name = name;
+		asset->upload = std::move(upload);
+		lock.unlock();
+		jobs.submit([this, asset, decode]() {
+			Clock::time_point begin = Clock::now();
+			try
+			{
+				decode();
+			}
+			catch (...)
+			{
+				asset->error = std::current_exception();
+			}
+			Clock::time_point end = Clock::now();
+			asset->timing.decodeSeconds = seconds(begin, end);
+			asset->timing.readyTime = seconds(start, end);
+			asset->decoded.store(true, std::memory_order_release);
+		});
+		return handle;
+	}
+
+	bool isDecoded(AssetHandle handle) const
+	{
+		return asset(handle)->decoded.load(std::memory_order_acquire);
+	}
+
+	bool isUploaded(AssetHandle handle) const
+	{
+		return asset(handle)->uploaded;
+	}
+
+	// Uploads every decoded asset not yet uploaded and returns how many it
+	// uploaded. Call from the thread that owns the device, e.g. once per frame.
+	// An exception thrown by a decode is rethrown here, in place of its upload.
+	int pump()
+	{
+		int uploaded = 0;
+		size_t count = assetCount();
+		for (size_t i = 0; i < count; i++)
+		{
+			Asset* a = asset(static_cast<AssetHandle>(i));
+			if (!a->uploaded && a->decoded.load(std::memory_order_acquire))
+			{
+				if (a->error)
+				{
+					a->uploaded = true;
+					std::rethrow_exception(a->error);
+				}
+				Clock::time_point begin = Clock::now();
+				a->upload();
+				a->upload = nullptr;
+				Clock::time_point end = Clock::now();
+				a->timing.uploadSeconds = seconds(begin, end);
+				a->timing.uploadedTime = seconds(start, end);
+				a->uploaded = true;
+				uploaded++;
+			}
+		}
+		return uploaded;
+	}
+
+	// Uploads assets as their decodes complete, helping with decoding while
+	// none is ready, and returns once every asset has been uploaded.
+	void finish()
+	{
+		while (true)
+		{
+			if (pump() > 0)
+			{
+				continue;
+			}
+			if (allUploaded())
+			{
+				return;
+			}
+			if (!jobs.runOne())
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	// The pool decodes run on, so a decode can spread its own work over it.
+	JobSystem& getJobSystem()
+	{
+		return jobs;
+	}
+
+	// Seconds since the pipeline was created.
+	double elapsed() const
+	{
+		return seconds(start, Clock::now());
+	}
+
+	std::vector<AssetTiming> getTimings() const
+	{
+		std::vector<AssetTiming> timings;
+		size_t count = assetCount();
+		for (size_t i = 0; i < count; i++)
+		{
+			timings.push_back(asset(static_cast<AssetHandle>(i))->timing);
+		}
+		return timings;
+	}
+
+	// One line per asset, then the sum of decode times against the wall time.
+	void printTimings(std::ostream& out) const
+	{
+		double decodeSum = 0.0;
+		double last = 0.0;
+		for (const AssetTiming& timing : getTimings())
+		{
+			out << timing.name << ": decode " << timing.decodeSeconds * 1e3 << " ms, upload " << timing.uploadSeconds * 1e3
+				<< " ms, ready at " << timing.readyTime * 1e3 << " ms\n";
+			decodeSum += timing.decodeSeconds;
+			last = timing.uploadedTime > last ? timing.uploadedTime : last;
+		}
+		out << "Decode time summed " << decodeSum * 1e3 << " ms, all assets uploaded at " << last * 1e3 << " ms\n";
+	}
+
+private:
+	typedef std::chrono::high_resolution_clock Clock;
+
+	struct Asset
+	{
+		AssetTiming timing;
+		std::function<void()> upload;
+		std::exception_ptr error;
+		std::atomic<bool> decoded{ false };
+		bool uploaded = false;
+	};
+
+	JobSystem& jobs;
+	Clock::time_point start;
+	mutable std::mutex assetsMutex;				// Guards the vector; assets themselves never move
+	std::vector<std::unique_ptr<Asset>> assets;
+
+	static double seconds(Clock::time_point from, Clock::time_point to)
+	{
+		return std::chrono::duration<double>(to - from).count();
+	}
+
+	size_t assetCount() const
+	{
+		std::lock_guard<std::mutex> lock(assetsMutex);
+		return assets.size();
+	}
+
+	Asset* asset(AssetHandle handle) const
+	{
+		std::lock_guard<std::mutex> lock(assetsMutex);
+		return assets[handle].get();
+	}
+
+	bool allUploaded() const
+	{
+		size_t count = assetCount();
+		for (size_t i = 0; i < count; i++)
+		{
+			if (!asset(static_cast<AssetHandle>(i))->uploaded)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void waitForDecodes()
+	{
+		size_t count = assetCount();
+		for (size_t i = 0; i < count; i++)
+		{
+			while (!asset(static_cast<AssetHandle>(i))->decoded.load(std::memory_order_acquire))
+			{
+				if (!jobs.runOne())
+				{
+					std::this_thread::yield();
+				}
+			}
+		}
+	}
+};
@@ -0,0 +1,486 @@
+#pragma once
+#include <cfloat>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include "core.h"
+#include "JobSystem.h"
+#include "MipChain.h"
+
+// CPU encoder for the D3D block-compressed formats, so textures can be cooked
+// once and uploaded at a quarter (BC3) or an eighth (BC1) of their RGBA8 size:
+//  - BC1 stores each 4x4 block as two RGB565 endpoints and 2-bit indices into
+//    the four colours between them. Used for opaque textures.
+//  - BC3 adds a second block for alpha: two 8-bit endpoints and 3-bit indices
+//    into the eight values between them. Used when any texel is transparent.
+// Colour endpoints are the extremes of the block along its principal axis,
+// refined by least squares against the indices they produce. Levels are
+// encoded in rows of blocks, optionally spread over a JobSystem.
+namespace BlockCompression
+{
+	enum class Format : uint32_t
+	{
+		RGBA8 = 0,		// Uncompressed, 4 bytes per texel
+		BC1 = 1,
+		BC3 = 3
+	};
+
+	inline unsigned int blockBytes(Format format)
+	{
+		return format == Format::BC1 ? 8 : 16;
+	}
+
+	// Bytes in one row of texels, or of blocks when compressed.
+	inline size_t rowPitch(int width, Format format)
+	{
+		if (format == Format::RGBA8)
+		{
+			return static_cast<size_t>(width) * 4;
+		}
+		return static_cast<size_t>((width + 3) / 4) * blockBytes(format);
+	}
+
+	inline size_t levelBytes(int width, int height, Format format)
+	{
+		int rows = format == Format::RGBA8 ? height : (height + 3) / 4;
+		return rowPitch(width, format) * rows;
+	}
+
+	// Bytes of the first levels of a chain stored back to back, level 0 first.
+	inline size_t chainBytes(int width, int height, int levels, Format format)
+	{
+		size_t bytes = 0;
+		for (int level = 0; level < levels; level++)
+		{
+			bytes += levelBytes(MipChain::levelSize(width, level), MipChain::levelSize(height, level), format);
+		}
+		return bytes;
+	}
+
+	// D3D needs the top level of a block-compressed texture to be whole blocks.
+	inline bool canCompress(int width, int height)
+	{
+		return width > 0 && height > 0 && width % 4 == 0 && height % 4 == 0;
+	}
+
+	// BC1 for opaque textures, BC3 when any texel is transparent.
+	inline Format chooseFormat(const unsigned char* rgba, size_t texelCount)
+	{
+		for (size_t i = 0; i < texelCount; i++)
+		{
+			if (rgba[i * 4 + 3] < 255)
+			{
+				return Format::BC3;
+			}
+		}
+		return Format::BC1;
+	}
+
+	namespace Detail
+	{
+		inline uint16_t pack565(float r, float g, float b)
+		{
+			int r5 = static_cast<int>(r * (31.0f / 255.0f) + 0.5f);
+			int g6 = static_cast<int>(g * (63.0f / 255.0f) + 0.5f);
+			int b5 = static_cast<int>(b * (31.0f / 255.0f) + 0.5f);
+			r5 = min(max(r5, 0), 31);
+			g6 = min(max(g6, 0), 63);
+			b5 = min(max(b5, 0), 31);
+			return static_cast<uint16_t>((r5 << 11) | (g6 << 5) | b5);
+		}
+
+		inline void unpack565(uint16_t c, int rgb[3])
+		{
+			int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+			rgb[0] = (r << 3) | (r >> 2);
+			rgb[1] = (g << 2) | (g >> 4);
+			rgb[2] = (b << 3) | (b >> 2);
+		}
+
+		// The four colours a BC1 block can use. Three colours and black when
+		// c0 <= c1, unless fourColour is set as it is for BC3.
+		inline void colourPalette(uint16_t c0, uint16_t c1, bool fourColour, int palette[4][3])
+		{
+			unpack565(c0, palette[0]);
+			unpack565(c1, palette[1]);
+			for (int c = 0; c < 3; c++)
+			{
+				if (fourColour || c0 > c1)
+				{
+					palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+					palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+				}
+				else
+				{
+					palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+					palette[3][c] = 0;
+				}
+			}
+		}
+
+		inline void alphaPalette(int a0, int a1, int palette[8])
+		{
+			palette[0] = a0;
+			palette[1] = a1;
+			if (a0 > a1)
+			{
+				for (int i = 1; i < 7; i++)
+				{
+					palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+				}
+			}
+			else
+			{
+				for (int i = 1; i < 5; i++)
+				{
+					palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+				}
+				palette[6] = 0;
+				palette[7] = 255;
+			}
+		}
+
+		struct ColourFit
+		{
+			uint16_t c0;
+			uint16_t c1;
+			uint32_t indices;
+			int error;
+		};
+
+		// Picks the nearest palette colour for each texel of the block.
+		inline ColourFit fitIndices(const unsigned char* block, uint16_t c0, uint16_t c1)
+		{
+			int palette[4][3];
+			colourPalette(c0, c1, true, palette);
+			ColourFit fit = { c0, c1, 0, 0 };
+			for (int i = 0; i < 16; i++)
+			{
+				const unsigned char* t = block + i * 4;
+				int best = 0, bestError = INT32_MAX;
+				for (int p = 0; p < 4; p++)
+				{
+					int dr = t[0] - palette[p][0], dg = t[1] - palette[p][1], db = t[2] - palette[p][2];
+					int error = dr * dr + dg * dg + db * db;
+					if (error < bestError)
+					{
+						best = p;
+						bestError = error;
+					}
+				}
+				fit.indices |= static_cast<uint32_t>(best) << (i * 2);
+				fit.error += bestError;
+			}
+			return fit;
+		}
+
+		// Endpoints minimising the squared error of the block for fixed indices.
+		// Returns false when every texel uses the same weight.
+		inline bool refineEndpoints(const unsigned char* block, uint32_t indices, uint16_t& c0, uint16_t& c1)
+		{
+			static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+			float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+			float ax[3] = { 0.0f, 0.0f, 0.0f }, bx[3] = { 0.0f, 0.0f, 0.0f };
+			for (int i = 0; i < 16; i++)
+			{
+				float w = weights[(indices >> (i * 2)) & 3];
+				aa += w * w;
+				bb += (1.0f - w) * (1.0f - w);
+				ab += w * (1.0f - w);
+				for (int c = 0; c < 3; c++)
+				{
+					ax[c] += w * block[i * 4 + c];
+					bx[c] += (1.0f - w) * block[i * 4 + c];
+				}
+			}
+			float det = aa * bb - ab * ab;
+			if (fabsf(det) < 1e-6f)
+			{
+				return false;
+			}
+			float a[3], b[3];
+			for (int c = 0; c < 3; c++)
+			{
+				a[c] = min(max((ax[c] * bb - bx[c] * ab) / det, 0.0f), 255.0f);
+				b[c] = min(max((bx[c] * aa - ax[c] * ab) / det, 0.0f), 255.0f);
+			}
+			c0 = pack565(a[0], a[1], a[2]);
+			c1 = pack565(b[0], b[1], b[2]);
+			return true;
+		}
+
+		// Encodes the RGB of 16 RGBA8 texels. BC1 blocks are kept in four-colour
+		// mode (c0 > c1) so no texel decodes as black.
+		inline void encodeColourBlock(const unsigned char* block, unsigned char* out)
+		{
+			float mean[3] = { 0.0f, 0.0f, 0.0f };
+			for (int i = 0; i < 16; i++)
+			{
+				for (int c = 0; c < 3; c++)
+				{
+					mean[c] += block[i * 4 + c] * (1.0f / 16.0f);
+				}
+			}
+			float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+			for (int i = 0; i < 16; i++)
+			{
+				float d[3] = { block[i * 4] - mean[0], block[i * 4 + 1] - mean[1], block[i * 4 + 2] - mean[2] };
+				cov[0] += d[0] * d[0];
+				cov[1] += d[0] * d[1];
+				cov[2] += d[0] * d[2];
+				cov[3] += d[1] * d[1];
+				cov[4] += d[1] * d[2];
+				cov[5] += d[2] * d[2];
+			}
+			// Principal axis by power iteration
+			float axis[3] = { 1.0f, 1.0f, 1.0f };
+			for (int iteration = 0; iteration < 8; iteration++)
+			{
+				float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+				float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+				float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+				float length = max(fabsf(x), max(fabsf(y), fabsf(z)));
+				if (length < 1e-6f)
+				{
+					break;
+				}
+				axis[0] = x / length;
+				axis[1] = y / length;
+				axis[2] = z / length;
+			}
+			int lo = 0, hi = 0;
+			float loDot = FLT_MAX, hiDot = -FLT_MAX;
+			for (int i = 0; i < 16; i++)
+			{
+				float dot = block[i * 4] * axis[0] + block[i * 4 + 1] * axis[1] + block[i * 4 + 2] * axis[2];
+				if (dot < loDot)
+				{
+					loDot = dot;
+					lo = i;
+				}
+				if (dot > hiDot)
+				{
+					hiDot = dot;
+					hi = i;
+				}
+			}
+			const unsigned char* a = block + hi * 4;
+			const unsigned char* b = block + lo * 4;
+			ColourFit fit = fitIndices(block, pack565(a[0], a[1], a[2]), pack565(b[0], b[1], b[2]));
+			uint16_t c0, c1;
+			for (int pass = 0; pass < 3 && fit.error > 0 && refineEndpoints(block, fit.indices, c0, c1); pass++)
+			{
+				ColourFit refined = fitIndices(block, c0, c1);
+				if (refined.error >= fit.error)
+				{
+					break;
+				}
+				fit = refined;
+			}
+			if (fit.c0 < fit.c1)
+			{
+				// Swapping the endpoints swaps indices 0 and 1, and 2 and 3
+				uint16_t c = fit.c0;
+				fit.c0 = fit.c1;
+				fit.c1 = c;
+				fit.indices ^= 0x55555555u;
+			}
+			else if (fit.c0 == fit.c1)
+			{
+				fit.indices = 0;
+			}
+			out[0] = static_cast<unsigned char>(fit.c0 & 255);
+			out[1] = static_cast<unsigned char>(fit.c0 >> 8);
+			out[2] = static_cast<unsigned char>(fit.c1 & 255);
+			out[3] = static_cast<unsigned char>(fit.c1 >> 8);
+			memcpy(out + 4, &fit.indices, 4);
+		}
+
+		// Encodes the alpha of 16 RGBA8 texels in eight-value mode.
+		inline void encodeAlphaBlock(const unsigned char* block, unsigned char* out)
+		{
+			int a0 = 0, a1 = 255;
+			for (int i = 0; i < 16; i++)
+			{
+				a0 = max(a0, static_cast<int>(block[i * 4 + 3]));
+				a1 = min(a1, static_cast<int>(block[i * 4 + 3]));
+			}
+			int palette[8];
+			alphaPalette(a0, a1, palette);
+			uint64_t indices = 0;
+			if (a0 > a1)
+			{
+				for (int i = 0; i < 16; i++)
+				{
+					int alpha = block[i * 4 + 3];
+					int best = 0, bestError = INT32_MAX;
+					for (int p = 0; p < 8; p++)
+					{
+						int error = (alpha - palette[p]) * (alpha - palette[p]);
+						if (error < bestError)
+						{
+							best = p;
+							bestError = error;
+						}
+					}
+					indices |= static_cast<uint64_t>(best) << (i * 3);
+				}
+			}
+			out[0] = static_cast<unsigned char>(a0);
+			out[1] = static_cast<unsigned char>(a1);
+			for (int i = 0; i < 6; i++)
+			{
+				out[2 + i] = static_cast<unsigned char>(indices >> (i * 8));
+			}
+		}
+
+		// Copies the 4x4 block at (bx, by) into 64 bytes, clamping at the edges.
+		inline void gatherBlock(const unsigned char* rgba, int width, int height, int bx, int by, unsigned char* block)
+		{
+			for (int y = 0; y < 4; y++)
+			{
+				const unsigned char* row = rgba + static_cast<size_t>(min(by * 4 + y, height - 1)) * width * 4;
+				for (int x = 0; x < 4; x++)
+				{
+					memcpy(block + (y * 4 + x) * 4, row + min(bx * 4 + x, width - 1) * 4, 4);
+				}
+			}
+		}
+	}
+
+	// Encodes one RGBA8 level into out, which must hold levelBytes. With jobs,
+	// rows of blocks run in parallel on it.
+	inline void encodeLevel(const unsigned char* rgba, int width, int height, Format format, unsigned char* out, JobSystem* jobs = nullptr)
+	{
+		if (format == Format::RGBA8)
+		{
+			memcpy(out, rgba, levelBytes(width, height, format));
+			return;
+		}
+		int blocksX = (width + 3) / 4;
+		int blocksY = (height + 3) / 4;
+		unsigned int bytes = blockBytes(format);
+		auto encodeRows = [&](size_t begin, size_t end) {
+			unsigned char block[64];
+			for (size_t by = begin; by < end; by++)
+			{
+				unsigned char* dst = out + by * blocksX * bytes;
+				for (int bx = 0; bx < blocksX; bx++, dst += bytes)
+				{
+					Detail::gatherBlock(rgba, width, height, bx, static_cast<int>(by), block);
+					if (format == Format::BC3)
+					{
+						Detail::encodeAlphaBlock(block, dst);
+						Detail::encodeColourBlock(block, dst + 8);
+					}
+					else
+					{
+						Detail::encodeColourBlock(block, dst);
+					}
+				}
+			}
+		};
+		if (jobs != nullptr)
+		{
+			jobs->parallelFor(blocksY, 4, encodeRows);
+		}
+		else
+		{
+			encodeRows(0, blocksY);
+		}
+	}
+
+	// Encodes a chain built by MipChain::generate. out is resized to chainBytes.
+	inline void encodeChain(const unsigned char* chain, int width, int height, int levels, Format format, std::vector<unsigned char>& out, JobSystem* jobs = nullptr)
+	{
+		out.resize(chainBytes(width, height, levels, format));
+		for (int level = 0; level < levels; level++)
+		{
+			encodeLevel(chain + MipChain::levelOffset(width, height, level), MipChain::levelSize(width, level), MipChain::levelSize(height, level),
+				format, out.data() + chainBytes(width, height, level, format), jobs);
+		}
+	}
+
+	// Decodes one level back to RGBA8, as the GPU would sample it.
+	inline void decodeLevel(const unsigned char* data, int width, int height, Format format, unsigned char* rgba)
+	{
+		if (format == Format::RGBA8)
+		{
+			memcpy(rgba, data, levelBytes(width, height, format));
+			return;
+		}
+		int blocksX = (width + 3) / 4;
+		int blocksY = (height + 3) / 4;
+		unsigned int bytes = blockBytes(format);
+		for (int by = 0; by < blocksY; by++)
+		{
+			for (int bx = 0; bx < blocksX; bx++)
+			{
+				const unsigned char* block = data + (static_cast<size_t>(by) * blocksX + bx) * bytes;
+				const unsigned char* colour = format == Format::BC3 ? block + 8 : block;
+				uint16_t c0 = static_cast<uint16_t>(colour[0] | (colour[1] << 8));
+				uint16_t c1 = static_cast<uint16_t>(colour[2] | (colour[3] << 8));
+				uint32_t indices;
+				memcpy(&indices, colour + 4, 4);
+				int palette[4][3];
+				Detail::colourPalette(c0, c1, format == Format::BC3, palette);
+				int alpha[8];
+				uint64_t alphaIndices = 0;
+				if (format == Format::BC3)
+				{
+					Detail::alphaPalette(block[0], block[1], alpha);
+					for (int i = 0; i < 6; i++)
+					{
+						alphaIndices |= static_cast<uint64_t>(block[2 + i]) << (i * 8);
+					}
+				}
+				for (int i = 0; i < 16; i++)
+				{
+					int x = bx * 4 + (i & 3), y = by * 4 + (i >> 2);
+					if (x >= width || y >= height)
+					{
+						continue;
+					}
+					unsigned char* t = rgba + (static_cast<size_t>(y) * width + x) * 4;
+					int p = (indices >> (i * 2)) & 3;
+					for (int c = 0; c < 3; c++)
+					{
+						t[c] = static_cast<unsigned char>(palette[p][c]);
+					}
+					if (format == Format::BC3)
+					{
+						t[3] = static_cast<unsigned char>(alpha[(alphaIndices >> (i * 3)) & 7]);
+					}
+					else
+					{
+						t[3] = c0 <= c1 && p == 3 ? 0 : 255;
+					}
+				}
+			}
+		}
+	}
+
+	// Peak signal-to-noise ratio in dB between two RGBA8 images, over RGB or
+	// RGBA. Identical images give infinity.
+	inline double psnr(const unsigned char* a, const unsigned char* b, size_t texelCount, bool includeAlpha = false)
+	{
+		int channels = includeAlpha ? 4 : 3;
+		double sum = 0.0;
+		for (size_t i = 0; i < texelCount; i++)
+		{
+			for (int c = 0; c < channels; c++)
+			{
+				double d = static_cast<double>(a[i * 4 + c]) - b[i * 4 + c];
+				sum += d * d;
+			}
+		}
+		if (sum == 0.0)
+		{
+			return std::numeric_limits<double>::infinity();
+		}
+		double mse = sum / (static_cast<double>(texelCount) * channels);
+		return 10.0 * log10(255.0 * 255.0 / mse);
+	}
+}
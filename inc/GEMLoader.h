@@ -29,6 +29,9 @@ SOFTWARE.
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <cstring>
+#include <algorithm>
+#include "MappedFile.h"
 
 namespace GEMLoader
 {
@@ -156,6 +159,19 @@ namespace GEMLoader
 		{
 			return verticesAnimated.size() > 0;
 		}
+		// True if every index names one of the mesh's vertices.
+		bool indicesInRange() const
+		{
+			size_t vertexCount = verticesAnimated.size() > 0 ? verticesAnimated.size() : verticesStatic.size();
+			for (unsigned int index : indices)
+			{
+				if (index >= vertexCount)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
 	};
 
 	class GEMMatrix
@@ -191,14 +207,110 @@ namespace GEMLoader
 		float ticksPerSecond;
 	};
 
+	// Where a clip's frames start in a GEM file. Each frame holds every bone's
+	// position, then every rotation, then every scale.
+	struct GEMClipEntry
+	{
+		std::string name;
+		int frames;
+		float ticksPerSecond;
+		size_t framesOffset;
+	};
+
 	class GEMAnimation
 	{
 	public:
 		std::vector<GEMBone> bones;
 		std::vector<GEMAnimationSequence> animations;
+		std::vector<GEMClipEntry> clips;	// Filled instead of animations by loadMappedLazy
 		GEMMatrix globalInverse;
 	};
 
+	// Bounds-checked cursor over a GEM file held in memory. Every read checks the
+	// bytes left first; once a read fails ok() stays false and later reads return
+	// zeros, so a parser only needs to check ok() at the end.
+	class GEMSpanReader
+	{
+	public:
+		GEMSpanReader(const unsigned char* _data, size_t _size) : data(_data), size(_size), offset(0), valid(_data != nullptr || _size == 0) {}
+		bool ok() const
+		{
+			return valid;
+		}
+		size_t remaining() const
+		{
+			return valid ? size - offset : 0;
+		}
+		size_t position() const
+		{
+			return offset;
+		}
+		bool skip(size_t bytes)
+		{
+			if (bytes > remaining())
+			{
+				valid = false;
+				return false;
+			}
+			offset += bytes;
+			return true;
+		}
+		void fail()
+		{
+			valid = false;
+		}
+		template<typename T>
+		T read()
+		{
+			T v{};
+			readArray(&v, 1);
+			return v;
+		}
+		template<typename T>
+		bool readArray(T* out, size_t count)
+		{
+			if (count > remaining() / sizeof(T))
+			{
+				valid = false;
+				return false;
+			}
+			memcpy(out, data + offset, count * sizeof(T));
+			offset += count * sizeof(T);
+			return true;
+		}
+		// Reads count elements with one copy; the count is checked against the
+		// bytes left before the vector is sized.
+		template<typename T>
+		bool readVector(std::vector<T>& v, size_t count)
+		{
+			if (count > remaining() / sizeof(T))
+			{
+				valid = false;
+				return false;
+			}
+			v.resize(count);
+			return count == 0 || readArray(v.data(), count);
+		}
+		std::string readString()
+		{
+			int l = read<int>();
+			if (l < 0 || static_cast<size_t>(l) > remaining())
+			{
+				valid = false;
+				return std::string();
+			}
+			const char* begin = reinterpret_cast<const char*>(data + offset);
+			offset += l;
+			// Matches loadString, which stops at the first null.
+			return std::string(begin, std::find(begin, begin + l, '\0'));
+		}
+	private:
+		const unsigned char* data;
+		size_t size;
+		size_t offset;
+		bool valid;
+	};
+
 	class GEMModelLoader
 	{
 	private:
@@ -308,6 +420,99 @@ namespace GEMLoader
 				loadFrame(aseq, file, bonesN);
 			}
 		}
+		void loadMesh(GEMSpanReader& reader, GEMMesh& mesh, unsigned int isAnimated)
+		{
+			unsigned int n = reader.read<unsigned int>();
+			for (unsigned int i = 0; i < n && reader.ok(); i++)
+			{
+				GEMMaterialProperty prop;
+				prop.name = reader.readString();
+				prop.value = reader.readString();
+				mesh.material.properties.push_back(prop);
+			}
+			if (isAnimated == 0)
+			{
+				reader.readVector(mesh.verticesStatic, reader.read<unsigned int>());
+			}
+			else
+			{
+				reader.readVector(mesh.verticesAnimated, reader.read<unsigned int>());
+			}
+			reader.readVector(mesh.indices, reader.read<unsigned int>());
+		}
+		bool parse(GEMSpanReader& reader, const std::string& filename, std::vector<GEMMesh>& meshes, GEMAnimation* animation, bool lazyClips = false)
+		{
+			if (reader.read<unsigned int>() != 4058972161)
+			{
+				std::cout << filename << " is not a GE Model File" << std::endl;
+				return false;
+			}
+			unsigned int isAnimated = reader.read<unsigned int>();
+			unsigned int n = reader.read<unsigned int>();
+			for (unsigned int i = 0; i < n && reader.ok(); i++)
+			{
+				meshes.emplace_back();
+				loadMesh(reader, meshes.back(), isAnimated);
+				// Indices are used on the CPU to optimize and simplify meshes, so
+				// one past the vertices would write out of bounds there.
+				if (!meshes.back().indicesInRange())
+				{
+					reader.fail();
+				}
+			}
+			// Static models end after their meshes
+			if (animation != nullptr && reader.remaining() > 0)
+			{
+				// Read skeleton
+				unsigned int bonesN = reader.read<unsigned int>();
+				for (unsigned int i = 0; i < bonesN && reader.ok(); i++)
+				{
+					GEMBone bone;
+					bone.name = reader.readString();
+					reader.readArray(bone.offset.m, 16);
+					bone.parentIndex = reader.read<int>();
+					animation->bones.push_back(bone);
+				}
+				reader.readArray(animation->globalInverse.m, 16);
+				// Read animation sequences, one bulk copy per key array
+				n = reader.read<unsigned int>();
+				size_t frameBytes = static_cast<size_t>(bonesN) * (sizeof(GEMVec3) * 2 + sizeof(GEMQuaternion));
+				for (unsigned int i = 0; i < n && reader.ok(); i++)
+				{
+					std::string name = reader.readString();
+					int frames = reader.read<int>();
+					float ticksPerSecond = reader.read<float>();
+					if (frames < 0 || (frameBytes > 0 && static_cast<size_t>(frames) > reader.remaining() / frameBytes))
+					{
+						reader.fail();
+						break;
+					}
+					if (lazyClips)
+					{
+						animation->clips.push_back({ name, frames, ticksPerSecond, reader.position() });
+						reader.skip(frames * frameBytes);
+						continue;
+					}
+					animation->animations.emplace_back();
+					GEMAnimationSequence& aseq = animation->animations.back();
+					aseq.name = name;
+					aseq.ticksPerSecond = ticksPerSecond;
+					aseq.frames.resize(frames);
+					for (int f = 0; f < frames; f++)
+					{
+						reader.readVector(aseq.frames[f].positions, bonesN);
+						reader.readVector(aseq.frames[f].rotations, bonesN);
+						reader.readVector(aseq.frames[f].scales, bonesN);
+					}
+				}
+			}
+			if (!reader.ok())
+			{
+				std::cout << filename << " is truncated or corrupt" << std::endl;
+				return false;
+			}
+			return true;
+		}
 	public:
 		bool isAnimatedModel(std::string filename)
 		{
@@ -392,6 +597,42 @@ namespace GEMLoader
 			}
 			file.close();
 		}
+		// Memory-mapped versions of load. Vertex, index and key arrays are copied
+		// out of the mapping in one go each instead of element by element. Return
+		// false, leaving partial output, if the file cannot be mapped or a header
+		// runs past the end of the file.
+		bool loadMapped(std::string filename, std::vector<GEMMesh>& meshes)
+		{
+			MappedFile file;
+			if (!file.open(filename))
+			{
+				return false;
+			}
+			GEMSpanReader reader(file.data(), file.size());
+			return parse(reader, filename, meshes, nullptr);
+		}
+		bool loadMapped(std::string filename, std::vector<GEMMesh>& meshes, GEMAnimation& animation)
+		{
+			MappedFile file;
+			if (!file.open(filename))
+			{
+				return false;
+			}
+			GEMSpanReader reader(file.data(), file.size());
+			return parse(reader, filename, meshes, &animation);
+		}
+		// As loadMapped, but clips are not read: animation.clips records where
+		// each one's frames are, to be decoded later on request.
+		bool loadMappedLazy(std::string filename, std::vector<GEMMesh>& meshes, GEMAnimation& animation)
+		{
+			MappedFile file;
+			if (!file.open(filename))
+			{
+				return false;
+			}
+			GEMSpanReader reader(file.data(), file.size());
+			return parse(reader, filename, meshes, &animation, true);
+		}
 	};
 
 };
\ No newline at end of file
@@ -1,6 +1,15 @@
 #pragma once
+#include <cstddef>
+#include <memory>
 #include "GEMLoader.h"
 #include "Animation.h"
+#include "ModelCache.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
+#include "MeshClusters.h"
+#include "IndexData.h"
+#include "VertexCompression.h"
+#include "AABB.h"
 #include "ShaderManager.h"
 
 // Enum to differentiate between static and animated models
@@ -53,6 +62,29 @@ struct ANIMATED_VERTEX
 	float boneWeights[4];
 };
 
+// The GEM loader's vertex types have exactly the layout of the vertex structs
+// above, so loaded arrays are handed to Mesh::init as they are instead of being
+// copied vertex by vertex.
+static_assert(sizeof(STATIC_VERTEX) == sizeof(GEMLoader::GEMStaticVertex), "STATIC_VERTEX must match GEMStaticVertex");
+static_assert(offsetof(STATIC_VERTEX, normal) == offsetof(GEMLoader::GEMStaticVertex, normal), "STATIC_VERTEX must match GEMStaticVertex");
+static_assert(offsetof(STATIC_VERTEX, tangent) == offsetof(GEMLoader::GEMStaticVertex, tangent), "STATIC_VERTEX must match GEMStaticVertex");
+static_assert(offsetof(STATIC_VERTEX, tu) == offsetof(GEMLoader::GEMStaticVertex, u), "STATIC_VERTEX must match GEMStaticVertex");
+static_assert(sizeof(ANIMATED_VERTEX) == sizeof(GEMLoader::GEMAnimatedVertex), "ANIMATED_VERTEX must match GEMAnimatedVertex");
+static_assert(offsetof(ANIMATED_VERTEX, tu) == offsetof(GEMLoader::GEMAnimatedVertex, u), "ANIMATED_VERTEX must match GEMAnimatedVertex");
+static_assert(offsetof(ANIMATED_VERTEX, bonesIDs) == offsetof(GEMLoader::GEMAnimatedVertex, bonesIDs), "ANIMATED_VERTEX must match GEMAnimatedVertex");
+static_assert(offsetof(ANIMATED_VERTEX, boneWeights) == offsetof(GEMLoader::GEMAnimatedVertex, boneWeights), "ANIMATED_VERTEX must match GEMAnimatedVertex");
+
+// Views loaded GEM vertices as engine vertices without copying.
+inline Span<STATIC_VERTEX> vertexSpan(const std::vector<GEMLoader::GEMStaticVertex>& vertices)
+{
+	return Span<STATIC_VERTEX>(reinterpret_cast<const STATIC_VERTEX*>(vertices.data()), vertices.size());
+}
+
+inline Span<ANIMATED_VERTEX> vertexSpan(const std::vector<GEMLoader::GEMAnimatedVertex>& vertices)
+{
+	return Span<ANIMATED_VERTEX>(reinterpret_cast<const ANIMATED_VERTEX*>(vertices.data()), vertices.size());
+}
+
 // Represents a single 3D object with vertices and indices.
 // Handles initialization and rendering for both static and animated models.
 class Mesh
@@ -62,18 +94,56 @@ public:
 	ID3D11Buffer* vertexBuffer;		// Buffer holding the mesh's vertices
 	int indicesSize;				// Number of indices
 	UINT strides;					// Size of each vertex in bytes
+	DXGI_FORMAT indexFormat = DXGI_FORMAT_R32_UINT;	// R16_UINT when the vertex count allows
+
+	// A coarser index buffer over the same vertices.
+	struct LOD
+	{
+		ID3D11Buffer* indexBuffer;
+		int indicesSize;
+		float error;				// Largest surface deviation from the full mesh, in model units
+	};
+	std::vector<LOD> lods;			// Coarser levels, level 1 first
+	std::vector<MeshClusters::Cluster> clusters;	// Runs of the full index buffer, empty unless built
+	bool compact = false;			// Vertices are in VertexCompression's compact format
+	VertexCompression::Quantization quantization;	// Rebuilds compact positions, see Model::draw
 
-	// Initializes the mesh with raw vertex and index data.
-	void init(void* vertices, int vertexSizeInBytes, int numVertices, unsigned int* indices, int numIndices, DXCore& core);
+	// Initializes the mesh with raw vertex and index data. indexSizeInBytes is 2 or 4.
+	void init(const void* vertices, int vertexSizeInBytes, int numVertices, const void* indices, int indexSizeInBytes, int numIndices, DXCore& core);
+
+	// As above with 32-bit indices, stored as 16 bits if the vertex count allows.
+	void init(const void* vertices, int vertexSizeInBytes, int numVertices, const unsigned int* indices, int numIndices, DXCore& core);
+	void init(const void* vertices, int vertexSizeInBytes, int numVertices, const IndexData& indices, DXCore& core);
 	
+	// Overloads taking views of existing arrays; the data is uploaded in place.
+	void init(Span<STATIC_VERTEX> vertices, Span<unsigned int> indices, DXCore& core);
+	void init(Span<ANIMATED_VERTEX> vertices, Span<unsigned int> indices, DXCore& core);
+
 	// Overload for static vertex initialization using vectors.
-	void init(std::vector<STATIC_VERTEX> vertices, std::vector<unsigned int> indices, DXCore& core);
+	void init(const std::vector<STATIC_VERTEX>& vertices, const std::vector<unsigned int>& indices, DXCore& core);
+	void init(const std::vector<STATIC_VERTEX>& vertices, const IndexData& indices, DXCore& core);
 
 	// Overload for animated vertex initialization using vectors.
-	void init(std::vector<ANIMATED_VERTEX> vertices, std::vector<unsigned int> indices, DXCore& core);
+	void init(const std::vector<ANIMATED_VERTEX>& vertices, const std::vector<unsigned int>& indices, DXCore& core);
+
+	// Adds the next coarser level of detail, in the mesh's index format.
+	void addLOD(const void* indices, int numIndices, float error, DXCore& core);
+	void addLOD(const unsigned int* indices, int numIndices, float error, DXCore& core);
 
 	// Draws the mesh using the vertex and index buffers.
 	void draw(DXCore& core);
+
+	// Draws runs of the full index buffer, e.g. the clusters left by culling.
+	void draw(DXCore& core, const std::vector<MeshClusters::DrawRange>& ranges);
+
+	// Draws a level of detail, 0 being the full mesh; levels past the last use the last.
+	void draw(DXCore& core, int lod);
+
+	// Triangles drawn at a level of detail.
+	int getTriangleCount(int lod) const;
+
+	// Adds the index buffers of every level.
+	void reportIndexMemory(IndexMemoryReport& report) const;
 };
 
 // Plane class generates a flat surface for rendering.
@@ -146,11 +216,67 @@ public:
 	std::vector<Mesh> meshes;						// List of meshes in the model
 	std::vector<std::string> textureFilenames;		// Textures associated with the model
 	Animation animation;							// Animation data for animated models
+	std::vector<AABB> bounds;						// Object-space bounds of each mesh
 	ModelType type;									// Type of the model (STATIC or ANIMATED)
+	bool useCache = true;							// Load from / write the .gemc cache next to the GEM file
+	bool compressAnimation = false;					// Compress clips at load, see AnimationSequence::compress
+	AnimationCompressionSettings compressionSettings;
+	std::map<std::string, AnimationCompressionReport> compressionReports;	// Per clip, filled when compressing at load
+	bool lazyAnimation = false;						// Decode each clip on first use, see Animation::setClipSource
+	std::vector<float> lodRatios;					// Triangle ratio of each generated LOD, e.g. { 0.5, 0.25 }; empty for none
+	MeshSimplifier::Settings lodSettings;			// Simplifier settings, targetRatio excepted
+	std::vector<float> lodErrors;					// Error of each level in model units over all meshes, level 0 first
+	bool useClusters = false;						// Split static meshes into clusters for drawVisible, see MeshClusters
+	bool clusterBackfaceCulling = true;				// Also skip clusters facing away; off for meshes seen from both sides
+	bool compactVertices = false;					// Upload VertexCompression's compact formats; draw with shaders compiled for VertexFormat::Compact
 
 	// Initializes the model by loading data from a file.
 	void init(std::string filename, DXCore& core, ModelType modelType);
 
+	// The two halves of init. load reads and decodes the file without touching
+	// the device, so it can run on a worker thread; upload then creates the
+	// buffers and must run on the thread that owns the device.
+	void load(std::string filename, ModelType modelType);
+	void upload(DXCore& core);
+
 	// Draws the model using the provided shaders and texture manager.
 	void draw(DXCore& core, Shaders& shader, TextureManager& textureManager);
+
+	// Draws a level of detail and returns the number of triangles submitted.
+	int draw(DXCore& core, Shaders& shader, TextureManager& textureManager, int lod);
+
+	// Coarsest level whose error stays under maxPixelError pixels for an
+	// instance of the given scale at distance, see MeshSimplifier::selectLOD.
+	int selectLOD(float distance, float scale, float fieldOfView, float screenHeight, float maxPixelError = 1.0f) const;
+
+	int getTriangleCount(int lod) const;
+
+	// Draws the clusters of the full mesh that pass culling and returns the
+	// number of triangles submitted. frustum and cameraPosition are in object
+	// space. Meshes without clusters are drawn whole.
+	int drawVisible(DXCore& core, Shaders& shader, TextureManager& textureManager, const MeshClusters::Frustum& frustum,
+		const vec3& cameraPosition, MeshClusters::CullStats* stats = nullptr);
+
+	void reportIndexMemory(IndexMemoryReport& report) const;
+
+private:
+	// CPU data held between load and upload: the mapped cache or the GEM meshes.
+	struct Staging
+	{
+		ModelCache cache;
+		bool cached = false;
+		std::vector<GEMLoader::GEMMesh> gemmeshes;
+		std::vector<IndexData> indices;				// Narrowed from the GEM meshes
+		std::vector<std::vector<MeshSimplifier::LOD>> lods;
+		std::vector<std::vector<MeshClusters::Cluster>> clusters;
+		std::vector<VertexCompression::CompactMesh> compactMeshes;	// Empty unless compactVertices
+	};
+	std::unique_ptr<Staging> staging;
+
+	std::vector<MeshClusters::DrawRange> visibleRanges;	// Scratch for drawVisible
+
+	void addLODError(int level, float error);
+
+	// Sets the quantization of a compact mesh's vertices in the vertex shader's constants.
+	void applyQuantization(DXCore& core, Shaders& shader, const Mesh& mesh);
 };
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "stb_image.h"
+#include "MappedFile.h"
+#include "MipChain.h"
+
+// Decodes image files straight to RGBA8. The file is mapped rather than read
+// through stdio, stb_image converts one, two and three channel images to four
+// as it decodes, and the texels are copied once into a buffer that already has
+// room for the mip chain. A decode then costs stb_image's buffer and the final
+// one, with no expansion pass of its own.
+namespace ImageDecoder
+{
+	// Decodes filename into texels as level 0 of an RGBA8 mip chain, with the
+	// capacity for the rest reserved (see MipChain::generateInPlace). Returns
+	// false if the file cannot be read or decoded.
+	inline bool decodeRGBA8(const std::string& filename, int& width, int& height, std::vector<unsigned char>& texels)
+	{
+		MappedFile file;
+		if (!file.open(filename) || file.size() == 0)
+		{
+			return false;
+		}
+		int fileChannels = 0;
+		unsigned char* decoded = stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &width, &height, &fileChannels, 4);
+		if (decoded == nullptr)
+		{
+			return false;
+		}
+		size_t bytes = static_cast<size_t>(width) * height * 4;
+		texels.clear();
+		texels.reserve(MipChain::levelOffset(width, height, MipChain::levelCount(width, height)));
+		texels.assign(decoded, decoded + bytes);
+		stbi_image_free(decoded);
+		return true;
+	}
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Index data in the narrowest format its vertex count allows: 16 bits while
+// every vertex can be addressed with them, otherwise 32. Meshes upload data()
+// as is and pick DXGI_FORMAT_R16_UINT or R32_UINT from stride().
+class IndexData
+{
+public:
+	static const size_t MAX_16BIT_VERTICES = 65536;
+
+	static unsigned int strideFor(size_t vertexCount)
+	{
+		return vertexCount <= MAX_16BIT_VERTICES ? 2 : 4;
+	}
+
+	IndexData() = default;
+
+	IndexData(const unsigned int* indices, size_t count, size_t vertexCount)
+	{
+		if (strideFor(vertexCount) == 2)
+		{
+			indices16.resize(count);
+			for (size_t i = 0; i < count; i++)
+			{
+				indices16[i] = static_cast<uint16_t>(indices[i]);
+			}
+		}
+		else
+		{
+			indices32.assign(indices, indices + count);
+		}
+	}
+
+	IndexData(const std::vector<unsigned int>& indices, size_t vertexCount) : IndexData(indices.data(), indices.size(), vertexCount) {}
+
+	// Takes 16-bit indices built directly by a generator.
+	explicit IndexData(std::vector<uint16_t> indices) : indices16(std::move(indices)) {}
+
+	unsigned int stride() const
+	{
+		return indices32.empty() ? 2 : 4;
+	}
+	size_t count() const
+	{
+		return indices32.empty() ? indices16.size() : indices32.size();
+	}
+	size_t bytes() const
+	{
+		return count() * stride();
+	}
+	const void* data() const
+	{
+		return indices32.empty() ? static_cast<const void*>(indices16.data()) : static_cast<const void*>(indices32.data());
+	}
+
+	unsigned int operator[](size_t i) const
+	{
+		return indices32.empty() ? indices16[i] : indices32[i];
+	}
+
+private:
+	std::vector<uint16_t> indices16;
+	std::vector<uint32_t> indices32;
+};
+
+// Index memory of a set of meshes against storing every index in 32 bits.
+struct IndexMemoryReport
+{
+	size_t buffers = 0;
+	size_t compactBuffers = 0;	// Stored as 16 bits
+	size_t indices = 0;
+	size_t bytes = 0;
+
+	void add(size_t count, unsigned int stride)
+	{
+		buffers++;
+		compactBuffers += stride == 2 ? 1 : 0;
+		indices += count;
+		bytes += count * stride;
+	}
+
+	size_t savedBytes() const
+	{
+		return indices * sizeof(uint32_t) - bytes;
+	}
+};
@@ -0,0 +1,228 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed-size work-stealing thread pool. Each worker owns a queue; it pops
+// its own work from the back and steals from the front of other queues when
+// empty. The thread calling parallelFor helps run jobs until they are all done,
+// so a parallelFor call is also the join point. submit queues independent
+// tasks that complete on their own; callers wait on their own state and may
+// call runOne to help.
+class JobSystem {
+public:
+	// Function run over a contiguous [begin, end) range of items.
+	typedef std::function<void(size_t begin, size_t end)> RangeFunction;
+
+	// Hardware concurrency minus one, leaving a core for the calling thread,
+	// which also runs jobs.
+	static unsigned int defaultWorkerCount() {
+		unsigned int hardware = std::thread::hardware_concurrency();
+		return hardware > 1 ? hardware - 1 : 0;
+	}
+
+	// With zero workers every parallelFor runs inline on the caller.
+	explicit JobSystem(unsigned int workerCount = defaultWorkerCount()) {
+		// One queue per worker plus one for threads outside the pool.
+		for (unsigned int i = 0; i <= workerCount; i++) {
+			queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+		}
+		for (unsigned int i = 0; i < workerCount; i++) {
+			workers.emplace_back([this, i]() { workerLoop(i); });
+		}
+	}
+
+	~JobSystem() {
+		{
+			std::lock_guard<std::mutex> lock(wakeMutex);
+			quit = true;
+		}
+		wake.notify_all();
+		for (auto& worker : workers) {
+			worker.join();
+		}
+	}
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// Number of pool threads, not counting the caller.
+	unsigned int getWorkerCount() const {
+		return static_cast<unsigned int>(workers.size());
+	}
+
+	// Runs fn over [0, count) in chunks of grainSize items and returns once every
+	// chunk has finished. Small batches, or a pool with no workers, run inline.
+	// If a chunk throws, the first exception is rethrown here after the rest finish.
+	void parallelFor(size_t count, size_t grainSize, const RangeFunction& fn) {
+		if (count == 0) {
+			return;
+		}
+		if (grainSize == 0) {
+			grainSize = 1;
+		}
+		if (workers.empty() || count <= grainSize) {
+			fn(0, count);
+			return;
+		}
+		size_t chunks = (count + grainSize - 1) / grainSize;
+		std::atomic<size_t> remaining(chunks);
+		JobError error;
+		size_t queueCount = queues.size();
+		// Counted before they are visible, so a worker taking one never sees
+		// pending at zero
+		{
+			std::lock_guard<std::mutex> lock(wakeMutex);
+			pending += chunks;
+		}
+		for (size_t c = 0; c < chunks; c++) {
+			Job job;
+			job.fn = &fn;
+			job.begin = c * grainSize;
+			job.end = job.begin + grainSize < count ? job.begin + grainSize : count;
+			job.remaining = &remaining;
+			job.error = &error;
+			WorkerQueue& queue = *queues[c % queueCount];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.jobs.push_back(job);
+		}
+		wake.notify_all();
+
+		// Help until our chunks are done; other callers' jobs may run here too.
+		size_t callerQueue = queueCount - 1;
+		while (remaining.load(std::memory_order_acquire) > 0) {
+			if (!tryRunJob(callerQueue)) {
+				std::this_thread::yield();
+			}
+		}
+		if (error.exception) {
+			std::rethrow_exception(error.exception);
+		}
+	}
+
+	// Queues task to run once on any pool thread and returns immediately. With
+	// no workers it only runs when a caller helps through runOne.
+	void submit(std::function<void()> task) {
+		Job job;
+		job.task = std::move(task);
+		{
+			std::lock_guard<std::mutex> lock(wakeMutex);
+			pending += 1;
+		}
+		{
+			WorkerQueue& queue = *queues[nextQueue.fetch_add(1) % queues.size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.jobs.push_back(std::move(job));
+		}
+		wake.notify_one();
+	}
+
+	// Runs one queued job on the calling thread. Returns false if none was queued.
+	bool runOne() {
+		return tryRunJob(queues.size() - 1);
+	}
+
+private:
+	// First exception thrown by the chunks of one parallelFor.
+	struct JobError {
+		std::mutex mutex;
+		std::exception_ptr exception;
+	};
+
+	struct Job {
+		const RangeFunction* fn = nullptr;
+		size_t begin = 0;
+		size_t end = 0;
+		std::atomic<size_t>* remaining = nullptr;
+		JobError* error = nullptr;
+		std::function<void()> task;		// Set instead of fn for submitted tasks
+	};
+
+	// Counts a chunk as done however its function exits.
+	struct ChunkDone {
+		std::atomic<size_t>* remaining;
+		~ChunkDone() {
+			remaining->fetch_sub(1, std::memory_order_release);
+		}
+	};
+
+	struct WorkerQueue {
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	std::vector<std::thread> workers;
+	std::vector<std::unique_ptr<WorkerQueue>> queues;
+	std::mutex wakeMutex;
+	std::condition_variable wake;
+	std::atomic<size_t> pending{ 0 };	// Jobs queued but not yet taken
+	std::atomic<size_t> nextQueue{ 0 };	// Round robin for submitted tasks
+	bool quit = false;
+
+	bool popLocal(size_t queueIndex, Job& job) {
+		WorkerQueue& queue = *queues[queueIndex];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty()) {
+			return false;
+		}
+		job = std::move(queue.jobs.back());
+		queue.jobs.pop_back();
+		return true;
+	}
+
+	bool steal(size_t thiefIndex, Job& job) {
+		size_t queueCount = queues.size();
+		for (size_t k = 1; k < queueCount; k++) {
+			WorkerQueue& queue = *queues[(thiefIndex + k) % queueCount];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if (!queue.jobs.empty()) {
+				job = std::move(queue.jobs.front());
+				queue.jobs.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool tryRunJob(size_t queueIndex) {
+		Job job;
+		if (!popLocal(queueIndex, job) && !steal(queueIndex, job)) {
+			return false;
+		}
+		pending.fetch_sub(1);
+		if (job.task) {
+			job.task();
+			return true;
+		}
+		ChunkDone done = { job.remaining };
+		try {
+			(*job.fn)(job.begin, job.end);
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(job.error->mutex);
+			if (!job.error->exception) {
+				job.error->exception = std::current_exception();
+			}
+		}
+		return true;
+	}
+
+	void workerLoop(size_t queueIndex) {
+		while (true) {
+			if (tryRunJob(queueIndex)) {
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(wakeMutex);
+			wake.wait(lock, [this]() { return quit || pending.load() > 0; });
+			if (quit) {
+				return;
+			}
+		}
+	}
+};
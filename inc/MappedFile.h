@@ -0,0 +1,125 @@
+#pragma once
+#include <string>
+#include <cstddef>
+#if defined(_WIN32)
+// Only the file mapping API is needed, and Windows.h's min/max macros would
+// clash with core.h's
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only memory mapping of a whole file (MapViewOfFile on Windows, mmap
+// elsewhere). The view stays valid until close() or destruction.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	~MappedFile()
+	{
+		close();
+	}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Maps filename. Returns false if it cannot be opened or mapped.
+	bool open(const std::string& filename)
+	{
+		close();
+#if defined(_WIN32)
+		file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE)
+		{
+			return false;
+		}
+		LARGE_INTEGER fileSize;
+		if (!GetFileSizeEx(file, &fileSize))
+		{
+			close();
+			return false;
+		}
+		length = static_cast<size_t>(fileSize.QuadPart);
+		if (length == 0)
+		{
+			return true;
+		}
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping == nullptr)
+		{
+			close();
+			return false;
+		}
+		view = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+		fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			return false;
+		}
+		struct stat info;
+		if (fstat(fd, &info) != 0)
+		{
+			close();
+			return false;
+		}
+		length = static_cast<size_t>(info.st_size);
+		if (length == 0)
+		{
+			return true;
+		}
+		void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		view = p == MAP_FAILED ? nullptr : static_cast<const unsigned char*>(p);
+#endif
+		if (view == nullptr)
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close()
+	{
+#if defined(_WIN32)
+		if (view) UnmapViewOfFile(view);
+		if (mapping) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+		mapping = nullptr;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (view) munmap(const_cast<unsigned char*>(view), length);
+		if (fd >= 0) ::close(fd);
+		fd = -1;
+#endif
+		view = nullptr;
+		length = 0;
+	}
+
+	const unsigned char* data() const
+	{
+		return view;
+	}
+	size_t size() const
+	{
+		return length;
+	}
+
+private:
+	const unsigned char* view = nullptr;
+	size_t length = 0;
+#if defined(_WIN32)
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = nullptr;
+#else
+	int fd = -1;
+#endif
+};
@@ -0,0 +1,549 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include "core.h"
+#include "MeshOptimizer.h"
+
+// Cluster (meshlet) partitioning of indexed triangle lists, for culling parts
+// of a mesh rather than whole models:
+//  - buildClusters reorders the triangles so each cluster of at most 64
+//    vertices and 124 triangles is a contiguous run of the index buffer. A
+//    cluster grows across shared vertices, preferring triangles that add the
+//    fewest new ones, and pulls in the nearest free triangle, found through a
+//    grid of triangle centroids, when it runs out of neighbours, so
+//    disconnected parts such as foliage cards still form compact clusters.
+//    Each run is then reordered for the vertex cache.
+//  - Each cluster stores a bounding sphere and a cone around its triangle
+//    normals. A cluster whose cone points away from the camera has no
+//    triangle facing it and can be skipped.
+//  - cullClusters tests the clusters against a frustum and the cone, and
+//    returns the index ranges left to draw.
+namespace MeshClusters
+{
+	static const unsigned int MAX_VERTICES = 64;
+	static const unsigned int MAX_TRIANGLES = 124;
+
+	// Plain floats so clusters are stored as they are in the model cache.
+	struct Cluster
+	{
+		uint32_t indexOffset;
+		uint32_t indexCount;
+		float center[3];
+		float radius;
+		float coneAxis[3];
+		float coneCutoff;	// Sine of the cone's half angle; 1 if the normals spread too far to cull
+	};
+
+	// A run of the index buffer to draw.
+	struct DrawRange
+	{
+		uint32_t indexOffset;
+		uint32_t indexCount;
+	};
+
+	// Counts from cullClusters, summed over calls.
+	struct CullStats
+	{
+		size_t clusters = 0;
+		size_t frustumCulled = 0;
+		size_t backfaceCulled = 0;
+		size_t triangles = 0;
+		size_t visibleTriangles = 0;
+
+		// Fraction of triangles culled.
+		float cullRatio() const
+		{
+			return triangles > 0 ? 1.0f - static_cast<float>(visibleTriangles) / triangles : 0.0f;
+		}
+	};
+
+	// Clip volume as six inward-facing planes with unit normals.
+	struct Frustum
+	{
+		vec4 planes[6];
+
+		// Planes of the volume a matrix maps to clip space, in the space it maps
+		// from: VP gives world-space planes, VP.mul(W) object-space ones. Uses the
+		// engine's column-vector convention and D3D's 0..w depth range.
+		static Frustum fromMatrix(const Matrix& m)
+		{
+			Frustum frustum;
+			for (int i = 0; i < 3; i++)
+			{
+				for (int c = 0; c < 4; c++)
+				{
+					frustum.planes[i * 2].v[c] = m.a[3][c] + m.a[i][c];
+					frustum.planes[i * 2 + 1].v[c] = m.a[3][c] - m.a[i][c];
+				}
+			}
+			// Near is z >= 0 rather than z >= -w.
+			for (int c = 0; c < 4; c++)
+			{
+				frustum.planes[4].v[c] = m.a[2][c];
+			}
+			for (vec4& plane : frustum.planes)
+			{
+				float length = plane.xyz.getLength();
+				if (length > 0.0f)
+				{
+					plane = vec4(plane.x / length, plane.y / length, plane.z / length, plane.w / length);
+				}
+			}
+			return frustum;
+		}
+
+		bool intersectsSphere(const vec3& center, float radius) const
+		{
+			for (const vec4& plane : planes)
+			{
+				if (plane.xyz.dot(center) + plane.w < -radius)
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+	};
+
+	// True if every triangle of the cluster faces away from cameraPosition.
+	inline bool isBackfacing(const Cluster& cluster, const vec3& cameraPosition)
+	{
+		if (cluster.coneCutoff >= 1.0f)
+		{
+			return false;
+		}
+		vec3 toCenter = vec3(cluster.center[0], cluster.center[1], cluster.center[2]) - cameraPosition;
+		vec3 axis(cluster.coneAxis[0], cluster.coneAxis[1], cluster.coneAxis[2]);
+		return toCenter.dot(axis) >= cluster.coneCutoff * toCenter.getLength() + cluster.radius;
+	}
+
+	// Appends the index ranges of clusters inside frustum with at least one
+	// triangle facing cameraPosition, both in the clusters' space. Clear
+	// cullBackfaces for meshes drawn without back-face culling. Neighbouring
+	// visible clusters share one range. Returns the visible triangle count.
+	inline size_t cullClusters(const Cluster* clusters, size_t clusterCount, const Frustum& frustum, const vec3& cameraPosition,
+		std::vector<DrawRange>& ranges, CullStats* stats = nullptr, bool cullBackfaces = true)
+	{
+		size_t visible = 0;
+		size_t first = ranges.size();
+		for (size_t i = 0; i < clusterCount; i++)
+		{
+			const Cluster& cluster = clusters[i];
+			bool inside = frustum.intersectsSphere(vec3(cluster.center[0], cluster.center[1], cluster.center[2]), cluster.radius);
+			bool backfacing = inside && cullBackfaces && isBackfacing(cluster, cameraPosition);
+			if (stats != nullptr)
+			{
+				stats->clusters++;
+				stats->frustumCulled += inside ? 0 : 1;
+				stats->backfaceCulled += backfacing ? 1 : 0;
+				stats->triangles += cluster.indexCount / 3;
+			}
+			if (!inside || backfacing)
+			{
+				continue;
+			}
+			visible += cluster.indexCount / 3;
+			if (ranges.size() > first && ranges.back().indexOffset + ranges.back().indexCount == cluster.indexOffset)
+			{
+				ranges.back().indexCount += cluster.indexCount;
+			}
+			else
+			{
+				ranges.push_back({ cluster.indexOffset, cluster.indexCount });
+			}
+		}
+		if (stats != nullptr)
+		{
+			stats->visibleTriangles += visible;
+		}
+		return visible;
+	}
+
+	inline size_t cullClusters(const std::vector<Cluster>& clusters, const Frustum& frustum, const vec3& cameraPosition,
+		std::vector<DrawRange>& ranges, CullStats* stats = nullptr, bool cullBackfaces = true)
+	{
+		return cullClusters(clusters.data(), clusters.size(), frustum, cameraPosition, ranges, stats, cullBackfaces);
+	}
+
+	namespace Detail
+	{
+		inline vec3 position(const float* positions, size_t positionStride, unsigned int vertex)
+		{
+			const float* p = reinterpret_cast<const float*>(reinterpret_cast<const unsigned char*>(positions) + vertex * positionStride);
+			return vec3(p[0], p[1], p[2]);
+		}
+
+		// Sphere around the cluster's vertices and cone around its face normals.
+		inline void computeBounds(Cluster& cluster, const unsigned int* indices, const float* positions, size_t positionStride)
+		{
+			vec3 lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			for (uint32_t i = 0; i < cluster.indexCount; i++)
+			{
+				vec3 p = position(positions, positionStride, indices[i]);
+				lo = vec3::Min(lo, p);
+				hi = vec3::Max(hi, p);
+			}
+			vec3 center = (lo + hi) * 0.5f;
+			float radius = 0.0f;
+			for (uint32_t i = 0; i < cluster.indexCount; i++)
+			{
+				radius = max(radius, (position(positions, positionStride, indices[i]) - center).getLength());
+			}
+
+			std::vector<vec3> normals;
+			vec3 sum;
+			for (uint32_t i = 0; i + 2 < cluster.indexCount; i += 3)
+			{
+				vec3 a = position(positions, positionStride, indices[i]);
+				vec3 n = (position(positions, positionStride, indices[i + 1]) - a).cross(position(positions, positionStride, indices[i + 2]) - a);
+				float length = n.getLength();
+				if (length > 0.0f)
+				{
+					normals.push_back(n / length);
+					sum = sum + normals.back();
+				}
+			}
+			float cutoff = 1.0f;
+			vec3 axis(0.0f, 0.0f, 0.0f);
+			if (sum.getLength() > 1e-6f)
+			{
+				axis = sum.normalize();
+				float minDot = 1.0f;
+				for (const vec3& n : normals)
+				{
+					minDot = min(minDot, n.dot(axis));
+				}
+				// Normals within acos(minDot) of the axis all face away from any
+				// view direction within 90 degrees minus that angle of it.
+				cutoff = minDot > 0.0f ? sqrtf(1.0f - minDot * minDot) : 1.0f;
+			}
+			memcpy(cluster.center, &center, sizeof(cluster.center));
+			cluster.radius = radius;
+			memcpy(cluster.coneAxis, &axis, sizeof(cluster.coneAxis));
+			cluster.coneCutoff = cutoff;
+		}
+
+		// Uniform grid over the centroids of the triangles not yet in a cluster,
+		// so the nearest free triangle is found by searching outwards from a
+		// point instead of over every triangle. Cells are cubes sized for a few
+		// triangles each.
+		class CentroidGrid
+		{
+		public:
+			CentroidGrid(const std::vector<vec3>& _centroids) : centroids(_centroids)
+			{
+				lo = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+				vec3 hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+				for (const vec3& c : centroids)
+				{
+					lo = vec3::Min(lo, c);
+					hi = vec3::Max(hi, c);
+				}
+				vec3 extent = hi - lo;
+				float largest = max(extent.x, max(extent.y, extent.z));
+				size_t targetCells = max(centroids.size() / 4, static_cast<size_t>(1));
+				cellSize = largest / max(cbrtf(static_cast<float>(targetCells)), 1.0f);
+				// Flat or thin meshes leave whole axes one cell deep; refine until
+				// the cells actually used come near the target.
+				resize(extent);
+				while (cellSize > 0.0f && static_cast<size_t>(dims[0]) * dims[1] * dims[2] * 8 <= targetCells)
+				{
+					cellSize *= 0.5f;
+					resize(extent);
+				}
+
+				cellStart.assign(static_cast<size_t>(dims[0]) * dims[1] * dims[2] + 1, 0);
+				std::vector<unsigned int> cellOf(centroids.size());
+				for (size_t t = 0; t < centroids.size(); t++)
+				{
+					int cell[3];
+					cellCoords(centroids[t], cell);
+					cellOf[t] = cellIndex(cell[0], cell[1], cell[2]);
+					cellStart[cellOf[t] + 1]++;
+				}
+				for (size_t c = 1; c < cellStart.size(); c++)
+				{
+					cellStart[c] += cellStart[c - 1];
+				}
+				cellTriangles.resize(centroids.size());
+				std::vector<unsigned int> fill(cellStart.begin(), cellStart.end() - 1);
+				for (size_t t = 0; t < centroids.size(); t++)
+				{
+					cellTriangles[fill[cellOf[t]]++] = static_cast<unsigned int>(t);
+				}
+				freeCount.resize(cellStart.size() - 1);
+				for (size_t c = 0; c + 1 < cellStart.size(); c++)
+				{
+					freeCount[c] = cellStart[c + 1] - cellStart[c];
+				}
+				triangleCell.swap(cellOf);
+			}
+
+			void remove(size_t triangle)
+			{
+				freeCount[triangleCell[triangle]]--;
+			}
+
+			// The free triangle whose centroid is nearest to point, lowest index
+			// on ties, or centroids.size() if none is left. emitted flags the
+			// triangles already removed.
+			size_t nearest(const vec3& point, const std::vector<unsigned char>& emitted) const
+			{
+				size_t best = centroids.size();
+				float bestDistance = FLT_MAX;
+				int center[3];
+				cellCoords(point, center);
+				int maxRing = max(dims[0], max(dims[1], dims[2]));
+				for (int ring = 0; ring <= maxRing; ring++)
+				{
+					// Cells in this ring are at least ring - 1 cells from point.
+					if (best != centroids.size() && (ring - 1) * cellSize > bestDistance)
+					{
+						break;
+					}
+					for (int z = center[2] - ring; z <= center[2] + ring; z++)
+					{
+						for (int y = center[1] - ring; y <= center[1] + ring; y++)
+						{
+							// Only the shell: interior rows are the two end cells.
+							bool face = z == center[2] - ring || z == center[2] + ring || y == center[1] - ring || y == center[1] + ring;
+							int step = face || ring == 0 ? 1 : ring * 2;
+							for (int x = center[0] - ring; x <= center[0] + ring; x += step)
+							{
+								if (x < 0 || y < 0 || z < 0 || x >= dims[0] || y >= dims[1] || z >= dims[2])
+								{
+									continue;
+								}
+								unsigned int cell = cellIndex(x, y, z);
+								if (freeCount[cell] == 0)
+								{
+									continue;
+								}
+								for (unsigned int i = cellStart[cell]; i < cellStart[cell + 1]; i++)
+								{
+									unsigned int t = cellTriangles[i];
+									if (emitted[t])
+									{
+										continue;
+									}
+									float distance = (centroids[t] - point).getLength();
+									if (distance < bestDistance || (distance == bestDistance && t < best))
+									{
+										best = t;
+										bestDistance = distance;
+									}
+								}
+							}
+						}
+					}
+				}
+				return best;
+			}
+
+		private:
+			const std::vector<vec3>& centroids;
+			vec3 lo;
+			float cellSize = 0.0f;
+			int dims[3] = { 1, 1, 1 };
+			std::vector<unsigned int> cellStart;		// Prefix offsets into cellTriangles, one per cell plus one
+			std::vector<unsigned int> cellTriangles;
+			std::vector<unsigned int> freeCount;		// Triangles of each cell not yet removed
+			std::vector<unsigned int> triangleCell;
+
+			void resize(const vec3& extent)
+			{
+				const float sizes[3] = { extent.x, extent.y, extent.z };
+				for (int k = 0; k < 3; k++)
+				{
+					dims[k] = cellSize > 0.0f ? min(static_cast<int>(sizes[k] / cellSize) + 1, 1024) : 1;
+				}
+			}
+
+			void cellCoords(const vec3& p, int* cell) const
+			{
+				const float offsets[3] = { p.x - lo.x, p.y - lo.y, p.z - lo.z };
+				for (int k = 0; k < 3; k++)
+				{
+					int c = cellSize > 0.0f ? static_cast<int>(offsets[k] / cellSize) : 0;
+					cell[k] = c < 0 ? 0 : (c >= dims[k] ? dims[k] - 1 : c);
+				}
+			}
+
+			unsigned int cellIndex(int x, int y, int z) const
+			{
+				return static_cast<unsigned int>((z * dims[1] + y) * dims[0] + x);
+			}
+		};
+	}
+
+	// Reorders indices into clusters and returns them, in index buffer order.
+	// positions points at the first vertex's position; positionStride is the
+	// vertex size in bytes.
+	inline std::vector<Cluster> buildClusters(std::vector<unsigned int>& indices, const float* positions, size_t positionStride, size_t vertexCount,
+		unsigned int maxVertices = MAX_VERTICES, unsigned int maxTriangles = MAX_TRIANGLES)
+	{
+		using namespace Detail;
+		std::vector<Cluster> clusters;
+		size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+		{
+			return clusters;
+		}
+
+		std::vector<vec3> centroids(triangleCount);
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			centroids[t] = (position(positions, positionStride, indices[t * 3]) + position(positions, positionStride, indices[t * 3 + 1]) +
+				position(positions, positionStride, indices[t * 3 + 2])) / 3.0f;
+		}
+		// Triangles using each vertex.
+		std::vector<unsigned int> adjacencyStart(vertexCount + 1, 0);
+		for (unsigned int v : indices)
+		{
+			adjacencyStart[v + 1]++;
+		}
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			adjacencyStart[v + 1] += adjacencyStart[v];
+		}
+		std::vector<unsigned int> adjacency(indices.size());
+		std::vector<unsigned int> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			adjacency[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+		}
+
+		std::vector<unsigned char> emitted(triangleCount, 0);
+		CentroidGrid freeTriangles(centroids);
+		std::vector<unsigned int> vertexCluster(vertexCount, ~0u);	// Cluster a vertex was last added to
+		std::vector<unsigned int> localVertex(vertexCount);			// Index of a vertex within its cluster
+		std::vector<unsigned int> clusterVertices;
+		std::vector<unsigned int> clusterTriangles;
+		std::vector<unsigned int> reordered;
+		reordered.reserve(indices.size());
+		size_t nextFree = 0;
+		size_t emittedCount = 0;
+		vec3 centroidSum;
+
+		auto newVertices = [&](size_t t) {
+			unsigned int id = static_cast<unsigned int>(clusters.size());
+			return (vertexCluster[indices[t * 3]] != id) + (vertexCluster[indices[t * 3 + 1]] != id) + (vertexCluster[indices[t * 3 + 2]] != id);
+		};
+		auto flush = [&]() {
+			Cluster cluster = {};
+			cluster.indexOffset = static_cast<uint32_t>(reordered.size());
+			cluster.indexCount = static_cast<uint32_t>(clusterTriangles.size() * 3);
+			// Growing by distance loses the cache order, so restore it per run.
+			// The run is optimized over the cluster's own vertices, so the cost
+			// does not grow with the whole mesh.
+			for (size_t i = 0; i < clusterVertices.size(); i++)
+			{
+				localVertex[clusterVertices[i]] = static_cast<unsigned int>(i);
+			}
+			std::vector<unsigned int> run;
+			run.reserve(cluster.indexCount);
+			for (unsigned int t : clusterTriangles)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					run.push_back(localVertex[indices[t * 3 + k]]);
+				}
+			}
+			MeshOptimizer::optimizeVertexCache(run, clusterVertices.size());
+			for (unsigned int v : run)
+			{
+				reordered.push_back(clusterVertices[v]);
+			}
+			computeBounds(cluster, &reordered[cluster.indexOffset], positions, positionStride);
+			clusters.push_back(cluster);
+			clusterVertices.clear();
+			clusterTriangles.clear();
+			centroidSum = vec3();
+		};
+
+		while (emittedCount < triangleCount)
+		{
+			size_t best = triangleCount;
+			if (clusterTriangles.empty())
+			{
+				while (emitted[nextFree])
+				{
+					nextFree++;
+				}
+				best = nextFree;
+			}
+			else
+			{
+				// Neighbours first: fewest new vertices, then closest to the cluster.
+				vec3 center = centroidSum / static_cast<float>(clusterTriangles.size());
+				int bestNew = 4;
+				float bestDistance = FLT_MAX;
+				for (unsigned int v : clusterVertices)
+				{
+					for (unsigned int a = adjacencyStart[v]; a < adjacencyStart[v + 1]; a++)
+					{
+						unsigned int t = adjacency[a];
+						if (emitted[t])
+						{
+							continue;
+						}
+						int added = newVertices(t);
+						float distance = (centroids[t] - center).getLength();
+						if (clusterVertices.size() + added <= maxVertices && (added < bestNew || (added == bestNew && distance < bestDistance)))
+						{
+							best = t;
+							bestNew = added;
+							bestDistance = distance;
+						}
+					}
+				}
+				// No free neighbour: the nearest free triangle. It shares no vertex
+				// with the cluster, else it would be a neighbour, so it adds three.
+				if (best == triangleCount && clusterVertices.size() + 3 <= maxVertices)
+				{
+					best = freeTriangles.nearest(center, emitted);
+				}
+				if (best == triangleCount)
+				{
+					flush();
+					continue;
+				}
+			}
+
+			unsigned int id = static_cast<unsigned int>(clusters.size());
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int v = indices[best * 3 + k];
+				if (vertexCluster[v] != id)
+				{
+					vertexCluster[v] = id;
+					clusterVertices.push_back(v);
+				}
+			}
+			clusterTriangles.push_back(static_cast<unsigned int>(best));
+			centroidSum = centroidSum + centroids[best];
+			emitted[best] = 1;
+			freeTriangles.remove(best);
+			emittedCount++;
+			if (clusterTriangles.size() == maxTriangles)
+			{
+				flush();
+			}
+		}
+		if (!clusterTriangles.empty())
+		{
+			flush();
+		}
+		indices.swap(reordered);
+		return clusters;
+	}
+
+	// As above for vertices whose first member is a float3 position.
+	template<typename Vertex>
+	std::vector<Cluster> buildClusters(const std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+	{
+		return buildClusters(indices, reinterpret_cast<const float*>(vertices.data()), sizeof(Vertex), vertices.size());
+	}
+}
@@ -0,0 +1,424 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+
+// Triangle and vertex reordering for indexed triangle lists, run when a mesh is
+// loaded or cooked:
+//  - weldVertices merges bitwise identical vertices, which exporters often
+//    write once per triangle, so the cache has something to reuse.
+//  - optimizeVertexCache reorders triangles so vertices are reused while still
+//    in the post-transform cache (Forsyth's linear-speed algorithm).
+//  - optimizeOverdraw reorders clusters of that order so outward-facing parts
+//    draw first, keeping the cache efficiency within a threshold.
+//  - optimizeVertexFetch reorders vertices by first use and remaps the indices.
+// analyzeVertexCache simulates a FIFO cache to measure the result.
+namespace MeshOptimizer
+{
+	// Result of simulating a FIFO post-transform cache over an index buffer.
+	struct VertexCacheStats
+	{
+		size_t triangles = 0;
+		size_t vertices = 0;	// Distinct vertices referenced
+		size_t misses = 0;		// Vertices transformed
+		float acmr = 0.0f;		// Average cache miss ratio: transforms per triangle, 0.5 at best, 3 at worst
+		float atvr = 0.0f;		// Average transform to vertex ratio: 1 at best
+	};
+
+	inline VertexCacheStats analyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount, unsigned int cacheSize = 16)
+	{
+		VertexCacheStats stats;
+		std::vector<unsigned int> fifo(cacheSize, ~0u);
+		std::vector<unsigned char> seen(vertexCount, 0);
+		size_t head = 0;
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			unsigned int v = indices[i];
+			if (!seen[v])
+			{
+				seen[v] = 1;
+				stats.vertices++;
+			}
+			if (std::find(fifo.begin(), fifo.end(), v) == fifo.end())
+			{
+				fifo[head] = v;
+				head = (head + 1) % cacheSize;
+				stats.misses++;
+			}
+		}
+		stats.triangles = indexCount / 3;
+		stats.acmr = stats.triangles > 0 ? static_cast<float>(stats.misses) / stats.triangles : 0.0f;
+		stats.atvr = stats.vertices > 0 ? static_cast<float>(stats.misses) / stats.vertices : 0.0f;
+		return stats;
+	}
+
+	namespace Detail
+	{
+		const int MAX_CACHE_SIZE = 32;
+
+		// Forsyth's vertex score: recently used vertices score high (the last
+		// triangle's three a fixed amount), and vertices with few triangles left
+		// get a boost so they are finished off rather than left stranded.
+		inline float vertexScore(int cachePosition, unsigned int remainingTriangles)
+		{
+			if (remainingTriangles == 0)
+			{
+				return -1.0f;
+			}
+			float score = 0.0f;
+			if (cachePosition >= 0)
+			{
+				score = cachePosition < 3 ? 0.75f : powf(1.0f - (cachePosition - 3) / static_cast<float>(MAX_CACHE_SIZE - 3), 1.5f);
+			}
+			return score + 2.0f / sqrtf(static_cast<float>(remainingTriangles));
+		}
+
+		// Adds a vertex to a cache simulated with timestamps and returns 1 on a miss.
+		inline unsigned int touch(unsigned int v, std::vector<unsigned int>& timestamps, unsigned int& timestamp, unsigned int cacheSize)
+		{
+			if (timestamp - timestamps[v] > cacheSize)
+			{
+				timestamps[v] = timestamp++;
+				return 1;
+			}
+			return 0;
+		}
+
+		inline unsigned int touchTriangle(const unsigned int* tri, std::vector<unsigned int>& timestamps, unsigned int& timestamp, unsigned int cacheSize)
+		{
+			return touch(tri[0], timestamps, timestamp, cacheSize) + touch(tri[1], timestamps, timestamp, cacheSize) + touch(tri[2], timestamps, timestamp, cacheSize);
+		}
+	}
+
+	// Reorders triangles in place for post-transform cache reuse.
+	inline void optimizeVertexCache(std::vector<unsigned int>& indices, size_t vertexCount)
+	{
+		using namespace Detail;
+		size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+		{
+			return;
+		}
+
+		// Triangles of each vertex, in one array with per-vertex offsets.
+		std::vector<unsigned int> remaining(vertexCount, 0);
+		for (unsigned int v : indices)
+		{
+			remaining[v]++;
+		}
+		std::vector<unsigned int> offsets(vertexCount + 1, 0);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			offsets[v + 1] = offsets[v] + remaining[v];
+		}
+		std::vector<unsigned int> adjacency(indices.size());
+		std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				adjacency[fill[indices[t * 3 + k]]++] = static_cast<unsigned int>(t);
+			}
+		}
+
+		std::vector<float> vertexScores(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			vertexScores[v] = vertexScore(-1, remaining[v]);
+		}
+		std::vector<unsigned char> emitted(triangleCount, 0);
+		std::vector<unsigned int> output;
+		output.reserve(indices.size());
+
+		unsigned int cache[MAX_CACHE_SIZE + 3];
+		unsigned int newCache[MAX_CACHE_SIZE + 3];
+		int cacheCount = 0;
+		size_t scanCursor = 0;
+		int best = -1;
+
+		for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++)
+		{
+			if (best < 0)
+			{
+				// Nothing in the cache touches a live triangle; take the next one in input order.
+				while (emitted[scanCursor])
+				{
+					scanCursor++;
+				}
+				best = static_cast<int>(scanCursor);
+			}
+			const unsigned int* tri = &indices[best * 3];
+			output.insert(output.end(), tri, tri + 3);
+			emitted[best] = 1;
+
+			// Drop the triangle from its vertices' lists.
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int v = tri[k];
+				unsigned int* list = &adjacency[offsets[v]];
+				for (unsigned int j = 0; j < remaining[v]; j++)
+				{
+					if (list[j] == static_cast<unsigned int>(best))
+					{
+						list[j] = list[remaining[v] - 1];
+						break;
+					}
+				}
+				remaining[v]--;
+			}
+
+			// The triangle's vertices move to the front of the cache.
+			int newCount = 0;
+			newCache[newCount++] = tri[0];
+			newCache[newCount++] = tri[1];
+			newCache[newCount++] = tri[2];
+			for (int i = 0; i < cacheCount; i++)
+			{
+				unsigned int v = cache[i];
+				if (v != tri[0] && v != tri[1] && v != tri[2])
+				{
+					newCache[newCount++] = v;
+				}
+			}
+			for (int i = MAX_CACHE_SIZE; i < newCount; i++)
+			{
+				vertexScores[newCache[i]] = vertexScore(-1, remaining[newCache[i]]);
+			}
+			cacheCount = newCount < MAX_CACHE_SIZE ? newCount : MAX_CACHE_SIZE;
+			memcpy(cache, newCache, cacheCount * sizeof(unsigned int));
+
+			// Rescore cached vertices and their triangles, keeping the best.
+			for (int i = 0; i < cacheCount; i++)
+			{
+				vertexScores[cache[i]] = vertexScore(i, remaining[cache[i]]);
+			}
+			best = -1;
+			float bestScore = -1.0f;
+			for (int i = 0; i < cacheCount; i++)
+			{
+				unsigned int v = cache[i];
+				const unsigned int* list = &adjacency[offsets[v]];
+				for (unsigned int j = 0; j < remaining[v]; j++)
+				{
+					unsigned int t = list[j];
+					float score = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+					if (score > bestScore)
+					{
+						bestScore = score;
+						best = static_cast<int>(t);
+					}
+				}
+			}
+		}
+		indices.swap(output);
+	}
+
+	// Reorders clusters of a cache-optimized index buffer so triangles facing
+	// away from the mesh centre draw first, which tends to occlude the rest.
+	// The cache-optimized order is split into clusters whose miss ratio stays
+	// within threshold times that of the run they came from, so reordering them
+	// costs at most that much cache efficiency. positions points at the first
+	// vertex's position; positionStride is the vertex size in bytes.
+	inline void optimizeOverdraw(std::vector<unsigned int>& indices, const float* positions, size_t vertexCount, size_t positionStride, float threshold = 1.05f, unsigned int cacheSize = 16)
+	{
+		using namespace Detail;
+		size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0)
+		{
+			return;
+		}
+		std::vector<unsigned int> timestamps(vertexCount, 0);
+		unsigned int timestamp = cacheSize + 1;
+
+		// Hard boundaries: a triangle missing on all three vertices starts a new patch.
+		std::vector<size_t> hard;
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			if (touchTriangle(&indices[t * 3], timestamps, timestamp, cacheSize) == 3 || t == 0)
+			{
+				hard.push_back(t);
+			}
+		}
+		hard.push_back(triangleCount);
+
+		// Soft boundaries: split each patch whenever the running miss ratio since
+		// the last split has reached the patch's ratio times threshold.
+		std::vector<size_t> clusters;
+		for (size_t h = 0; h + 1 < hard.size(); h++)
+		{
+			size_t start = hard[h];
+			size_t end = hard[h + 1];
+			timestamp += cacheSize + 1;
+			unsigned int patchMisses = 0;
+			for (size_t t = start; t < end; t++)
+			{
+				patchMisses += touchTriangle(&indices[t * 3], timestamps, timestamp, cacheSize);
+			}
+			float target = threshold * patchMisses / static_cast<float>(end - start);
+
+			size_t first = clusters.size();
+			clusters.push_back(start);
+			timestamp += cacheSize + 1;
+			unsigned int misses = 0;
+			size_t faces = 0;
+			for (size_t t = start; t < end; t++)
+			{
+				misses += touchTriangle(&indices[t * 3], timestamps, timestamp, cacheSize);
+				faces++;
+				if (misses <= target * faces && t + 1 < end)
+				{
+					clusters.push_back(t + 1);
+					timestamp += cacheSize + 1;
+					misses = 0;
+					faces = 0;
+				}
+			}
+			// A tail that never reached the target joins the cluster before it.
+			if (faces > 0 && misses > target * faces && clusters.size() - first > 1)
+			{
+				clusters.pop_back();
+			}
+		}
+		clusters.push_back(triangleCount);
+
+		auto position = [&](unsigned int v) {
+			return reinterpret_cast<const float*>(reinterpret_cast<const unsigned char*>(positions) + v * positionStride);
+		};
+
+		// Area-weighted centroid of the whole mesh.
+		size_t clusterCount = clusters.size() - 1;
+		std::vector<float> clusterCentroid(clusterCount * 3, 0.0f), clusterNormal(clusterCount * 3, 0.0f), clusterArea(clusterCount, 0.0f);
+		float meshCentroid[3] = { 0.0f, 0.0f, 0.0f };
+		float meshArea = 0.0f;
+		for (size_t c = 0; c < clusterCount; c++)
+		{
+			for (size_t t = clusters[c]; t < clusters[c + 1]; t++)
+			{
+				const float* a = position(indices[t * 3]);
+				const float* b = position(indices[t * 3 + 1]);
+				const float* d = position(indices[t * 3 + 2]);
+				float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+				float e2[3] = { d[0] - a[0], d[1] - a[1], d[2] - a[2] };
+				float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+				float area = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+				for (int k = 0; k < 3; k++)
+				{
+					float centre = (a[k] + b[k] + d[k]) / 3.0f;
+					clusterCentroid[c * 3 + k] += centre * area;
+					clusterNormal[c * 3 + k] += n[k];
+					meshCentroid[k] += centre * area;
+				}
+				clusterArea[c] += area;
+				meshArea += area;
+			}
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			meshCentroid[k] = meshArea > 0.0f ? meshCentroid[k] / meshArea : 0.0f;
+		}
+
+		// Sort key: how far the cluster faces out from the mesh centre.
+		std::vector<float> keys(clusterCount, 0.0f);
+		for (size_t c = 0; c < clusterCount; c++)
+		{
+			float* n = &clusterNormal[c * 3];
+			float length = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (clusterArea[c] <= 0.0f || length <= 0.0f)
+			{
+				continue;
+			}
+			for (int k = 0; k < 3; k++)
+			{
+				keys[c] += (clusterCentroid[c * 3 + k] / clusterArea[c] - meshCentroid[k]) * n[k] / length;
+			}
+		}
+		std::vector<size_t> order(clusterCount);
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys[a] > keys[b]; });
+
+		std::vector<unsigned int> output;
+		output.reserve(indices.size());
+		for (size_t c : order)
+		{
+			output.insert(output.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+		}
+		indices.swap(output);
+	}
+
+	// Merges vertices with identical bytes and remaps the indices. Returns the
+	// new vertex count.
+	template<typename Vertex>
+	size_t weldVertices(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+	{
+		auto hash = [&](unsigned int v) {
+			const unsigned char* p = reinterpret_cast<const unsigned char*>(&vertices[v]);
+			size_t h = 14695981039346656037ull;
+			for (size_t i = 0; i < sizeof(Vertex); i++)
+			{
+				h = (h ^ p[i]) * 1099511628211ull;
+			}
+			return h;
+		};
+		auto equal = [&](unsigned int a, unsigned int b) {
+			return memcmp(&vertices[a], &vertices[b], sizeof(Vertex)) == 0;
+		};
+		std::unordered_map<unsigned int, unsigned int, decltype(hash), decltype(equal)> unique(vertices.size(), hash, equal);
+		std::vector<unsigned int> remap(vertices.size());
+		std::vector<Vertex> welded;
+		welded.reserve(vertices.size());
+		for (size_t v = 0; v < vertices.size(); v++)
+		{
+			auto inserted = unique.insert({ static_cast<unsigned int>(v), static_cast<unsigned int>(welded.size()) });
+			if (inserted.second)
+			{
+				welded.push_back(vertices[v]);
+			}
+			remap[v] = inserted.first->second;
+		}
+		for (unsigned int& index : indices)
+		{
+			index = remap[index];
+		}
+		vertices.swap(welded);
+		return vertices.size();
+	}
+
+	// Reorders vertices by first use in the index buffer and remaps the indices.
+	// Unreferenced vertices are dropped; returns the new vertex count.
+	template<typename Vertex>
+	size_t optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices)
+	{
+		std::vector<unsigned int> remap(vertices.size(), ~0u);
+		std::vector<Vertex> reordered;
+		reordered.reserve(vertices.size());
+		for (unsigned int& index : indices)
+		{
+			if (remap[index] == ~0u)
+			{
+				remap[index] = static_cast<unsigned int>(reordered.size());
+				reordered.push_back(vertices[index]);
+			}
+			index = remap[index];
+		}
+		vertices.swap(reordered);
+		return vertices.size();
+	}
+
+	// Runs all passes on a mesh whose vertices start with a float3 position.
+	template<typename Vertex>
+	void optimizeMesh(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices, float overdrawThreshold = 1.05f)
+	{
+		if (vertices.empty() || indices.size() < 3)
+		{
+			return;
+		}
+		weldVertices(vertices, indices);
+		optimizeVertexCache(indices, vertices.size());
+		optimizeOverdraw(indices, reinterpret_cast<const float*>(vertices.data()), vertices.size(), sizeof(Vertex), overdrawThreshold);
+		optimizeVertexFetch(vertices, indices);
+	}
+}
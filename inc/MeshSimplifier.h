@@ -0,0 +1,936 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+#include "MeshOptimizer.h"
+
+// Quadric error simplification for building mesh LODs. Edges are collapsed
+// onto one of their two positions, cheapest first by the mean squared distance
+// to the planes of the triangles around the removed position, so every LOD is
+// just a smaller index buffer over the original vertices.
+//
+// Vertices sharing a position (UV or normal seams) move together: each is
+// merged into a vertex at the target position on its own side of the seam,
+// and collapses that would pull one across a UV seam are rejected, so seams
+// shorten without tearing. With attributes given, the normal and UV change of
+// each merged pair adds to the cost. Open borders only collapse along
+// themselves, or are locked entirely with lockBorders. For skinned meshes,
+// collapses between vertices with different bone weights cost extra and are
+// rejected past maxSkinDifference, so joints keep their shape.
+namespace MeshSimplifier
+{
+	struct Settings
+	{
+		float targetRatio = 0.5f;			// Fraction of triangles to keep
+		float maxError = 1.0f;				// Largest error allowed, relative to the mesh extent
+		bool lockBorders = false;			// Keep open edges in place
+		float skinWeight = 0.01f;			// Error, relative to the extent, charged per unit of bone weight difference
+		float maxSkinDifference = 0.5f;		// Summed bone weight difference (0 to 2) beyond which a collapse is rejected
+		float normalWeight = 0.01f;			// Error, relative to the extent, charged per unit of normal difference
+		float uvWeight = 0.01f;				// Error, relative to the extent, charged per unit of UV difference
+	};
+
+	// Up to four bone influences of a vertex.
+	struct SkinInfluence
+	{
+		unsigned int bones[4];
+		float weights[4];
+	};
+
+	// The attributes of a vertex that collapses are charged for changing.
+	struct VertexAttributes
+	{
+		float normal[3];
+		float uv[2];
+	};
+
+	// One level of a LOD chain: indices into the original vertices, and the
+	// largest distance from an original vertex to the LOD surface, in model units.
+	struct LOD
+	{
+		std::vector<unsigned int> indices;
+		float error = 0.0f;
+	};
+
+	namespace Detail
+	{
+		// Symmetric 4x4 matrix accumulating weighted squared plane distances,
+		// with the total weight, so evaluate gives their weighted mean rather
+		// than a sum that grows with the area merged in.
+		struct Quadric
+		{
+			double xx = 0, xy = 0, xz = 0, xw = 0, yy = 0, yz = 0, yw = 0, zz = 0, zw = 0, ww = 0;
+			double weight = 0;
+
+			void addPlane(double a, double b, double c, double d, double w)
+			{
+				xx += w * a * a; xy += w * a * b; xz += w * a * c; xw += w * a * d;
+				yy += w * b * b; yz += w * b * c; yw += w * b * d;
+				zz += w * c * c; zw += w * c * d;
+				ww += w * d * d;
+				weight += w;
+			}
+
+			void add(const Quadric& q)
+			{
+				xx += q.xx; xy += q.xy; xz += q.xz; xw += q.xw;
+				yy += q.yy; yz += q.yz; yw += q.yw;
+				zz += q.zz; zw += q.zw;
+				ww += q.ww;
+				weight += q.weight;
+			}
+
+			double evaluate(const float* p) const
+			{
+				double x = p[0], y = p[1], z = p[2];
+				double r = xx * x * x + 2 * xy * x * y + 2 * xz * x * z + 2 * xw * x
+					+ yy * y * y + 2 * yz * y * z + 2 * yw * y
+					+ zz * z * z + 2 * zw * z
+					+ ww;
+				return r > 0 && weight > 0 ? r / weight : 0;
+			}
+		};
+
+		enum VertexKind : unsigned char { Interior, Border, Locked };
+
+		const unsigned int NO_VERTEX = ~0u;
+
+		inline uint64_t edgeKey(unsigned int a, unsigned int b)
+		{
+			return (static_cast<uint64_t>(a) << 32) | b;
+		}
+
+		inline void cross(const float* a, const float* b, float* out)
+		{
+			out[0] = a[1] * b[2] - a[2] * b[1];
+			out[1] = a[2] * b[0] - a[0] * b[2];
+			out[2] = a[0] * b[1] - a[1] * b[0];
+		}
+
+		inline float dot(const float* a, const float* b)
+		{
+			return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+		}
+
+		inline void triangleNormal(const float* a, const float* b, const float* c, float* n)
+		{
+			float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			cross(e1, e2, n);
+		}
+
+		// Closest point to p on triangle abc, by which Voronoi region of the
+		// triangle p projects into (Ericson, Real-Time Collision Detection 5.1.5).
+		inline void closestPointOnTriangle(const float* p, const float* a, const float* b, const float* c, float* out)
+		{
+			float ab[3], ac[3], ap[3], bp[3], cp[3];
+			for (int k = 0; k < 3; k++)
+			{
+				ab[k] = b[k] - a[k];
+				ac[k] = c[k] - a[k];
+				ap[k] = p[k] - a[k];
+				bp[k] = p[k] - b[k];
+				cp[k] = p[k] - c[k];
+			}
+			float d1 = dot(ab, ap), d2 = dot(ac, ap);
+			if (d1 <= 0.0f && d2 <= 0.0f)
+			{
+				memcpy(out, a, sizeof(float) * 3);
+				return;
+			}
+			float d3 = dot(ab, bp), d4 = dot(ac, bp);
+			if (d3 >= 0.0f && d4 <= d3)
+			{
+				memcpy(out, b, sizeof(float) * 3);
+				return;
+			}
+			float vc = d1 * d4 - d3 * d2;
+			if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+			{
+				float t = d1 / (d1 - d3);
+				for (int k = 0; k < 3; k++) out[k] = a[k] + ab[k] * t;
+				return;
+			}
+			float d5 = dot(ab, cp), d6 = dot(ac, cp);
+			if (d6 >= 0.0f && d5 <= d6)
+			{
+				memcpy(out, c, sizeof(float) * 3);
+				return;
+			}
+			float vb = d5 * d2 - d1 * d6;
+			if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+			{
+				float t = d2 / (d2 - d6);
+				for (int k = 0; k < 3; k++) out[k] = a[k] + ac[k] * t;
+				return;
+			}
+			float va = d3 * d6 - d5 * d4;
+			if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f)
+			{
+				float t = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+				for (int k = 0; k < 3; k++) out[k] = b[k] + (c[k] - b[k]) * t;
+				return;
+			}
+			float sum = va + vb + vc;
+			float v = sum > 0.0f ? vb / sum : 0.0f, w = sum > 0.0f ? vc / sum : 0.0f;
+			for (int k = 0; k < 3; k++) out[k] = a[k] + ab[k] * v + ac[k] * w;
+		}
+
+		inline float distanceSquared(const float* a, const float* b)
+		{
+			float d[3] = { a[0] - b[0], a[1] - b[1], a[2] - b[2] };
+			return dot(d, d);
+		}
+
+		inline float pointTriangleDistanceSquared(const float* p, const float* a, const float* b, const float* c)
+		{
+			float closest[3];
+			closestPointOnTriangle(p, a, b, c, closest);
+			return distanceSquared(p, closest);
+		}
+
+		// Maps each of count packed float3 positions to the first vertex with
+		// the same position.
+		inline std::vector<unsigned int> groupPositions(const float* pos, size_t count)
+		{
+			struct PositionHash
+			{
+				const float* pos;
+				size_t operator()(unsigned int v) const
+				{
+					uint32_t bits[3];
+					memcpy(bits, pos + v * 3, sizeof(bits));
+					return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+				}
+			};
+			struct PositionEqual
+			{
+				const float* pos;
+				bool operator()(unsigned int a, unsigned int b) const
+				{
+					return memcmp(pos + a * 3, pos + b * 3, 3 * sizeof(float)) == 0;
+				}
+			};
+			std::unordered_map<unsigned int, unsigned int, PositionHash, PositionEqual> groups(count, PositionHash{ pos }, PositionEqual{ pos });
+			std::vector<unsigned int> group(count);
+			for (size_t v = 0; v < count; v++)
+			{
+				group[v] = groups.insert({ static_cast<unsigned int>(v), static_cast<unsigned int>(v) }).first->second;
+			}
+			return group;
+		}
+
+		inline std::vector<float> packPositions(const float* positions, size_t positionStride, size_t vertexCount)
+		{
+			std::vector<float> pos(vertexCount * 3);
+			for (size_t v = 0; v < vertexCount; v++)
+			{
+				memcpy(&pos[v * 3], reinterpret_cast<const unsigned char*>(positions) + v * positionStride, sizeof(float) * 3);
+			}
+			return pos;
+		}
+
+		inline float skinDifference(const SkinInfluence& a, const SkinInfluence& b)
+		{
+			// Sum over the union of bones of |weight in a - weight in b|.
+			float difference = 0.0f;
+			for (int i = 0; i < 4; i++)
+			{
+				float other = 0.0f;
+				for (int j = 0; j < 4; j++)
+				{
+					if (b.bones[j] == a.bones[i]) other += b.weights[j];
+				}
+				difference += fabsf(a.weights[i] - other);
+			}
+			for (int j = 0; j < 4; j++)
+			{
+				bool shared = false;
+				for (int i = 0; i < 4; i++)
+				{
+					shared = shared || a.bones[i] == b.bones[j];
+				}
+				if (!shared) difference += b.weights[j];
+			}
+			return difference;
+		}
+
+		template<typename Vertex>
+		auto readUV(const Vertex& vertex, float* uv) -> decltype(vertex.tu, void())
+		{
+			uv[0] = vertex.tu;
+			uv[1] = vertex.tv;
+		}
+
+		template<typename Vertex>
+		auto readUV(const Vertex& vertex, float* uv) -> decltype(vertex.u, void())
+		{
+			uv[0] = vertex.u;
+			uv[1] = vertex.v;
+		}
+
+		// Attributes of vertices with a float3 normal member and u, v or tu, tv members.
+		template<typename Vertex>
+		std::vector<VertexAttributes> gatherAttributes(const std::vector<Vertex>& vertices)
+		{
+			std::vector<VertexAttributes> attributes(vertices.size());
+			for (size_t v = 0; v < vertices.size(); v++)
+			{
+				memcpy(attributes[v].normal, &vertices[v].normal, sizeof(attributes[v].normal));
+				readUV(vertices[v], attributes[v].uv);
+			}
+			return attributes;
+		}
+	}
+
+	// Largest distance from a vertex of original to the surface of simplified,
+	// in model units: the one-sided Hausdorff distance over the original
+	// vertices. collapsedTo maps each vertex to the one it was merged into, as
+	// simplify reports it; the triangles around that vertex bound the search,
+	// which then checks every triangle in a grid within that distance.
+	inline float measureError(const std::vector<unsigned int>& original, const std::vector<unsigned int>& simplified,
+		const float* positions, size_t positionStride, size_t vertexCount, const std::vector<unsigned int>& collapsedTo)
+	{
+		using namespace Detail;
+		if (simplified.empty())
+		{
+			return 0.0f;
+		}
+		std::vector<float> pos = packPositions(positions, positionStride, vertexCount);
+		std::vector<unsigned int> group = groupPositions(pos.data(), vertexCount);
+
+		// Simplified triangles around each position.
+		std::vector<unsigned int> offsets(vertexCount + 1, 0), triangles(simplified.size());
+		for (unsigned int v : simplified)
+		{
+			offsets[group[v] + 1]++;
+		}
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			offsets[v + 1] += offsets[v];
+		}
+		std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < simplified.size(); i++)
+		{
+			triangles[fill[group[simplified[i]]]++] = static_cast<unsigned int>(i / 3);
+		}
+
+		// Simplified triangles in a uniform grid over their bounds, each in every
+		// cell its bounding box overlaps.
+		size_t triangleCount = simplified.size() / 3;
+		int cells = static_cast<int>(cbrt(static_cast<double>(triangleCount)));
+		cells = cells < 1 ? 1 : cells;
+		float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX }, cellSize[3];
+		for (unsigned int v : simplified)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				lo[k] = pos[v * 3 + k] < lo[k] ? pos[v * 3 + k] : lo[k];
+				hi[k] = pos[v * 3 + k] > hi[k] ? pos[v * 3 + k] : hi[k];
+			}
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			cellSize[k] = hi[k] > lo[k] ? (hi[k] - lo[k]) / cells : 1.0f;
+		}
+		auto cellOf = [&](float x, int k) {
+			int c = static_cast<int>(floorf((x - lo[k]) / cellSize[k]));
+			return c < 0 ? 0 : (c >= cells ? cells - 1 : c);
+		};
+		auto triangleCells = [&](size_t t, int* c0, int* c1) {
+			for (int k = 0; k < 3; k++)
+			{
+				float a = pos[simplified[t * 3] * 3 + k], b = pos[simplified[t * 3 + 1] * 3 + k], c = pos[simplified[t * 3 + 2] * 3 + k];
+				c0[k] = cellOf(a < b ? (a < c ? a : c) : (b < c ? b : c), k);
+				c1[k] = cellOf(a > b ? (a > c ? a : c) : (b > c ? b : c), k);
+			}
+		};
+		std::vector<unsigned int> cellOffsets(static_cast<size_t>(cells) * cells * cells + 1, 0), cellTriangles;
+		for (int round = 0; round < 2; round++)
+		{
+			std::vector<unsigned int> cellFill(cellOffsets.begin(), cellOffsets.end() - 1);
+			for (size_t t = 0; t < triangleCount; t++)
+			{
+				int c0[3], c1[3];
+				triangleCells(t, c0, c1);
+				for (int z = c0[2]; z <= c1[2]; z++)
+				{
+					for (int y = c0[1]; y <= c1[1]; y++)
+					{
+						for (int x = c0[0]; x <= c1[0]; x++)
+						{
+							size_t cell = (static_cast<size_t>(z) * cells + y) * cells + x;
+							if (round == 0)
+							{
+								cellOffsets[cell + 1]++;
+							}
+							else
+							{
+								cellTriangles[cellFill[cell]++] = static_cast<unsigned int>(t);
+							}
+						}
+					}
+				}
+			}
+			if (round == 0)
+			{
+				for (size_t c = 0; c + 1 < cellOffsets.size(); c++)
+				{
+					cellOffsets[c + 1] += cellOffsets[c];
+				}
+				cellTriangles.resize(cellOffsets.back());
+			}
+		}
+
+		float worst = 0.0f;
+		std::vector<unsigned char> measured(vertexCount, 0);
+		std::vector<unsigned int> checked(triangleCount, 0);
+		for (unsigned int v : original)
+		{
+			unsigned int g = group[v];
+			if (measured[g] || offsets[g] != offsets[g + 1])
+			{
+				continue;	// Done, or still a vertex of the LOD
+			}
+			measured[g] = 1;
+			const float* p = &pos[v * 3];
+			auto distance = [&](size_t t) {
+				const unsigned int* tri = &simplified[t * 3];
+				return pointTriangleDistanceSquared(p, &pos[tri[0] * 3], &pos[tri[1] * 3], &pos[tri[2] * 3]);
+			};
+			float best = FLT_MAX;
+			unsigned int target = group[collapsedTo[v]];
+			for (unsigned int j = offsets[target]; j < offsets[target + 1]; j++)
+			{
+				float d = distance(triangles[j]);
+				best = d < best ? d : best;
+			}
+			// Any closer triangle overlaps the cells within best of the vertex.
+			float radius = best < FLT_MAX ? sqrtf(best) : FLT_MAX;
+			int c0[3], c1[3];
+			for (int k = 0; k < 3; k++)
+			{
+				c0[k] = radius < FLT_MAX ? cellOf(p[k] - radius, k) : 0;
+				c1[k] = radius < FLT_MAX ? cellOf(p[k] + radius, k) : cells - 1;
+			}
+			for (int z = c0[2]; z <= c1[2]; z++)
+			{
+				for (int y = c0[1]; y <= c1[1]; y++)
+				{
+					for (int x = c0[0]; x <= c1[0]; x++)
+					{
+						size_t cell = (static_cast<size_t>(z) * cells + y) * cells + x;
+						for (unsigned int j = cellOffsets[cell]; j < cellOffsets[cell + 1]; j++)
+						{
+							unsigned int t = cellTriangles[j];
+							if (checked[t] != v + 1)
+							{
+								checked[t] = v + 1;
+								float d = distance(t);
+								best = d < best ? d : best;
+							}
+						}
+					}
+				}
+			}
+			worst = best > worst ? best : worst;
+		}
+		return sqrtf(worst);
+	}
+
+	// Simplifies indices in place towards settings.targetRatio of the triangles
+	// and returns the error reached, as measureError gives it. Stops early if no
+	// collapse is left within settings.maxError. positions points at the first
+	// vertex's position; positionStride is the vertex size in bytes. skin and
+	// attributes are optional, one entry per vertex. collapsedTo, if given,
+	// receives the vertex each vertex was merged into, or the vertex itself.
+	inline float simplify(std::vector<unsigned int>& indices, const float* positions, size_t positionStride, size_t vertexCount,
+		const Settings& settings, const SkinInfluence* skin = nullptr, const VertexAttributes* attributes = nullptr,
+		std::vector<unsigned int>* collapsedTo = nullptr)
+	{
+		using namespace Detail;
+		std::vector<unsigned int> merged(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			merged[v] = static_cast<unsigned int>(v);
+		}
+		size_t targetIndexCount = static_cast<size_t>(indices.size() / 3 * settings.targetRatio) * 3;
+		if (indices.size() <= targetIndexCount || vertexCount == 0)
+		{
+			if (collapsedTo != nullptr)
+			{
+				collapsedTo->swap(merged);
+			}
+			return 0.0f;
+		}
+		const std::vector<unsigned int> original = indices;
+
+		// Positions scaled so the mesh extent is 1, keeping errors scale independent.
+		std::vector<float> pos = packPositions(positions, positionStride, vertexCount);
+		float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				lo[k] = pos[v * 3 + k] < lo[k] ? pos[v * 3 + k] : lo[k];
+				hi[k] = pos[v * 3 + k] > hi[k] ? pos[v * 3 + k] : hi[k];
+			}
+		}
+		float extent = 0.0f;
+		for (int k = 0; k < 3; k++)
+		{
+			extent = hi[k] - lo[k] > extent ? hi[k] - lo[k] : extent;
+		}
+		float scale = extent > 0.0f ? 1.0f / extent : 1.0f;
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				pos[v * 3 + k] = (pos[v * 3 + k] - lo[k]) * scale;
+			}
+		}
+
+		// Vertices at the same position share a group, named by its first vertex,
+		// which holds the group's quadric and kind. copies lists each group's vertices.
+		std::vector<unsigned int> group = groupPositions(pos.data(), vertexCount);
+		std::vector<unsigned int> copyOffsets(vertexCount + 1, 0), copies(vertexCount);
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			copyOffsets[group[v] + 1]++;
+		}
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			copyOffsets[v + 1] += copyOffsets[v];
+		}
+		{
+			std::vector<unsigned int> fill(copyOffsets.begin(), copyOffsets.end() - 1);
+			for (size_t v = 0; v < vertexCount; v++)
+			{
+				copies[fill[group[v]]++] = static_cast<unsigned int>(v);
+			}
+		}
+
+		// Border edges have no opposite half-edge between the same two positions.
+		std::unordered_set<uint64_t> halfEdges;
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				halfEdges.insert(edgeKey(group[indices[i + k]], group[indices[i + (k + 1) % 3]]));
+			}
+		}
+		auto isBorderEdge = [&](unsigned int a, unsigned int b) {
+			return halfEdges.count(edgeKey(group[b], group[a])) == 0 || halfEdges.count(edgeKey(group[a], group[b])) == 0;
+		};
+
+		std::vector<unsigned char> kind(vertexCount, Interior);
+		std::vector<Quadric> quadrics(vertexCount);
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			const unsigned int tri[3] = { indices[i], indices[i + 1], indices[i + 2] };
+			float n[3];
+			triangleNormal(&pos[tri[0] * 3], &pos[tri[1] * 3], &pos[tri[2] * 3], n);
+			double length = sqrt(static_cast<double>(n[0]) * n[0] + static_cast<double>(n[1]) * n[1] + static_cast<double>(n[2]) * n[2]);
+			if (length <= 0)
+			{
+				continue;
+			}
+			double a = n[0] / length, b = n[1] / length, c = n[2] / length;
+			double d = -(a * pos[tri[0] * 3] + b * pos[tri[0] * 3 + 1] + c * pos[tri[0] * 3 + 2]);
+			double area = length * 0.5;
+			for (int k = 0; k < 3; k++)
+			{
+				quadrics[group[tri[k]]].addPlane(a, b, c, d, area);
+			}
+			// A plane through each border edge, perpendicular to the triangle,
+			// keeps border vertices on the border line.
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int v0 = group[tri[k]], v1 = group[tri[(k + 1) % 3]];
+				if (!halfEdges.count(edgeKey(v1, v0)))
+				{
+					kind[v0] = Border;
+					kind[v1] = Border;
+					float edge[3] = { pos[v1 * 3] - pos[v0 * 3], pos[v1 * 3 + 1] - pos[v0 * 3 + 1], pos[v1 * 3 + 2] - pos[v0 * 3 + 2] };
+					float triNormal[3] = { static_cast<float>(a), static_cast<float>(b), static_cast<float>(c) };
+					float p[3];
+					cross(edge, triNormal, p);
+					double pl = sqrt(static_cast<double>(p[0]) * p[0] + static_cast<double>(p[1]) * p[1] + static_cast<double>(p[2]) * p[2]);
+					if (pl > 0)
+					{
+						double pa = p[0] / pl, pb = p[1] / pl, pc = p[2] / pl;
+						double pd = -(pa * pos[v0 * 3] + pb * pos[v0 * 3 + 1] + pc * pos[v0 * 3 + 2]);
+						double weight = 10.0 * pl * pl;
+						quadrics[v0].addPlane(pa, pb, pc, pd, weight);
+						quadrics[v1].addPlane(pa, pb, pc, pd, weight);
+					}
+				}
+			}
+		}
+		if (settings.lockBorders)
+		{
+			for (size_t v = 0; v < vertexCount; v++)
+			{
+				if (kind[v] == Border)
+				{
+					kind[v] = Locked;
+				}
+			}
+		}
+
+		std::vector<unsigned char> used(vertexCount);
+		std::vector<unsigned int> offsets(vertexCount + 1), adjacency;
+
+		// Weighted squared change of normal and UV when a merges into b.
+		auto attributeCost = [&](unsigned int a, unsigned int b) {
+			if (attributes == nullptr)
+			{
+				return 0.0;
+			}
+			const VertexAttributes& x = attributes[a];
+			const VertexAttributes& y = attributes[b];
+			double normal = 0.0, uv = 0.0;
+			for (int k = 0; k < 3; k++)
+			{
+				normal += static_cast<double>(x.normal[k] - y.normal[k]) * (x.normal[k] - y.normal[k]);
+			}
+			for (int k = 0; k < 2; k++)
+			{
+				uv += static_cast<double>(x.uv[k] - y.uv[k]) * (x.uv[k] - y.uv[k]);
+			}
+			return static_cast<double>(settings.normalWeight) * settings.normalWeight * normal + static_cast<double>(settings.uvWeight) * settings.uvWeight * uv;
+		};
+		// Vertices with the same UV are on the same side of any UV seam through their position.
+		auto sameSide = [&](unsigned int a, unsigned int b) {
+			return attributes == nullptr || (attributes[a].uv[0] == attributes[b].uv[0] && attributes[a].uv[1] == attributes[b].uv[1]);
+		};
+
+		// Pairs each used vertex at position from with the vertex at position to
+		// it merges into: the closest in attributes among those sharing a triangle
+		// with it, or failing that, with a vertex on its side of the seam at from.
+		// Fails if some vertex has no such partner, or a pair's bone weights differ
+		// too much; cost is the largest attribute and skin cost of a pair.
+		std::vector<std::pair<unsigned int, unsigned int>> pairs;
+		auto pairCopies = [&](unsigned int from, unsigned int to, double& cost) {
+			pairs.clear();
+			double worstAttributes = 0.0, worstSkin = 0.0;
+			for (unsigned int i = copyOffsets[from]; i < copyOffsets[from + 1]; i++)
+			{
+				unsigned int f = copies[i];
+				if (!used[f])
+				{
+					continue;
+				}
+				unsigned int partner = NO_VERTEX;
+				double best = DBL_MAX;
+				for (int pass = 0; pass < 2 && partner == NO_VERTEX; pass++)
+				{
+					for (unsigned int j = copyOffsets[from]; j < copyOffsets[from + 1]; j++)
+					{
+						unsigned int source = copies[j];
+						if ((pass == 0) != (source == f) || !used[source] || !sameSide(source, f))
+						{
+							continue;
+						}
+						for (unsigned int t = offsets[source]; t < offsets[source + 1]; t++)
+						{
+							const unsigned int* tri = &indices[adjacency[t] * 3];
+							for (int k = 0; k < 3; k++)
+							{
+								double c = group[tri[k]] == to ? attributeCost(f, tri[k]) : DBL_MAX;
+								if (c < best)
+								{
+									best = c;
+									partner = tri[k];
+								}
+							}
+						}
+					}
+				}
+				if (partner == NO_VERTEX)
+				{
+					return false;
+				}
+				if (skin != nullptr)
+				{
+					float difference = skinDifference(skin[f], skin[partner]);
+					if (difference > settings.maxSkinDifference)
+					{
+						return false;
+					}
+					double c = static_cast<double>(settings.skinWeight) * difference * settings.skinWeight * difference;
+					worstSkin = c > worstSkin ? c : worstSkin;
+				}
+				worstAttributes = best > worstAttributes ? best : worstAttributes;
+				pairs.push_back({ f, partner });
+			}
+			cost = worstAttributes + worstSkin;
+			return !pairs.empty();
+		};
+
+		struct Collapse
+		{
+			unsigned int from;
+			unsigned int to;
+			float cost;
+		};
+		std::vector<Collapse> collapses;
+		std::vector<uint64_t> edges;
+		std::vector<unsigned int> remap(vertexCount);
+		std::vector<unsigned char> touched(vertexCount);
+		double maxCost = static_cast<double>(settings.maxError) * settings.maxError;
+
+		for (int pass = 0; pass < 100 && indices.size() > targetIndexCount; pass++)
+		{
+			// Triangles around each vertex, for pairing and the flip test.
+			std::fill(used.begin(), used.end(), 0);
+			std::fill(offsets.begin(), offsets.end(), 0);
+			for (unsigned int v : indices)
+			{
+				used[v] = 1;
+				offsets[v + 1]++;
+			}
+			for (size_t v = 0; v < vertexCount; v++)
+			{
+				offsets[v + 1] += offsets[v];
+			}
+			adjacency.resize(indices.size());
+			std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < indices.size(); i++)
+			{
+				adjacency[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+			}
+
+			// Candidate collapses along every edge between two positions, in both directions.
+			edges.clear();
+			for (size_t i = 0; i < indices.size(); i += 3)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					unsigned int a = group[indices[i + k]], b = group[indices[i + (k + 1) % 3]];
+					if (a != b)
+					{
+						edges.push_back(edgeKey(a, b));
+						edges.push_back(edgeKey(b, a));
+					}
+				}
+			}
+			std::sort(edges.begin(), edges.end());
+			edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+			collapses.clear();
+			for (uint64_t edge : edges)
+			{
+				unsigned int from = static_cast<unsigned int>(edge >> 32), to = static_cast<unsigned int>(edge);
+				if (kind[from] == Locked || (kind[from] == Border && (kind[to] == Interior || !isBorderEdge(from, to))))
+				{
+					continue;
+				}
+				double cost;
+				if (!pairCopies(from, to, cost))
+				{
+					continue;
+				}
+				cost += quadrics[from].evaluate(&pos[to * 3]);
+				collapses.push_back({ from, to, static_cast<float>(cost) });
+			}
+			if (collapses.empty())
+			{
+				break;
+			}
+			std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+			// Apply the cheapest collapses that do not touch each other's triangles.
+			for (size_t v = 0; v < vertexCount; v++)
+			{
+				remap[v] = static_cast<unsigned int>(v);
+			}
+			std::fill(touched.begin(), touched.end(), 0);
+			size_t trianglesToRemove = (indices.size() - targetIndexCount) / 3;
+			size_t removed = 0;
+			size_t applied = 0;
+			// Once a collapse waits for the next pass, much costlier ones wait too,
+			// or a batch would spend expensive collapses ahead of cheap ones.
+			double passLimit = maxCost;
+			for (const Collapse& c : collapses)
+			{
+				if (c.cost > passLimit || removed >= trianglesToRemove)
+				{
+					break;
+				}
+				if (touched[c.from] || touched[c.to])
+				{
+					double limit = c.cost * 2.0 + 1e-10;
+					passLimit = limit < passLimit ? limit : passLimit;
+					continue;
+				}
+				double unusedCost;
+				pairCopies(c.from, c.to, unusedCost);
+				// Reject collapses that flip a remaining triangle.
+				bool flips = false;
+				size_t degenerate = 0;
+				for (size_t p = 0; p < pairs.size() && !flips; p++)
+				{
+					unsigned int f = pairs[p].first;
+					for (unsigned int j = offsets[f]; j < offsets[f + 1] && !flips; j++)
+					{
+						const unsigned int* tri = &indices[adjacency[j] * 3];
+						if (group[tri[0]] == c.to || group[tri[1]] == c.to || group[tri[2]] == c.to)
+						{
+							degenerate++;
+							continue;
+						}
+						float before[3], after[3];
+						float moved[9];
+						for (int k = 0; k < 3; k++)
+						{
+							unsigned int v = tri[k] == f ? c.to : tri[k];
+							memcpy(&moved[k * 3], &pos[v * 3], sizeof(float) * 3);
+						}
+						triangleNormal(&pos[tri[0] * 3], &pos[tri[1] * 3], &pos[tri[2] * 3], before);
+						triangleNormal(&moved[0], &moved[3], &moved[6], after);
+						flips = before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0f;
+					}
+				}
+				if (flips)
+				{
+					continue;
+				}
+				quadrics[c.to].add(quadrics[c.from]);
+				// Neighbours' triangles changed shape; leave them for the next pass.
+				for (const std::pair<unsigned int, unsigned int>& pair : pairs)
+				{
+					remap[pair.first] = pair.second;
+					for (unsigned int j = offsets[pair.first]; j < offsets[pair.first + 1]; j++)
+					{
+						const unsigned int* tri = &indices[adjacency[j] * 3];
+						touched[group[tri[0]]] = touched[group[tri[1]]] = touched[group[tri[2]]] = 1;
+					}
+				}
+				touched[c.to] = 1;
+				removed += degenerate;
+				applied++;
+			}
+			if (applied == 0)
+			{
+				break;
+			}
+
+			// Remap and drop triangles that collapsed to a line.
+			size_t write = 0;
+			for (size_t i = 0; i < indices.size(); i += 3)
+			{
+				unsigned int a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+				if (group[a] != group[b] && group[b] != group[c] && group[a] != group[c])
+				{
+					indices[write++] = a;
+					indices[write++] = b;
+					indices[write++] = c;
+				}
+			}
+			indices.resize(write);
+			for (size_t v = 0; v < vertexCount; v++)
+			{
+				merged[v] = remap[merged[v]];
+			}
+		}
+
+		float error = measureError(original, indices, positions, positionStride, vertexCount, merged);
+		if (collapsedTo != nullptr)
+		{
+			collapsedTo->swap(merged);
+		}
+		return error;
+	}
+
+	// Builds successively coarser LODs, one per ratio of the original triangle
+	// count, each simplified from the one before and reordered for the vertex
+	// cache. Each level's error is measured against the original mesh, and never
+	// less than the level before. A level that removes less than a tenth of the
+	// previous one's triangles ends the chain, as a smaller ratio cannot unlock
+	// the collapses that were rejected.
+	inline std::vector<LOD> buildLODChain(const std::vector<unsigned int>& indices, const float* positions, size_t positionStride, size_t vertexCount,
+		const std::vector<float>& ratios, const Settings& settings, const SkinInfluence* skin = nullptr, const VertexAttributes* attributes = nullptr)
+	{
+		std::vector<LOD> chain;
+		std::vector<unsigned int> current = indices;
+		std::vector<unsigned int> collapsedTo(vertexCount), step;
+		for (size_t v = 0; v < vertexCount; v++)
+		{
+			collapsedTo[v] = static_cast<unsigned int>(v);
+		}
+		float error = 0.0f;
+		for (float ratio : ratios)
+		{
+			Settings stepSettings = settings;
+			stepSettings.targetRatio = ratio * indices.size() / static_cast<float>(current.size());
+			std::vector<unsigned int> next = current;
+			simplify(next, positions, positionStride, vertexCount, stepSettings, skin, attributes, &step);
+			if (next.empty() || next.size() * 10 > current.size() * 9)
+			{
+				break;
+			}
+			for (size_t v = 0; v < vertexCount; v++)
+			{
+				collapsedTo[v] = step[collapsedTo[v]];
+			}
+			float measured = measureError(indices, next, positions, positionStride, vertexCount, collapsedTo);
+			error = measured > error ? measured : error;
+			MeshOptimizer::optimizeVertexCache(next, vertexCount);
+			LOD lod;
+			lod.indices = next;
+			lod.error = error;
+			chain.push_back(lod);
+			current.swap(next);
+		}
+		return chain;
+	}
+
+	// LOD chain for vertices starting with a float3 position, with a normal
+	// member and u, v or tu, tv members.
+	template<typename Vertex>
+	std::vector<LOD> buildLODChain(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices,
+		const std::vector<float>& ratios, const Settings& settings = Settings())
+	{
+		std::vector<VertexAttributes> attributes = Detail::gatherAttributes(vertices);
+		return buildLODChain(indices, reinterpret_cast<const float*>(vertices.data()), sizeof(Vertex), vertices.size(), ratios, settings,
+			nullptr, attributes.data());
+	}
+
+	// LOD chain for skinned vertices, which also have bonesIDs and boneWeights members.
+	template<typename Vertex>
+	std::vector<LOD> buildSkinnedLODChain(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices,
+		const std::vector<float>& ratios, const Settings& settings = Settings())
+	{
+		std::vector<SkinInfluence> skin(vertices.size());
+		for (size_t v = 0; v < vertices.size(); v++)
+		{
+			memcpy(skin[v].bones, vertices[v].bonesIDs, sizeof(skin[v].bones));
+			memcpy(skin[v].weights, vertices[v].boneWeights, sizeof(skin[v].weights));
+		}
+		std::vector<VertexAttributes> attributes = Detail::gatherAttributes(vertices);
+		return buildLODChain(indices, reinterpret_cast<const float*>(vertices.data()), sizeof(Vertex), vertices.size(), ratios, settings,
+			skin.data(), attributes.data());
+	}
+
+	// Picks the coarsest LOD whose error, projected at distance, covers at most
+	// maxPixelError pixels. errors holds each level's error in model units with
+	// level 0, the full mesh, at 0; scale is the instance's uniform scale.
+	inline int selectLOD(const std::vector<float>& errors, float distance, float scale, float fieldOfView, float screenHeight, float maxPixelError = 1.0f)
+	{
+		float pixelsPerUnit = screenHeight / (2.0f * (distance > 0.0001f ? distance : 0.0001f) * tanf(fieldOfView * 0.5f));
+		int lod = 0;
+		for (int i = 1; i < static_cast<int>(errors.size()); i++)
+		{
+			if (errors[i] * scale * pixelsPerUnit <= maxPixelError)
+			{
+				lod = i;
+			}
+		}
+		return lod;
+	}
+}
@@ -0,0 +1,262 @@
+#pragma once
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "core.h"
+
+// Mipmap chains for RGBA8 textures, built on the CPU when a texture is decoded
+// so every level can go into the texture's initial data:
+//  - Each level is a 2x2 box filter of the one above. Colour textures are
+//    averaged in linear light (sRGB decoded through a table, re-encoded
+//    through a finer one), so distant texels do not darken; data textures
+//    such as normal and roughness maps are averaged as stored.
+//  - Alpha-tested textures keep the fraction of texels passing the test: the
+//    alpha of each level is scaled until its coverage matches level 0, so
+//    cut-out foliage does not thin out with distance.
+// The SSE and scalar paths do the same float operations in the same order, so
+// they produce the same bytes.
+namespace MipChain
+{
+	struct Settings
+	{
+		bool srgb = true;					// Filter colour channels in linear light
+		bool preserveAlphaCoverage = false;
+		float alphaReference = 0.5f;		// Alpha test threshold, see TexPixelShader.hlsl
+	};
+
+	// Number of levels down to 1x1.
+	inline int levelCount(int width, int height)
+	{
+		int levels = 1;
+		while (width > 1 || height > 1)
+		{
+			width = width > 1 ? width / 2 : 1;
+			height = height > 1 ? height / 2 : 1;
+			levels++;
+		}
+		return levels;
+	}
+
+	inline int levelSize(int size, int level)
+	{
+		int s = size >> level;
+		return s > 0 ? s : 1;
+	}
+
+	// Byte offset of a level in a chain stored back to back, level 0 first.
+	inline size_t levelOffset(int width, int height, int level)
+	{
+		size_t offset = 0;
+		for (int l = 0; l < level; l++)
+		{
+			offset += static_cast<size_t>(levelSize(width, l)) * levelSize(height, l) * 4;
+		}
+		return offset;
+	}
+
+	// Colour textures are filtered as sRGB; normal, roughness and metallic maps
+	// hold data and are filtered as stored. Alpha coverage is kept for colour
+	// textures with any transparent texel, since only those are alpha tested.
+	inline Settings settingsFor(const std::string& filename, const unsigned char* rgba, size_t texelCount)
+	{
+		Settings settings;
+		std::string lower = filename;
+		for (char& c : lower)
+		{
+			c = static_cast<char>(tolower(static_cast<unsigned char>(c)));
+		}
+		for (const char* data : { "normal", "roughness", "metallic" })
+		{
+			if (lower.find(data) != std::string::npos)
+			{
+				settings.srgb = false;
+			}
+		}
+		for (size_t i = 0; settings.srgb && i < texelCount; i++)
+		{
+			if (rgba[i * 4 + 3] < 255)
+			{
+				settings.preserveAlphaCoverage = true;
+				break;
+			}
+		}
+		return settings;
+	}
+
+	namespace Detail
+	{
+		static const int ENCODE_STEPS = 4096;
+
+		struct Tables
+		{
+			float srgbToLinear[256];
+			float unormToFloat[256];
+			unsigned char linearToSrgb[ENCODE_STEPS];
+
+			Tables()
+			{
+				for (int i = 0; i < 256; i++)
+				{
+					float c = i / 255.0f;
+					srgbToLinear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+					unormToFloat[i] = c;
+				}
+				for (int i = 0; i < ENCODE_STEPS; i++)
+				{
+					float l = i / static_cast<float>(ENCODE_STEPS - 1);
+					float c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+					linearToSrgb[i] = static_cast<unsigned char>(c * 255.0f + 0.5f);
+				}
+			}
+		};
+
+		inline const Tables& tables()
+		{
+			static const Tables instance;
+			return instance;
+		}
+
+		// Averages the 2x2 block of src under each dst texel. Odd sizes clamp the
+		// block to the last row or column. simd selects the SSE path when built.
+		inline void downsample(const unsigned char* src, int srcWidth, int srcHeight, unsigned char* dst, bool srgb, bool simd = true)
+		{
+			const Tables& t = tables();
+			const float* colour = srgb ? t.srgbToLinear : t.unormToFloat;
+			const float* alpha = t.unormToFloat;
+			const float colourScale = srgb ? static_cast<float>(ENCODE_STEPS - 1) : 255.0f;
+			int dstWidth = srcWidth > 1 ? srcWidth / 2 : 1;
+			int dstHeight = srcHeight > 1 ? srcHeight / 2 : 1;
+			for (int y = 0; y < dstHeight; y++)
+			{
+				const unsigned char* row0 = src + static_cast<size_t>(min(y * 2, srcHeight - 1)) * srcWidth * 4;
+				const unsigned char* row1 = src + static_cast<size_t>(min(y * 2 + 1, srcHeight - 1)) * srcWidth * 4;
+				unsigned char* out = dst + static_cast<size_t>(y) * dstWidth * 4;
+				for (int x = 0; x < dstWidth; x++, out += 4)
+				{
+					const unsigned char* p[4] = { row0 + min(x * 2, srcWidth - 1) * 4, row0 + min(x * 2 + 1, srcWidth - 1) * 4,
+						row1 + min(x * 2, srcWidth - 1) * 4, row1 + min(x * 2 + 1, srcWidth - 1) * 4 };
+					int encoded[4];
+#if defined(CORE_SIMD_SSE)
+					if (simd)
+					{
+						__m128 sum = _mm_setr_ps(colour[p[0][0]], colour[p[0][1]], colour[p[0][2]], alpha[p[0][3]]);
+						for (int k = 1; k < 4; k++)
+						{
+							sum = _mm_add_ps(sum, _mm_setr_ps(colour[p[k][0]], colour[p[k][1]], colour[p[k][2]], alpha[p[k][3]]));
+						}
+						__m128 scaled = _mm_mul_ps(_mm_mul_ps(sum, _mm_set1_ps(0.25f)), _mm_setr_ps(colourScale, colourScale, colourScale, 255.0f));
+						_mm_storeu_si128(reinterpret_cast<__m128i*>(encoded), _mm_cvtps_epi32(scaled));
+					}
+					else
+#endif
+					{
+						for (int c = 0; c < 4; c++)
+						{
+							const float* decode = c < 3 ? colour : alpha;
+							float sum = decode[p[0][c]];
+							for (int k = 1; k < 4; k++)
+							{
+								sum = sum + decode[p[k][c]];
+							}
+							encoded[c] = static_cast<int>(std::nearbyint((sum * 0.25f) * (c < 3 ? colourScale : 255.0f)));
+						}
+					}
+					for (int c = 0; c < 3; c++)
+					{
+						out[c] = srgb ? t.linearToSrgb[encoded[c]] : static_cast<unsigned char>(encoded[c]);
+					}
+					out[3] = static_cast<unsigned char>(encoded[3]);
+				}
+			}
+		}
+
+		inline int scaledAlpha(unsigned char alpha, float scale)
+		{
+			return static_cast<int>(min(alpha * scale + 0.5f, 255.0f));
+		}
+
+		// Texels whose alpha, scaled as scaleAlpha would, passes the alpha test.
+		inline size_t coverage(const unsigned char* rgba, size_t texelCount, float scale, float reference)
+		{
+			int threshold = static_cast<int>(ceilf(reference * 255.0f));
+			size_t passing = 0;
+			for (size_t i = 0; i < texelCount; i++)
+			{
+				passing += scaledAlpha(rgba[i * 4 + 3], scale) >= threshold ? 1 : 0;
+			}
+			return passing;
+		}
+
+		inline void scaleAlpha(unsigned char* rgba, size_t texelCount, float scale)
+		{
+			for (size_t i = 0; i < texelCount; i++)
+			{
+				rgba[i * 4 + 3] = static_cast<unsigned char>(scaledAlpha(rgba[i * 4 + 3], scale));
+			}
+		}
+
+		// Scales a level's alpha so the fraction passing the test is as close to
+		// target as the search gets.
+		inline void matchCoverage(unsigned char* rgba, size_t texelCount, float targetCoverage, float reference)
+		{
+			size_t target = static_cast<size_t>(targetCoverage * texelCount + 0.5f);
+			float lo = 0.0f, hi = 4.0f;
+			for (int i = 0; i < 16; i++)
+			{
+				float mid = (lo + hi) * 0.5f;
+				if (coverage(rgba, texelCount, mid, reference) < target)
+				{
+					lo = mid;
+				}
+				else
+				{
+					hi = mid;
+				}
+			}
+			float scale = hi;
+			size_t above = coverage(rgba, texelCount, hi, reference);
+			size_t below = coverage(rgba, texelCount, lo, reference);
+			if ((below > target ? below - target : target - below) < (above > target ? above - target : target - above))
+			{
+				scale = lo;
+			}
+			scaleAlpha(rgba, texelCount, scale);
+		}
+	}
+
+	// Builds the levels below level 0, which chain must already hold, and
+	// resizes chain to hold them all back to back. Returns the number of levels.
+	// Reserving levelOffset(width, height, levelCount(width, height)) bytes
+	// beforehand keeps the resize from reallocating.
+	inline int generateInPlace(std::vector<unsigned char>& chain, int width, int height, const Settings& settings)
+	{
+		int levels = levelCount(width, height);
+		chain.resize(levelOffset(width, height, levels));
+		size_t texels = static_cast<size_t>(width) * height;
+		float targetCoverage = settings.preserveAlphaCoverage && texels > 0 ?
+			static_cast<float>(Detail::coverage(chain.data(), texels, 1.0f, settings.alphaReference)) / texels : 0.0f;
+		for (int level = 1; level < levels; level++)
+		{
+			const unsigned char* src = chain.data() + levelOffset(width, height, level - 1);
+			unsigned char* dst = chain.data() + levelOffset(width, height, level);
+			Detail::downsample(src, levelSize(width, level - 1), levelSize(height, level - 1), dst, settings.srgb);
+			if (settings.preserveAlphaCoverage)
+			{
+				Detail::matchCoverage(dst, static_cast<size_t>(levelSize(width, level)) * levelSize(height, level), targetCoverage, settings.alphaReference);
+			}
+		}
+		return levels;
+	}
+
+	// Builds every level of an RGBA8 image into chain, back to back with level 0
+	// (a copy of rgba) first. Returns the number of levels.
+	inline int generate(const unsigned char* rgba, int width, int height, const Settings& settings, std::vector<unsigned char>& chain)
+	{
+		chain.reserve(levelOffset(width, height, levelCount(width, height)));
+		chain.assign(rgba, rgba + static_cast<size_t>(width) * height * 4);
+		return generateInPlace(chain, width, height, settings);
+	}
+}
@@ -0,0 +1,710 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "GEMLoader.h"
+#include "Animation.h"
+#include "MeshSimplifier.h"
+#include "MeshClusters.h"
+#include "IndexData.h"
+#include "VertexCompression.h"
+
+// Converts GEM bones to a runtime skeleton.
+inline void buildSkeleton(const GEMLoader::GEMAnimation& gemanimation, Skeleton& skeleton)
+{
+	for (size_t i = 0; i < gemanimation.bones.size(); i++)
+	{
+		Bone bone;
+		bone.name = gemanimation.bones[i].name;
+		memcpy(bone.offset.m, gemanimation.bones[i].offset.m, 16 * sizeof(float));
+		bone.parentIndex = gemanimation.bones[i].parentIndex;
+		skeleton.bones.push_back(bone);
+	}
+}
+
+// Converts a GEM clip to the runtime SoA layout.
+inline void buildAnimationSequence(const GEMLoader::GEMAnimationSequence& gemsequence, AnimationSequence& aseq)
+{
+	int frameCount = static_cast<int>(gemsequence.frames.size());
+	int boneCount = frameCount > 0 ? static_cast<int>(gemsequence.frames[0].positions.size()) : 0;
+	aseq.ticksPerSecond = gemsequence.ticksPerSecond;
+	aseq.allocate(frameCount, boneCount);
+	// GEM keys are plain float arrays with the same layout as vec3/Quaternion,
+	// so each frame is copied straight into its slot of the SoA arrays as raw
+	// floats.
+	for (int n = 0; n < frameCount; n++)
+	{
+		int key = aseq.keyIndex(n, 0);
+		memcpy(static_cast<void*>(&aseq.positions[key]), gemsequence.frames[n].positions.data(), boneCount * sizeof(vec3));
+		memcpy(static_cast<void*>(&aseq.rotations[key]), gemsequence.frames[n].rotations.data(), boneCount * sizeof(Quaternion));
+		memcpy(static_cast<void*>(&aseq.scales[key]), gemsequence.frames[n].scales.data(), boneCount * sizeof(vec3));
+	}
+}
+
+// Cooked model cache (.gemc) written next to a GEM file. It holds the vertex
+// and index blobs, per-mesh bounds and LOD index buffers, the diffuse texture
+// path of each mesh, optional culling clusters and every clip's keys in
+// AnimationSequence's SoA block layout. Vertices are either the GEM layout or,
+// for models that asked for them, VertexCompression's compact formats with
+// each mesh's quantization. All sections are
+// 16-byte aligned so the mapped file is used in place: vertex and index data go
+// straight to Mesh::init and each clip is filled with a single copy. Indices
+// are stored 16 bits wide when the mesh's vertex count allows, see IndexData.
+//
+// A cache is valid while its source has the size and modification time it had
+// when the cache was written. If only the time differs (a copy or checkout of
+// the same file), the source's content hash is compared instead. The LOD
+// ratios the chains were built with and the vertex format are stored too, so a
+// model asking for different ones can tell the cache does not match.
+class ModelCache
+{
+public:
+	static const uint32_t VERSION = 7;
+
+	// One LOD of a mesh, pointing into the mapped cache.
+	struct LODView
+	{
+		const void* indices;		// indexStride of the mesh
+		uint32_t indexCount;
+		float error;
+	};
+
+	// One mesh, pointing into the mapped cache.
+	struct MeshView
+	{
+		const void* vertices;
+		uint32_t vertexCount;
+		uint32_t vertexStride;
+		const void* indices;
+		uint32_t indexStride;		// 2 or 4 bytes
+		uint32_t indexCount;
+		vec3 boundsMin;
+		vec3 boundsMax;
+		std::string texture;
+		std::vector<LODView> lods;
+		const MeshClusters::Cluster* clusters;	// Ranges of the full index buffer
+		uint32_t clusterCount;
+		VertexCompression::Quantization quantization;	// Zero unless the vertices are compact
+	};
+
+	// Identity of a source file.
+	struct SourceInfo
+	{
+		uint64_t size = 0;
+		int64_t modifiedTime = 0;
+		uint64_t hash = 0;
+	};
+
+	static std::string pathFor(const std::string& source)
+	{
+		return source + "c";
+	}
+
+	// Size and modification time of filename. Returns false if it does not exist.
+	static bool statSource(const std::string& filename, SourceInfo& info)
+	{
+#if defined(_WIN32)
+		struct _stat64 st;
+		if (_stat64(filename.c_str(), &st) != 0)
+		{
+			return false;
+		}
+#else
+		struct stat st;
+		if (stat(filename.c_str(), &st) != 0)
+		{
+			return false;
+		}
+#endif
+		info.size = static_cast<uint64_t>(st.st_size);
+		info.modifiedTime = static_cast<int64_t>(st.st_mtime);
+		return true;
+	}
+
+	// 64-bit FNV-1a of the file's contents.
+	static bool hashSource(const std::string& filename, uint64_t& hash)
+	{
+		MappedFile file;
+		if (!file.open(filename))
+		{
+			return false;
+		}
+		hash = 14695981039346656037ull;
+		const unsigned char* p = file.data();
+		for (size_t i = 0; i < file.size(); i++)
+		{
+			hash = (hash ^ p[i]) * 1099511628211ull;
+		}
+		return true;
+	}
+
+	// Writes the cache for source. animation may be nullptr for static models;
+	// its clips must not be compressed yet. lods holds one chain per mesh, built
+	// with lodRatios, or is empty; so is clusters, which holds each mesh's
+	// clusters when they were built. compactMeshes, if not empty, holds every
+	// mesh's vertices in the compact format, stored in place of the GEM ones.
+	// Returns false if the file cannot be written.
+	static bool write(const std::string& source, const std::vector<GEMLoader::GEMMesh>& meshes, const Animation* animation,
+		const std::vector<float>& lodRatios = std::vector<float>(), const std::vector<std::vector<MeshSimplifier::LOD>>& lods = std::vector<std::vector<MeshSimplifier::LOD>>(),
+		const std::vector<std::vector<MeshClusters::Cluster>>& clusters = std::vector<std::vector<MeshClusters::Cluster>>(),
+		const std::vector<VertexCompression::CompactMesh>& compactMeshes = std::vector<VertexCompression::CompactMesh>())
+	{
+		return write(source, pathFor(source), meshes, animation, lodRatios, lods, clusters, compactMeshes);
+	}
+
+	static bool write(const std::string& source, const std::string& cachePath, const std::vector<GEMLoader::GEMMesh>& meshes, const Animation* animation,
+		const std::vector<float>& lodRatios = std::vector<float>(), const std::vector<std::vector<MeshSimplifier::LOD>>& lods = std::vector<std::vector<MeshSimplifier::LOD>>(),
+		const std::vector<std::vector<MeshClusters::Cluster>>& clusters = std::vector<std::vector<MeshClusters::Cluster>>(),
+		const std::vector<VertexCompression::CompactMesh>& compactMeshes = std::vector<VertexCompression::CompactMesh>())
+	{
+		if (!compactMeshes.empty() && compactMeshes.size() != meshes.size())
+		{
+			return false;
+		}
+		Header header = {};
+		memcpy(header.magic, "GEMC", 4);
+		header.version = VERSION;
+		SourceInfo info;
+		if (!statSource(source, info) || !hashSource(source, info.hash))
+		{
+			return false;
+		}
+		header.sourceSize = info.size;
+		header.sourceTime = info.modifiedTime;
+		header.sourceHash = info.hash;
+
+		std::vector<unsigned char> out(sizeof(Header));
+		std::vector<MeshRecord> meshRecords(meshes.size());
+		for (size_t i = 0; i < meshes.size(); i++)
+		{
+			const GEMLoader::GEMMesh& mesh = meshes[i];
+			MeshRecord& record = meshRecords[i];
+			bool animated = !mesh.verticesAnimated.empty();
+			const unsigned char* vertices = animated ? reinterpret_cast<const unsigned char*>(mesh.verticesAnimated.data()) : reinterpret_cast<const unsigned char*>(mesh.verticesStatic.data());
+			size_t stride = animated ? sizeof(GEMLoader::GEMAnimatedVertex) : sizeof(GEMLoader::GEMStaticVertex);
+			record.vertexCount = static_cast<uint32_t>(animated ? mesh.verticesAnimated.size() : mesh.verticesStatic.size());
+			if (!compactMeshes.empty())
+			{
+				const VertexCompression::CompactMesh& compact = compactMeshes[i];
+				if (compact.vertices.size() != static_cast<size_t>(record.vertexCount) * compact.stride)
+				{
+					return false;
+				}
+				record.vertexStride = compact.stride;
+				record.vertexOffset = append(out, compact.vertices.data(), compact.vertices.size());
+				memcpy(record.quantizationOffset, compact.quantization.offset, sizeof(record.quantizationOffset));
+				memcpy(record.quantizationScale, compact.quantization.scale, sizeof(record.quantizationScale));
+			}
+			else
+			{
+				record.vertexStride = static_cast<uint32_t>(stride);
+				record.vertexOffset = append(out, vertices, static_cast<size_t>(record.vertexCount) * record.vertexStride);
+			}
+			IndexData indices(mesh.indices, record.vertexCount);
+			record.indexCount = static_cast<uint32_t>(indices.count());
+			record.indexStride = indices.stride();
+			record.indexOffset = append(out, indices.data(), indices.bytes());
+			// Both vertex types start with the position.
+			vec3 lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+			for (uint32_t v = 0; v < record.vertexCount; v++)
+			{
+				vec3 p;
+				memcpy(&p, vertices + static_cast<size_t>(v) * stride, sizeof(vec3));
+				lo = vec3::Min(lo, p);
+				hi = vec3::Max(hi, p);
+			}
+			memcpy(record.boundsMin, &lo, sizeof(record.boundsMin));
+			memcpy(record.boundsMax, &hi, sizeof(record.boundsMax));
+			GEMLoader::GEMMaterial material = mesh.material;
+			record.texture = appendString(out, material.find("diffuse").getValue());
+			if (i < lods.size())
+			{
+				std::vector<LODRecord> lodRecords(lods[i].size());
+				for (size_t l = 0; l < lods[i].size(); l++)
+				{
+					IndexData lodIndices(lods[i][l].indices, record.vertexCount);
+					lodRecords[l].indexCount = static_cast<uint32_t>(lodIndices.count());
+					lodRecords[l].error = lods[i][l].error;
+					lodRecords[l].indexOffset = append(out, lodIndices.data(), lodIndices.bytes());
+				}
+				record.lodCount = static_cast<uint32_t>(lodRecords.size());
+				record.lodTable = append(out, lodRecords.data(), lodRecords.size() * sizeof(LODRecord));
+			}
+			if (i < clusters.size())
+			{
+				record.clusterCount = static_cast<uint32_t>(clusters[i].size());
+				record.clusterTable = append(out, clusters[i].data(), clusters[i].size() * sizeof(MeshClusters::Cluster));
+			}
+		}
+		if (!clusters.empty())
+		{
+			header.flags |= FLAG_CLUSTERS;
+		}
+		if (!compactMeshes.empty())
+		{
+			header.flags |= FLAG_COMPACT_VERTICES;
+		}
+		header.meshCount = static_cast<uint32_t>(meshRecords.size());
+		header.meshTable = append(out, meshRecords.data(), meshRecords.size() * sizeof(MeshRecord));
+		header.lodRatioCount = static_cast<uint32_t>(lodRatios.size());
+		header.lodRatioTable = append(out, lodRatios.data(), lodRatios.size() * sizeof(float));
+
+		if (animation != nullptr)
+		{
+			std::vector<BoneRecord> boneRecords(animation->skeleton.bones.size());
+			for (size_t i = 0; i < boneRecords.size(); i++)
+			{
+				const Bone& bone = animation->skeleton.bones[i];
+				memcpy(boneRecords[i].offset, &bone.offset, sizeof(boneRecords[i].offset));
+				boneRecords[i].parentIndex = bone.parentIndex;
+				boneRecords[i].name = appendString(out, bone.name);
+			}
+			// Clips are stored in handle order so handles match the GEM path.
+			std::vector<std::string> names(animation->sequences.size());
+			for (auto& named : animation->sequenceNames)
+			{
+				names[named.second] = named.first;
+			}
+			std::vector<ClipRecord> clipRecords;
+			for (size_t i = 0; i < animation->sequences.size(); i++)
+			{
+				const AnimationSequence& sequence = animation->sequences[i];
+				if (sequence.isCompressed())
+				{
+					return false;
+				}
+				ClipRecord record = {};
+				record.name = appendString(out, names[i]);
+				record.ticksPerSecond = sequence.ticksPerSecond;
+				record.frameCount = static_cast<uint32_t>(sequence.getFrameCount());
+				record.boneCount = static_cast<uint32_t>(sequence.getBoneCount());
+				record.keysOffset = append(out, sequence.keyBlock(), AnimationSequence::keyBlockBytes(sequence.getFrameCount(), sequence.getBoneCount()));
+				clipRecords.push_back(record);
+			}
+			header.flags |= FLAG_ANIMATION;
+			header.boneCount = static_cast<uint32_t>(boneRecords.size());
+			header.boneTable = append(out, boneRecords.data(), boneRecords.size() * sizeof(BoneRecord));
+			header.clipCount = static_cast<uint32_t>(clipRecords.size());
+			header.clipTable = append(out, clipRecords.data(), clipRecords.size() * sizeof(ClipRecord));
+		}
+		header.fileSize = out.size();
+		memcpy(out.data(), &header, sizeof(Header));
+
+		// Written under a temporary name so a partly written cache is never picked up.
+		std::string temporary = cachePath + ".tmp";
+		{
+			std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+			if (!file.write(reinterpret_cast<const char*>(out.data()), out.size()))
+			{
+				return false;
+			}
+		}
+		std::remove(cachePath.c_str());
+		return std::rename(temporary.c_str(), cachePath.c_str()) == 0;
+	}
+
+	// Maps the cache for source and checks it against the source file. Returns
+	// false if it is missing, stale or malformed; the caller then loads the GEM file.
+	bool open(const std::string& source)
+	{
+		return open(source, pathFor(source));
+	}
+
+	bool open(const std::string& source, const std::string& cachePath)
+	{
+		close();
+		SourceInfo info;
+		if (!statSource(source, info) || !file.open(cachePath) || !validate())
+		{
+			close();
+			return false;
+		}
+		if (info.size != header->sourceSize)
+		{
+			close();
+			return false;
+		}
+		if (info.modifiedTime != header->sourceTime && (!hashSource(source, info.hash) || info.hash != header->sourceHash))
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void close()
+	{
+		file.close();
+		header = nullptr;
+	}
+
+	bool isOpen() const
+	{
+		return header != nullptr;
+	}
+	bool hasAnimation() const
+	{
+		return (header->flags & FLAG_ANIMATION) != 0;
+	}
+	bool hasClusters() const
+	{
+		return (header->flags & FLAG_CLUSTERS) != 0;
+	}
+	bool hasCompactVertices() const
+	{
+		return (header->flags & FLAG_COMPACT_VERTICES) != 0;
+	}
+	int getMeshCount() const
+	{
+		return static_cast<int>(header->meshCount);
+	}
+
+	MeshView getMesh(int index) const
+	{
+		const MeshRecord& record = meshRecords()[index];
+		MeshView view;
+		view.vertices = file.data() + record.vertexOffset;
+		view.vertexCount = record.vertexCount;
+		view.vertexStride = record.vertexStride;
+		view.indices = file.data() + record.indexOffset;
+		view.indexStride = record.indexStride;
+		view.indexCount = record.indexCount;
+		memcpy(&view.boundsMin, record.boundsMin, sizeof(record.boundsMin));
+		memcpy(&view.boundsMax, record.boundsMax, sizeof(record.boundsMax));
+		view.texture = string(record.texture);
+		const LODRecord* lods = reinterpret_cast<const LODRecord*>(file.data() + record.lodTable);
+		for (uint32_t l = 0; l < record.lodCount; l++)
+		{
+			LODView lod;
+			lod.indices = file.data() + lods[l].indexOffset;
+			lod.indexCount = lods[l].indexCount;
+			lod.error = lods[l].error;
+			view.lods.push_back(lod);
+		}
+		view.clusters = reinterpret_cast<const MeshClusters::Cluster*>(file.data() + record.clusterTable);
+		view.clusterCount = record.clusterCount;
+		memcpy(view.quantization.offset, record.quantizationOffset, sizeof(record.quantizationOffset));
+		memcpy(view.quantization.scale, record.quantizationScale, sizeof(record.quantizationScale));
+		return view;
+	}
+
+	// Triangle ratios the LOD chains were built with.
+	std::vector<float> getLODRatios() const
+	{
+		const float* ratios = reinterpret_cast<const float*>(file.data() + header->lodRatioTable);
+		return std::vector<float>(ratios, ratios + header->lodRatioCount);
+	}
+
+	// Fills the skeleton and clips of animation. Each clip's keys are one copy.
+	void loadAnimation(Animation& animation) const
+	{
+		loadSkeleton(animation);
+		for (int i = 0; i < getClipCount(); i++)
+		{
+			AnimationSequence aseq;
+			loadClip(i, aseq);
+			animation.addSequence(getClipName(i), std::move(aseq));
+		}
+	}
+
+	void loadSkeleton(Animation& animation) const
+	{
+		const BoneRecord* bones = reinterpret_cast<const BoneRecord*>(file.data() + header->boneTable);
+		for (uint32_t i = 0; i < header->boneCount; i++)
+		{
+			Bone bone;
+			bone.name = string(bones[i].name);
+			memcpy(&bone.offset, bones[i].offset, sizeof(bones[i].offset));
+			bone.parentIndex = bones[i].parentIndex;
+			animation.skeleton.bones.push_back(bone);
+		}
+	}
+
+	// Clips in handle order, for loading them one at a time.
+	int getClipCount() const
+	{
+		return static_cast<int>(header->clipCount);
+	}
+	std::string getClipName(int clip) const
+	{
+		return string(clipRecord(clip).name);
+	}
+	void loadClip(int clip, AnimationSequence& aseq) const
+	{
+		const ClipRecord& record = clipRecord(clip);
+		aseq.ticksPerSecond = record.ticksPerSecond;
+		aseq.allocate(static_cast<int>(record.frameCount), static_cast<int>(record.boneCount));
+		memcpy(aseq.keyBlock(), file.data() + record.keysOffset, AnimationSequence::keyBlockBytes(record.frameCount, record.boneCount));
+	}
+
+private:
+	static const uint32_t FLAG_ANIMATION = 1;
+	static const uint32_t FLAG_CLUSTERS = 2;
+	static const uint32_t FLAG_COMPACT_VERTICES = 4;
+
+	// Offsets are from the start of the file; strings are offset and length.
+	struct StringRef
+	{
+		uint32_t offset;
+		uint32_t length;
+	};
+
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t sourceSize;
+		int64_t sourceTime;
+		uint64_t sourceHash;
+		uint64_t fileSize;
+		uint32_t flags;
+		uint32_t meshCount;
+		uint32_t boneCount;
+		uint32_t clipCount;
+		uint64_t meshTable;
+		uint64_t boneTable;
+		uint64_t clipTable;
+		uint32_t lodRatioCount;
+		uint32_t reserved;
+		uint64_t lodRatioTable;
+	};
+
+	struct MeshRecord
+	{
+		uint64_t vertexOffset;
+		uint64_t indexOffset;
+		uint32_t vertexCount;
+		uint32_t vertexStride;
+		uint32_t indexCount;
+		uint32_t indexStride;
+		StringRef texture;
+		float boundsMin[3];
+		float boundsMax[3];
+		uint32_t lodCount;
+		uint64_t lodTable;
+		uint32_t clusterCount;
+		uint64_t clusterTable;
+		float quantizationOffset[3];
+		float quantizationScale[3];
+	};
+
+	struct LODRecord
+	{
+		uint64_t indexOffset;
+		uint32_t indexCount;
+		float error;
+	};
+
+	struct BoneRecord
+	{
+		float offset[16];
+		int32_t parentIndex;
+		StringRef name;
+	};
+
+	struct ClipRecord
+	{
+		uint64_t keysOffset;
+		uint32_t frameCount;
+		uint32_t boneCount;
+		float ticksPerSecond;
+		StringRef name;
+	};
+
+	MappedFile file;
+	const Header* header = nullptr;
+
+	const ClipRecord& clipRecord(int clip) const
+	{
+		return reinterpret_cast<const ClipRecord*>(file.data() + header->clipTable)[clip];
+	}
+
+	static uint64_t append(std::vector<unsigned char>& out, const void* data, size_t bytes)
+	{
+		out.resize((out.size() + 15) & ~static_cast<size_t>(15));
+		uint64_t offset = out.size();
+		if (bytes > 0)
+		{
+			out.insert(out.end(), static_cast<const unsigned char*>(data), static_cast<const unsigned char*>(data) + bytes);
+		}
+		return offset;
+	}
+
+	static StringRef appendString(std::vector<unsigned char>& out, const std::string& s)
+	{
+		StringRef ref = { static_cast<uint32_t>(out.size()), static_cast<uint32_t>(s.size()) };
+		out.insert(out.end(), s.begin(), s.end());
+		return ref;
+	}
+
+	const MeshRecord* meshRecords() const
+	{
+		return reinterpret_cast<const MeshRecord*>(file.data() + header->meshTable);
+	}
+
+	std::string string(const StringRef& ref) const
+	{
+		return std::string(reinterpret_cast<const char*>(file.data()) + ref.offset, ref.length);
+	}
+
+	bool contains(uint64_t offset, uint64_t bytes) const
+	{
+		return offset <= file.size() && bytes <= file.size() - offset;
+	}
+
+	bool contains(const StringRef& ref) const
+	{
+		return contains(ref.offset, ref.length);
+	}
+
+	// Checks the header and that every table, blob and string lies inside the file.
+	bool validate()
+	{
+		if (file.size() < sizeof(Header))
+		{
+			return false;
+		}
+		header = reinterpret_cast<const Header*>(file.data());
+		if (memcmp(header->magic, "GEMC", 4) != 0 || header->version != VERSION || header->fileSize != file.size())
+		{
+			return false;
+		}
+		if (!contains(header->meshTable, static_cast<uint64_t>(header->meshCount) * sizeof(MeshRecord)) ||
+			!contains(header->boneTable, static_cast<uint64_t>(header->boneCount) * sizeof(BoneRecord)) ||
+			!contains(header->clipTable, static_cast<uint64_t>(header->clipCount) * sizeof(ClipRecord)) ||
+			!contains(header->lodRatioTable, static_cast<uint64_t>(header->lodRatioCount) * sizeof(float)))
+		{
+			return false;
+		}
+		for (uint32_t i = 0; i < header->meshCount; i++)
+		{
+			const MeshRecord& record = meshRecords()[i];
+			if ((record.indexStride != 2 && record.indexStride != 4) ||
+				!contains(record.vertexOffset, static_cast<uint64_t>(record.vertexCount) * record.vertexStride) ||
+				!contains(record.indexOffset, static_cast<uint64_t>(record.indexCount) * record.indexStride) ||
+				!contains(record.texture) ||
+				!contains(record.lodTable, static_cast<uint64_t>(record.lodCount) * sizeof(LODRecord)) ||
+				!contains(record.clusterTable, static_cast<uint64_t>(record.clusterCount) * sizeof(MeshClusters::Cluster)))
+			{
+				return false;
+			}
+			const MeshClusters::Cluster* clusters = reinterpret_cast<const MeshClusters::Cluster*>(file.data() + record.clusterTable);
+			for (uint32_t c = 0; c < record.clusterCount; c++)
+			{
+				if (static_cast<uint64_t>(clusters[c].indexOffset) + clusters[c].indexCount > record.indexCount)
+				{
+					return false;
+				}
+			}
+			const LODRecord* lods = reinterpret_cast<const LODRecord*>(file.data() + record.lodTable);
+			for (uint32_t l = 0; l < record.lodCount; l++)
+			{
+				if (!contains(lods[l].indexOffset, static_cast<uint64_t>(lods[l].indexCount) * record.indexStride))
+				{
+					return false;
+				}
+			}
+		}
+		const BoneRecord* bones = reinterpret_cast<const BoneRecord*>(file.data() + header->boneTable);
+		for (uint32_t i = 0; i < header->boneCount; i++)
+		{
+			if (!contains(bones[i].name))
+			{
+				return false;
+			}
+		}
+		const ClipRecord* clips = reinterpret_cast<const ClipRecord*>(file.data() + header->clipTable);
+		for (uint32_t i = 0; i < header->clipCount; i++)
+		{
+			if (!contains(clips[i].keysOffset, AnimationSequence::keyBlockBytes(clips[i].frameCount, clips[i].boneCount)) || !contains(clips[i].name))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+// Loads clips from a model's cache on request, see Animation::setClipSource.
+// Keeps its own mapping of the cache open for as long as the animation uses it.
+class CachedClipSource : public AnimationClipSource
+{
+public:
+	bool open(const std::string& source)
+	{
+		return cache.open(source) && cache.hasAnimation();
+	}
+	bool open(const std::string& source, const std::string& cachePath)
+	{
+		return cache.open(source, cachePath) && cache.hasAnimation();
+	}
+	int getClipCount() const override
+	{
+		return cache.getClipCount();
+	}
+	std::string getClipName(int clip) const override
+	{
+		return cache.getClipName(clip);
+	}
+	bool loadClip(int clip, AnimationSequence& sequence) override
+	{
+		cache.loadClip(clip, sequence);
+		return true;
+	}
+
+private:
+	ModelCache cache;
+};
+
+// Loads clips straight from a GEM file on request, using the clip table
+// GEMModelLoader::loadMappedLazy recorded. Each frame is copied into the SoA
+// arrays as in buildAnimationSequence, without building GEM frames first.
+class GEMClipSource : public AnimationClipSource
+{
+public:
+	bool open(const std::string& filename, const GEMLoader::GEMAnimation& gemanimation)
+	{
+		clips = gemanimation.clips;
+		boneCount = static_cast<int>(gemanimation.bones.size());
+		return file.open(filename);
+	}
+	int getClipCount() const override
+	{
+		return static_cast<int>(clips.size());
+	}
+	std::string getClipName(int clip) const override
+	{
+		return clips[clip].name;
+	}
+	bool loadClip(int clip, AnimationSequence& sequence) override
+	{
+		const GEMLoader::GEMClipEntry& entry = clips[clip];
+		size_t positionBytes = boneCount * sizeof(vec3);
+		size_t rotationBytes = boneCount * sizeof(Quaternion);
+		size_t frameBytes = positionBytes * 2 + rotationBytes;
+		if (entry.framesOffset + entry.frames * frameBytes > file.size())
+		{
+			return false;
+		}
+		sequence.ticksPerSecond = entry.ticksPerSecond;
+		sequence.allocate(entry.frames, boneCount);
+		const unsigned char* frame = file.data() + entry.framesOffset;
+		for (int n = 0; n < entry.frames; n++, frame += frameBytes)
+		{
+			int key = sequence.keyIndex(n, 0);
+			memcpy(&sequence.positions[key], frame, positionBytes);
+			memcpy(&sequence.rotations[key], frame + positionBytes, rotationBytes);
+			memcpy(&sequence.scales[key], frame + positionBytes + rotationBytes, positionBytes);
+		}
+		return true;
+	}
+
+private:
+	MappedFile file;
+	std::vector<GEMLoader::GEMClipEntry> clips;
+	int boneCount = 0;
+};
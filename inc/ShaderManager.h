@@ -5,7 +5,8 @@
 class ShaderManager {
 public:
     // Loads and initializes a shader with the given name, vertex shader file, and pixel shader file.
-    void loadShader(const std::string& name, const std::string& vsFile, const std::string& psFile, DXCore& core);
+    // format picks the vertex layout the shader reads, see VertexFormat.
+    void loadShader(const std::string& name, const std::string& vsFile, const std::string& psFile, DXCore& core, VertexFormat format = VertexFormat::Full);
     
     // Retrieves a pointer to the shader associated with the given name.
     // Returns nullptr if the shader is not found.
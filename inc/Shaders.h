@@ -3,15 +3,25 @@
 #include "Texture.h"
 #include "ShaderReflection.h"
 
+// Vertex layout a shader's input layout reads.
+enum class VertexFormat {
+    Full,       // STATIC_VERTEX / ANIMATED_VERTEX floats
+    Compact     // VertexCompression's compact formats; the vertex shader is compiled with COMPACT_VERTICES
+};
+
 // Manages shader programs, their compilation, and the binding of resources like textures and constant buffers.
 class Shaders {
 public:
     // Initializes the shader by loading and compiling the vertex and pixel shaders.
-    void init(const std::string& VS_filename, const std::string& PS_filename, DXCore& core);
+    void init(const std::string& VS_filename, const std::string& PS_filename, DXCore& core, VertexFormat format = VertexFormat::Full);
     
     // Applies the compiled shaders and input layout to the rendering pipeline.
     void apply(DXCore& core);
 
+    // Uploads constant buffers changed since the last upload, e.g. per-mesh
+    // constants set between draws after apply.
+    void uploadConstants(DXCore& core);
+
     // Updates a constant buffer variable for the vertex shader.
     void updateConstantVS(const std::string& constantBufferName, const std::string& variableName, void* data);
    
@@ -38,8 +48,8 @@ private:
     // Reads shader source code from a file.
     std::string readFile(const std::string& filename);
     
-    // Compiles the vertex shader and sets up the input layout.
-    void compileVS(const std::string& VS_filename, DXCore& core);
+    // Compiles the vertex shader and sets up the input layout for format.
+    void compileVS(const std::string& VS_filename, DXCore& core, VertexFormat format);
     
     // Compiles the pixel shader.
     void compilePS(const std::string& PS_filename, DXCore& core);
@@ -1,54 +1,231 @@
 #pragma once
 #include <string>
 #include <map>
+#include <vector>
 #include "DXCore.h"
+#include "AssetPipeline.h"
+#include "TextureResidency.h"
+#include "TextureStreamer.h"
+#include "TextureCache.h"
+
+// Decoded texels, produced by Texture::decode without touching the device.
+// texels holds mipLevels levels of format back to back, level 0 first (see
+// MipChain.h); RGBA8 unless the texture was block compressed.
+struct TextureData {
+	int width = 0;
+	int height = 0;
+	int channels = 0;
+	int mipLevels = 1;
+	DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	std::vector<unsigned char> texels;
+};
+
+// Texture memory of a set of textures against storing them all as RGBA8.
+struct TextureMemoryReport {
+	size_t textures = 0;
+	size_t compressedTextures = 0;
+	size_t bytes = 0;
+	size_t rgba8Bytes = 0;
+
+	void add(size_t textureBytes, size_t uncompressedBytes) {
+		textures++;
+		compressedTextures += textureBytes < uncompressedBytes ? 1 : 0;
+		bytes += textureBytes;
+		rgba8Bytes += uncompressedBytes;
+	}
+
+	size_t savedBytes() const {
+		return rgba8Bytes - bytes;
+	}
+};
+
 class Texture {
 public:
-	ID3D11Texture2D* texture;
-	ID3D11ShaderResourceView* srv;
-	ID3D11RenderTargetView* rtv;
+	ID3D11Texture2D* texture = nullptr;
+	ID3D11ShaderResourceView* srv = nullptr;
+	ID3D11RenderTargetView* rtv = nullptr;
+	size_t bytes = 0;			// Texels of every level, in format
+	size_t rgba8Bytes = 0;		// The same levels stored as RGBA8
+	int width = 0;
+	int height = 0;
+	int mipLevels = 1;
+	int residentLevel = 0;		// Finest level uploaded; the view starts here
+	DXGI_FORMAT format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	std::string name;			// Set by TextureManager
+
+	// data holds mipLevels levels back to back, each half the size of the last.
+	// Block-compressed formats take rows of 4x4 blocks instead of texels.
+	void init(int width, int height, int channels, DXGI_FORMAT format, unsigned char *data, DXCore& core, int mipLevels = 1);
+	void load(DXCore& core, std::string filename, bool compress = false);
 
-	void init(int width, int height, int channels, DXGI_FORMAT format, unsigned char *data, DXCore& core);
-	void load(DXCore& core, std::string filename);
+	// The two halves of load: decode reads the file and can run on any thread,
+	// upload creates the texture on the thread that owns the device.
+	// With compress, decode reads the cooked cache next to the file when it is
+	// current, and otherwise block compresses the texture, on jobs if given,
+	// and writes the cache (see TextureCache.h).
+	static TextureData decode(const std::string& filename, bool compress = false, JobSystem* jobs = nullptr);
+	void upload(DXCore& core, TextureData& data);
+
+	// Streaming from the cooked cache. loadStreamed creates the whole chain but
+	// uploads only the levels no bigger than TextureStreamer::INITIAL_LEVEL_SIZE,
+	// and returns false if filename has no current cache. readLevel copies one
+	// level out of the cache and can run on any thread; uploadLevel uploads it
+	// and moves the view to it. It returns false unless level is the one above
+	// residentLevel and data holds that level in the texture's format.
+	bool loadStreamed(DXCore& core, const std::string& filename);
+	static bool readLevel(const std::string& filename, int level, std::vector<unsigned char>& data);
+	bool uploadLevel(DXCore& core, int level, const std::vector<unsigned char>& data);
 
 	void free() {
-		srv->Release();
-		texture->Release();
+		if (srv) srv->Release();
+		if (texture) texture->Release();
+		srv = nullptr;
+		texture = nullptr;
 	}
+
+private:
+	void createView(DXCore& core);
 };
 
-class TextureManager
+// Owns the loaded textures. Residency keeps them within a memory budget and
+// evicts textures that have not been drawn for a while; find loads an evicted
+// texture again from its cooked cache. Call beginFrame once per frame.
+//
+// Textures with a current cooked cache are streamed: they load with only their
+// smallest levels, and the streamer reads the finer ones on the job system and
+// uploads them in beginFrame, nearest the camera first (see setScreenCoverage).
+class TextureManager : private TextureBackend<Texture>
 {
 public:
-	std::map<std::string, Texture*> textures;
+	TextureResidency<Texture> residency;
+	TextureStreamer streamer;
+	// Load textures block compressed, through the cooked texture cache.
+	bool compress = true;
+	// Stream the mip levels of cached textures rather than loading them whole.
+	bool streamMips = true;
+
+	TextureManager() : residency(*this), streamer(Texture::readLevel, [this](const std::string& name, int level, std::vector<unsigned char>& data) {
+		Texture* texture = residency.find(name);
+		return texture != nullptr && device != nullptr && texture->uploadLevel(*device, level, data);
+	}) {}
 
 	void load(DXCore& core, std::string filename)
 	{
-		std::map<std::string, Texture*>::iterator it = textures.find(filename);
-		if (it != textures.end())
+		device = &core;
+		residency.acquire(filename);
+	}
+	// Queues filename on pipeline: decoded on a worker, then created and
+	// registered when the pipeline uploads it.
+	void loadAsync(AssetPipeline& pipeline, DXCore& core, std::string filename)
+	{
+		if (residency.isResident(filename))
 		{
 			return;
 		}
-		Texture* texture = new Texture();
-		texture->load(core, filename);
-		textures.insert({ filename, texture });
+		device = &core;
+		// Loading the coarse levels of a cached texture takes less than a decode
+		if (compress && streamMips && TextureCache::isCurrent(filename))
+		{
+			residency.acquire(filename);
+			return;
+		}
+		bool compressed = compress;
+		JobSystem* jobs = &pipeline.getJobSystem();
+		pipeline.load(filename, [filename, compressed, jobs]() { return Texture::decode(filename, compressed, jobs); }, [this, &core, filename](TextureData& data) {
+			if (residency.isResident(filename))
+			{
+				return;
+			}
+			if (data.width == 0)
+			{
+				residency.markFailed(filename);
+				return;
+			}
+			Texture* texture = new Texture();
+			texture->upload(core, data);
+			texture->name = filename;
+			if (!residency.insert(filename, texture, texture->bytes))
+			{
+				destroy(texture);
+			}
+		});
 	}
+	// The texture's view, loading it if it was evicted. Returns nullptr for
+	// textures that cannot be loaded. A streamed texture's view covers the
+	// levels resident so far.
 	ID3D11ShaderResourceView* find(std::string name)
 	{
-		return textures[name]->srv;
+		Texture* texture = residency.acquire(name);
+		return texture != nullptr ? texture->srv : nullptr;
+	}
+	// Evicts idle textures and uploads the mip levels streamed since last frame.
+	void beginFrame()
+	{
+		residency.beginFrame();
+		streamer.update();
+	}
+	// How many pixels across name is drawn this frame; sets how fine a level it
+	// streams and how soon. See TextureStreamer::screenCoverage.
+	void setScreenCoverage(const std::string& name, float pixels)
+	{
+		streamer.setScreenCoverage(name, pixels);
+	}
+	void setJobSystem(JobSystem* jobs)
+	{
+		streamer.setJobSystem(jobs);
+	}
+	void reportMemory(TextureMemoryReport& report) const
+	{
+		residency.forEach([&report](const std::string&, const Texture* texture, size_t) {
+			report.add(texture->bytes, texture->rgba8Bytes);
+		});
 	}
 	void unload(std::string name)
 	{
-		textures[name]->free();
-		textures.erase(name);
+		residency.evict(name);
 	}
 	~TextureManager()
 	{
-		for (auto it = textures.cbegin(); it != textures.cend(); )
+		residency.clear();
+	}
+
+private:
+	DXCore* device = nullptr;	// Device textures are reloaded on
+
+	Texture* create(const std::string& name, size_t& bytes) override
+	{
+		if (device == nullptr)
 		{
-			it->second->free();
-			textures.erase(it++);
+			return nullptr;
 		}
+		if (compress && streamMips)
+		{
+			Texture* texture = new Texture();
+			if (texture->loadStreamed(*device, name))
+			{
+				texture->name = name;
+				streamer.add(name, texture->width, texture->height, texture->mipLevels, texture->residentLevel);
+				bytes = texture->bytes;
+				return texture;
+			}
+			delete texture;
+		}
+		TextureData data = Texture::decode(name, compress);
+		if (data.width == 0)
+		{
+			return nullptr;
+		}
+		Texture* texture = new Texture();
+		texture->upload(*device, data);
+		texture->name = name;
+		bytes = texture->bytes;
+		return texture;
+	}
+	void destroy(Texture* texture) override
+	{
+		streamer.remove(texture->name);
+		texture->free();
+		delete texture;
 	}
 };
 
@@ -0,0 +1,189 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <fstream>
+#include "ModelCache.h"
+#include "BlockCompression.h"
+
+// Cooked texture cache (.pngc, .jpgc, ...) written next to a source image. It
+// holds the texture's whole mip chain in its upload format, BC1, BC3 or RGBA8,
+// with the levels back to back so Texture::init can point each subresource
+// into it. Loading a cooked texture skips the image decode, mip generation
+// and block compression.
+//
+// A cache is valid while its source has the size and modification time it
+// had when the cache was written, or the same content hash, as for ModelCache.
+class TextureCache
+{
+public:
+	static const uint32_t VERSION = 1;
+
+	static std::string pathFor(const std::string& source)
+	{
+		return source + "c";
+	}
+
+	// Writes the cache for source. data holds levels levels of format, as laid
+	// out by BlockCompression::encodeChain. Returns false if it cannot be written.
+	static bool write(const std::string& source, int width, int height, int levels, BlockCompression::Format format, const unsigned char* data)
+	{
+		return write(source, pathFor(source), width, height, levels, format, data);
+	}
+
+	static bool write(const std::string& source, const std::string& cachePath, int width, int height, int levels, BlockCompression::Format format, const unsigned char* data)
+	{
+		Header header = {};
+		memcpy(header.magic, "TEXC", 4);
+		header.version = VERSION;
+		ModelCache::SourceInfo info;
+		if (!ModelCache::statSource(source, info) || !ModelCache::hashSource(source, info.hash))
+		{
+			return false;
+		}
+		header.sourceSize = info.size;
+		header.sourceTime = info.modifiedTime;
+		header.sourceHash = info.hash;
+		header.width = static_cast<uint32_t>(width);
+		header.height = static_cast<uint32_t>(height);
+		header.mipLevels = static_cast<uint32_t>(levels);
+		header.format = static_cast<uint32_t>(format);
+		header.dataOffset = (sizeof(Header) + 15) & ~static_cast<size_t>(15);
+		header.dataBytes = BlockCompression::chainBytes(width, height, levels, format);
+		header.fileSize = header.dataOffset + header.dataBytes;
+
+		// Written under a temporary name so a partly written cache is never picked up.
+		std::string temporary = cachePath + ".tmp";
+		{
+			std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+			std::vector<char> padding(header.dataOffset - sizeof(Header), 0);
+			if (!file.write(reinterpret_cast<const char*>(&header), sizeof(Header)) ||
+				!file.write(padding.data(), padding.size()) ||
+				!file.write(reinterpret_cast<const char*>(data), header.dataBytes))
+			{
+				return false;
+			}
+		}
+		std::remove(cachePath.c_str());
+		return std::rename(temporary.c_str(), cachePath.c_str()) == 0;
+	}
+
+	// Maps the cache for source and checks it against the source file. Returns
+	// false if it is missing, stale or malformed; the caller then decodes the image.
+	bool open(const std::string& source)
+	{
+		return open(source, pathFor(source));
+	}
+
+	bool open(const std::string& source, const std::string& cachePath)
+	{
+		close();
+		ModelCache::SourceInfo info;
+		if (!ModelCache::statSource(source, info) || !file.open(cachePath) || !validate())
+		{
+			close();
+			return false;
+		}
+		if (info.size != header->sourceSize)
+		{
+			close();
+			return false;
+		}
+		if (info.modifiedTime != header->sourceTime && (!ModelCache::hashSource(source, info.hash) || info.hash != header->sourceHash))
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	// Whether source has a cache that open would accept.
+	static bool isCurrent(const std::string& source)
+	{
+		TextureCache cache;
+		return cache.open(source);
+	}
+
+	void close()
+	{
+		file.close();
+		header = nullptr;
+	}
+
+	bool isOpen() const
+	{
+		return header != nullptr;
+	}
+	int getWidth() const
+	{
+		return static_cast<int>(header->width);
+	}
+	int getHeight() const
+	{
+		return static_cast<int>(header->height);
+	}
+	int getMipLevels() const
+	{
+		return static_cast<int>(header->mipLevels);
+	}
+	BlockCompression::Format getFormat() const
+	{
+		return static_cast<BlockCompression::Format>(header->format);
+	}
+
+	// Every level, back to back, in the mapped file.
+	const unsigned char* data() const
+	{
+		return file.data() + header->dataOffset;
+	}
+	size_t dataBytes() const
+	{
+		return static_cast<size_t>(header->dataBytes);
+	}
+
+private:
+	struct Header
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t sourceSize;
+		int64_t sourceTime;
+		uint64_t sourceHash;
+		uint64_t fileSize;
+		uint32_t width;
+		uint32_t height;
+		uint32_t mipLevels;
+		uint32_t format;
+		uint64_t dataOffset;
+		uint64_t dataBytes;
+	};
+
+	MappedFile file;
+	const Header* header = nullptr;
+
+	// Checks the header and that the chain it describes fills the file.
+	bool validate()
+	{
+		if (file.size() < sizeof(Header))
+		{
+			return false;
+		}
+		header = reinterpret_cast<const Header*>(file.data());
+		if (memcmp(header->magic, "TEXC", 4) != 0 || header->version != VERSION || header->fileSize != file.size())
+		{
+			return false;
+		}
+		BlockCompression::Format format = static_cast<BlockCompression::Format>(header->format);
+		if (format != BlockCompression::Format::RGBA8 && format != BlockCompression::Format::BC1 && format != BlockCompression::Format::BC3)
+		{
+			return false;
+		}
+		if (header->width == 0 || header->height == 0 || header->width > 16384 || header->height > 16384 || header->mipLevels == 0 ||
+			header->mipLevels > static_cast<uint32_t>(MipChain::levelCount(header->width, header->height)))
+		{
+			return false;
+		}
+		return header->dataBytes == BlockCompression::chainBytes(header->width, header->height, header->mipLevels, format) &&
+			header->dataOffset <= file.size() && header->dataBytes <= file.size() - header->dataOffset;
+	}
+};
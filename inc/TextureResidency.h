@@ -0,0 +1,247 @@
+#pragma once
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+// Creates and destroys the device side of textures for a TextureResidency.
+// TextureManager implements it with D3D textures; tests use a fake.
+template<typename T>
+class TextureBackend
+{
+public:
+	virtual ~TextureBackend() {}
+
+	// Loads the texture called name and sets bytes to the memory it takes.
+	// Returns nullptr if it cannot be loaded.
+	virtual T* create(const std::string& name, size_t& bytes) = 0;
+	virtual void destroy(T* texture) = 0;
+};
+
+struct TextureResidencyStats
+{
+	size_t budgetBytes = 0;
+	size_t residentBytes = 0;
+	size_t peakResidentBytes = 0;
+	size_t residentTextures = 0;
+	uint64_t requests = 0;		// acquire calls
+	uint64_t hits = 0;			// acquire calls that found the texture resident
+	uint64_t loads = 0;			// Textures created on a miss or inserted
+	uint64_t failedLoads = 0;
+	uint64_t evictions = 0;		// Idle, over budget or explicit
+
+	float hitRate() const
+	{
+		return requests > 0 ? static_cast<float>(hits) / requests : 1.0f;
+	}
+};
+
+// Keeps the textures in use within a memory budget. Textures are created on
+// first use and kept in least recently used order:
+//  - beginFrame evicts textures not used in the last idleFrames frames.
+//  - A load that takes resident memory over the budget evicts the least
+//    recently used textures until it fits again, but never one used in the
+//    current frame, so pointers handed out this frame stay valid until the
+//    next beginFrame. If every resident texture is in use the budget is
+//    exceeded rather than failing the load.
+// Evicted textures are created again the next time they are acquired. Names
+// that fail to load are remembered and not retried every frame.
+template<typename T>
+class TextureResidency
+{
+public:
+	static const size_t UNLIMITED = SIZE_MAX;
+
+	explicit TextureResidency(TextureBackend<T>& _backend, size_t budgetBytes = UNLIMITED, unsigned int _idleFrames = 600) : backend(_backend), idleFrames(_idleFrames)
+	{
+		stats.budgetBytes = budgetBytes;
+	}
+
+	~TextureResidency()
+	{
+		clear();
+	}
+
+	TextureResidency(const TextureResidency&) = delete;
+	TextureResidency& operator=(const TextureResidency&) = delete;
+
+	void setBudget(size_t bytes)
+	{
+		stats.budgetBytes = bytes;
+		evictToBudget();
+	}
+	size_t getBudget() const
+	{
+		return stats.budgetBytes;
+	}
+	void setIdleFrames(unsigned int frames)
+	{
+		idleFrames = frames;
+	}
+
+	// Returns the texture, loading it if it is not resident, and marks it used
+	// this frame. Returns nullptr if it cannot be loaded.
+	T* acquire(const std::string& name)
+	{
+		stats.requests++;
+		auto it = entries.find(name);
+		if (it != entries.end())
+		{
+			stats.hits++;
+			touch(it->second);
+			return it->second.texture;
+		}
+		if (failed.count(name) > 0)
+		{
+			return nullptr;
+		}
+		size_t bytes = 0;
+		T* texture = backend.create(name, bytes);
+		if (texture == nullptr)
+		{
+			stats.failedLoads++;
+			failed.insert(name);
+			return nullptr;
+		}
+		add(name, texture, bytes);
+		return texture;
+	}
+
+	// Takes ownership of a texture loaded elsewhere, e.g. by an asset pipeline.
+	// Returns false, leaving texture with the caller, if name is already resident.
+	bool insert(const std::string& name, T* texture, size_t bytes)
+	{
+		if (entries.count(name) > 0)
+		{
+			return false;
+		}
+		failed.erase(name);
+		add(name, texture, bytes);
+		return true;
+	}
+
+	// Records that name could not be loaded, so acquire does not retry it.
+	void markFailed(const std::string& name)
+	{
+		stats.failedLoads++;
+		failed.insert(name);
+	}
+
+	// The texture if it is resident, without loading it or marking it used.
+	T* find(const std::string& name) const
+	{
+		auto it = entries.find(name);
+		return it != entries.end() ? it->second.texture : nullptr;
+	}
+	bool isResident(const std::string& name) const
+	{
+		return entries.count(name) > 0;
+	}
+
+	// Starts a new frame and evicts textures idle for more than idleFrames.
+	void beginFrame()
+	{
+		frame++;
+		while (!recency.empty())
+		{
+			Entry& oldest = entries.at(recency.back());
+			if (frame - oldest.lastUsed <= idleFrames)
+			{
+				break;
+			}
+			evict(recency.back());
+		}
+	}
+
+	bool evict(const std::string& name)
+	{
+		auto it = entries.find(name);
+		if (it == entries.end())
+		{
+			return false;
+		}
+		T* texture = it->second.texture;
+		stats.residentBytes -= it->second.bytes;
+		stats.residentTextures--;
+		stats.evictions++;
+		recency.erase(it->second.position);
+		entries.erase(it);
+		backend.destroy(texture);
+		return true;
+	}
+
+	// Destroys every resident texture and forgets failed names.
+	void clear()
+	{
+		while (!recency.empty())
+		{
+			evict(recency.back());
+		}
+		failed.clear();
+	}
+
+	// Calls fn(name, texture, bytes) for every resident texture, most recently used first.
+	template<typename Fn>
+	void forEach(Fn fn) const
+	{
+		for (const std::string& name : recency)
+		{
+			const Entry& entry = entries.at(name);
+			fn(name, entry.texture, entry.bytes);
+		}
+	}
+
+	const TextureResidencyStats& getStats() const
+	{
+		return stats;
+	}
+	uint64_t getFrame() const
+	{
+		return frame;
+	}
+
+private:
+	struct Entry
+	{
+		T* texture;
+		size_t bytes;
+		uint64_t lastUsed;
+		std::list<std::string>::iterator position;	// In recency
+	};
+
+	TextureBackend<T>& backend;
+	unsigned int idleFrames;
+	uint64_t frame = 0;
+	std::unordered_map<std::string, Entry> entries;
+	std::list<std::string> recency;		// Most recently used first
+	std::unordered_set<std::string> failed;
+	TextureResidencyStats stats;
+
+	void touch(Entry& entry)
+	{
+		entry.lastUsed = frame;
+		recency.splice(recency.begin(), recency, entry.position);
+	}
+
+	void add(const std::string& name, T* texture, size_t bytes)
+	{
+		recency.push_front(name);
+		Entry entry = { texture, bytes, frame, recency.begin() };
+		entries.emplace(name, entry);
+		stats.loads++;
+		stats.residentBytes += bytes;
+		stats.residentTextures++;
+		stats.peakResidentBytes = stats.residentBytes > stats.peakResidentBytes ? stats.residentBytes : stats.peakResidentBytes;
+		evictToBudget();
+	}
+
+	// Evicts least recently used textures not used this frame while over budget.
+	void evictToBudget()
+	{
+		while (stats.residentBytes > stats.budgetBytes && !recency.empty() && entries.at(recency.back()).lastUsed < frame)
+		{
+			evict(recency.back());
+		}
+	}
+};
@@ -0,0 +1,325 @@
+#pragma once
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "JobSystem.h"
+#include "MipChain.h"
+
+// One level read started by a TextureStreamer, in the order they were started.
+struct TextureStreamRequest
+{
+	std::string name;
+	int level;
+};
+
+// Streams mip levels of textures that start out with only their smallest
+// levels resident. Each texture has a desired level, picked from how many
+// pixels it covers on screen, and a priority, the coverage itself. update,
+// called once per frame on the device thread, starts reads for the textures
+// with the highest priority first, up to a limit in flight at once. It
+// reads one level at a time per texture, coarse to fine, and passes finished
+// reads to the upload function. Reads run on a JobSystem, or inline without
+// one. Every read started is logged, so the schedule can be checked without a GPU.
+class TextureStreamer
+{
+public:
+	// Fills data with one level of a texture. Runs on a pool thread.
+	typedef std::function<bool(const std::string& name, int level, std::vector<unsigned char>& data)> ReadLevel;
+	// Makes a level that has been read resident. Runs in update. Returning
+	// false stops streaming the texture, as a failed read does.
+	typedef std::function<bool(const std::string& name, int level, std::vector<unsigned char>& data)> UploadLevel;
+
+	// Largest width or height of the first level a streamed texture starts with.
+	static const int INITIAL_LEVEL_SIZE = 64;
+
+	TextureStreamer(ReadLevel _read, UploadLevel _upload, JobSystem* _jobs = nullptr, int _maxInFlight = 2) :
+		read(std::move(_read)), upload(std::move(_upload)), jobs(_jobs), maxInFlight(_maxInFlight) {}
+
+	~TextureStreamer()
+	{
+		// Reads reference the read function, so they must finish first.
+		waitForReads();
+	}
+
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	// Reads started after this run on jobs, or inline if it is nullptr.
+	void setJobSystem(JobSystem* _jobs)
+	{
+		waitForReads();
+		jobs = _jobs;
+	}
+
+	// The first level to make resident: the largest no bigger than INITIAL_LEVEL_SIZE.
+	static int initialLevel(int width, int height, int mipLevels)
+	{
+		int level = 0;
+		while (level < mipLevels - 1 && (MipChain::levelSize(width, level) > INITIAL_LEVEL_SIZE || MipChain::levelSize(height, level) > INITIAL_LEVEL_SIZE))
+		{
+			level++;
+		}
+		return level;
+	}
+
+	// Pixels an object of the given radius spans at distance.
+	static float screenCoverage(float radius, float distance, float fieldOfView, float screenHeight)
+	{
+		return radius * screenHeight / ((distance > 0.0001f ? distance : 0.0001f) * tanf(fieldOfView * 0.5f));
+	}
+
+	// Finest level worth loading for a texture of textureSize texels stretched
+	// over pixels pixels: the first no more than twice the pixels across.
+	static int levelForCoverage(int textureSize, int mipLevels, float pixels)
+	{
+		int level = 0;
+		while (level < mipLevels - 1 && MipChain::levelSize(textureSize, level) > pixels * 2.0f)
+		{
+			level++;
+		}
+		return level;
+	}
+
+	// Registers a texture whose levels from residentLevel down are resident. It
+	// streams towards level 0 at priority 0 until setScreenCoverage says otherwise.
+	void add(const std::string& name, int width, int height, int mipLevels, int residentLevel)
+	{
+		StreamedTexture& texture = textures[name];
+		texture = StreamedTexture();
+		texture.width = width;
+		texture.height = height;
+		texture.mipLevels = mipLevels;
+		texture.residentLevel = residentLevel;
+	}
+
+	// Stops streaming a texture; a read in flight for it is dropped.
+	void remove(const std::string& name)
+	{
+		textures.erase(name);
+	}
+
+	bool contains(const std::string& name) const
+	{
+		return textures.count(name) > 0;
+	}
+
+	// Sets the desired level and priority of a texture from the pixels it covers.
+	void setScreenCoverage(const std::string& name, float pixels)
+	{
+		auto it = textures.find(name);
+		if (it == textures.end())
+		{
+			return;
+		}
+		StreamedTexture& texture = it->second;
+		int size = texture.width > texture.height ? texture.width : texture.height;
+		setDesiredLevel(name, levelForCoverage(size, texture.mipLevels, pixels), pixels);
+	}
+
+	void setDesiredLevel(const std::string& name, int level, float priority)
+	{
+		auto it = textures.find(name);
+		if (it != textures.end())
+		{
+			it->second.desiredLevel = level;
+			it->second.priority = priority;
+		}
+	}
+
+	// Finest resident level of a texture, or -1 if it is not streamed.
+	int getResidentLevel(const std::string& name) const
+	{
+		auto it = textures.find(name);
+		return it != textures.end() ? it->second.residentLevel : -1;
+	}
+
+	// Uploads finished reads and starts new ones. Returns the levels uploaded.
+	int update()
+	{
+		int uploaded = uploadFinished();
+		startReads();
+		if (jobs == nullptr)
+		{
+			uploaded += uploadFinished();
+		}
+		return uploaded;
+	}
+
+	// True when no read is in flight and every texture has its desired level.
+	bool isIdle() const
+	{
+		if (!reads.empty())
+		{
+			return false;
+		}
+		for (auto& entry : textures)
+		{
+			if (wantsLevel(entry.second))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Runs update, helping the pool with reads, until the streamer is idle.
+	void finish()
+	{
+		while (!isIdle())
+		{
+			if (update() == 0 && (jobs == nullptr || !jobs->runOne()))
+			{
+				std::this_thread::yield();
+			}
+		}
+	}
+
+	const std::vector<TextureStreamRequest>& getRequestLog() const
+	{
+		return requestLog;
+	}
+	void clearRequestLog()
+	{
+		requestLog.clear();
+	}
+
+private:
+	struct StreamedTexture
+	{
+		int width = 0;
+		int height = 0;
+		int mipLevels = 1;
+		int residentLevel = 0;
+		int desiredLevel = 0;
+		float priority = 0.0f;
+		bool reading = false;
+		bool failed = false;	// A read or upload failed; streaming stops
+	};
+
+	struct Read
+	{
+		std::string name;
+		int level;
+		std::vector<unsigned char> data;
+		bool ok = false;
+		std::atomic<bool> done{ false };
+	};
+
+	ReadLevel read;
+	UploadLevel upload;
+	JobSystem* jobs;
+	int maxInFlight;
+	std::unordered_map<std::string, StreamedTexture> textures;
+	std::vector<std::shared_ptr<Read>> reads;	// In flight, oldest first
+	std::vector<TextureStreamRequest> requestLog;
+
+	static bool wantsLevel(const StreamedTexture& texture)
+	{
+		return !texture.reading && !texture.failed && texture.residentLevel > texture.desiredLevel;
+	}
+
+	// Orders candidates: highest priority, then most levels missing, then name.
+	static bool before(const std::string& aName, const StreamedTexture& a, const std::string& bName, const StreamedTexture& b)
+	{
+		if (a.priority != b.priority)
+		{
+			return a.priority > b.priority;
+		}
+		int aMissing = a.residentLevel - a.desiredLevel, bMissing = b.residentLevel - b.desiredLevel;
+		if (aMissing != bMissing)
+		{
+			return aMissing > bMissing;
+		}
+		return aName < bName;
+	}
+
+	void startReads()
+	{
+		while (static_cast<int>(reads.size()) < maxInFlight)
+		{
+			const std::string* bestName = nullptr;
+			StreamedTexture* best = nullptr;
+			for (auto& entry : textures)
+			{
+				if (wantsLevel(entry.second) && (best == nullptr || before(entry.first, entry.second, *bestName, *best)))
+				{
+					bestName = &entry.first;
+					best = &entry.second;
+				}
+			}
+			if (best == nullptr)
+			{
+				return;
+			}
+			std::shared_ptr<Read> r = std::make_shared<Read>();
+			r->name = *bestName;
+			r->level = best->residentLevel - 1;
+			best->reading = true;
+			requestLog.push_back({ r->name, r->level });
+			reads.push_back(r);
+			if (jobs != nullptr)
+			{
+				ReadLevel* readLevel = &read;
+				jobs->submit([r, readLevel]() {
+					r->ok = (*readLevel)(r->name, r->level, r->data);
+					r->done.store(true, std::memory_order_release);
+				});
+			}
+			else
+			{
+				r->ok = read(r->name, r->level, r->data);
+				r->done.store(true, std::memory_order_relaxed);
+			}
+		}
+	}
+
+	int uploadFinished()
+	{
+		int uploaded = 0;
+		for (size_t i = 0; i < reads.size(); )
+		{
+			std::shared_ptr<Read> r = reads[i];
+			if (!r->done.load(std::memory_order_acquire))
+			{
+				i++;
+				continue;
+			}
+			reads.erase(reads.begin() + i);
+			auto it = textures.find(r->name);
+			if (it == textures.end() || it->second.residentLevel != r->level + 1)
+			{
+				continue;	// Removed, or removed and added again, while reading
+			}
+			it->second.reading = false;
+			if (!r->ok || !upload(r->name, r->level, r->data))
+			{
+				it->second.failed = true;
+				continue;
+			}
+			it->second.residentLevel = r->level;
+			uploaded++;
+		}
+		return uploaded;
+	}
+
+	void waitForReads()
+	{
+		while (!reads.empty())
+		{
+			if (!reads.front()->done.load(std::memory_order_acquire))
+			{
+				if (jobs == nullptr || !jobs->runOne())
+				{
+					std::this_thread::yield();
+				}
+				continue;
+			}
+			reads.erase(reads.begin());
+		}
+	}
+};
@@ -0,0 +1,253 @@
+#pragma once
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include "core.h"
+
+// Structure-of-arrays output stream: x, y and z live in separate float arrays.
+struct SoAStream
+{
+	float* x;
+	float* y;
+	float* z;
+};
+
+// Read-only structure-of-arrays input stream.
+struct ConstSoAStream
+{
+	const float* x;
+	const float* y;
+	const float* z;
+};
+
+// Batch versions of Matrix::mulPoint and Matrix::mulVec. Inputs are either SoA
+// streams or strided AoS vec3 data (e.g. the pos/normal member of STATIC_VERTEX),
+// outputs are always SoA. Results match the single-vector Matrix functions
+// exactly, so batch and per-call code paths can be mixed freely.
+namespace TransformBatch
+{
+	// Controls optional multithreaded chunking. Batches smaller than
+	// minElementsPerThread * 2 always run on the calling thread.
+	struct Options
+	{
+		unsigned int threads = 1;
+		size_t minElementsPerThread = 16384;
+	};
+
+	// Reads element i of a strided vec3 array.
+	inline const float* stridedElement(const float* base, size_t strideBytes, size_t i)
+	{
+		return reinterpret_cast<const float*>(reinterpret_cast<const char*>(base) + strideBytes * i);
+	}
+
+	// Core kernel: transforms [begin, end) of a strided or SoA input. When aos is
+	// non-null it is used (with strideBytes), otherwise the SoA input is read.
+	// isPoint selects mulPoint (translation + w divide) or mulVec semantics.
+	inline void transformRange(const Matrix& m, const float* aos, size_t strideBytes, ConstSoAStream soa,
+		SoAStream out, size_t begin, size_t end, bool isPoint)
+	{
+		size_t i = begin;
+#if defined(CORE_SIMD_SSE)
+		const __m128 m0 = _mm_set1_ps(m.m[0]), m1 = _mm_set1_ps(m.m[1]), m2 = _mm_set1_ps(m.m[2]), m3 = _mm_set1_ps(m.m[3]);
+		const __m128 m4 = _mm_set1_ps(m.m[4]), m5 = _mm_set1_ps(m.m[5]), m6 = _mm_set1_ps(m.m[6]), m7 = _mm_set1_ps(m.m[7]);
+		const __m128 m8 = _mm_set1_ps(m.m[8]), m9 = _mm_set1_ps(m.m[9]), m10 = _mm_set1_ps(m.m[10]), m11 = _mm_set1_ps(m.m[11]);
+		const __m128 m12 = _mm_set1_ps(m.m[12]), m13 = _mm_set1_ps(m.m[13]), m14 = _mm_set1_ps(m.m[14]), m15 = _mm_set1_ps(m.m[15]);
+		const __m128 one = _mm_set1_ps(1.0f);
+		const size_t simdEnd = begin + ((end - begin) & ~static_cast<size_t>(3));
+		for (; i < simdEnd; i += 4)
+		{
+			__m128 x, y, z;
+			if (aos)
+			{
+				const float* p0 = stridedElement(aos, strideBytes, i);
+				const float* p1 = stridedElement(aos, strideBytes, i + 1);
+				const float* p2 = stridedElement(aos, strideBytes, i + 2);
+				const float* p3 = stridedElement(aos, strideBytes, i + 3);
+				x = _mm_setr_ps(p0[0], p1[0], p2[0], p3[0]);
+				y = _mm_setr_ps(p0[1], p1[1], p2[1], p3[1]);
+				z = _mm_setr_ps(p0[2], p1[2], p2[2], p3[2]);
+			}
+			else
+			{
+				x = _mm_loadu_ps(&soa.x[i]);
+				y = _mm_loadu_ps(&soa.y[i]);
+				z = _mm_loadu_ps(&soa.z[i]);
+			}
+			__m128 rx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m0), _mm_mul_ps(y, m1)), _mm_mul_ps(z, m2));
+			__m128 ry = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m4), _mm_mul_ps(y, m5)), _mm_mul_ps(z, m6));
+			__m128 rz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m8), _mm_mul_ps(y, m9)), _mm_mul_ps(z, m10));
+			if (isPoint)
+			{
+				rx = _mm_add_ps(rx, m3);
+				ry = _mm_add_ps(ry, m7);
+				rz = _mm_add_ps(rz, m11);
+				__m128 w = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(m12, x), _mm_mul_ps(m13, y)), _mm_mul_ps(m14, z)), m15);
+				w = _mm_div_ps(one, w);
+				rx = _mm_mul_ps(rx, w);
+				ry = _mm_mul_ps(ry, w);
+				rz = _mm_mul_ps(rz, w);
+			}
+			_mm_storeu_ps(&out.x[i], rx);
+			_mm_storeu_ps(&out.y[i], ry);
+			_mm_storeu_ps(&out.z[i], rz);
+		}
+#endif
+		for (; i < end; i++)
+		{
+			vec3 v;
+			if (aos)
+			{
+				const float* p = stridedElement(aos, strideBytes, i);
+				v = vec3(p[0], p[1], p[2]);
+			}
+			else
+			{
+				v = vec3(soa.x[i], soa.y[i], soa.z[i]);
+			}
+			vec3 r = isPoint ? m.mulPoint(v) : m.mulVec(v);
+			out.x[i] = r.x;
+			out.y[i] = r.y;
+			out.z[i] = r.z;
+		}
+	}
+
+	// Per-element kernel: element i is transformed by matrices[i].
+	inline void transformRangePerElement(const Matrix* matrices, const float* aos, size_t strideBytes, ConstSoAStream soa,
+		SoAStream out, size_t begin, size_t end, bool isPoint)
+	{
+		for (size_t i = begin; i < end; i++)
+		{
+			float x, y, z;
+			if (aos)
+			{
+				const float* p = stridedElement(aos, strideBytes, i);
+				x = p[0]; y = p[1]; z = p[2];
+			}
+			else
+			{
+				x = soa.x[i]; y = soa.y[i]; z = soa.z[i];
+			}
+			const float* m = matrices[i].m;
+#if defined(CORE_SIMD_SSE)
+			// Row products, then a transpose turns the four horizontal sums into
+			// one vertical add chain with the same operand order as mulPoint.
+			__m128 p = _mm_setr_ps(x, y, z, isPoint ? 1.0f : 0.0f);
+			__m128 r0 = _mm_mul_ps(_mm_loadu_ps(&m[0]), p);
+			__m128 r1 = _mm_mul_ps(_mm_loadu_ps(&m[4]), p);
+			__m128 r2 = _mm_mul_ps(_mm_loadu_ps(&m[8]), p);
+			__m128 r3 = _mm_mul_ps(_mm_loadu_ps(&m[12]), p);
+			_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+			__m128 sum = _mm_add_ps(_mm_add_ps(r0, r1), r2);
+			if (isPoint)
+			{
+				sum = _mm_add_ps(sum, r3);
+				__m128 w = _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(3, 3, 3, 3));
+				sum = _mm_mul_ps(sum, _mm_div_ps(_mm_set1_ps(1.0f), w));
+			}
+			alignas(16) float r[4];
+			_mm_store_ps(r, sum);
+			out.x[i] = r[0];
+			out.y[i] = r[1];
+			out.z[i] = r[2];
+#else
+			vec3 r = isPoint ? matrices[i].mulPoint(vec3(x, y, z)) : matrices[i].mulVec(vec3(x, y, z));
+			out.x[i] = r.x;
+			out.y[i] = r.y;
+			out.z[i] = r.z;
+#endif
+		}
+	}
+
+	// Splits [0, count) into contiguous chunks and runs them on worker threads.
+	template<typename Fn>
+	void runChunked(size_t count, const Options& options, Fn fn)
+	{
+		size_t threads = options.threads;
+		if (options.minElementsPerThread > 0)
+		{
+			threads = min(threads, count / options.minElementsPerThread);
+		}
+		if (threads <= 1)
+		{
+			fn(0, count);
+			return;
+		}
+		// Chunks are multiples of 4 so every thread except the last stays on the SIMD path.
+		size_t chunk = ((count + threads - 1) / threads + 3) & ~static_cast<size_t>(3);
+		std::vector<std::thread> workers;
+		for (size_t begin = chunk; begin < count; begin += chunk)
+		{
+			size_t end = min(begin + chunk, count);
+			workers.emplace_back([=]() { fn(begin, end); });
+		}
+		fn(0, min(chunk, count));
+		for (auto& worker : workers)
+		{
+			worker.join();
+		}
+	}
+
+	// SoA points by a single matrix.
+	inline void transformPoints(const Matrix& m, ConstSoAStream in, SoAStream out, size_t count, const Options& options = Options())
+	{
+		runChunked(count, options, [&](size_t begin, size_t end) { transformRange(m, nullptr, 0, in, out, begin, end, true); });
+	}
+
+	// SoA vectors (no translation) by a single matrix.
+	inline void transformVectors(const Matrix& m, ConstSoAStream in, SoAStream out, size_t count, const Options& options = Options())
+	{
+		runChunked(count, options, [&](size_t begin, size_t end) { transformRange(m, nullptr, 0, in, out, begin, end, false); });
+	}
+
+	// Strided AoS points by a single matrix. first points at the x component of element 0.
+	inline void transformPointsStrided(const Matrix& m, const float* first, size_t strideBytes, SoAStream out, size_t count, const Options& options = Options())
+	{
+		runChunked(count, options, [&](size_t begin, size_t end) { transformRange(m, first, strideBytes, ConstSoAStream(), out, begin, end, true); });
+	}
+
+	// Strided AoS vectors by a single matrix.
+	inline void transformVectorsStrided(const Matrix& m, const float* first, size_t strideBytes, SoAStream out, size_t count, const Options& options = Options())
+	{
+		runChunked(count, options, [&](size_t begin, size_t end) { transformRange(m, first, strideBytes, ConstSoAStream(), out, begin, end, false); });
+	}
+
+	// SoA points, element i transformed by matrices[i].
+	inline void transformPoints(const Matrix* matrices, ConstSoAStream in, SoAStream out, size_t count, const Options& options = Options())
+	{
+		runChunked(count, options, [&](size_t begin, size_t end) { transformRangePerElement(matrices, nullptr, 0, in, out, begin, end, true); });
+	}
+
+	// SoA vectors, element i transformed by matrices[i].
+	inline void transformVectors(const Matrix* matrices, ConstSoAStream in, SoAStream out, size_t count, const Options& options = Options())
+	{
+		runChunked(count, options, [&](size_t begin, size_t end) { transformRangePerElement(matrices, nullptr, 0, in, out, begin, end, false); });
+	}
+
+	// Strided AoS points, element i transformed by matrices[i].
+	inline void transformPointsStrided(const Matrix* matrices, const float* first, size_t strideBytes, SoAStream out, size_t count, const Options& options = Options())
+	{
+		runChunked(count, options, [&](size_t begin, size_t end) { transformRangePerElement(matrices, first, strideBytes, ConstSoAStream(), out, begin, end, true); });
+	}
+
+	// Strided AoS vectors, element i transformed by matrices[i].
+	inline void transformVectorsStrided(const Matrix* matrices, const float* first, size_t strideBytes, SoAStream out, size_t count, const Options& options = Options())
+	{
+		runChunked(count, options, [&](size_t begin, size_t end) { transformRangePerElement(matrices, first, strideBytes, ConstSoAStream(), out, begin, end, false); });
+	}
+
+	// Vertex helpers for any vertex type with vec3 pos and normal members
+	// (STATIC_VERTEX, ANIMATED_VERTEX).
+	template<typename Vertex>
+	void transformVertexPositions(const Matrix& m, const Vertex* vertices, SoAStream out, size_t count, const Options& options = Options())
+	{
+		if (count == 0) return;
+		transformPointsStrided(m, vertices[0].pos.v, sizeof(Vertex), out, count, options);
+	}
+
+	template<typename Vertex>
+	void transformVertexNormals(const Matrix& m, const Vertex* vertices, SoAStream out, size_t count, const Options& options = Options())
+	{
+		if (count == 0) return;
+		transformVectorsStrided(m, vertices[0].normal.v, sizeof(Vertex), out, count, options);
+	}
+}
@@ -0,0 +1,463 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+// Compact vertex formats and their CPU encode/decode. Positions are 16-bit
+// unorm within the mesh's bounds, normals and tangents octahedral-encoded as
+// two 16-bit snorm values, UVs half floats, bone indices 8-bit and weights
+// 8-bit unorm summing exactly to 255. Every field maps onto a DXGI format
+// (R16G16B16A16_UNORM, R16G16_SNORM, R16G16_FLOAT, R8G8B8A8_UINT/UNORM), so a
+// vertex shader can fetch them directly and rebuild the floats the same way.
+// Models with compactVertices set upload and cache them, and VertexShader.hlsl
+// and VShaderAnim.hlsl decode them when compiled for VertexFormat::Compact.
+//
+// The mesh-level functions take STATIC_VERTEX / ANIMATED_VERTEX or any type
+// with the same layout, such as the GEM loader's vertices.
+namespace VertexCompression
+{
+	// Maps 16-bit positions back to model space: position = offset + q / 65535 * scale.
+	struct Quantization
+	{
+		float offset[3] = { 0.0f, 0.0f, 0.0f };
+		float scale[3] = { 0.0f, 0.0f, 0.0f };
+	};
+
+	struct CompactStaticVertex
+	{
+		uint16_t position[4];	// w is padding, so the position reads as R16G16B16A16_UNORM
+		int16_t normal[2];
+		int16_t tangent[2];
+		uint16_t uv[2];			// Half floats
+	};
+
+	struct CompactAnimatedVertex
+	{
+		uint16_t position[4];
+		int16_t normal[2];
+		int16_t tangent[2];
+		uint16_t uv[2];
+		uint8_t bones[4];
+		uint8_t weights[4];
+	};
+
+	static_assert(sizeof(CompactStaticVertex) == 20, "CompactStaticVertex must be tightly packed");
+	static_assert(sizeof(CompactAnimatedVertex) == 28, "CompactAnimatedVertex must be tightly packed");
+
+	// Largest round-trip errors over a mesh.
+	struct ErrorReport
+	{
+		float position = 0.0f;	// Model units
+		float normal = 0.0f;	// Radians
+		float tangent = 0.0f;	// Radians
+		float uv = 0.0f;
+		float weight = 0.0f;
+	};
+
+	// IEEE half precision, rounding to nearest even. Values beyond the half
+	// range become infinity.
+	inline uint16_t floatToHalf(float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		uint32_t sign = (bits >> 16) & 0x8000u;
+		uint32_t exponent = (bits >> 23) & 0xFFu;
+		uint32_t mantissa = bits & 0x7FFFFFu;
+		if (exponent == 0xFFu)
+		{
+			return static_cast<uint16_t>(sign | 0x7C00u | (mantissa ? 0x200u : 0u));
+		}
+		int halfExponent = static_cast<int>(exponent) - 127 + 15;
+		if (halfExponent >= 31)
+		{
+			return static_cast<uint16_t>(sign | 0x7C00u);
+		}
+		if (halfExponent <= 0)
+		{
+			// Subnormal half, or zero.
+			if (halfExponent < -10)
+			{
+				return static_cast<uint16_t>(sign);
+			}
+			mantissa |= 0x800000u;
+			uint32_t shift = static_cast<uint32_t>(14 - halfExponent);
+			uint32_t half = mantissa >> shift;
+			uint32_t rest = mantissa & ((1u << shift) - 1u);
+			uint32_t halfway = 1u << (shift - 1);
+			if (rest > halfway || (rest == halfway && (half & 1u)))
+			{
+				half++;
+			}
+			return static_cast<uint16_t>(sign | half);
+		}
+		uint32_t half = sign | (static_cast<uint32_t>(halfExponent) << 10) | (mantissa >> 13);
+		uint32_t rest = mantissa & 0x1FFFu;
+		if (rest > 0x1000u || (rest == 0x1000u && (half & 1u)))
+		{
+			half++;	// May carry into the exponent, which rounds up correctly
+		}
+		return static_cast<uint16_t>(half);
+	}
+
+	inline float halfToFloat(uint16_t half)
+	{
+		uint32_t sign = static_cast<uint32_t>(half & 0x8000u) << 16;
+		uint32_t exponent = (half >> 10) & 0x1Fu;
+		uint32_t mantissa = half & 0x3FFu;
+		uint32_t bits;
+		if (exponent == 0x1Fu)
+		{
+			bits = sign | 0x7F800000u | (mantissa << 13);
+		}
+		else if (exponent != 0)
+		{
+			bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+		}
+		else if (mantissa == 0)
+		{
+			bits = sign;
+		}
+		else
+		{
+			// Subnormal: normalize the mantissa.
+			int e = -1;
+			do
+			{
+				e++;
+				mantissa <<= 1;
+			} while ((mantissa & 0x400u) == 0);
+			bits = sign | (static_cast<uint32_t>(127 - 15 - e) << 23) | ((mantissa & 0x3FFu) << 13);
+		}
+		float value;
+		memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	inline int16_t encodeSnorm16(float value)
+	{
+		value = value < -1.0f ? -1.0f : (value > 1.0f ? 1.0f : value);
+		return static_cast<int16_t>(lroundf(value * 32767.0f));
+	}
+
+	// As D3D reads SNORM: -32768 and -32767 both give -1.
+	inline float decodeSnorm16(int16_t value)
+	{
+		float f = value / 32767.0f;
+		return f < -1.0f ? -1.0f : f;
+	}
+
+	inline float signNotZero(float value)
+	{
+		return value >= 0.0f ? 1.0f : -1.0f;
+	}
+
+	// Octahedral encoding: the unit sphere is projected onto the octahedron
+	// |x| + |y| + |z| = 1 and the lower half folded over the upper one, giving
+	// two values in [-1, 1].
+	inline void encodeOctahedral(const float* n, int16_t* out)
+	{
+		float length = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+		if (length <= 0.0f)
+		{
+			out[0] = 0;
+			out[1] = 0;
+			return;
+		}
+		float x = n[0] / length, y = n[1] / length;
+		if (n[2] < 0.0f)
+		{
+			float fx = (1.0f - fabsf(y)) * signNotZero(x);
+			float fy = (1.0f - fabsf(x)) * signNotZero(y);
+			x = fx;
+			y = fy;
+		}
+		out[0] = encodeSnorm16(x);
+		out[1] = encodeSnorm16(y);
+	}
+
+	inline void decodeOctahedral(const int16_t* in, float* n)
+	{
+		float x = decodeSnorm16(in[0]), y = decodeSnorm16(in[1]);
+		float z = 1.0f - fabsf(x) - fabsf(y);
+		if (z < 0.0f)
+		{
+			float fx = (1.0f - fabsf(y)) * signNotZero(x);
+			float fy = (1.0f - fabsf(x)) * signNotZero(y);
+			x = fx;
+			y = fy;
+		}
+		float length = sqrtf(x * x + y * y + z * z);
+		n[0] = x / length;
+		n[1] = y / length;
+		n[2] = z / length;
+	}
+
+	// Quantization covering positions, one float3 every stride bytes.
+	inline Quantization computeQuantization(const float* positions, size_t count, size_t stride)
+	{
+		Quantization q;
+		if (count == 0)
+		{
+			return q;
+		}
+		float lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX }, hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+		for (size_t v = 0; v < count; v++)
+		{
+			const float* p = reinterpret_cast<const float*>(reinterpret_cast<const unsigned char*>(positions) + v * stride);
+			for (int k = 0; k < 3; k++)
+			{
+				lo[k] = p[k] < lo[k] ? p[k] : lo[k];
+				hi[k] = p[k] > hi[k] ? p[k] : hi[k];
+			}
+		}
+		for (int k = 0; k < 3; k++)
+		{
+			q.offset[k] = lo[k];
+			q.scale[k] = hi[k] - lo[k];
+		}
+		return q;
+	}
+
+	inline void encodePosition(const float* p, const Quantization& q, uint16_t* out)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			float t = q.scale[k] > 0.0f ? (p[k] - q.offset[k]) / q.scale[k] : 0.0f;
+			t = t < 0.0f ? 0.0f : (t > 1.0f ? 1.0f : t);
+			out[k] = static_cast<uint16_t>(lroundf(t * 65535.0f));
+		}
+		out[3] = 0;
+	}
+
+	inline void decodePosition(const uint16_t* in, const Quantization& q, float* p)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			p[k] = q.offset[k] + in[k] / 65535.0f * q.scale[k];
+		}
+	}
+
+	// Rounds weights to 8 bits so they still sum to 255: the rounding error is
+	// given to the largest weight. Weights are renormalized first.
+	inline void encodeWeights(const float* weights, uint8_t* out)
+	{
+		float sum = weights[0] + weights[1] + weights[2] + weights[3];
+		float scale = sum > 0.0f ? 255.0f / sum : 0.0f;
+		int total = 0;
+		int largest = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			int w = static_cast<int>(lroundf(weights[i] * scale));
+			w = w < 0 ? 0 : (w > 255 ? 255 : w);
+			out[i] = static_cast<uint8_t>(w);
+			total += w;
+			largest = weights[i] > weights[largest] ? i : largest;
+		}
+		if (sum > 0.0f)
+		{
+			out[largest] = static_cast<uint8_t>(out[largest] + (255 - total));
+		}
+	}
+
+	inline void decodeWeights(const uint8_t* in, float* weights)
+	{
+		for (int i = 0; i < 4; i++)
+		{
+			weights[i] = in[i] / 255.0f;
+		}
+	}
+
+	namespace Detail
+	{
+		// Field offsets shared by STATIC_VERTEX and ANIMATED_VERTEX, in floats.
+		enum Layout { POSITION = 0, NORMAL = 3, TANGENT = 6, U = 9, V = 10, BONES = 11, WEIGHTS = 15 };
+
+		inline float angleBetween(const float* a, const float* b)
+		{
+			float la = sqrtf(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+			float lb = sqrtf(b[0] * b[0] + b[1] * b[1] + b[2] * b[2]);
+			if (la <= 0.0f || lb <= 0.0f)
+			{
+				return 0.0f;
+			}
+			// Chord length, accurate for the small angles measured here.
+			float chord = 0.0f;
+			for (int k = 0; k < 3; k++)
+			{
+				float d = a[k] / la - b[k] / lb;
+				chord += d * d;
+			}
+			float s = sqrtf(chord) * 0.5f;
+			return 2.0f * asinf(s > 1.0f ? 1.0f : s);
+		}
+
+		inline void encodeSurface(const float* v, const Quantization& q, uint16_t* position, int16_t* normal, int16_t* tangent, uint16_t* uv)
+		{
+			encodePosition(v + POSITION, q, position);
+			encodeOctahedral(v + NORMAL, normal);
+			encodeOctahedral(v + TANGENT, tangent);
+			uv[0] = floatToHalf(v[U]);
+			uv[1] = floatToHalf(v[V]);
+		}
+
+		inline void decodeSurface(const uint16_t* position, const int16_t* normal, const int16_t* tangent, const uint16_t* uv, const Quantization& q, float* v)
+		{
+			decodePosition(position, q, v + POSITION);
+			decodeOctahedral(normal, v + NORMAL);
+			decodeOctahedral(tangent, v + TANGENT);
+			v[U] = halfToFloat(uv[0]);
+			v[V] = halfToFloat(uv[1]);
+		}
+
+		inline void measureSurface(const float* a, const float* b, ErrorReport& report)
+		{
+			for (int k = 0; k < 3; k++)
+			{
+				float d = fabsf(a[POSITION + k] - b[POSITION + k]);
+				report.position = d > report.position ? d : report.position;
+			}
+			float n = angleBetween(a + NORMAL, b + NORMAL);
+			float t = angleBetween(a + TANGENT, b + TANGENT);
+			float u = fabsf(a[U] - b[U]) > fabsf(a[V] - b[V]) ? fabsf(a[U] - b[U]) : fabsf(a[V] - b[V]);
+			report.normal = n > report.normal ? n : report.normal;
+			report.tangent = t > report.tangent ? t : report.tangent;
+			report.uv = u > report.uv ? u : report.uv;
+		}
+	}
+
+	// Encodes static vertices with a quantization covering their bounds.
+	template<typename Vertex>
+	std::vector<CompactStaticVertex> compressStatic(const std::vector<Vertex>& vertices, Quantization& quantization)
+	{
+		static_assert(sizeof(Vertex) == 11 * sizeof(float), "Vertex must have the STATIC_VERTEX layout");
+		quantization = computeQuantization(reinterpret_cast<const float*>(vertices.data()), vertices.size(), sizeof(Vertex));
+		std::vector<CompactStaticVertex> out(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			const float* v = reinterpret_cast<const float*>(&vertices[i]);
+			Detail::encodeSurface(v, quantization, out[i].position, out[i].normal, out[i].tangent, out[i].uv);
+		}
+		return out;
+	}
+
+	template<typename Vertex>
+	std::vector<Vertex> decompressStatic(const std::vector<CompactStaticVertex>& compact, const Quantization& quantization)
+	{
+		static_assert(sizeof(Vertex) == 11 * sizeof(float), "Vertex must have the STATIC_VERTEX layout");
+		std::vector<Vertex> out(compact.size());
+		for (size_t i = 0; i < compact.size(); i++)
+		{
+			float* v = reinterpret_cast<float*>(&out[i]);
+			Detail::decodeSurface(compact[i].position, compact[i].normal, compact[i].tangent, compact[i].uv, quantization, v);
+		}
+		return out;
+	}
+
+	// Encodes skinned vertices. Returns false if a bone index does not fit in 8
+	// bits; out is then left empty.
+	template<typename Vertex>
+	bool compressAnimated(const std::vector<Vertex>& vertices, std::vector<CompactAnimatedVertex>& out, Quantization& quantization)
+	{
+		static_assert(sizeof(Vertex) == 19 * sizeof(float), "Vertex must have the ANIMATED_VERTEX layout");
+		out.clear();
+		quantization = computeQuantization(reinterpret_cast<const float*>(vertices.data()), vertices.size(), sizeof(Vertex));
+		std::vector<CompactAnimatedVertex> encoded(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			const float* v = reinterpret_cast<const float*>(&vertices[i]);
+			Detail::encodeSurface(v, quantization, encoded[i].position, encoded[i].normal, encoded[i].tangent, encoded[i].uv);
+			uint32_t bones[4];
+			memcpy(bones, v + Detail::BONES, sizeof(bones));
+			for (int b = 0; b < 4; b++)
+			{
+				// Unused slots may hold any index; their weight is zero.
+				if (bones[b] > 255 && v[Detail::WEIGHTS + b] > 0.0f)
+				{
+					return false;
+				}
+				encoded[i].bones[b] = static_cast<uint8_t>(bones[b] > 255 ? 0 : bones[b]);
+			}
+			encodeWeights(v + Detail::WEIGHTS, encoded[i].weights);
+		}
+		out.swap(encoded);
+		return true;
+	}
+
+	template<typename Vertex>
+	std::vector<Vertex> decompressAnimated(const std::vector<CompactAnimatedVertex>& compact, const Quantization& quantization)
+	{
+		static_assert(sizeof(Vertex) == 19 * sizeof(float), "Vertex must have the ANIMATED_VERTEX layout");
+		std::vector<Vertex> out(compact.size());
+		for (size_t i = 0; i < compact.size(); i++)
+		{
+			float* v = reinterpret_cast<float*>(&out[i]);
+			Detail::decodeSurface(compact[i].position, compact[i].normal, compact[i].tangent, compact[i].uv, quantization, v);
+			uint32_t bones[4] = { compact[i].bones[0], compact[i].bones[1], compact[i].bones[2], compact[i].bones[3] };
+			memcpy(v + Detail::BONES, bones, sizeof(bones));
+			decodeWeights(compact[i].weights, v + Detail::WEIGHTS);
+		}
+		return out;
+	}
+
+	// One mesh's vertices in the compact format of its type, with the
+	// quantization its vertex shader rebuilds positions from.
+	struct CompactMesh
+	{
+		std::vector<unsigned char> vertices;	// CompactStaticVertex or CompactAnimatedVertex
+		uint32_t stride = 0;
+		Quantization quantization;
+	};
+
+	template<typename Vertex>
+	CompactMesh compressStaticMesh(const std::vector<Vertex>& vertices)
+	{
+		CompactMesh mesh;
+		std::vector<CompactStaticVertex> compact = compressStatic(vertices, mesh.quantization);
+		mesh.stride = sizeof(CompactStaticVertex);
+		mesh.vertices.assign(reinterpret_cast<const unsigned char*>(compact.data()), reinterpret_cast<const unsigned char*>(compact.data() + compact.size()));
+		return mesh;
+	}
+
+	// Returns false if a bone index does not fit in 8 bits; mesh is then left empty.
+	template<typename Vertex>
+	bool compressAnimatedMesh(const std::vector<Vertex>& vertices, CompactMesh& mesh)
+	{
+		mesh = CompactMesh();
+		std::vector<CompactAnimatedVertex> compact;
+		if (!compressAnimated(vertices, compact, mesh.quantization))
+		{
+			mesh.quantization = Quantization();
+			return false;
+		}
+		mesh.stride = sizeof(CompactAnimatedVertex);
+		mesh.vertices.assign(reinterpret_cast<const unsigned char*>(compact.data()), reinterpret_cast<const unsigned char*>(compact.data() + compact.size()));
+		return true;
+	}
+
+	// Largest differences between two meshes of the same layout, e.g. the
+	// originals and their decoded compact form.
+	template<typename Vertex>
+	ErrorReport measureError(const std::vector<Vertex>& original, const std::vector<Vertex>& decoded)
+	{
+		ErrorReport report;
+		for (size_t i = 0; i < original.size() && i < decoded.size(); i++)
+		{
+			const float* a = reinterpret_cast<const float*>(&original[i]);
+			const float* b = reinterpret_cast<const float*>(&decoded[i]);
+			Detail::measureSurface(a, b, report);
+			if (sizeof(Vertex) == 19 * sizeof(float))
+			{
+				float sum = a[Detail::WEIGHTS] + a[Detail::WEIGHTS + 1] + a[Detail::WEIGHTS + 2] + a[Detail::WEIGHTS + 3];
+				for (int k = 0; k < 4; k++)
+				{
+					float expected = sum > 0.0f ? a[Detail::WEIGHTS + k] / sum : 0.0f;
+					float d = fabsf(expected - b[Detail::WEIGHTS + k]);
+					report.weight = d > report.weight ? d : report.weight;
+				}
+			}
+		}
+		return report;
+	}
+}
@@ -4,19 +4,97 @@
 #include <algorithm>
 #include <memory.h>
 #include <iostream>
+#include <stdexcept>
+#include <cfloat>
+#include <cstdlib>
+#if defined(_MSC_VER)
+#include <malloc.h>
+#endif
+// Standard headers that must be seen before the min/max macros below, so that
+// headers including core.h first still compile against libstdc++.
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+
+// SIMD backends for the matrix kernels. SSE2 is the x86/x64 baseline, AVX2 is
+// selected at runtime when the CPU supports it and NEON is used on ARM64.
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define CORE_SIMD_SSE 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define CORE_TARGET_AVX2
+#else
+#define CORE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#define CORE_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
 #define _USE_MATH_DEFINES
 #define SQ(x) (x)* (x)
 #define max(a,b) (a > b ? a : b)
 #define min(a,b) (a < b ? a : b)
 constexpr auto CANVAS_WIDTH = 1024;
 constexpr auto CANVAS_HEIGHT = 768;
+#ifndef M_PI
 constexpr auto M_PI = 3.14159265358979323846;
 constexpr auto M_PI_2 = 1.57079632679489661923;
+#endif
 
 
 
 using namespace std;
 
+// Aligned heap allocation for buffers read with SIMD loads. Free with alignedFree.
+inline void* alignedAlloc(size_t size, size_t alignment)
+{
+#if defined(_MSC_VER)
+    return _aligned_malloc(size ? size : alignment, alignment);
+#else
+    void* p = nullptr;
+    if (posix_memalign(&p, alignment, size ? size : alignment) != 0) {
+        return nullptr;
+    }
+    return p;
+#endif
+}
+
+inline void alignedFree(void* p)
+{
+#if defined(_MSC_VER)
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+// Non-owning view of a contiguous array, used to pass loaded data along
+// without copying it into a new container.
+template<typename T>
+struct Span
+{
+    const T* data = nullptr;
+    size_t size = 0;
+
+    Span() {}
+    Span(const T* _data, size_t _size) : data(_data), size(_size) {}
+    Span(const std::vector<T>& v) : data(v.data()), size(v.size()) {}
+
+    const T* begin() const { return data; }
+    const T* end() const { return data + size; }
+    bool empty() const { return size == 0; }
+    const T& operator[](size_t i) const { return data[i]; }
+};
+
 template<typename T>
 static T lerp(const T a, const T b, float t)
 {
@@ -289,7 +367,7 @@ public:
     union {
         float v[4];
         struct { float x, y, z, w; };
-        vec3 xyz = vec3(x, y, z);
+        vec3 xyz;
     };
 
     float dot(const vec4& pVec) const {
@@ -427,7 +505,373 @@ public:
     }
 };
 
-class Matrix {
+// Row-major 4x4 matrix kernels used by Matrix. Every backend takes 16 floats
+// per matrix and produces the same results as the scalar reference (mul and
+// transpose are bit-identical, invert agrees to float rounding).
+namespace MatrixKernels
+{
+    enum class Backend { Scalar, SSE, AVX2, NEON };
+
+    typedef void (*MulFn)(const float* a, const float* b, float* out);
+    typedef void (*InvertFn)(const float* m, float* out);
+    typedef void (*TransposeFn)(const float* m, float* out);
+    typedef void (*MulAffineFn)(const float* a, const float* b, float* out);
+
+    struct Dispatch
+    {
+        Backend backend;
+        MulFn mul;
+        InvertFn invert;
+        TransposeFn transpose;
+        MulAffineFn mulAffine;
+    };
+
+    inline void mulScalar(const float* a, const float* b, float* out)
+    {
+        float r[16];
+        for (int i = 0; i < 4; i++) {
+            const float* row = &a[i * 4];
+            r[i * 4 + 0] = row[0] * b[0] + row[1] * b[4] + row[2] * b[8] + row[3] * b[12];
+            r[i * 4 + 1] = row[0] * b[1] + row[1] * b[5] + row[2] * b[9] + row[3] * b[13];
+            r[i * 4 + 2] = row[0] * b[2] + row[1] * b[6] + row[2] * b[10] + row[3] * b[14];
+            r[i * 4 + 3] = row[0] * b[3] + row[1] * b[7] + row[2] * b[11] + row[3] * b[15];
+        }
+        memcpy(out, r, 16 * sizeof(float));
+    }
+
+    // 3x4 affine compose; the implicit fourth row of both inputs is (0, 0, 0, 1).
+    inline void mulAffineScalar(const float* a, const float* b, float* out)
+    {
+        float r[12];
+        for (int i = 0; i < 3; i++) {
+            const float* row = &a[i * 4];
+            r[i * 4 + 0] = row[0] * b[0] + row[1] * b[4] + row[2] * b[8];
+            r[i * 4 + 1] = row[0] * b[1] + row[1] * b[5] + row[2] * b[9];
+            r[i * 4 + 2] = row[0] * b[2] + row[1] * b[6] + row[2] * b[10];
+            r[i * 4 + 3] = row[0] * b[3] + row[1] * b[7] + row[2] * b[11] + row[3];
+        }
+        memcpy(out, r, 12 * sizeof(float));
+    }
+
+    inline void transposeScalar(const float* m, float* out)
+    {
+        float r[16];
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 4; j++) {
+                r[i * 4 + j] = m[j * 4 + i];
+            }
+        }
+        memcpy(out, r, 16 * sizeof(float));
+    }
+
+    inline void invertScalar(const float* m, float* out)
+    {
+        float inv[16];
+        inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] + m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+        inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] - m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+        inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] + m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+        inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] - m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+        inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] - m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+        inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] + m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+        inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] - m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+        inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] + m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+        inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] + m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+        inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] - m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+        inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] + m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+        inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] - m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+        inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] - m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+        inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] + m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+        inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] - m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+        inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] + m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+        float det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+        det = 1.0f / det;
+        for (int i = 0; i < 16; i++) {
+            out[i] = inv[i] * det;
+        }
+    }
+
+#if defined(CORE_SIMD_SSE)
+#define CORE_SHUFFLE(a, b, x, y, z, w) _mm_shuffle_ps(a, b, _MM_SHUFFLE(w, z, y, x))
+#define CORE_SWIZZLE(a, x, y, z, w) CORE_SHUFFLE(a, a, x, y, z, w)
+
+    inline void mulSSE(const float* a, const float* b, float* out)
+    {
+        __m128 b0 = _mm_loadu_ps(&b[0]);
+        __m128 b1 = _mm_loadu_ps(&b[4]);
+        __m128 b2 = _mm_loadu_ps(&b[8]);
+        __m128 b3 = _mm_loadu_ps(&b[12]);
+        __m128 r[4];
+        for (int i = 0; i < 4; i++) {
+            __m128 row = _mm_loadu_ps(&a[i * 4]);
+            __m128 v = _mm_mul_ps(CORE_SWIZZLE(row, 0, 0, 0, 0), b0);
+            v = _mm_add_ps(v, _mm_mul_ps(CORE_SWIZZLE(row, 1, 1, 1, 1), b1));
+            v = _mm_add_ps(v, _mm_mul_ps(CORE_SWIZZLE(row, 2, 2, 2, 2), b2));
+            v = _mm_add_ps(v, _mm_mul_ps(CORE_SWIZZLE(row, 3, 3, 3, 3), b3));
+            r[i] = v;
+        }
+        _mm_storeu_ps(&out[0], r[0]);
+        _mm_storeu_ps(&out[4], r[1]);
+        _mm_storeu_ps(&out[8], r[2]);
+        _mm_storeu_ps(&out[12], r[3]);
+    }
+
+    inline void mulAffineSSE(const float* a, const float* b, float* out)
+    {
+        const __m128 translationMask = _mm_castsi128_ps(_mm_setr_epi32(0, 0, 0, -1));
+        __m128 b0 = _mm_loadu_ps(&b[0]);
+        __m128 b1 = _mm_loadu_ps(&b[4]);
+        __m128 b2 = _mm_loadu_ps(&b[8]);
+        __m128 r[3];
+        for (int i = 0; i < 3; i++) {
+            __m128 row = _mm_loadu_ps(&a[i * 4]);
+            __m128 v = _mm_mul_ps(CORE_SWIZZLE(row, 0, 0, 0, 0), b0);
+            v = _mm_add_ps(v, _mm_mul_ps(CORE_SWIZZLE(row, 1, 1, 1, 1), b1));
+            v = _mm_add_ps(v, _mm_mul_ps(CORE_SWIZZLE(row, 2, 2, 2, 2), b2));
+            r[i] = _mm_add_ps(v, _mm_and_ps(row, translationMask));
+        }
+        _mm_storeu_ps(&out[0], r[0]);
+        _mm_storeu_ps(&out[4], r[1]);
+        _mm_storeu_ps(&out[8], r[2]);
+    }
+
+    inline void transposeSSE(const float* m, float* out)
+    {
+        __m128 r0 = _mm_loadu_ps(&m[0]);
+        __m128 r1 = _mm_loadu_ps(&m[4]);
+        __m128 r2 = _mm_loadu_ps(&m[8]);
+        __m128 r3 = _mm_loadu_ps(&m[12]);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _mm_storeu_ps(&out[0], r0);
+        _mm_storeu_ps(&out[4], r1);
+        _mm_storeu_ps(&out[8], r2);
+        _mm_storeu_ps(&out[12], r3);
+    }
+
+    // 2x2 row-major block helpers for the block-wise inverse below.
+    // mat2Mul: A * B, mat2AdjMul: adj(A) * B, mat2MulAdj: A * adj(B).
+    inline __m128 mat2Mul(__m128 a, __m128 b)
+    {
+        return _mm_add_ps(_mm_mul_ps(a, CORE_SWIZZLE(b, 0, 3, 0, 3)),
+            _mm_mul_ps(CORE_SWIZZLE(a, 1, 0, 3, 2), CORE_SWIZZLE(b, 2, 1, 2, 1)));
+    }
+
+    inline __m128 mat2AdjMul(__m128 a, __m128 b)
+    {
+        return _mm_sub_ps(_mm_mul_ps(CORE_SWIZZLE(a, 3, 3, 0, 0), b),
+            _mm_mul_ps(CORE_SWIZZLE(a, 1, 1, 2, 2), CORE_SWIZZLE(b, 2, 3, 0, 1)));
+    }
+
+    inline __m128 mat2MulAdj(__m128 a, __m128 b)
+    {
+        return _mm_sub_ps(_mm_mul_ps(a, CORE_SWIZZLE(b, 3, 0, 3, 0)),
+            _mm_mul_ps(CORE_SWIZZLE(a, 1, 0, 3, 2), CORE_SWIZZLE(b, 2, 1, 2, 1)));
+    }
+
+    // General inverse by 2x2 sub-blocks [A B; C D] using the Schur complement.
+    inline void invertSSE(const float* m, float* out)
+    {
+        __m128 r0 = _mm_loadu_ps(&m[0]);
+        __m128 r1 = _mm_loadu_ps(&m[4]);
+        __m128 r2 = _mm_loadu_ps(&m[8]);
+        __m128 r3 = _mm_loadu_ps(&m[12]);
+
+        __m128 A = _mm_movelh_ps(r0, r1);
+        __m128 B = _mm_movehl_ps(r1, r0);
+        __m128 C = _mm_movelh_ps(r2, r3);
+        __m128 D = _mm_movehl_ps(r3, r2);
+
+        // Determinants of the four 2x2 blocks: |A|, |B|, |C|, |D|
+        __m128 detSub = _mm_sub_ps(
+            _mm_mul_ps(CORE_SHUFFLE(r0, r2, 0, 2, 0, 2), CORE_SHUFFLE(r1, r3, 1, 3, 1, 3)),
+            _mm_mul_ps(CORE_SHUFFLE(r0, r2, 1, 3, 1, 3), CORE_SHUFFLE(r1, r3, 0, 2, 0, 2)));
+        __m128 detA = CORE_SWIZZLE(detSub, 0, 0, 0, 0);
+        __m128 detB = CORE_SWIZZLE(detSub, 1, 1, 1, 1);
+        __m128 detC = CORE_SWIZZLE(detSub, 2, 2, 2, 2);
+        __m128 detD = CORE_SWIZZLE(detSub, 3, 3, 3, 3);
+
+        __m128 DC = mat2AdjMul(D, C);
+        __m128 AB = mat2AdjMul(A, B);
+        __m128 X = _mm_sub_ps(_mm_mul_ps(detD, A), mat2Mul(B, DC));
+        __m128 W = _mm_sub_ps(_mm_mul_ps(detA, D), mat2Mul(C, AB));
+        __m128 Y = _mm_sub_ps(_mm_mul_ps(detB, C), mat2MulAdj(D, AB));
+        __m128 Z = _mm_sub_ps(_mm_mul_ps(detC, B), mat2MulAdj(A, DC));
+
+        __m128 detM = _mm_add_ps(_mm_mul_ps(detA, detD), _mm_mul_ps(detB, detC));
+        __m128 tr = _mm_mul_ps(AB, CORE_SWIZZLE(DC, 0, 2, 1, 3));
+        tr = _mm_add_ps(tr, CORE_SWIZZLE(tr, 2, 3, 0, 1));
+        tr = _mm_add_ps(tr, CORE_SWIZZLE(tr, 1, 0, 3, 2));
+        detM = _mm_sub_ps(detM, tr);
+
+        const __m128 adjSignMask = _mm_setr_ps(1.f, -1.f, -1.f, 1.f);
+        __m128 rDetM = _mm_div_ps(adjSignMask, detM);
+        X = _mm_mul_ps(X, rDetM);
+        Y = _mm_mul_ps(Y, rDetM);
+        Z = _mm_mul_ps(Z, rDetM);
+        W = _mm_mul_ps(W, rDetM);
+
+        _mm_storeu_ps(&out[0], CORE_SHUFFLE(X, Y, 3, 1, 3, 1));
+        _mm_storeu_ps(&out[4], CORE_SHUFFLE(X, Y, 2, 0, 2, 0));
+        _mm_storeu_ps(&out[8], CORE_SHUFFLE(Z, W, 3, 1, 3, 1));
+        _mm_storeu_ps(&out[12], CORE_SHUFFLE(Z, W, 2, 0, 2, 0));
+    }
+
+    // Two result rows per iteration: each 128-bit lane holds one row of a.
+    CORE_TARGET_AVX2 inline void mulAVX2(const float* a, const float* b, float* out)
+    {
+        __m256 b0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(&b[0]));
+        __m256 b1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(&b[4]));
+        __m256 b2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(&b[8]));
+        __m256 b3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(&b[12]));
+        __m256 a01 = _mm256_loadu_ps(&a[0]);
+        __m256 a23 = _mm256_loadu_ps(&a[8]);
+
+        __m256 r01 = _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, 0x00), b0);
+        r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, 0x55), b1));
+        r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, 0xAA), b2));
+        r01 = _mm256_add_ps(r01, _mm256_mul_ps(_mm256_shuffle_ps(a01, a01, 0xFF), b3));
+
+        __m256 r23 = _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, 0x00), b0);
+        r23 = _mm256_add_ps(r23, _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, 0x55), b1));
+        r23 = _mm256_add_ps(r23, _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, 0xAA), b2));
+        r23 = _mm256_add_ps(r23, _mm256_mul_ps(_mm256_shuffle_ps(a23, a23, 0xFF), b3));
+
+        _mm256_storeu_ps(&out[0], r01);
+        _mm256_storeu_ps(&out[8], r23);
+    }
+
+    inline bool cpuSupportsAVX2()
+    {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) {
+            return false;
+        }
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx || (_xgetbv(0) & 6) != 6) {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2");
+#endif
+    }
+#endif
+
+#if defined(CORE_SIMD_NEON)
+    inline void mulNEON(const float* a, const float* b, float* out)
+    {
+        float32x4_t b0 = vld1q_f32(&b[0]);
+        float32x4_t b1 = vld1q_f32(&b[4]);
+        float32x4_t b2 = vld1q_f32(&b[8]);
+        float32x4_t b3 = vld1q_f32(&b[12]);
+        float32x4_t r[4];
+        for (int i = 0; i < 4; i++) {
+            float32x4_t row = vld1q_f32(&a[i * 4]);
+            float32x4_t v = vmulq_laneq_f32(b0, row, 0);
+            v = vaddq_f32(v, vmulq_laneq_f32(b1, row, 1));
+            v = vaddq_f32(v, vmulq_laneq_f32(b2, row, 2));
+            v = vaddq_f32(v, vmulq_laneq_f32(b3, row, 3));
+            r[i] = v;
+        }
+        for (int i = 0; i < 4; i++) {
+            vst1q_f32(&out[i * 4], r[i]);
+        }
+    }
+
+    inline void mulAffineNEON(const float* a, const float* b, float* out)
+    {
+        float32x4_t b0 = vld1q_f32(&b[0]);
+        float32x4_t b1 = vld1q_f32(&b[4]);
+        float32x4_t b2 = vld1q_f32(&b[8]);
+        const float translation[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+        float32x4_t t = vld1q_f32(translation);
+        float32x4_t r[3];
+        for (int i = 0; i < 3; i++) {
+            float32x4_t row = vld1q_f32(&a[i * 4]);
+            float32x4_t v = vmulq_laneq_f32(b0, row, 0);
+            v = vaddq_f32(v, vmulq_laneq_f32(b1, row, 1));
+            v = vaddq_f32(v, vmulq_laneq_f32(b2, row, 2));
+            r[i] = vaddq_f32(v, vmulq_laneq_f32(t, row, 3));
+        }
+        for (int i = 0; i < 3; i++) {
+            vst1q_f32(&out[i * 4], r[i]);
+        }
+    }
+
+    // vld4 de-interleaves the rows, which is exactly a transpose.
+    inline void transposeNEON(const float* m, float* out)
+    {
+        float32x4x4_t cols = vld4q_f32(m);
+        vst1q_f32(&out[0], cols.val[0]);
+        vst1q_f32(&out[4], cols.val[1]);
+        vst1q_f32(&out[8], cols.val[2]);
+        vst1q_f32(&out[12], cols.val[3]);
+    }
+#endif
+
+    inline Dispatch makeDispatch(Backend backend)
+    {
+        switch (backend) {
+#if defined(CORE_SIMD_SSE)
+        case Backend::SSE:
+            return { Backend::SSE, mulSSE, invertSSE, transposeSSE, mulAffineSSE };
+        case Backend::AVX2:
+            if (cpuSupportsAVX2()) {
+                return { Backend::AVX2, mulAVX2, invertSSE, transposeSSE, mulAffineSSE };
+            }
+            return { Backend::SSE, mulSSE, invertSSE, transposeSSE, mulAffineSSE };
+#endif
+#if defined(CORE_SIMD_NEON)
+        case Backend::NEON:
+            return { Backend::NEON, mulNEON, invertScalar, transposeNEON, mulAffineNEON };
+#endif
+        default:
+            return { Backend::Scalar, mulScalar, invertScalar, transposeScalar, mulAffineScalar };
+        }
+    }
+
+    // Picks the widest backend the CPU supports.
+    inline Backend detectBackend()
+    {
+#if defined(CORE_SIMD_SSE)
+        return cpuSupportsAVX2() ? Backend::AVX2 : Backend::SSE;
+#elif defined(CORE_SIMD_NEON)
+        return Backend::NEON;
+#else
+        return Backend::Scalar;
+#endif
+    }
+
+    // The active kernels, selected on first use from the CPU features.
+    inline Dispatch& active()
+    {
+        static Dispatch dispatch = makeDispatch(detectBackend());
+        return dispatch;
+    }
+
+    // Forces a backend (e.g. Scalar for reference comparisons). Backends the
+    // CPU or build does not support fall back to the nearest available one.
+    inline void setBackend(Backend backend)
+    {
+        active() = makeDispatch(backend);
+    }
+
+    inline const char* backendName(Backend backend)
+    {
+        switch (backend) {
+        case Backend::SSE: return "SSE";
+        case Backend::AVX2: return "AVX2";
+        case Backend::NEON: return "NEON";
+        default: return "Scalar";
+        }
+    }
+}
+
+class alignas(16) Matrix {
 public:
     union {
         float a[4][4];
@@ -471,7 +915,7 @@ public:
         return (v1 * w);
     }
 
-    vec3 mulVec(const vec3& v)
+    vec3 mulVec(const vec3& v) const
     {
         return vec3(
             (v.x * m[0] + v.y * m[1] + v.z * m[2]),
@@ -482,57 +926,18 @@ public:
     Matrix mul(const Matrix& matrix) const
     {
         Matrix ret;
-        ret.m[0] = m[0] * matrix.m[0] + m[1] * matrix.m[4] + m[2] * matrix.m[8] + m[3] * matrix.m[12];
-        ret.m[1] = m[0] * matrix.m[1] + m[1] * matrix.m[5] + m[2] * matrix.m[9] + m[3] * matrix.m[13];
-        ret.m[2] = m[0] * matrix.m[2] + m[1] * matrix.m[6] + m[2] * matrix.m[10] + m[3] * matrix.m[14];
-        ret.m[3] = m[0] * matrix.m[3] + m[1] * matrix.m[7] + m[2] * matrix.m[11] + m[3] * matrix.m[15];
-        ret.m[4] = m[4] * matrix.m[0] + m[5] * matrix.m[4] + m[6] * matrix.m[8] + m[7] * matrix.m[12];
-        ret.m[5] = m[4] * matrix.m[1] + m[5] * matrix.m[5] + m[6] * matrix.m[9] + m[7] * matrix.m[13];
-        ret.m[6] = m[4] * matrix.m[2] + m[5] * matrix.m[6] + m[6] * matrix.m[10] + m[7] * matrix.m[14];
-        ret.m[7] = m[4] * matrix.m[3] + m[5] * matrix.m[7] + m[6] * matrix.m[11] + m[7] * matrix.m[15];
-        ret.m[8] = m[8] * matrix.m[0] + m[9] * matrix.m[4] + m[10] * matrix.m[8] + m[11] * matrix.m[12];
-        ret.m[9] = m[8] * matrix.m[1] + m[9] * matrix.m[5] + m[10] * matrix.m[9] + m[11] * matrix.m[13];
-        ret.m[10] = m[8] * matrix.m[2] + m[9] * matrix.m[6] + m[10] * matrix.m[10] + m[11] * matrix.m[14];
-        ret.m[11] = m[8] * matrix.m[3] + m[9] * matrix.m[7] + m[10] * matrix.m[11] + m[11] * matrix.m[15];
-        ret.m[12] = m[12] * matrix.m[0] + m[13] * matrix.m[4] + m[14] * matrix.m[8] + m[15] * matrix.m[12];
-        ret.m[13] = m[12] * matrix.m[1] + m[13] * matrix.m[5] + m[14] * matrix.m[9] + m[15] * matrix.m[13];
-        ret.m[14] = m[12] * matrix.m[2] + m[13] * matrix.m[6] + m[14] * matrix.m[10] + m[15] * matrix.m[14];
-        ret.m[15] = m[12] * matrix.m[3] + m[13] * matrix.m[7] + m[14] * matrix.m[11] + m[15] * matrix.m[15];
+        MatrixKernels::active().mul(m, matrix.m, ret.m);
         return ret;
-
     }
 
-    Matrix invert()
+    Matrix invert() const
     {
         Matrix inv;
-        inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] + m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
-        inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] - m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
-        inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] + m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
-        inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] - m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
-        inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] - m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
-        inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] + m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
-        inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] - m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
-        inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] + m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
-        inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] + m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
-        inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] - m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
-        inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] + m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
-        inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] - m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
-        inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] - m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
-        inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] + m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
-        inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] - m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
-        inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] + m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
-        float det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
-        if (det == 0) {
-            // Handle this case
-        }
-        det = 1.0 / det;
-        for (int i = 0; i < 16; i++) {
-            inv[i] = inv[i] * det;
-        }
+        MatrixKernels::active().invert(m, inv.m);
         return inv;
     }
 
-    Matrix operator*(const Matrix& matrix)
+    Matrix operator*(const Matrix& matrix) const
     {
         return mul(matrix);
     }
@@ -637,11 +1042,7 @@ public:
 
     Matrix transpose() const {
         Matrix transposed;
-        for (int i = 0; i < 4; i++) {
-            for (int j = 0; j < 4; j++) {
-                transposed.a[i][j] = this->a[j][i];
-            }
-        }
+        MatrixKernels::active().transpose(m, transposed.m);
         return transposed;
     }
 
@@ -806,6 +1207,103 @@ public:
     }
 };
 
+// 3x4 row-major affine transform. The fourth row is implicitly (0, 0, 0, 1), so
+// it stores 12 floats instead of 16 and composes with 25% fewer multiplies.
+// Used for bone palettes, where every transform is affine.
+class alignas(16) AffineMatrix {
+public:
+    union {
+        float a[3][4];
+        float m[12];
+    };
+
+    AffineMatrix() { identity(); }
+
+    // Drops the bottom row of a 4x4 matrix, which must be affine.
+    explicit AffineMatrix(const Matrix& matrix) {
+        memcpy(m, matrix.m, 12 * sizeof(float));
+    }
+
+    void identity() {
+        memset(m, 0, 12 * sizeof(float));
+        m[0] = 1.f;
+        m[5] = 1.f;
+        m[10] = 1.f;
+    }
+
+    Matrix toMatrix() const {
+        Matrix mat;
+        memcpy(mat.m, m, 12 * sizeof(float));
+        return mat;
+    }
+
+    // Composes this * matrix, i.e. applies matrix first.
+    AffineMatrix mul(const AffineMatrix& matrix) const {
+        AffineMatrix ret;
+        MatrixKernels::active().mulAffine(m, matrix.m, ret.m);
+        return ret;
+    }
+
+    AffineMatrix operator*(const AffineMatrix& matrix) const {
+        return mul(matrix);
+    }
+
+    vec3 mulPoint(const vec3& v) const {
+        return vec3(
+            (v.x * m[0] + v.y * m[1] + v.z * m[2]) + m[3],
+            (v.x * m[4] + v.y * m[5] + v.z * m[6]) + m[7],
+            (v.x * m[8] + v.y * m[9] + v.z * m[10]) + m[11]);
+    }
+
+    vec3 mulVec(const vec3& v) const {
+        return vec3(
+            (v.x * m[0] + v.y * m[1] + v.z * m[2]),
+            (v.x * m[4] + v.y * m[5] + v.z * m[6]),
+            (v.x * m[8] + v.y * m[9] + v.z * m[10]));
+    }
+
+    // Inverse of an affine transform: inverts the 3x3 part and rotates the
+    // negated translation into the new space.
+    AffineMatrix invertAffine() const {
+        float c00 = m[5] * m[10] - m[6] * m[9];
+        float c01 = m[6] * m[8] - m[4] * m[10];
+        float c02 = m[4] * m[9] - m[5] * m[8];
+        float det = m[0] * c00 + m[1] * c01 + m[2] * c02;
+        float invDet = 1.0f / det;
+        AffineMatrix inv;
+        inv.m[0] = c00 * invDet;
+        inv.m[1] = (m[2] * m[9] - m[1] * m[10]) * invDet;
+        inv.m[2] = (m[1] * m[6] - m[2] * m[5]) * invDet;
+        inv.m[4] = c01 * invDet;
+        inv.m[5] = (m[0] * m[10] - m[2] * m[8]) * invDet;
+        inv.m[6] = (m[2] * m[4] - m[0] * m[6]) * invDet;
+        inv.m[8] = c02 * invDet;
+        inv.m[9] = (m[1] * m[8] - m[0] * m[9]) * invDet;
+        inv.m[10] = (m[0] * m[5] - m[1] * m[4]) * invDet;
+        inv.m[3] = -(inv.m[0] * m[3] + inv.m[1] * m[7] + inv.m[2] * m[11]);
+        inv.m[7] = -(inv.m[4] * m[3] + inv.m[5] * m[7] + inv.m[6] * m[11]);
+        inv.m[11] = -(inv.m[8] * m[3] + inv.m[9] * m[7] + inv.m[10] * m[11]);
+        return inv;
+    }
+
+    // Builds translation * rotation * scale directly. The rotation uses the
+    // same quaternion convention as Quaternion::toMatrix, so the result equals
+    // the top three rows of the equivalent 4x4 product.
+    static AffineMatrix fromTRS(const vec3& translation, const Quaternion& rotation, const vec3& scale) {
+        Matrix r = rotation.toMatrix();
+        AffineMatrix mat;
+        for (int i = 0; i < 3; i++) {
+            mat.a[i][0] = r.a[i][0] * scale.x;
+            mat.a[i][1] = r.a[i][1] * scale.y;
+            mat.a[i][2] = r.a[i][2] * scale.z;
+        }
+        mat.a[0][3] = translation.x;
+        mat.a[1][3] = translation.y;
+        mat.a[2][3] = translation.z;
+        return mat;
+    }
+};
+
 class Colour {
 public:
     // Constructors
@@ -821,7 +1319,7 @@ public:
     union {
         float v[3];
         struct { float r, g, b; };
-        vec3 rgb = vec3(r, g, b);
+        vec3 rgb;
     };
 
     // Methods for adding, subtracting, and multiplying colors
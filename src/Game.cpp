@@ -4,6 +4,8 @@
 #include "../inc/Camera.h"
 #include "../inc/core.h"
 #include "../inc/AnimationController.h"
+#include "../inc/AnimationLOD.h"
+#include "../inc/AssetPipeline.h"
 #include <cstdlib>
 #include <ctime>
 #include <vector>
@@ -137,25 +139,50 @@ std::vector<TreeInstance> generateRandomTreesInRadius(
     return trees;
 }
 
-// Load textures into the texture manager
-void initializeTextures(TextureManager& textureManager, DXCore& dx) {
-    textureManager.load(dx, "Textures/T-rex_Base_Color.png");
-    textureManager.load(dx, "Textures/bark09.png");
-    textureManager.load(dx, "Textures/pine branch.png");
-    textureManager.load(dx, "Textures/stump01.png");
-    textureManager.load(dx, "resources/NightSkyHDRI001_4K-TONEMAPPED.jpg"); // HDRI texture for the Skydome
+// Queue the textures on the asset pipeline; they are decoded in parallel and
+// added to the texture manager as their uploads run. The first run block
+// compresses them and writes the cooked cache next to each image; later runs
+// load only the smallest levels of each cached texture here and stream the
+// rest in while the game runs, so the first frame no longer waits for them.
+void initializeTextures(TextureManager& textureManager, AssetPipeline& assets, DXCore& dx) {
+    textureManager.loadAsync(assets, dx, "Textures/T-rex_Base_Color.png");
+    textureManager.loadAsync(assets, dx, "Textures/bark09.png");
+    textureManager.loadAsync(assets, dx, "Textures/pine branch.png");
+    textureManager.loadAsync(assets, dx, "Textures/stump01.png");
+    textureManager.loadAsync(assets, dx, "resources/NightSkyHDRI001_4K-TONEMAPPED.jpg"); // HDRI texture for the Skydome
+}
+
+// Radius of the sphere around a model's bounds, for its size on screen.
+static float modelRadius(const Model& model) {
+    AABB box;
+    for (const AABB& meshBounds : model.bounds) {
+        box.extend(meshBounds.minExt);
+        box.extend(meshBounds.maxExt);
+    }
+    return model.bounds.empty() ? 1.0f : box.getSize().getLength() * 0.5f;
+}
+
+// Streams finer levels of a model's textures the more pixels it covers.
+static void setModelTextureCoverage(TextureManager& textureManager, const Model& model, float pixels) {
+    for (const std::string& name : model.textureFilenames) {
+        textureManager.setScreenCoverage(name, pixels);
+    }
 }
 
 // Load and compile the shaders.
 void initializeShaders(ShaderManager& shaderManager, DXCore& dx) {
-    shaderManager.loadShader("shaderAnimTex", "VShaderAnim.hlsl", "TexPixelShader.hlsl", dx);
-    shaderManager.loadShader("shaderStatTex", "VertexShader.hlsl", "TexPixelShader.hlsl", dx);
+    // The T-rex and pine are uploaded with compact vertices, see Model::compactVertices
+    shaderManager.loadShader("shaderAnimTex", "VShaderAnim.hlsl", "TexPixelShader.hlsl", dx, VertexFormat::Compact);
+    shaderManager.loadShader("shaderStatTex", "VertexShader.hlsl", "TexPixelShader.hlsl", dx, VertexFormat::Compact);
     shaderManager.loadShader("shaderStat", "VertexShader.hlsl", "PixelShader.hlsl", dx);
     shaderManager.loadShader("shaderSkydome", "SkydomeVertexShader.hlsl", "SkydomePixelShader.hlsl", dx);
 }
 
-// Render trees
-void renderTrees(const std::vector<TreeInstance>& trees, Model* pine, ShaderManager* shaderManager, DXCore& dx, TextureManager& textureManager) {
+// Render trees, each at the level of detail its size on screen calls for.
+// Returns the number of triangles submitted.
+int renderTrees(const std::vector<TreeInstance>& trees, Model* pine, ShaderManager* shaderManager, DXCore& dx, TextureManager& textureManager,
+    const vec3& cameraPosition, const Matrix& VP, float fieldOfView, float screenHeight, MeshClusters::CullStats& cullStats) {
+    int triangles = 0;
     for (const auto& tree : trees) {
         // Create transformation matrix for each tree
         Matrix treeMatrix = Matrix::scaling(vec3(tree.scale, tree.scale, tree.scale)) *
@@ -165,9 +192,19 @@ void renderTrees(const std::vector<TreeInstance>& trees, Model* pine, ShaderMana
         shaderManager->getShader("shaderStatTex")->updateConstantVS("staticMeshBuffer", "W", &treeMatrix);
         shaderManager->applyShader("shaderStatTex", dx);
         
-        // Render the tree model
-        pine->draw(dx, *shaderManager->getShader("shaderStatTex"), textureManager);
+        // Render the tree model; up close, only the clusters that pass culling
+        // in the tree's own space are drawn
+        int lod = pine->selectLOD(calculateDistance(tree.position, cameraPosition), tree.scale, fieldOfView, screenHeight);
+        if (lod == 0) {
+            MeshClusters::Frustum frustum = MeshClusters::Frustum::fromMatrix(VP.mul(treeMatrix));
+            vec3 eye = treeMatrix.invert().mulPoint(cameraPosition);
+            triangles += pine->drawVisible(dx, *shaderManager->getShader("shaderStatTex"), textureManager, frustum, eye, &cullStats);
+        }
+        else {
+            triangles += pine->draw(dx, *shaderManager->getShader("shaderStatTex"), textureManager, lod);
+        }
     }
+    return triangles;
 }
 
 // Main game function
@@ -177,7 +214,16 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nC
     auto win = std::make_unique<Window>();
     auto shaderManager = std::make_unique<ShaderManager>();
     auto timer = std::make_unique<Timer>();
+    // Worker pool shared by asset loading, texture streaming and the per-frame
+    // animation update. Declared before the texture manager so it outlives the
+    // streamer's reads.
+    JobSystem jobSystem;
     auto textureManager = std::make_unique<TextureManager>();
+    // Finer texture levels are read from the cooked cache on the workers
+    textureManager->setJobSystem(&jobSystem);
+    // Block-compressed scene textures take a few MB; the budget leaves room for more
+    textureManager->residency.setBudget(256 * 1024 * 1024);
+    textureManager->residency.setIdleFrames(600);
 
     // Random seed for tree placement
     srand(static_cast<unsigned>(time(0)));
@@ -210,53 +256,124 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nC
     // Initialize camera with loaded parameters
     auto camera = std::make_unique<Camera>(cameraPosition, cameraForward, cameraSpeed, cameraSensitivity);
 
-    // Load T-Rex model
-    auto trex = std::make_unique<Model>();
-    trex->init(trexMeshPath, *dx, trexModelType);
 
+    // Models and textures are read and decoded on the job system while the main
+    // thread builds the procedural geometry and compiles shaders; only the
+    // device uploads run here, one at a time
+    auto trex = std::make_unique<Model>();
     auto pine = std::make_unique<Model>();
-    pine->init(pineMeshPath, *dx, pineModelType);
-
     auto plane = std::make_unique<Plane>();
-    plane->init(*dx);
-
-    // Initialize Skydome
     auto skydome = std::make_unique<Sphere>();
-    skydome->init(30, 30, skyboxRadius, *dx); // Large sphere for Skydome
+    {
+        AssetPipeline assets(jobSystem);
+        trex->compressAnimation = true;
+        // Clips are decoded the first time they play; the first run still loads
+        // them all to write the cache
+        trex->lazyAnimation = true;
+        // Simplified LODs are built at cook time and stored in the model cache
+        trex->lodRatios = { 0.5f, 0.25f };
+        pine->lodRatios = { 0.5f, 0.25f, 0.1f };
+        // Vertices are quantized to 28 and 20 bytes; shaderAnimTex and
+        // shaderStatTex read the compact layout
+        trex->compactVertices = true;
+        pine->compactVertices = true;
+        // Clusters are culled per tree; the rasterizer draws both sides of the
+        // needle cards, so only the frustum test is used
+        pine->useClusters = true;
+        pine->clusterBackfaceCulling = false;
+        assets.add(trexMeshPath, [&]() { trex->load(trexMeshPath, trexModelType); }, [&]() { trex->upload(*dx); });
+        assets.add(pineMeshPath, [&]() { pine->load(pineMeshPath, pineModelType); }, [&]() { pine->upload(*dx); });
+        initializeTextures(*textureManager, assets, *dx);
+
+        plane->init(*dx);
+        skydome->init(30, 30, skyboxRadius, *dx); // Large sphere for Skydome
+        initializeShaders(*shaderManager, *dx);
+
+        assets.finish();
+        std::ostringstream timings;
+        assets.printTimings(timings);
+        OutputDebugStringA(timings.str().c_str());
+    }
 
-    // Initialize textures and shaders
-    initializeTextures(*textureManager, *dx);
-    initializeShaders(*shaderManager, *dx);
+    // Index memory of the loaded scene against 32-bit indices everywhere
+    {
+        IndexMemoryReport indexMemory;
+        plane->geometry.reportIndexMemory(indexMemory);
+        skydome->geometry.reportIndexMemory(indexMemory);
+        trex->reportIndexMemory(indexMemory);
+        pine->reportIndexMemory(indexMemory);
+        std::ostringstream report;
+        report << "Index buffers: " << indexMemory.compactBuffers << " of " << indexMemory.buffers << " 16-bit, "
+            << indexMemory.bytes / 1024 << " KB, " << indexMemory.savedBytes() / 1024 << " KB saved\n";
+        OutputDebugStringA(report.str().c_str());
+    }
 
-    // HDRI texture for Skydome
-    ID3D11ShaderResourceView* skydomeTexture = textureManager->find(skyboxTexturePath);
+    // Fraction of the triangles each LOD level kept against the ratio asked
+    // for; a mesh whose chain ended early draws its last level
+    {
+        std::ostringstream report;
+        for (const auto& entry : { std::make_pair("T-rex", trex.get()), std::make_pair("Pine", pine.get()) }) {
+            const Model& model = *entry.second;
+            report << entry.first << " LODs:";
+            for (size_t l = 0; l < model.lodRatios.size(); l++) {
+                report << " " << static_cast<float>(model.getTriangleCount(static_cast<int>(l) + 1)) / model.getTriangleCount(0)
+                    << " of " << model.lodRatios[l];
+            }
+            report << "\n";
+        }
+        OutputDebugStringA(report.str().c_str());
+    }
+
+    // Texture memory of the block-compressed textures against RGBA8
+    {
+        TextureMemoryReport textureMemory;
+        textureManager->reportMemory(textureMemory);
+        std::ostringstream report;
+        report << "Textures: " << textureMemory.compressedTextures << " of " << textureMemory.textures << " block compressed, "
+            << textureMemory.bytes / 1024 << " KB, " << textureMemory.savedBytes() / 1024 << " KB saved\n";
+        OutputDebugStringA(report.str().c_str());
+    }
 
     // Initialize T-Rex animation
     AnimationInstance trexAnimInstance;
     trexAnimInstance.animation = &trex->animation;
     vec3 trexPosition = trexInitialPosition; // Initial position of T-Rex
+    float trexRadius = modelRadius(*trex);
+    float pineRadius = modelRadius(*pine);
+
+    // Animated instances are updated together on the job system each frame,
+    // at a rate chosen by their distance to the camera
+    std::vector<AnimationUpdateRequest> animationUpdates;
+    AnimationLOD trexLOD(trex->animation.skeleton);
+    AnimationLODState trexLODState;
 
-    // Animation controller setup
+    // Animation controller setup. Clip names are resolved to handles once here.
     AnimationController animationController;
-    animationController.addState("Idle", [&]() {
-        trexAnimInstance.resetAnimationTime();
-        trexAnimInstance.currentAnimation = "Idle";
+    animationController.setDefaultFadeTime(0.25f);
+    animationController.addState("Idle", trex->animation.findSequence("Idle"), [&]() {
+        trexAnimInstance.crossFade(animationController.getCurrentClip(), animationController.getFadeTime());
         });
 
-    animationController.addState("Run", [&]() {
-        trexAnimInstance.resetAnimationTime();
-        trexAnimInstance.currentAnimation = "Run";
+    animationController.addState("Run", trex->animation.findSequence("Run"), [&]() {
+        trexAnimInstance.crossFade(animationController.getCurrentClip(), animationController.getFadeTime());
         });
 
-    animationController.addState("attack", [&]() {
-        trexAnimInstance.resetAnimationTime();
-        trexAnimInstance.currentAnimation = "attack";
+    animationController.addState("attack", trex->animation.findSequence("attack"), [&]() {
+        trexAnimInstance.crossFade(animationController.getCurrentClip(), animationController.getFadeTime());
         });
 
     // Generate trees based on loaded parameters
     std::vector<TreeInstance> trees = generateRandomTreesInRadius(treeCount, treeMinScale, treeMaxScale, treeRadius);
 
     Matrix worldMatrix;
+    const float fieldOfView = M_PI / 4.0f;
+
+    // Submitted triangles and animation LOD work, reported once a second
+    long long submittedTriangles = 0;
+    MeshClusters::CullStats cullStats;
+    AnimationLODStats animationLODStats;
+    int reportFrames = 0;
+    float reportTime = 0.0f;
 
     while (true) {
         float dt = timer->update();
@@ -274,11 +391,30 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nC
 
         // Compute View-Projection matrix
         Matrix view = camera->getViewMatrix();
-        Matrix projection = projection.Projection(M_PI / 4.0f, float(win->width) / win->height, 0.1f, 100.0f);
+        Matrix projection = projection.Projection(fieldOfView, float(win->width) / win->height, 0.1f, 100.0f);
         Matrix VP = projection.mul(view);
 
         dx->clear();
 
+        // Texture levels stream in by how large their models are on screen. The
+        // sky surrounds the camera, so its texture spans the field of view's share
+        // of a full turn.
+        float screenHeight = float(win->height);
+        textureManager->setScreenCoverage(skyboxTexturePath, screenHeight * 2.0f * float(M_PI) / fieldOfView);
+        setModelTextureCoverage(*textureManager, *trex,
+            TextureStreamer::screenCoverage(trexRadius, calculateDistance(trexPosition, camera->position), fieldOfView, screenHeight));
+        float pinePixels = 0.0f;
+        for (const TreeInstance& tree : trees) {
+            float pixels = TextureStreamer::screenCoverage(pineRadius * tree.scale, calculateDistance(tree.position, camera->position), fieldOfView, screenHeight);
+            pinePixels = pixels > pinePixels ? pixels : pinePixels;
+        }
+        setModelTextureCoverage(*textureManager, *pine, pinePixels);
+
+        // Textures not drawn for about ten seconds are evicted; evicted ones
+        // reload from their cooked cache when next drawn. Streamed levels read
+        // since the last frame are uploaded here.
+        textureManager->beginFrame();
+
         // Update lighting
         shaderManager->getShader("shaderStatTex")->updateLight("LightBuffer", skylightDirection, skylightIntensity, skylightColor, ambientColor);
         shaderManager->getShader("shaderAnimTex")->updateLight("LightBuffer", skylightDirection, skylightIntensity, skylightColor, ambientColor);
@@ -288,7 +424,7 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nC
         worldMatrix =  Matrix::translation(vec3(camera->position));
         shaderManager->getShader("shaderSkydome")->updateConstantVS("staticMeshBuffer", "W", &worldMatrix);
         shaderManager->getShader("shaderSkydome")->updateConstantVS("staticMeshBuffer", "VP", &VP);
-        shaderManager->getShader("shaderSkydome")->updateTexturePS("skyTex", skydomeTexture, *dx);
+        shaderManager->getShader("shaderSkydome")->updateTexturePS("skyTex", textureManager->find(skyboxTexturePath), *dx);
         shaderManager->applyShader("shaderSkydome", *dx);
         skydome->geometry.draw(*dx);
 
@@ -299,7 +435,7 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nC
         plane->geometry.draw(*dx);
 
         // Render trees
-        renderTrees(trees, pine.get(), shaderManager.get(), *dx, *textureManager);
+        int frameTriangles = renderTrees(trees, pine.get(), shaderManager.get(), *dx, *textureManager, camera->position, VP, fieldOfView, float(win->height), cullStats);
 
         // Handle T-Rex animations based on player distance
         float distanceToCamera = calculateDistance(trexPosition, camera->position);
@@ -315,8 +451,16 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nC
             animationController.transitionTo("Idle");
         }
 
-        // Update T-Rex animation
-        trexAnimInstance.update(animationController.getCurrentState(), dt);
+        // Update animations in parallel; this returns once every palette is ready
+        trexLOD.beginFrame();
+        trex->animation.beginFrame();
+        animationUpdates.clear();
+        trexLOD.schedule(trexAnimInstance, trexLODState, animationController.getCurrentClip(), dt, distanceToCamera, animationUpdates);
+        animationLODStats.add(trexLOD.stats);
+        updateAnimationInstances(jobSystem, animationUpdates);
+
+        // No jobs are running now, so clips idle for about ten seconds can go
+        trex->animation.evictUnusedSequences(600);
 
         // Calculate the direction vector to the camera, projected to the XZ-plane
         vec3 directionToCamera = camera->position - trexPosition;
@@ -334,7 +478,30 @@ int WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PSTR lpCmdLine, int nC
         shaderManager->getShader("shaderAnimTex")->updateConstantVS("animatedMeshBuffer", "W", &worldMatrix);
         shaderManager->getShader("shaderAnimTex")->updateConstantVS("animatedMeshBuffer", "bones", trexAnimInstance.matrices);
         shaderManager->applyShader("shaderAnimTex", *dx);
-        trex->draw(*dx, *shaderManager->getShader("shaderAnimTex"), *textureManager);
+        int trexMeshLOD = trex->selectLOD(distanceToCamera, 1.0f, fieldOfView, float(win->height));
+        frameTriangles += trex->draw(*dx, *shaderManager->getShader("shaderAnimTex"), *textureManager, trexMeshLOD);
+
+        submittedTriangles += frameTriangles;
+        reportFrames++;
+        reportTime += dt;
+        if (reportTime >= 1.0f) {
+            std::ostringstream report;
+            report << "Triangles submitted per frame: " << submittedTriangles / reportFrames
+                << ", clusters culled: " << cullStats.cullRatio() * 100.0f << "% of their triangles\n";
+            report << "Animation updates (evaluated/skipped) every frame: " << animationLODStats.evaluatedPerTier[0] << "/" << animationLODStats.skippedPerTier[0]
+                << ", every 2nd: " << animationLODStats.evaluatedPerTier[1] << "/" << animationLODStats.skippedPerTier[1]
+                << ", every 4th: " << animationLODStats.evaluatedPerTier[2] << "/" << animationLODStats.skippedPerTier[2]
+                << "; bones evaluated " << animationLODStats.bonesEvaluated << ", saved " << animationLODStats.bonesSaved << "\n";
+            const TextureResidencyStats& textureStats = textureManager->residency.getStats();
+            report << "Textures resident: " << textureStats.residentTextures << ", " << textureStats.residentBytes / 1024 << " KB, hit rate "
+                << textureStats.hitRate() * 100.0f << "%, " << textureStats.evictions << " evicted\n";
+            OutputDebugStringA(report.str().c_str());
+            submittedTriangles = 0;
+            cullStats = MeshClusters::CullStats();
+            animationLODStats = AnimationLODStats();
+            reportFrames = 0;
+            reportTime = 0.0f;
+        }
 
         // Update view-projection matrices
         shaderManager->getShader("shaderStatTex")->updateConstantVS("staticMeshBuffer", "VP", &VP);
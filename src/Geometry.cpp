@@ -1,12 +1,13 @@
 #include "../inc/Geometry.h"
 #include "../inc/Texture.h"
+#include <stdexcept>
 
-void Mesh::init(void* vertices, int vertexSizeInBytes, int numVertices, unsigned int* indices, int numIndices, DXCore& core)
+void Mesh::init(const void* vertices, int vertexSizeInBytes, int numVertices, const void* indices, int indexSizeInBytes, int numIndices, DXCore& core)
 {
 	D3D11_BUFFER_DESC bd;
 	memset(&bd, 0, sizeof(D3D11_BUFFER_DESC));
 	bd.Usage = D3D11_USAGE_DEFAULT;
-	bd.ByteWidth = sizeof(unsigned int) * numIndices;
+	bd.ByteWidth = indexSizeInBytes * numIndices;
 	bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
 	D3D11_SUBRESOURCE_DATA data;
 	memset(&data, 0, sizeof(D3D11_SUBRESOURCE_DATA));
@@ -18,27 +19,118 @@ void Mesh::init(void* vertices, int vertexSizeInBytes, int numVertices, unsigned
 	core.device->CreateBuffer(&bd, &data, &vertexBuffer);
 	indicesSize = numIndices;
 	strides = vertexSizeInBytes;
+	indexFormat = indexSizeInBytes == 2 ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+}
 
+void Mesh::init(const void* vertices, int vertexSizeInBytes, int numVertices, const unsigned int* indices, int numIndices, DXCore& core)
+{
+	init(vertices, vertexSizeInBytes, numVertices, IndexData(indices, numIndices, numVertices), core);
 }
 
-void Mesh::init(std::vector<STATIC_VERTEX> vertices, std::vector<unsigned int> indices, DXCore& core)
+void Mesh::init(const void* vertices, int vertexSizeInBytes, int numVertices, const IndexData& indices, DXCore& core)
 {
-	init(&vertices[0], sizeof(STATIC_VERTEX), vertices.size(), &indices[0], indices.size(), core);
+	init(vertices, vertexSizeInBytes, numVertices, indices.data(), indices.stride(), static_cast<int>(indices.count()), core);
 }
 
-void Mesh::init(std::vector<ANIMATED_VERTEX> vertices, std::vector<unsigned int> indices, DXCore& core)
+void Mesh::init(Span<STATIC_VERTEX> vertices, Span<unsigned int> indices, DXCore& core)
 {
-	init(&vertices[0], sizeof(ANIMATED_VERTEX), vertices.size(), &indices[0], indices.size(), core);
+	init(vertices.data, sizeof(STATIC_VERTEX), static_cast<int>(vertices.size), indices.data, static_cast<int>(indices.size), core);
 }
 
+void Mesh::init(Span<ANIMATED_VERTEX> vertices, Span<unsigned int> indices, DXCore& core)
+{
+	init(vertices.data, sizeof(ANIMATED_VERTEX), static_cast<int>(vertices.size), indices.data, static_cast<int>(indices.size), core);
+}
+
+void Mesh::init(const std::vector<STATIC_VERTEX>& vertices, const std::vector<unsigned int>& indices, DXCore& core)
+{
+	init(Span<STATIC_VERTEX>(vertices), Span<unsigned int>(indices), core);
+}
+
+void Mesh::init(const std::vector<STATIC_VERTEX>& vertices, const IndexData& indices, DXCore& core)
+{
+	init(vertices.data(), sizeof(STATIC_VERTEX), static_cast<int>(vertices.size()), indices, core);
+}
+
+void Mesh::init(const std::vector<ANIMATED_VERTEX>& vertices, const std::vector<unsigned int>& indices, DXCore& core)
+{
+	init(Span<ANIMATED_VERTEX>(vertices), Span<unsigned int>(indices), core);
+}
+
+
+void Mesh::addLOD(const void* indices, int numIndices, float error, DXCore& core)
+{
+	D3D11_BUFFER_DESC bd;
+	memset(&bd, 0, sizeof(D3D11_BUFFER_DESC));
+	bd.Usage = D3D11_USAGE_DEFAULT;
+	bd.ByteWidth = (indexFormat == DXGI_FORMAT_R16_UINT ? 2 : 4) * numIndices;
+	bd.BindFlags = D3D11_BIND_INDEX_BUFFER;
+	D3D11_SUBRESOURCE_DATA data;
+	memset(&data, 0, sizeof(D3D11_SUBRESOURCE_DATA));
+	data.pSysMem = indices;
+	LOD lod;
+	core.device->CreateBuffer(&bd, &data, &lod.indexBuffer);
+	lod.indicesSize = numIndices;
+	lod.error = error;
+	lods.push_back(lod);
+}
+
+void Mesh::addLOD(const unsigned int* indices, int numIndices, float error, DXCore& core)
+{
+	if (indexFormat == DXGI_FORMAT_R16_UINT) {
+		// Every level indexes the same vertices, so the narrowing always fits.
+		addLOD(IndexData(indices, numIndices, IndexData::MAX_16BIT_VERTICES).data(), numIndices, error, core);
+	}
+	else {
+		addLOD(static_cast<const void*>(indices), numIndices, error, core);
+	}
+}
 
 void Mesh::draw(DXCore& core)
+{
+	draw(core, 0);
+}
+
+void Mesh::draw(DXCore& core, int lod)
+{
+	lod = lod < static_cast<int>(lods.size()) ? lod : static_cast<int>(lods.size());
+	UINT offsets = 0;
+	core.devicecontext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	core.devicecontext->IASetVertexBuffers(0, 1, &vertexBuffer, &strides, &offsets);
+	if (lod > 0) {
+		core.devicecontext->IASetIndexBuffer(lods[lod - 1].indexBuffer, indexFormat, 0);
+		core.devicecontext->DrawIndexed(lods[lod - 1].indicesSize, 0, 0);
+	}
+	else {
+		core.devicecontext->IASetIndexBuffer(indexBuffer, indexFormat, 0);
+		core.devicecontext->DrawIndexed(indicesSize, 0, 0);
+	}
+}
+
+void Mesh::draw(DXCore& core, const std::vector<MeshClusters::DrawRange>& ranges)
 {
 	UINT offsets = 0;
 	core.devicecontext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 	core.devicecontext->IASetVertexBuffers(0, 1, &vertexBuffer, &strides, &offsets);
-	core.devicecontext->IASetIndexBuffer(indexBuffer, DXGI_FORMAT_R32_UINT, 0);
-	core.devicecontext->DrawIndexed(indicesSize, 0, 0);
+	core.devicecontext->IASetIndexBuffer(indexBuffer, indexFormat, 0);
+	for (const MeshClusters::DrawRange& range : ranges) {
+		core.devicecontext->DrawIndexed(range.indexCount, range.indexOffset, 0);
+	}
+}
+
+int Mesh::getTriangleCount(int lod) const
+{
+	lod = lod < static_cast<int>(lods.size()) ? lod : static_cast<int>(lods.size());
+	return (lod > 0 ? lods[lod - 1].indicesSize : indicesSize) / 3;
+}
+
+void Mesh::reportIndexMemory(IndexMemoryReport& report) const
+{
+	unsigned int stride = indexFormat == DXGI_FORMAT_R16_UINT ? 2 : 4;
+	report.add(indicesSize, stride);
+	for (const LOD& lod : lods) {
+		report.add(lod.indicesSize, stride);
+	}
 }
 
 void Plane::init(DXCore& core) {
@@ -47,10 +139,10 @@ void Plane::init(DXCore& core) {
 	vertices.push_back(addVertex(vec3(15, 0, -15), vec3(0, 1, 0), 1, 0));
 	vertices.push_back(addVertex(vec3(-15, 0, 15), vec3(0, 1, 0), 0, 1));
 	vertices.push_back(addVertex(vec3(15, 0, 15), vec3(0, 1, 0), 1, 1));
-	std::vector<unsigned int> indices;
+	std::vector<uint16_t> indices;
 	indices.push_back(2); indices.push_back(1); indices.push_back(0);
 	indices.push_back(1); indices.push_back(2); indices.push_back(3);
-	geometry.init(vertices, indices, core);
+	geometry.init(vertices, IndexData(std::move(indices)), core);
 
 }
 
@@ -130,7 +222,7 @@ void Cube::init(DXCore& core) {
 	vertices.push_back(addVertex(p1, vec3(0.0f, -1.0f, 0.0f), 1.0f, 0.0f));
 	vertices.push_back(addVertex(p0, vec3(0.0f, -1.0f, 0.0f), 0.0f, 0.0f));
 
-	std::vector<unsigned int> indices;
+	std::vector<uint16_t> indices;
 	indices.push_back(0); indices.push_back(1); indices.push_back(2);
 	indices.push_back(0); indices.push_back(2); indices.push_back(3);
 	indices.push_back(4); indices.push_back(5); indices.push_back(6);
@@ -144,12 +236,33 @@ void Cube::init(DXCore& core) {
 	indices.push_back(20); indices.push_back(21); indices.push_back(22);
 	indices.push_back(20); indices.push_back(22); indices.push_back(23);
 
-	geometry.init(vertices, indices, core);
+	geometry.init(vertices, IndexData(std::move(indices)), core);
+}
+
+// Two triangles per quad between neighbouring rings and segments.
+template<typename Index>
+static std::vector<Index> sphereIndices(int rings, int segments) {
+	std::vector<Index> indices;
+	indices.reserve(static_cast<size_t>(rings) * segments * 6);
+	for (int lat = 0; lat < rings; ++lat) {
+		for (int lon = 0; lon < segments; ++lon) {
+			int current = lat * (segments + 1) + lon;
+			int next = current + segments + 1;
+
+			indices.push_back(static_cast<Index>(current));
+			indices.push_back(static_cast<Index>(next));
+			indices.push_back(static_cast<Index>(current + 1));
+
+			indices.push_back(static_cast<Index>(current + 1));
+			indices.push_back(static_cast<Index>(next));
+			indices.push_back(static_cast<Index>(next + 1));
+		}
+	}
+	return indices;
 }
 
 void Sphere::init(int rings, int segments, float radius, DXCore& core) {
 	std::vector<STATIC_VERTEX> vertices;
-	std::vector<unsigned int> indices;
 
 	for (int lat = 0; lat <= rings; ++lat) {
 		float theta = lat * M_PI / rings;
@@ -174,103 +287,345 @@ void Sphere::init(int rings, int segments, float radius, DXCore& core) {
 		}
 	}
 
-	for (int lat = 0; lat < rings; ++lat) {
-		for (int lon = 0; lon < segments; ++lon) {
-			int current = lat * (segments + 1) + lon;
-			int next = current + segments + 1;
-
-			indices.push_back(current);
-			indices.push_back(next);
-			indices.push_back(current + 1);
-
-			indices.push_back(current + 1);
-			indices.push_back(next);
-			indices.push_back(next + 1);
-		}
+	// 16-bit indices unless the sphere is too finely divided for them
+	if (IndexData::strideFor(vertices.size()) == 2) {
+		geometry.init(vertices, IndexData(sphereIndices<uint16_t>(rings, segments)), core);
+	}
+	else {
+		geometry.init(vertices, sphereIndices<unsigned int>(rings, segments), core);
 	}
-
-	geometry.init(vertices, indices, core);
 }
 
 void Model::init(std::string filename, DXCore& core, ModelType modelType)
+{
+	load(filename, modelType);
+	upload(core);
+}
+
+void Model::load(std::string filename, ModelType modelType)
 {
 	type = modelType;
-	GEMLoader::GEMModelLoader loader;
-	std::vector<GEMLoader::GEMMesh> gemmeshes;
-	GEMLoader::GEMAnimation gemanimation;
+	staging.reset(new Staging());
+	int vertexSize = type == ModelType::ANIMATED ? sizeof(ANIMATED_VERTEX) : sizeof(STATIC_VERTEX);
+	if (compactVertices) {
+		vertexSize = type == ModelType::ANIMATED ? sizeof(VertexCompression::CompactAnimatedVertex) : sizeof(VertexCompression::CompactStaticVertex);
+	}
 
-	loader.load(filename, gemmeshes, gemanimation);
+	// A valid cache is used in place: vertex and index data are uploaded straight
+	// from the mapping and each clip is one copy.
+	ModelCache& cache = staging->cache;
+	bool cached = useCache && cache.open(filename) && cache.hasAnimation() == (type == ModelType::ANIMATED);
+	for (int i = 0; cached && i < cache.getMeshCount(); i++) {
+		cached = static_cast<int>(cache.getMesh(i).vertexStride) == vertexSize;
+	}
+	cached = cached && cache.getLODRatios() == lodRatios;
+	bool clustered = useClusters && type == ModelType::STATIC;
+	cached = cached && cache.hasClusters() == clustered;
+	cached = cached && cache.hasCompactVertices() == compactVertices;
+	staging->cached = cached;
+	if (cached) {
+		for (int i = 0; i < cache.getMeshCount(); i++) {
+			ModelCache::MeshView view = cache.getMesh(i);
+			textureFilenames.push_back(view.texture);
+			AABB box;
+			box.extend(view.boundsMin);
+			box.extend(view.boundsMax);
+			bounds.push_back(box);
+			for (size_t l = 0; l < view.lods.size(); l++) {
+				addLODError(static_cast<int>(l) + 1, view.lods[l].error);
+			}
+		}
+		if (type == ModelType::ANIMATED) {
+			std::shared_ptr<CachedClipSource> clips = std::make_shared<CachedClipSource>();
+			if (lazyAnimation && clips->open(filename)) {
+				cache.loadSkeleton(animation);
+				animation.setClipSource(clips, compressAnimation, compressionSettings);
+			}
+			else {
+				cache.loadAnimation(animation);
+			}
+		}
+	}
+	else {
+		cache.close();
+		GEMLoader::GEMModelLoader loader;
+		std::vector<GEMLoader::GEMMesh>& gemmeshes = staging->gemmeshes;
+		GEMLoader::GEMAnimation gemanimation;
+
+		// Prefer the memory-mapped loader; the stream loader is kept as a fallback.
+		// Clips are only skipped over when they are loaded lazily and no cache is
+		// written, since writing one needs all of them.
+		bool lazyClips = lazyAnimation && !useCache && type == ModelType::ANIMATED;
+		std::shared_ptr<GEMClipSource> clips = std::make_shared<GEMClipSource>();
+		bool loaded = lazyClips ? loader.loadMappedLazy(filename, gemmeshes, gemanimation) && clips->open(filename, gemanimation) : loader.loadMapped(filename, gemmeshes, gemanimation);
+		if (!loaded)
+		{
+			lazyClips = false;
+			gemmeshes.clear();
+			gemanimation = GEMLoader::GEMAnimation();
+			loader.load(filename, gemmeshes, gemanimation);
+		}
+		for (auto& gemmesh : gemmeshes) {
+			if (!gemmesh.indicesInRange()) {
+				throw std::runtime_error(filename + ": index past the vertex count");
+			}
+		}
 
-	for (int i = 0; i < gemmeshes.size(); i++) {
-		Mesh mesh;
+		// Reorder triangles for the post-transform cache and overdraw, and
+		// vertices for fetch locality, before the data is uploaded or cooked.
+		for (auto& gemmesh : gemmeshes) {
+			if (type == ModelType::ANIMATED) {
+				MeshOptimizer::optimizeMesh(gemmesh.verticesAnimated, gemmesh.indices);
+			}
+			else {
+				MeshOptimizer::optimizeMesh(gemmesh.verticesStatic, gemmesh.indices);
+			}
+		}
 
-		if (type == ModelType::ANIMATED) {
-			std::vector<ANIMATED_VERTEX> vertices;
-			for (int j = 0; j < gemmeshes[i].verticesAnimated.size(); j++) {
-				ANIMATED_VERTEX v;
-				memcpy(&v, &gemmeshes[i].verticesAnimated[j], sizeof(ANIMATED_VERTEX));
-				vertices.push_back(v);
+		// Clusters reorder the triangles into runs, each kept in cache order.
+		// Skinned meshes move away from bind-pose bounds, so only static ones
+		// are split.
+		if (clustered) {
+			for (auto& gemmesh : gemmeshes) {
+				staging->clusters.push_back(MeshClusters::buildClusters(gemmesh.verticesStatic, gemmesh.indices));
 			}
-			textureFilenames.push_back(gemmeshes[i].material.find("diffuse").getValue());
-			mesh.init(vertices, gemmeshes[i].indices, core);
-			meshes.push_back(mesh);
 		}
-		else {
-			std::vector<STATIC_VERTEX> vertices;
-			for (int j = 0; j < gemmeshes[i].verticesStatic.size(); j++)
+
+		// LOD chains index the optimized vertices. Skinned meshes keep collapses
+		// within regions of similar bone weights so joints still bend.
+		std::vector<std::vector<MeshSimplifier::LOD>>& lods = staging->lods;
+		if (!lodRatios.empty()) {
+			for (auto& gemmesh : gemmeshes) {
+				if (type == ModelType::ANIMATED) {
+					lods.push_back(MeshSimplifier::buildSkinnedLODChain(gemmesh.verticesAnimated, gemmesh.indices, lodRatios, lodSettings));
+				}
+				else {
+					lods.push_back(MeshSimplifier::buildLODChain(gemmesh.verticesStatic, gemmesh.indices, lodRatios, lodSettings));
+				}
+				for (size_t l = 0; l < lods.back().size(); l++) {
+					addLODError(static_cast<int>(l) + 1, lods.back()[l].error);
+				}
+			}
+		}
+
+		// Vertices are packed last, as clusters and LODs read the floats. A bone
+		// index past 255 would not fit the shader's bone palette either.
+		if (compactVertices) {
+			for (auto& gemmesh : gemmeshes) {
+				VertexCompression::CompactMesh compact;
+				if (type == ModelType::ANIMATED) {
+					if (!VertexCompression::compressAnimatedMesh(gemmesh.verticesAnimated, compact)) {
+						throw std::runtime_error(filename + ": bone index too large for compact vertices");
+					}
+				}
+				else {
+					compact = VertexCompression::compressStaticMesh(gemmesh.verticesStatic);
+				}
+				staging->compactMeshes.push_back(std::move(compact));
+			}
+		}
+
+		if (lazyClips) {
+			buildSkeleton(gemanimation, animation.skeleton);
+			animation.setClipSource(clips, compressAnimation, compressionSettings);
+		}
+		else if (type == ModelType::ANIMATED) {
+			buildSkeleton(gemanimation, animation.skeleton);
+			for (int i = 0; i < gemanimation.animations.size(); i++)
 			{
-				STATIC_VERTEX v;
-				memcpy(&v, &gemmeshes[i].verticesStatic[j], sizeof(STATIC_VERTEX));
-				vertices.push_back(v);
+				AnimationSequence aseq;
+				buildAnimationSequence(gemanimation.animations[i], aseq);
+				animation.addSequence(gemanimation.animations[i].name, std::move(aseq));
+			}
+		}
+
+		// Failing to write (e.g. a read-only directory) only means the next
+		// start parses again.
+		if (useCache) {
+			ModelCache::write(filename, gemmeshes, type == ModelType::ANIMATED ? &animation : nullptr, lodRatios, lods, staging->clusters, staging->compactMeshes);
+		}
+
+		for (int i = 0; i < gemmeshes.size(); i++) {
+			AABB box;
+			if (type == ModelType::ANIMATED) {
+				for (const auto& v : gemmeshes[i].verticesAnimated) {
+					box.extend(vec3(v.position.x, v.position.y, v.position.z));
+				}
+			}
+			else {
+				for (const auto& v : gemmeshes[i].verticesStatic) {
+					box.extend(vec3(v.position.x, v.position.y, v.position.z));
+				}
 			}
 			textureFilenames.push_back(gemmeshes[i].material.find("diffuse").getValue());
-			mesh.init(vertices, gemmeshes[i].indices, core);
-			meshes.push_back(mesh);
+			bounds.push_back(box);
+
+			// Indices are narrowed here, off the device thread, and the 32-bit
+			// originals released.
+			size_t vertexCount = type == ModelType::ANIMATED ? gemmeshes[i].verticesAnimated.size() : gemmeshes[i].verticesStatic.size();
+			staging->indices.push_back(IndexData(gemmeshes[i].indices, vertexCount));
+			std::vector<unsigned int>().swap(gemmeshes[i].indices);
+			if (compactVertices) {
+				std::vector<GEMLoader::GEMAnimatedVertex>().swap(gemmeshes[i].verticesAnimated);
+				std::vector<GEMLoader::GEMStaticVertex>().swap(gemmeshes[i].verticesStatic);
+			}
 		}
 	}
 
-	if (type == ModelType::ANIMATED) {
-		for (int i = 0; i < gemanimation.bones.size(); i++)
-		{
-			Bone bone;
-			bone.name = gemanimation.bones[i].name;
-			memcpy(&bone.offset, &gemanimation.bones[i].offset, 16 * sizeof(float));
-			bone.parentIndex = gemanimation.bones[i].parentIndex;
-			animation.skeleton.bones.push_back(bone);
+	if (compressAnimation) {
+		for (auto& named : animation.sequenceNames) {
+			if (!animation.isSequenceLoaded(named.second)) {
+				continue;
+			}
+			compressionReports[named.first] = animation.sequences[named.second].compress(compressionSettings);
 		}
+	}
+}
 
-		for (int i = 0; i < gemanimation.animations.size(); i++)
-		{
-			std::string name = gemanimation.animations[i].name;
-			AnimationSequence aseq;
-			aseq.ticksPerSecond = gemanimation.animations[i].ticksPerSecond;
-			for (int n = 0; n < gemanimation.animations[i].frames.size(); n++)
-			{
-				AnimationFrame frame;
-				for (int index = 0; index < gemanimation.animations[i].frames[n].positions.size(); index++)
-				{
-					vec3 p;
-					Quaternion q;
-					vec3 s;
-					memcpy(&p, &gemanimation.animations[i].frames[n].positions[index], sizeof(vec3));
-					frame.positions.push_back(p);
-					memcpy(&q, &gemanimation.animations[i].frames[n].rotations[index], sizeof(Quaternion));
-					frame.rotations.push_back(q);
-					memcpy(&s, &gemanimation.animations[i].frames[n].scales[index], sizeof(vec3));
-					frame.scales.push_back(s);
+void Model::upload(DXCore& core)
+{
+	if (!staging) {
+		return;
+	}
+	if (staging->cached) {
+		// load checked the stride against the vertex format asked for.
+		for (int i = 0; i < staging->cache.getMeshCount(); i++) {
+			ModelCache::MeshView view = staging->cache.getMesh(i);
+			Mesh mesh;
+			mesh.init(view.vertices, static_cast<int>(view.vertexStride), view.vertexCount, view.indices, view.indexStride, view.indexCount, core);
+			mesh.compact = staging->cache.hasCompactVertices();
+			mesh.quantization = view.quantization;
+			for (const ModelCache::LODView& lod : view.lods) {
+				mesh.addLOD(lod.indices, lod.indexCount, lod.error, core);
+			}
+			mesh.clusters.assign(view.clusters, view.clusters + view.clusterCount);
+			meshes.push_back(mesh);
+		}
+	}
+	else {
+		std::vector<GEMLoader::GEMMesh>& gemmeshes = staging->gemmeshes;
+		for (int i = 0; i < gemmeshes.size(); i++) {
+			Mesh mesh;
+
+			// Loaded arrays go straight to buffer creation, then are released so
+			// only one mesh's worth of CPU data is alive beyond the loader output.
+			if (!staging->compactMeshes.empty()) {
+				VertexCompression::CompactMesh& compact = staging->compactMeshes[i];
+				mesh.init(compact.vertices.data(), static_cast<int>(compact.stride), static_cast<int>(compact.vertices.size() / compact.stride), staging->indices[i], core);
+				mesh.compact = true;
+				mesh.quantization = compact.quantization;
+				std::vector<unsigned char>().swap(compact.vertices);
+			}
+			else if (type == ModelType::ANIMATED) {
+				Span<ANIMATED_VERTEX> vertices = vertexSpan(gemmeshes[i].verticesAnimated);
+				mesh.init(vertices.data, sizeof(ANIMATED_VERTEX), static_cast<int>(vertices.size), staging->indices[i], core);
+				std::vector<GEMLoader::GEMAnimatedVertex>().swap(gemmeshes[i].verticesAnimated);
+			}
+			else {
+				Span<STATIC_VERTEX> vertices = vertexSpan(gemmeshes[i].verticesStatic);
+				mesh.init(vertices.data, sizeof(STATIC_VERTEX), static_cast<int>(vertices.size), staging->indices[i], core);
+				std::vector<GEMLoader::GEMStaticVertex>().swap(gemmeshes[i].verticesStatic);
+			}
+			staging->indices[i] = IndexData();
+			if (i < staging->lods.size()) {
+				for (const MeshSimplifier::LOD& lod : staging->lods[i]) {
+					mesh.addLOD(lod.indices.data(), static_cast<int>(lod.indices.size()), lod.error, core);
 				}
-				aseq.frames.push_back(frame);
 			}
-			animation.animations.insert({ name, aseq });
+			if (i < staging->clusters.size()) {
+				mesh.clusters.swap(staging->clusters[i]);
+			}
+			meshes.push_back(mesh);
 		}
 	}
+	staging.reset();
 }
 
 void Model::draw(DXCore& core, Shaders& shader, TextureManager& textureManager)
 {
+	draw(core, shader, textureManager, 0);
+}
+
+int Model::draw(DXCore& core, Shaders& shader, TextureManager& textureManager, int lod)
+{
+	int triangles = 0;
 	for (int i = 0; i < meshes.size(); i++)
 	{
 		shader.updateTexturePS("tex", textureManager.find(textureFilenames[i]), core);
-		meshes[i].draw(core);
+		applyQuantization(core, shader, meshes[i]);
+		meshes[i].draw(core, lod);
+		triangles += meshes[i].getTriangleCount(lod);
+	}
+	return triangles;
+}
+
+int Model::drawVisible(DXCore& core, Shaders& shader, TextureManager& textureManager, const MeshClusters::Frustum& frustum,
+	const vec3& cameraPosition, MeshClusters::CullStats* stats)
+{
+	int triangles = 0;
+	for (int i = 0; i < meshes.size(); i++)
+	{
+		if (meshes[i].clusters.empty()) {
+			shader.updateTexturePS("tex", textureManager.find(textureFilenames[i]), core);
+			applyQuantization(core, shader, meshes[i]);
+			meshes[i].draw(core, 0);
+			triangles += meshes[i].getTriangleCount(0);
+			continue;
+		}
+		visibleRanges.clear();
+		int visible = static_cast<int>(MeshClusters::cullClusters(meshes[i].clusters, frustum, cameraPosition, visibleRanges, stats, clusterBackfaceCulling));
+		if (visible > 0) {
+			shader.updateTexturePS("tex", textureManager.find(textureFilenames[i]), core);
+			applyQuantization(core, shader, meshes[i]);
+			meshes[i].draw(core, visibleRanges);
+			triangles += visible;
+		}
+	}
+	return triangles;
+}
+
+int Model::selectLOD(float distance, float scale, float fieldOfView, float screenHeight, float maxPixelError) const
+{
+	return MeshSimplifier::selectLOD(lodErrors, distance, scale, fieldOfView, screenHeight, maxPixelError);
+}
+
+void Model::addLODError(int level, float error)
+{
+	// A level's error is the worst over the meshes that have it.
+	if (static_cast<int>(lodErrors.size()) <= level) {
+		lodErrors.resize(level + 1, 0.0f);
+	}
+	lodErrors[level] = error > lodErrors[level] ? error : lodErrors[level];
+}
+
+void Model::applyQuantization(DXCore& core, Shaders& shader, const Mesh& mesh)
+{
+	if (!mesh.compact) {
+		return;
+	}
+	// Declared as float4 in the shaders, so the reflected buffer size matches its layout.
+	float offset[4] = { mesh.quantization.offset[0], mesh.quantization.offset[1], mesh.quantization.offset[2], 0.0f };
+	float scale[4] = { mesh.quantization.scale[0], mesh.quantization.scale[1], mesh.quantization.scale[2], 0.0f };
+	const char* buffer = type == ModelType::ANIMATED ? "animatedMeshBuffer" : "staticMeshBuffer";
+	shader.updateConstantVS(buffer, "positionOffset", offset);
+	shader.updateConstantVS(buffer, "positionScale", scale);
+	shader.uploadConstants(core);
+}
+
+int Model::getTriangleCount(int lod) const
+{
+	int triangles = 0;
+	for (const Mesh& mesh : meshes)
+	{
+		triangles += mesh.getTriangleCount(lod);
+	}
+	return triangles;
+}
+
+void Model::reportIndexMemory(IndexMemoryReport& report) const
+{
+	for (const Mesh& mesh : meshes)
+	{
+		mesh.reportIndexMemory(report);
 	}
 }
\ No newline at end of file
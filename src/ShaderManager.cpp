@@ -1,9 +1,9 @@
 #include "../inc/ShaderManager.h"
 
-void ShaderManager::loadShader(const std::string& name, const std::string& vsFile, const std::string& psFile, DXCore& core) {
-    Shaders shader;                         // Create a new shader instance.
-    shader.init(vsFile, psFile, core);      // Initialize the shader with the given files.
-    shaders[name] = shader;                 // Store the shader in the map using the name as the key.
+void ShaderManager::loadShader(const std::string& name, const std::string& vsFile, const std::string& psFile, DXCore& core, VertexFormat format) {
+    Shaders shader;                             // Create a new shader instance.
+    shader.init(vsFile, psFile, core, format);  // Initialize the shader with the given files.
+    shaders[name] = shader;                     // Store the shader in the map using the name as the key.
 }
 
 Shaders* ShaderManager::getShader(const std::string& name) {
@@ -10,16 +10,17 @@ std::string Shaders::readFile(const std::string& filename) {
     return buffer.str();    // Return the shader source as a string.
 }
 
-void Shaders::compileVS(const std::string& VS_filename, DXCore& core) {
+void Shaders::compileVS(const std::string& VS_filename, DXCore& core, VertexFormat format) {
     ID3DBlob* compiledVertexShader = nullptr;
     ID3DBlob* status = nullptr;
 
-    // Compile the vertex shader source code.
+    // Compile the vertex shader source code, selecting its compact input path if asked.
+    D3D_SHADER_MACRO compactDefines[] = { { "COMPACT_VERTICES", "1" }, { nullptr, nullptr } };
     HRESULT hr = D3DCompile(
         VS_filename.c_str(),
         VS_filename.length(),
         nullptr,
-        nullptr,
+        format == VertexFormat::Compact ? compactDefines : nullptr,
         nullptr,
         "VS",
         "vs_5_0",
@@ -55,10 +56,22 @@ void Shaders::compileVS(const std::string& VS_filename, DXCore& core) {
         { "BONEWEIGHTS", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
     };
 
+    // The compact formats, see VertexCompression: unorm positions within the
+    // mesh bounds, octahedral snorm normals and tangents, half UVs, 8-bit bones.
+    D3D11_INPUT_ELEMENT_DESC compactLayoutDesc[] = {
+        { "POS", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+        { "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+        { "TANGENT", 0, DXGI_FORMAT_R16G16_SNORM, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+        { "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+        { "BONEIDS", 0, DXGI_FORMAT_R8G8B8A8_UINT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+        { "BONEWEIGHTS", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+    };
+    bool compact = format == VertexFormat::Compact;
+
     // Create the input layout for the vertex shader.
     core.device->CreateInputLayout(
-        layoutDesc,
-        _countof(layoutDesc),
+        compact ? compactLayoutDesc : layoutDesc,
+        compact ? _countof(compactLayoutDesc) : _countof(layoutDesc),
         compiledVertexShader->GetBufferPointer(),
         compiledVertexShader->GetBufferSize(),
         &layout
@@ -112,11 +125,11 @@ void Shaders::compilePS(const std::string& PS_filename, DXCore& core) {
     compiledPixelShader->Release();
 }
 
-void Shaders::init(const std::string& VS_filename, const std::string& PS_filename, DXCore& core) {
+void Shaders::init(const std::string& VS_filename, const std::string& PS_filename, DXCore& core, VertexFormat format) {
     std::string vertexShaderSource = readFile(VS_filename);
     std::string pixelShaderSource = readFile(PS_filename);
 
-    compileVS(vertexShaderSource, core);
+    compileVS(vertexShaderSource, core, format);
     compilePS(pixelShaderSource, core);
 }
 
@@ -175,7 +188,10 @@ void Shaders::apply(DXCore& core) {
     core.devicecontext->IASetInputLayout(layout);
     core.devicecontext->VSSetShader(vertexShader, nullptr, 0);
     core.devicecontext->PSSetShader(pixelShader, nullptr, 0);
+    uploadConstants(core);
+}
 
+void Shaders::uploadConstants(DXCore& core) {
     for (auto& buffer : vsConstantBuffers) {
         buffer.upload(core);
     }
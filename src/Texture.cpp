@@ -1,14 +1,40 @@
 #define STB_IMAGE_IMPLEMENTATION
-#include "../inc/stb_image.h"
+#include "../inc/ImageDecoder.h"
 #include "../inc/Texture.h"
+#include "../inc/MipChain.h"
+#include "../inc/BlockCompression.h"
+#include "../inc/TextureCache.h"
 
-void Texture::init(int width, int height, int channels, DXGI_FORMAT format, unsigned char *data, DXCore& core)
+// Block layout of the formats textures are uploaded in.
+static BlockCompression::Format blockFormat(DXGI_FORMAT format) {
+    switch (format) {
+    case DXGI_FORMAT_BC1_UNORM:
+        return BlockCompression::Format::BC1;
+    case DXGI_FORMAT_BC3_UNORM:
+        return BlockCompression::Format::BC3;
+    default:
+        return BlockCompression::Format::RGBA8;
+    }
+}
+
+static DXGI_FORMAT dxgiFormat(BlockCompression::Format format) {
+    switch (format) {
+    case BlockCompression::Format::BC1:
+        return DXGI_FORMAT_BC1_UNORM;
+    case BlockCompression::Format::BC3:
+        return DXGI_FORMAT_BC3_UNORM;
+    default:
+        return DXGI_FORMAT_R8G8B8A8_UNORM;
+    }
+}
+
+void Texture::init(int width, int height, int channels, DXGI_FORMAT format, unsigned char *data, DXCore& core, int mipLevels)
 {
     D3D11_TEXTURE2D_DESC texDesc;
     memset(&texDesc, 0, sizeof(D3D11_TEXTURE2D_DESC));
     texDesc.Width = width;
     texDesc.Height = height;
-    texDesc.MipLevels = 1;
+    texDesc.MipLevels = mipLevels;
     texDesc.ArraySize = 1;
     texDesc.Format = format;
     texDesc.SampleDesc.Count = 1;
@@ -16,41 +42,162 @@ void Texture::init(int width, int height, int channels, DXGI_FORMAT format, unsi
     texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
     texDesc.CPUAccessFlags = 0;
 
-    D3D11_SUBRESOURCE_DATA initData;
-    memset(&initData, 0, sizeof(D3D11_SUBRESOURCE_DATA));
-    initData.pSysMem = data;
-    initData.SysMemPitch = width * channels;
-    core.device->CreateTexture2D(&texDesc, &initData, &texture);
+    BlockCompression::Format blocks = blockFormat(format);
+    std::vector<D3D11_SUBRESOURCE_DATA> initData(mipLevels);
+    size_t offset = 0;
+    for (int level = 0; level < mipLevels; level++) {
+        int levelWidth = MipChain::levelSize(width, level);
+        int levelHeight = MipChain::levelSize(height, level);
+        memset(&initData[level], 0, sizeof(D3D11_SUBRESOURCE_DATA));
+        initData[level].pSysMem = data + offset;
+        if (blocks == BlockCompression::Format::RGBA8) {
+            initData[level].SysMemPitch = levelWidth * channels;
+            offset += static_cast<size_t>(levelWidth) * levelHeight * channels;
+        }
+        else {
+            initData[level].SysMemPitch = static_cast<UINT>(BlockCompression::rowPitch(levelWidth, blocks));
+            offset += BlockCompression::levelBytes(levelWidth, levelHeight, blocks);
+        }
+    }
+    core.device->CreateTexture2D(&texDesc, initData.data(), &texture);
+    bytes = offset;
+    rgba8Bytes = BlockCompression::chainBytes(width, height, mipLevels, BlockCompression::Format::RGBA8);
+    this->width = width;
+    this->height = height;
+    this->mipLevels = mipLevels;
+    this->format = format;
+    residentLevel = 0;
+    createView(core);
+}
 
+void Texture::createView(DXCore& core)
+{
+    if (srv) srv->Release();
+    srv = nullptr;
     D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc;
     srvDesc.Format = format;
     srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
-    srvDesc.Texture2D.MostDetailedMip = 0;
-    srvDesc.Texture2D.MipLevels = 1;
+    srvDesc.Texture2D.MostDetailedMip = residentLevel;
+    srvDesc.Texture2D.MipLevels = mipLevels - residentLevel;
     core.device->CreateShaderResourceView(texture, &srvDesc, &srv);
 }
 
-void Texture::load(DXCore& core, std::string filename) {
-    int width = 0;
-    int height = 0;
-    int channels = 0;
-    unsigned char* texels = stbi_load(filename.c_str(), &width, &height, &channels, 0);
-    if (channels == 3) {
-        channels = 4;
-        unsigned char* texelsWithAlpha = new unsigned char[width * height * channels];
-        for (int i = 0; i < (width * height); i++) {
-            texelsWithAlpha[i * 4] = texels[i * 3];
-            texelsWithAlpha[(i * 4) + 1] = texels[(i * 3) + 1];
-            texelsWithAlpha[(i * 4) + 2] = texels[(i * 3) + 2];
-            texelsWithAlpha[(i * 4) + 3] = 255;
+void Texture::load(DXCore& core, std::string filename, bool compress) {
+    TextureData data = decode(filename, compress);
+    upload(core, data);
+}
+
+TextureData Texture::decode(const std::string& filename, bool compress, JobSystem* jobs) {
+    TextureData data;
+    if (compress) {
+        TextureCache cache;
+        if (cache.open(filename)) {
+            data.width = cache.getWidth();
+            data.height = cache.getHeight();
+            data.channels = 4;
+            data.mipLevels = cache.getMipLevels();
+            data.format = dxgiFormat(cache.getFormat());
+            data.texels.assign(cache.data(), cache.data() + cache.dataBytes());
+            return data;
+        }
+    }
+    if (!ImageDecoder::decodeRGBA8(filename, data.width, data.height, data.texels)) {
+        data.width = 0;
+        data.height = 0;
+        return data;
+    }
+    data.channels = 4;
+    MipChain::Settings settings = MipChain::settingsFor(filename, data.texels.data(), static_cast<size_t>(data.width) * data.height);
+    data.mipLevels = MipChain::generateInPlace(data.texels, data.width, data.height, settings);
+    if (compress) {
+        // Sizes that are not whole blocks are cached uncompressed
+        BlockCompression::Format format = BlockCompression::Format::RGBA8;
+        if (BlockCompression::canCompress(data.width, data.height)) {
+            format = BlockCompression::chooseFormat(data.texels.data(), static_cast<size_t>(data.width) * data.height);
+            std::vector<unsigned char> blocks;
+            BlockCompression::encodeChain(data.texels.data(), data.width, data.height, data.mipLevels, format, blocks, jobs);
+            data.texels.swap(blocks);
+            data.format = dxgiFormat(format);
         }
-        init(width, height, channels, DXGI_FORMAT_R8G8B8A8_UNORM, texelsWithAlpha, core);
-        delete[] texelsWithAlpha;
+        TextureCache::write(filename, data.width, data.height, data.mipLevels, format, data.texels.data());
     }
-    else {
-        init(width, height, channels, DXGI_FORMAT_R8G8B8A8_UNORM, texels, core);
+    return data;
+}
+
+void Texture::upload(DXCore& core, TextureData& data) {
+    init(data.width, data.height, data.channels, data.format, data.texels.data(), core, data.mipLevels);
+    std::vector<unsigned char>().swap(data.texels);
+}
+
+bool Texture::loadStreamed(DXCore& core, const std::string& filename) {
+    TextureCache cache;
+    if (!cache.open(filename)) {
+        return false;
+    }
+    width = cache.getWidth();
+    height = cache.getHeight();
+    mipLevels = cache.getMipLevels();
+    format = dxgiFormat(cache.getFormat());
+    residentLevel = TextureStreamer::initialLevel(width, height, mipLevels);
+
+    // D3D allocates every level; the ones not yet streamed are left undefined
+    // and the view never reaches them.
+    D3D11_TEXTURE2D_DESC texDesc;
+    memset(&texDesc, 0, sizeof(D3D11_TEXTURE2D_DESC));
+    texDesc.Width = width;
+    texDesc.Height = height;
+    texDesc.MipLevels = mipLevels;
+    texDesc.ArraySize = 1;
+    texDesc.Format = format;
+    texDesc.SampleDesc.Count = 1;
+    texDesc.Usage = D3D11_USAGE_DEFAULT;
+    texDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    texDesc.CPUAccessFlags = 0;
+    if (FAILED(core.device->CreateTexture2D(&texDesc, nullptr, &texture))) {
+        texture = nullptr;
+        return false;
+    }
+    BlockCompression::Format blocks = cache.getFormat();
+    size_t offset = BlockCompression::chainBytes(width, height, residentLevel, blocks);
+    for (int level = residentLevel; level < mipLevels; level++) {
+        int levelWidth = MipChain::levelSize(width, level);
+        int levelHeight = MipChain::levelSize(height, level);
+        UINT pitch = static_cast<UINT>(BlockCompression::rowPitch(levelWidth, blocks));
+        core.devicecontext->UpdateSubresource(texture, level, nullptr, cache.data() + offset, pitch, 0);
+        offset += BlockCompression::levelBytes(levelWidth, levelHeight, blocks);
+    }
+    bytes = cache.dataBytes();
+    rgba8Bytes = BlockCompression::chainBytes(width, height, mipLevels, BlockCompression::Format::RGBA8);
+    createView(core);
+    return true;
+}
+
+bool Texture::readLevel(const std::string& filename, int level, std::vector<unsigned char>& data) {
+    TextureCache cache;
+    if (!cache.open(filename) || level < 0 || level >= cache.getMipLevels()) {
+        return false;
+    }
+    int width = cache.getWidth();
+    int height = cache.getHeight();
+    BlockCompression::Format blocks = cache.getFormat();
+    const unsigned char* start = cache.data() + BlockCompression::chainBytes(width, height, level, blocks);
+    data.assign(start, start + BlockCompression::levelBytes(MipChain::levelSize(width, level), MipChain::levelSize(height, level), blocks));
+    return true;
+}
+
+bool Texture::uploadLevel(DXCore& core, int level, const std::vector<unsigned char>& data) {
+    // The cache may have been cooked again with another layout since loadStreamed
+    BlockCompression::Format blocks = blockFormat(format);
+    int levelWidth = MipChain::levelSize(width, level);
+    if (texture == nullptr || level != residentLevel - 1 ||
+        data.size() != BlockCompression::levelBytes(levelWidth, MipChain::levelSize(height, level), blocks)) {
+        return false;
     }
-    stbi_image_free(texels);
+    UINT pitch = static_cast<UINT>(BlockCompression::rowPitch(levelWidth, blocks));
+    core.devicecontext->UpdateSubresource(texture, level, nullptr, data.data(), pitch, 0);
+    residentLevel = level;
+    createView(core);
+    return true;
 }
 
 void Sampler::init(DXCore& core)